@@ -46,6 +46,18 @@
 */
 @property (nonatomic, readonly) NSTimeInterval SPDYDeferrableInterval;
 
+/**
+  If set to > 0, and the request is idempotent and has no body stream, a
+  duplicate of the request is sent on a different session in the pool when
+  no response has started this long after the request was sent. Whichever
+  copy receives a response first is used, and the other is reset. See
+  SPDYMetadata.hedged and SPDYMetadata.hedgeWon.
+
+  Only set this for requests where the extra server load is acceptable, and
+  to a value near the high percentiles of normal response latency.
+*/
+@property (nonatomic, readonly) NSTimeInterval SPDYHedgeAfter;
+
 /**
   If set, SPDYProtocol will decline to handle the request and instead pass
   it along to the next registered protocol (e.g. NSHTTPURLProtocol).
@@ -71,6 +83,7 @@
 @property (nonatomic) NSInputStream *SPDYBodyStream;
 @property (nonatomic) NSString *SPDYBodyFile;
 @property (nonatomic) NSTimeInterval SPDYDeferrableInterval;
+@property (nonatomic) NSTimeInterval SPDYHedgeAfter;
 @property (nonatomic) NSUInteger SPDYPriority;
 @property (nonatomic) BOOL SPDYBypass;
 @property (nonatomic) NSURLSession *SPDYURLSession;
@@ -29,6 +29,11 @@
     return [[SPDYProtocol propertyForKey:@"SPDYDeferrableInterval" inRequest:self] doubleValue];
 }
 
+- (NSTimeInterval)SPDYHedgeAfter
+{
+    return [[SPDYProtocol propertyForKey:@"SPDYHedgeAfter" inRequest:self] doubleValue];
+}
+
 - (BOOL)SPDYBypass
 {
     return [[SPDYProtocol propertyForKey:@"SPDYBypass" inRequest:self] boolValue];
@@ -165,6 +170,11 @@
     [SPDYProtocol setProperty:@(deferrableInterval) forKey:@"SPDYDeferrableInterval" inRequest:self];
 }
 
+- (void)setSPDYHedgeAfter:(NSTimeInterval)hedgeAfter
+{
+    [SPDYProtocol setProperty:@(hedgeAfter) forKey:@"SPDYHedgeAfter" inRequest:self];
+}
+
 - (void)setSPDYBypass:(BOOL)bypass
 {
     [SPDYProtocol setProperty:@(bypass) forKey:@"SPDYBypass" inRequest:self];
@@ -0,0 +1,84 @@
+//
+//  SPDYConnectionBudget.h
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#import <Foundation/Foundation.h>
+
+@class SPDYConfiguration;
+@class SPDYOrigin;
+
+@protocol SPDYConnectionBudgetClient <NSObject>
+
+@property (nonatomic, readonly) SPDYOrigin *origin;
+@property (nonatomic, readonly) NSArray *runLoopModes;
+
+/**
+  Called on the thread the client last asked for budget from, once budget
+  it was waiting for may be available. The client should simply try again.
+*/
+- (void)connectionBudgetAvailable;
+
+@end
+
+/**
+  Process-wide limits on open sessions and in-flight streams, shared by the
+  session managers of every origin on every thread.
+
+  Clients that find the budget spent can wait for it, and waiting clients
+  are served by start-time fair queueing: each grant advances its origin's
+  virtual time by the inverse of the origin's weight, and the waiting origin
+  with the earliest virtual time goes next. Each grant must be returned with
+  releaseSessions: or releaseStreams:. With a limit of 0, grants are always
+  made, but still counted.
+*/
+@interface SPDYConnectionBudget : NSObject
+
++ (SPDYConnectionBudget *)sharedBudget;
+
+/**
+  @return number of sessions granted and not yet released
+*/
+@property (nonatomic, readonly) NSUInteger sessionCount;
+
+/**
+  @return number of streams granted and not yet released
+*/
+@property (nonatomic, readonly) NSUInteger streamCount;
+
+/**
+  Takes on the configuration's maxSessions, maxConcurrentStreams and
+  originWeights. Lowering a limit never takes back grants already made.
+*/
+- (void)setConfiguration:(SPDYConfiguration *)configuration;
+
+/**
+  @param wait whether the client should be told once a session may be
+    available, if it can't have one now
+  @return YES if the client may open a session
+*/
+- (bool)acquireSessionForClient:(id<SPDYConnectionBudgetClient>)client waitIfUnavailable:(bool)wait;
+
+/**
+  @param wait whether the client should be told once a stream may be
+    available, if it can't have one now
+  @return YES if the client may open a stream
+*/
+- (bool)acquireStreamForClient:(id<SPDYConnectionBudgetClient>)client waitIfUnavailable:(bool)wait;
+
+- (void)releaseSessions:(NSUInteger)count;
+- (void)releaseStreams:(NSUInteger)count;
+
+/**
+  Stops waiting for budget the client no longer needs, so it doesn't hold
+  up other origins.
+*/
+- (void)withdrawClient:(id<SPDYConnectionBudgetClient>)client;
+
+@end
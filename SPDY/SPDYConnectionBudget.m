@@ -0,0 +1,327 @@
+//
+//  SPDYConnectionBudget.m
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#if !defined(__has_feature) || !__has_feature(objc_arc)
+#error "This file requires ARC support."
+#endif
+
+#import "SPDYCommonLogger.h"
+#import "SPDYConnectionBudget.h"
+#import "SPDYOrigin.h"
+#import "SPDYProtocol.h"
+
+static char *const SPDYConnectionBudgetQueue = "com.twitter.SPDYConnectionBudgetQueue";
+
+// A client waiting on one of the budget's resources, along with where to reach it
+@interface SPDYBudgetWaiter : NSObject
+@property (nonatomic, weak) id<SPDYConnectionBudgetClient> client;
+@property (nonatomic) SPDYOrigin *origin;
+@property (nonatomic) NSThread *thread;
+@property (nonatomic) NSArray *runLoopModes;
+@property (nonatomic) bool woken;
+@end
+
+@implementation SPDYBudgetWaiter
+@end
+
+/**
+  One limited resource, with the virtual time of each origin that has been
+  granted some of it and the clients waiting for more. Only touched on the
+  budget's queue.
+*/
+@interface SPDYBudgetResource : NSObject
+@property (nonatomic) NSUInteger limit;
+@property (nonatomic, readonly) NSUInteger count;
+- (bool)acquireForClient:(id<SPDYConnectionBudgetClient>)client
+                  thread:(NSThread *)thread
+                  weight:(double)weight
+                    wait:(bool)wait
+                    wake:(NSMutableArray *)wakeWaiters;
+- (void)release:(NSUInteger)count wake:(NSMutableArray *)wakeWaiters;
+- (void)withdrawClient:(id<SPDYConnectionBudgetClient>)client wake:(NSMutableArray *)wakeWaiters;
+@end
+
+@implementation SPDYBudgetResource
+{
+    NSMutableArray *_waiters;
+    NSMutableDictionary *_finishTimes;
+    double _virtualTime;
+}
+
+- (id)init
+{
+    self = [super init];
+    if (self) {
+        _waiters = [[NSMutableArray alloc] init];
+        _finishTimes = [[NSMutableDictionary alloc] init];
+        _virtualTime = 0;
+        _limit = 0;
+        _count = 0;
+    }
+    return self;
+}
+
+- (double)_startTimeForOrigin:(SPDYOrigin *)origin
+{
+    return MAX(_virtualTime, [_finishTimes[origin] doubleValue]);
+}
+
+- (SPDYBudgetWaiter *)_waiterForClient:(id<SPDYConnectionBudgetClient>)client
+{
+    for (SPDYBudgetWaiter *waiter in _waiters) {
+        if (waiter.client == client) return waiter;
+    }
+    return nil;
+}
+
+- (bool)acquireForClient:(id<SPDYConnectionBudgetClient>)client
+                  thread:(NSThread *)thread
+                  weight:(double)weight
+                    wait:(bool)wait
+                    wake:(NSMutableArray *)wakeWaiters
+{
+    SPDYOrigin *origin = client.origin;
+    SPDYBudgetWaiter *waiter = [self _waiterForClient:client];
+
+    if (_limit == 0) {
+        if (waiter) [_waiters removeObjectIdenticalTo:waiter];
+        _count += 1;
+        return YES;
+    }
+
+    double startTime = [self _startTimeForOrigin:origin];
+    bool available = _count < _limit;
+
+    // Budget that's free still goes to whichever waiting origin is furthest behind
+    SPDYBudgetWaiter *nextWaiter = nil;
+    double nextStartTime = startTime;
+    for (SPDYBudgetWaiter *otherWaiter in [_waiters copy]) {
+        if (!otherWaiter.client) {
+            [_waiters removeObjectIdenticalTo:otherWaiter];
+            continue;
+        }
+
+        double otherStartTime = [self _startTimeForOrigin:otherWaiter.origin];
+        if (otherWaiter != waiter && otherStartTime < nextStartTime) {
+            nextWaiter = otherWaiter;
+            nextStartTime = otherStartTime;
+        }
+    }
+
+    if (!available || nextWaiter) {
+        if (available && !nextWaiter.woken) {
+            nextWaiter.woken = YES;
+            [wakeWaiters addObject:nextWaiter];
+        }
+
+        if (wait) {
+            if (!waiter) {
+                waiter = [[SPDYBudgetWaiter alloc] init];
+                waiter.client = client;
+                [_waiters addObject:waiter];
+            }
+            waiter.origin = origin;
+            waiter.thread = thread;
+            waiter.runLoopModes = client.runLoopModes;
+            waiter.woken = NO;
+        } else if (waiter) {
+            [_waiters removeObjectIdenticalTo:waiter];
+        }
+        return NO;
+    }
+
+    if (waiter) [_waiters removeObjectIdenticalTo:waiter];
+    _count += 1;
+    _virtualTime = startTime;
+    _finishTimes[origin] = @(startTime + 1.0 / weight);
+
+    // Another origin may now be furthest behind
+    [self _wakeWaiters:wakeWaiters];
+    return YES;
+}
+
+- (void)release:(NSUInteger)count wake:(NSMutableArray *)wakeWaiters
+{
+    _count -= MIN(count, _count);
+    [self _wakeWaiters:wakeWaiters];
+}
+
+- (void)withdrawClient:(id<SPDYConnectionBudgetClient>)client wake:(NSMutableArray *)wakeWaiters
+{
+    SPDYBudgetWaiter *waiter = [self _waiterForClient:client];
+    if (waiter) {
+        [_waiters removeObjectIdenticalTo:waiter];
+        [self _wakeWaiters:wakeWaiters];
+    }
+}
+
+- (void)_wakeWaiters:(NSMutableArray *)wakeWaiters
+{
+    if (_limit > 0 && _count >= _limit) return;
+
+    // Every waiter tries again, and fairness sorts out which of them goes first
+    for (SPDYBudgetWaiter *waiter in _waiters) {
+        if (!waiter.woken) {
+            waiter.woken = YES;
+            [wakeWaiters addObject:waiter];
+        }
+    }
+}
+
+@end
+
+@implementation SPDYConnectionBudget
+{
+    dispatch_queue_t _queue;
+    SPDYBudgetResource *_sessions;
+    SPDYBudgetResource *_streams;
+    NSDictionary *_originWeights;
+}
+
++ (SPDYConnectionBudget *)sharedBudget
+{
+    static dispatch_once_t once;
+    static SPDYConnectionBudget *sharedBudget;
+    dispatch_once(&once, ^{
+        sharedBudget = [[SPDYConnectionBudget alloc] init];
+    });
+    return sharedBudget;
+}
+
+- (id)init
+{
+    self = [super init];
+    if (self) {
+        _queue = dispatch_queue_create(SPDYConnectionBudgetQueue, DISPATCH_QUEUE_SERIAL);
+        _sessions = [[SPDYBudgetResource alloc] init];
+        _streams = [[SPDYBudgetResource alloc] init];
+        _originWeights = @{};
+    }
+    return self;
+}
+
+- (NSUInteger)sessionCount
+{
+    __block NSUInteger count;
+    dispatch_sync(_queue, ^{
+        count = _sessions.count;
+    });
+    return count;
+}
+
+- (NSUInteger)streamCount
+{
+    __block NSUInteger count;
+    dispatch_sync(_queue, ^{
+        count = _streams.count;
+    });
+    return count;
+}
+
+- (void)setConfiguration:(SPDYConfiguration *)configuration
+{
+    NSMutableDictionary *originWeights = [[NSMutableDictionary alloc] init];
+    for (NSString *originString in configuration.originWeights) {
+        NSError *error = nil;
+        SPDYOrigin *origin = [[SPDYOrigin alloc] initWithString:originString error:&error];
+        NSUInteger weight = [configuration.originWeights[originString] unsignedIntegerValue];
+        if (!origin || weight == 0) {
+            SPDY_WARNING(@"ignoring budget weight for %@: %@", originString, error);
+            continue;
+        }
+        originWeights[origin] = @(weight);
+    }
+
+    NSMutableArray *wakeWaiters = [[NSMutableArray alloc] init];
+    dispatch_sync(_queue, ^{
+        _sessions.limit = configuration.maxSessions;
+        _streams.limit = configuration.maxConcurrentStreams;
+        _originWeights = originWeights;
+
+        // A raised limit may let waiting clients through
+        [_sessions release:0 wake:wakeWaiters];
+        [_streams release:0 wake:wakeWaiters];
+    });
+    [self _wakeWaiters:wakeWaiters];
+}
+
+- (bool)acquireSessionForClient:(id<SPDYConnectionBudgetClient>)client waitIfUnavailable:(bool)wait
+{
+    return [self _acquire:_sessions forClient:client wait:wait];
+}
+
+- (bool)acquireStreamForClient:(id<SPDYConnectionBudgetClient>)client waitIfUnavailable:(bool)wait
+{
+    return [self _acquire:_streams forClient:client wait:wait];
+}
+
+- (void)releaseSessions:(NSUInteger)count
+{
+    [self _release:_sessions count:count];
+}
+
+- (void)releaseStreams:(NSUInteger)count
+{
+    [self _release:_streams count:count];
+}
+
+- (void)withdrawClient:(id<SPDYConnectionBudgetClient>)client
+{
+    NSMutableArray *wakeWaiters = [[NSMutableArray alloc] init];
+    dispatch_sync(_queue, ^{
+        [_sessions withdrawClient:client wake:wakeWaiters];
+        [_streams withdrawClient:client wake:wakeWaiters];
+    });
+    [self _wakeWaiters:wakeWaiters];
+}
+
+#pragma mark private methods
+
+- (bool)_acquire:(SPDYBudgetResource *)resource forClient:(id<SPDYConnectionBudgetClient>)client wait:(bool)wait
+{
+    __block bool acquired;
+    NSThread *thread = [NSThread currentThread];
+    NSMutableArray *wakeWaiters = [[NSMutableArray alloc] init];
+    dispatch_sync(_queue, ^{
+        double weight = MAX([_originWeights[client.origin] doubleValue], 1.0);
+        acquired = [resource acquireForClient:client thread:thread weight:weight wait:wait wake:wakeWaiters];
+    });
+    [self _wakeWaiters:wakeWaiters];
+    return acquired;
+}
+
+- (void)_release:(SPDYBudgetResource *)resource count:(NSUInteger)count
+{
+    if (count == 0) return;
+
+    NSMutableArray *wakeWaiters = [[NSMutableArray alloc] init];
+    dispatch_sync(_queue, ^{
+        [resource release:count wake:wakeWaiters];
+    });
+    [self _wakeWaiters:wakeWaiters];
+}
+
+- (void)_wakeWaiters:(NSArray *)wakeWaiters
+{
+    // Clients are confined to their threads, so they're told there, and never while the budget is locked
+    for (SPDYBudgetWaiter *waiter in wakeWaiters) {
+        NSObject<SPDYConnectionBudgetClient> *client = waiter.client;
+        if (!client || waiter.thread.isFinished) continue;
+
+        [client performSelector:@selector(connectionBudgetAvailable)
+                       onThread:waiter.thread
+                     withObject:nil
+                  waitUntilDone:NO
+                          modes:waiter.runLoopModes];
+    }
+}
+
+@end
@@ -18,6 +18,7 @@
 @end
 
 @interface SPDYHeaderBlockFrame : SPDYFrame
+// Frames produced by SPDYFrameDecoder carry a lazily materialized SPDYHeaderBlock
 @property (nonatomic, strong) NSDictionary *headers;
 @end
 
@@ -28,9 +28,16 @@
 
 @end
 
+// Default for maxHeaderBlockLength, shared with SPDYConfiguration
+#define DEFAULT_MAX_HEADER_BLOCK_LENGTH 131072
+
 @interface SPDYFrameDecoder : NSObject
 @property (nonatomic, weak) id<SPDYFrameDecoderDelegate> delegate;
 
+// Upper bound on the decompressed size of a single header block; the buffer starts small and
+// grows on demand up to this limit. Exceeding it is a protocol error.
+@property (nonatomic) NSUInteger maxHeaderBlockLength;
+
 - (id)initWithDelegate:(id<SPDYFrameDecoderDelegate>)delegate;
 
 // returns the number of bytes consumed; the caller is responsible for accumulating unprocessed bytes
@@ -13,12 +13,14 @@
 #error "This file requires ARC support."
 #endif
 
+#import "SPDYCommonLogger.h"
 #import "SPDYFrameDecoder.h"
+#import "SPDYHeaderBlock.h"
 #import "SPDYHeaderBlockDecompressor.h"
 
 #define SPDY_VERSION 3
 #define SPDY_COMMON_HEADER_SIZE 8
-#define MAX_HEADER_BLOCK_LENGTH 32768
+#define INITIAL_DECOMPRESSED_LENGTH 1024
 
 typedef struct {
     bool ctrl;
@@ -50,6 +52,7 @@ typedef enum {
 - (NSUInteger)_readDataFrame:(uint8_t *)buffer length:(NSUInteger)len;
 - (NSUInteger)_readHeaderBlock:(uint8_t *)buffer length:(NSUInteger)len;
 - (NSUInteger)_readSettings:(uint8_t *)buffer length:(NSUInteger)len;
+- (bool)_growDecompressedBuffer;
 @end
 
 @implementation SPDYFrameDecoder
@@ -61,8 +64,8 @@ typedef enum {
     SPDYControlFrameType _type;
     SPDYFrameDecoderState _state;
     NSUInteger _decompressedLength;
+    NSUInteger _decompressedCapacity;
     NSUInteger _length;
-    NSUInteger _maxHeaderBlockLength;
     uint8_t *_decompressed;
 }
 
@@ -110,12 +113,15 @@ SPDYCommonHeader getCommonHeader(uint8_t *buffer) {
     self = [super init];
     if (self) {
         _delegate = delegate;
-        _maxHeaderBlockLength = MAX_HEADER_BLOCK_LENGTH;
+        _maxHeaderBlockLength = DEFAULT_MAX_HEADER_BLOCK_LENGTH;
         _state = READ_COMMON_HEADER;
 
+        // The decompression buffer is allocated on demand and handed off to
+        // each decoded header block, so an idle decoder holds no buffer.
         _decompressor = [[SPDYHeaderBlockDecompressor alloc] init];
-        _decompressed = malloc(sizeof(uint8_t) * MAX_HEADER_BLOCK_LENGTH);
+        _decompressed = NULL;
         _decompressedLength = 0;
+        _decompressedCapacity = 0;
     }
     return self;
 }
@@ -387,12 +393,47 @@ SPDYCommonHeader getCommonHeader(uint8_t *buffer) {
     NSUInteger bytesRead = 0;
     NSError *error = nil;
 
-    _decompressedLength += [_decompressor inflate:buffer
-                                          availIn:bytesToRead
-                                     outputBuffer:(_decompressed + _decompressedLength)
-                                         availOut:(_maxHeaderBlockLength - _decompressedLength)
-                                            error:&error];
+    // Inflate into a buffer that starts small and grows geometrically, up to
+    // maxHeaderBlockLength, whenever zlib fills it.
+    while (!error) {
+        // Once the input is consumed, inflate stopping short of a full buffer
+        // means it has no output pending
+        bool full = (_decompressedLength == _decompressedCapacity);
+        if (bytesRead == bytesToRead && !full) {
+            break;
+        }
+
+        NSUInteger bytesConsumed = 0;
+        if (full && ![self _growDecompressedBuffer]) {
+            // A full buffer at the limit is only an overflow if inflate has more for it,
+            // so a block of exactly maxHeaderBlockLength still decodes
+            uint8_t overflow;
+            NSUInteger overflowLength = [_decompressor inflate:(buffer + bytesRead)
+                                                       availIn:(bytesToRead - bytesRead)
+                                                  outputBuffer:&overflow
+                                                      availOut:1
+                                                 bytesConsumed:&bytesConsumed
+                                                         error:&error];
+            bytesRead += bytesConsumed;
+            if (overflowLength > 0) {
+                SPDY_WARNING(@"header block exceeds %lu bytes", (unsigned long)_maxHeaderBlockLength);
+                _state = FRAME_ERROR;
+                return bytesToRead;
+            }
+            if (bytesRead == bytesToRead) {
+                break;
+            }
+            continue;
+        }
 
+        _decompressedLength += [_decompressor inflate:(buffer + bytesRead)
+                                              availIn:(bytesToRead - bytesRead)
+                                         outputBuffer:(_decompressed + _decompressedLength)
+                                             availOut:(_decompressedCapacity - _decompressedLength)
+                                        bytesConsumed:&bytesConsumed
+                                                error:&error];
+        bytesRead += bytesConsumed;
+    }
 
     bytesRead = bytesToRead;
 
@@ -405,75 +446,15 @@ SPDYCommonHeader getCommonHeader(uint8_t *buffer) {
 
     if (_length == 0) {
         if (_headerBlockFrame != nil) {
-            NSMutableDictionary *headers = [[NSMutableDictionary alloc] init];
-            NSUInteger headerNameLength, headerValueLength;
-
-            if (_decompressedLength < 4) {
-                _state = FRAME_ERROR;
-                return bytesRead;
-            }
-
-            NSUInteger headerCount = getUnsignedInt32(_decompressed);
-            NSUInteger bufferIndex = 4;
-
-            while (headerCount > 0 && bufferIndex < _decompressedLength) {
-
-                /* Read header name length */
-
-                if (bufferIndex + 4 > _decompressedLength) {
-                    _state = FRAME_ERROR;
-                    return bytesRead;
-                }
-
-                headerNameLength = getUnsignedInt32(_decompressed + bufferIndex);
-                bufferIndex += 4;
-
-                /* Read header name */
-
-                if (bufferIndex + headerNameLength > _decompressedLength) {
-                    _state = FRAME_ERROR;
-                    return bytesRead;
-                }
-
-                NSString *headerName = [[NSString alloc] initWithBytes:(_decompressed + bufferIndex) length:headerNameLength encoding:NSUTF8StringEncoding];
-                bufferIndex += headerNameLength;
-
-                /* Read header value length */
-
-                if (bufferIndex + 4 > _decompressedLength) {
-                    _state = FRAME_ERROR;
-                    return bytesRead;
-                }
-
-                headerValueLength = getUnsignedInt32(_decompressed + bufferIndex);
-                bufferIndex += 4;
-
-                /* Read header value */
-
-                if (bufferIndex + headerValueLength > _decompressedLength) {
-                    _state = FRAME_ERROR;
-                    return bytesRead;
-                }
-
-                NSString *headerValue = [[NSString alloc] initWithBytes:(_decompressed + bufferIndex) length:headerValueLength encoding:NSUTF8StringEncoding];
-                bool arrayValue = NO;
-                for (int i = 1; !arrayValue && i < headerValueLength - 1; i++) {
-                    if (_decompressed[bufferIndex + i] == '\0') {
-                        arrayValue = YES;
-                    }
-                }
-                bufferIndex += headerValueLength;
-
-                if (arrayValue) {
-                    headers[headerName] = [headerValue componentsSeparatedByString:@"\0"];
-                } else {
-                    headers[headerName] = headerValue;
-                }
-
-                headerCount--;
-            }
-
-            if (headerCount > 0 || bufferIndex < _decompressedLength) {
+            // Names and values are only indexed here; strings are created on access.
+            // The header block takes ownership of the decompression buffer.
+            SPDYHeaderBlock *headers = [[SPDYHeaderBlock alloc] initWithBytesNoCopy:_decompressed
+                                                                             length:_decompressedLength];
+            _decompressed = NULL;
+            _decompressedLength = 0;
+            _decompressedCapacity = 0;
+
+            if (!headers) {
                 _state = FRAME_ERROR;
                 return bytesRead;
             }
@@ -503,6 +484,25 @@ SPDYCommonHeader getCommonHeader(uint8_t *buffer) {
     return bytesRead;
 }
 
+- (bool)_growDecompressedBuffer
+{
+    if (_decompressedCapacity >= _maxHeaderBlockLength) {
+        return NO;
+    }
+
+    NSUInteger capacity = _decompressedCapacity > 0 ? _decompressedCapacity * 2 : INITIAL_DECOMPRESSED_LENGTH;
+    capacity = MIN(capacity, _maxHeaderBlockLength);
+
+    uint8_t *decompressed = realloc(_decompressed, sizeof(uint8_t) * capacity);
+    if (decompressed == NULL) {
+        return NO;
+    }
+
+    _decompressed = decompressed;
+    _decompressedCapacity = capacity;
+    return YES;
+}
+
 - (NSUInteger)_readSettings:(uint8_t *)buffer length:(NSUInteger)len
 {
     NSUInteger bytesToRead = MIN(_length, len);
@@ -16,12 +16,26 @@
 #define COMPRESSED_FRAME_HEADER_LENGTH 12
 #define MAX_HEADER_BLOCK_LENGTH (16384 - COMPRESSED_FRAME_HEADER_LENGTH)
 #define MAX_COMPRESSED_HEADER_BLOCK_LENGTH (MAX_HEADER_BLOCK_LENGTH + COMPRESSED_FRAME_HEADER_LENGTH)
+#define INITIAL_HEADER_BLOCK_LENGTH 1024
 
 @class SPDYFrameEncoder;
 
 @protocol SPDYFrameEncoderDelegate <NSObject>
-- (void)didEncodeData:(NSData *)data frameEncoder:(SPDYFrameEncoder *)encoder;
-- (void)didEncodeData:(NSData *)data withTag:(uint32_t)tag frameEncoder:(SPDYFrameEncoder *)encoder;
+
+/**
+  Called once per encoded frame. The frame is the header bytes followed by
+  the payload, if any. For control frames the header holds the entire frame
+  and payload is nil; for DATA frames the payload is the caller's data,
+  passed through without copying.
+
+  The header bytes live in a buffer owned and reused by the encoder, and are
+  only valid for the duration of this call.
+*/
+- (void)didEncodeFrameHeader:(const uint8_t *)header
+                      length:(NSUInteger)headerLength
+                     payload:(NSData *)payload
+                         tag:(uint32_t)tag
+                frameEncoder:(SPDYFrameEncoder *)encoder;
 @end
 
 @interface SPDYFrameEncoder : NSObject
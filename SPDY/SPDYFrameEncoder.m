@@ -17,19 +17,57 @@
 #import "SPDYFrameEncoder.h"
 #import "SPDYHeaderBlockCompressor.h"
 
+// Conservative worst-case deflate expansion (cf. deflateBound) plus the sync flush marker
+#define COMPRESSED_BOUND(length) ((length) + ((length) >> 3) + ((length) >> 6) + COMPRESSED_FRAME_HEADER_LENGTH + 6)
+
+// Room reserved ahead of the compressed header block for the fixed fields of the largest
+// header-bearing frame (SYN_STREAM), so the whole frame can be emitted contiguously.
+#define HEADER_BLOCK_FRAME_PREFIX_LENGTH 18
+
+// A SETTINGS frame carrying every setting is the largest frame without a variable payload
+#define MAX_FIXED_FRAME_LENGTH (12 + 8 * SPDY_SETTINGS_LENGTH)
+
+static inline uint8_t *writeUInt16(uint8_t *buffer, uint16_t value)
+{
+    value = htons(value);
+    memcpy(buffer, &value, sizeof(value));
+    return buffer + sizeof(value);
+}
+
+static inline uint8_t *writeUInt32(uint8_t *buffer, uint32_t value)
+{
+    value = htonl(value);
+    memcpy(buffer, &value, sizeof(value));
+    return buffer + sizeof(value);
+}
+
+static inline uint8_t *writeControlFrameHeader(uint8_t *buffer, uint16_t type, uint8_t flags, uint32_t length)
+{
+    buffer[0] = 0x80; // control bit
+    buffer[1] = 3;    // version
+    buffer = writeUInt16(buffer + 2, type);
+    return writeUInt32(buffer, (uint32_t)flags << 24 | length);
+}
+
 @interface SPDYFrameEncoder ()
+- (NSInteger)_emitFrame:(uint8_t *)frameEnd tag:(uint32_t)tag;
 - (bool)_encodeHeaders:(NSDictionary *)dictionary error:(NSError **)pError;
 - (bool)_writeUInt32:(uint32_t)value error:(NSError **)pError;
 - (bool)_writeString:(NSString*)value error:(NSError **)pError;
+- (bool)_reserveEncodedHeaders:(NSUInteger)length error:(NSError **)pError;
+- (bool)_reserveCompressed:(NSUInteger)length;
 @end
 
 @implementation SPDYFrameEncoder
 {
     SPDYHeaderBlockCompressor *_compressor;
     NSUInteger _encodedHeadersLength;
+    NSUInteger _encodedHeadersCapacity;
     NSUInteger _compressedLength;
+    NSUInteger _compressedCapacity;
     uint8_t *_encodedHeaders;
     uint8_t *_compressed;
+    uint8_t _frame[MAX_FIXED_FRAME_LENGTH];
 }
 
 - (id)initWithDelegate:(id<SPDYFrameEncoderDelegate>)delegate headerCompressionLevel:(NSUInteger)headerCompressionLevel
@@ -39,8 +77,11 @@
         _delegate = delegate;
 
         _compressor = [[SPDYHeaderBlockCompressor alloc] initWithCompressionLevel:headerCompressionLevel];
-        _encodedHeaders = malloc(sizeof(uint8_t) * MAX_HEADER_BLOCK_LENGTH);
-        _compressed = malloc(sizeof(uint8_t) * MAX_COMPRESSED_HEADER_BLOCK_LENGTH);
+        // Header buffers start small and grow on demand up to MAX_HEADER_BLOCK_LENGTH
+        _encodedHeaders = malloc(sizeof(uint8_t) * INITIAL_HEADER_BLOCK_LENGTH);
+        _compressed = malloc(sizeof(uint8_t) * INITIAL_HEADER_BLOCK_LENGTH);
+        _encodedHeadersCapacity = INITIAL_HEADER_BLOCK_LENGTH;
+        _compressedCapacity = INITIAL_HEADER_BLOCK_LENGTH;
         _encodedHeadersLength = 0;
         _compressedLength = 0;
     }
@@ -55,18 +96,16 @@
 
 - (NSInteger)encodeDataFrame:(SPDYDataFrame *)dataFrame
 {
-    NSMutableData *encodedData = [[NSMutableData alloc] initWithCapacity:8];
+    uint8_t *p = _frame;
+    uint8_t flags = SPDY_DATA_FLAG_FIN * dataFrame.last;
 
-    uint32_t streamId = htonl(dataFrame.streamId);
-    uint32_t flags = SPDY_DATA_FLAG_FIN * dataFrame.last;
-    uint32_t flags_length = htonl(flags << 24 | (uint32_t)dataFrame.data.length);
+    p = writeUInt32(p, dataFrame.streamId);
+    p = writeUInt32(p, (uint32_t)flags << 24 | (uint32_t)dataFrame.data.length);
 
-    [encodedData appendBytes:&streamId length:4];
-    [encodedData appendBytes:&flags_length length:4];
-
-    [_delegate didEncodeData:encodedData frameEncoder:self];
-    [_delegate didEncodeData:dataFrame.data frameEncoder:self];
-    return encodedData.length + dataFrame.data.length;
+    // The payload is handed off as-is; only the 8 byte header is written out here
+    NSUInteger headerLength = (NSUInteger)(p - _frame);
+    [_delegate didEncodeFrameHeader:_frame length:headerLength payload:dataFrame.data tag:0 frameEncoder:self];
+    return headerLength + dataFrame.data.length;
 }
 
 - (NSInteger)encodeSynStreamFrame:(SPDYSynStreamFrame *)synStreamFrame error:(NSError **)pError
@@ -75,28 +114,19 @@
         return -1;
     }
 
-    NSMutableData *encodedData = [[NSMutableData alloc] initWithCapacity:18 + _compressedLength];
-
-    uint8_t control = 0x80;
-    uint8_t version = 3;
-    uint16_t type = htons(SPDY_SYN_STREAM_FRAME);
-    uint32_t flags = SPDY_FLAG_FIN * synStreamFrame.last | SPDY_FLAG_UNIDIRECTIONAL * synStreamFrame.unidirectional;
-    uint32_t flags_length = htonl(flags << 24 | 10 + _compressedLength);
-    uint32_t streamId = htonl(synStreamFrame.streamId);
-    uint32_t assocStreamId = htonl(synStreamFrame.associatedToStreamId);
-    uint16_t priority_slot = htons((uint16_t)synStreamFrame.priority << 13);
-
-    [encodedData appendBytes:&control length:1];
-    [encodedData appendBytes:&version length:1];
-    [encodedData appendBytes:&type length:2];
-    [encodedData appendBytes:&flags_length length:4];
-    [encodedData appendBytes:&streamId length:4];
-    [encodedData appendBytes:&assocStreamId length:4];
-    [encodedData appendBytes:&priority_slot length:2];
-    [encodedData appendBytes:_compressed length:_compressedLength];
-
-    [_delegate didEncodeData:encodedData frameEncoder:self];
-    return encodedData.length;
+    // Fixed fields are written directly in front of the compressed header block
+    uint8_t *frame = _compressed + HEADER_BLOCK_FRAME_PREFIX_LENGTH - 18;
+    uint8_t *p = frame;
+    uint8_t flags = SPDY_FLAG_FIN * synStreamFrame.last | SPDY_FLAG_UNIDIRECTIONAL * synStreamFrame.unidirectional;
+
+    p = writeControlFrameHeader(p, SPDY_SYN_STREAM_FRAME, flags, (uint32_t)(10 + _compressedLength));
+    p = writeUInt32(p, synStreamFrame.streamId);
+    p = writeUInt32(p, synStreamFrame.associatedToStreamId);
+    p = writeUInt16(p, (uint16_t)synStreamFrame.priority << 13);
+
+    NSUInteger length = (NSUInteger)(p - frame) + _compressedLength;
+    [_delegate didEncodeFrameHeader:frame length:length payload:nil tag:0 frameEncoder:self];
+    return length;
 }
 
 - (NSInteger)encodeSynReplyFrame:(SPDYSynReplyFrame *)synReplyFrame error:(NSError **)pError
@@ -105,46 +135,27 @@
         return -1;
     }
 
-    NSMutableData *encodedData = [[NSMutableData alloc] initWithCapacity:12 + _compressedLength];
-
-    uint8_t control = 0x80;
-    uint8_t version = 3;
-    uint16_t type = htons(SPDY_SYN_REPLY_FRAME);
-    uint32_t flags = SPDY_FLAG_FIN * synReplyFrame.last;
-    uint32_t flags_length = htonl(flags << 24 | 4 + _compressedLength);
-    uint32_t streamId = htonl(synReplyFrame.streamId);
+    uint8_t *frame = _compressed + HEADER_BLOCK_FRAME_PREFIX_LENGTH - 12;
+    uint8_t *p = frame;
+    uint8_t flags = SPDY_FLAG_FIN * synReplyFrame.last;
 
-    [encodedData appendBytes:&control length:1];
-    [encodedData appendBytes:&version length:1];
-    [encodedData appendBytes:&type length:2];
-    [encodedData appendBytes:&flags_length length:4];
-    [encodedData appendBytes:&streamId length:4];
-    [encodedData appendBytes:_compressed length:_compressedLength];
+    p = writeControlFrameHeader(p, SPDY_SYN_REPLY_FRAME, flags, (uint32_t)(4 + _compressedLength));
+    p = writeUInt32(p, synReplyFrame.streamId);
 
-    [_delegate didEncodeData:encodedData frameEncoder:self];
-    return encodedData.length;
+    NSUInteger length = (NSUInteger)(p - frame) + _compressedLength;
+    [_delegate didEncodeFrameHeader:frame length:length payload:nil tag:0 frameEncoder:self];
+    return length;
 }
 
 - (NSInteger)encodeRstStreamFrame:(SPDYRstStreamFrame *)rstStreamFrame
 {
-    NSMutableData *encodedData = [[NSMutableData alloc] initWithCapacity:16];
-
-    uint8_t control = 0x80;
-    uint8_t version = 3;
-    uint16_t type = htons(SPDY_RST_STREAM_FRAME);
-    uint32_t flags_length = htonl(8); // no flags
-    uint32_t streamId = htonl(rstStreamFrame.streamId);
-    uint32_t statusCode = htonl(rstStreamFrame.statusCode);
-
-    [encodedData appendBytes:&control length:1];
-    [encodedData appendBytes:&version length:1];
-    [encodedData appendBytes:&type length:2];
-    [encodedData appendBytes:&flags_length length:4];
-    [encodedData appendBytes:&streamId length:4];
-    [encodedData appendBytes:&statusCode length:4];
-
-    [_delegate didEncodeData:encodedData frameEncoder:self];
-    return encodedData.length;
+    uint8_t *p = _frame;
+
+    p = writeControlFrameHeader(p, SPDY_RST_STREAM_FRAME, 0, 8);
+    p = writeUInt32(p, rstStreamFrame.streamId);
+    p = writeUInt32(p, rstStreamFrame.statusCode);
+
+    return [self _emitFrame:p tag:0];
 }
 
 - (NSInteger)encodeSettingsFrame:(SPDYSettingsFrame *)settingsFrame
@@ -157,74 +168,41 @@
         }
     }
 
-    NSMutableData *encodedData = [[NSMutableData alloc] initWithCapacity:(12 + 8 * numEntries)];
+    uint8_t *p = _frame;
+    uint8_t flags = SPDY_SETTINGS_FLAG_CLEAR_SETTINGS * settingsFrame.clearSettings;
 
-    uint8_t control = 0x80;
-    uint8_t version = 3;
-    uint16_t type = htons(SPDY_SETTINGS_FRAME);
-    uint32_t flags = SPDY_SETTINGS_FLAG_CLEAR_SETTINGS * settingsFrame.clearSettings;
-    uint32_t flags_length = htonl(flags << 24 | 4 + 8 * numEntries);
-    numEntries = htonl(numEntries);
-
-    [encodedData appendBytes:&control length:1];
-    [encodedData appendBytes:&version length:1];
-    [encodedData appendBytes:&type length:2];
-    [encodedData appendBytes:&flags_length length:4];
-    [encodedData appendBytes:&numEntries length:4];
+    p = writeControlFrameHeader(p, SPDY_SETTINGS_FRAME, flags, 4 + 8 * numEntries);
+    p = writeUInt32(p, numEntries);
 
     SPDY_SETTINGS_ITERATOR(i) {
         if (settingsFrame.settings[i].set) {
-            uint32_t flags_entryId = htonl((uint32_t)settingsFrame.settings[i].flags << 24 | i);
-            uint32_t entryValue = htonl(settingsFrame.settings[i].value);
-            [encodedData appendBytes:&flags_entryId length:4];
-            [encodedData appendBytes:&entryValue length:4];
+            p = writeUInt32(p, (uint32_t)settingsFrame.settings[i].flags << 24 | i);
+            p = writeUInt32(p, (uint32_t)settingsFrame.settings[i].value);
         }
     }
 
-    [_delegate didEncodeData:encodedData frameEncoder:self];
-    return encodedData.length;
+    return [self _emitFrame:p tag:0];
 }
 
 - (NSInteger)encodePingFrame:(SPDYPingFrame *)pingFrame
 {
-    NSMutableData *encodedData = [[NSMutableData alloc] initWithCapacity:12];
-
-    uint8_t control = 0x80;
-    uint8_t version = 3;
-    uint16_t type = htons(SPDY_PING_FRAME);
-    uint32_t flags_length = htonl(4); // no flags
-    uint32_t pingId = htonl(pingFrame.pingId);
-
-    [encodedData appendBytes:&control length:1];
-    [encodedData appendBytes:&version length:1];
-    [encodedData appendBytes:&type length:2];
-    [encodedData appendBytes:&flags_length length:4];
-    [encodedData appendBytes:&pingId length:4];
-
-    [_delegate didEncodeData:encodedData withTag:pingFrame.pingId frameEncoder:self];
-    return encodedData.length;
+    uint8_t *p = _frame;
+
+    p = writeControlFrameHeader(p, SPDY_PING_FRAME, 0, 4);
+    p = writeUInt32(p, pingFrame.pingId);
+
+    return [self _emitFrame:p tag:pingFrame.pingId];
 }
 
 - (NSInteger)encodeGoAwayFrame:(SPDYGoAwayFrame *)goAwayFrame
 {
-    NSMutableData *encodedData = [[NSMutableData alloc] initWithCapacity:1];
-
-    uint8_t control = 0x80;
-    uint8_t version = 3;
-    uint16_t type = htons(SPDY_GOAWAY_FRAME);
-    uint32_t flags_length = htonl(8); // no flags
-    uint32_t lastGoodStreamId = htonl(goAwayFrame.lastGoodStreamId);
-    uint32_t statusCode = htonl(goAwayFrame.statusCode);
-
-    [encodedData appendBytes:&control length:1];
-    [encodedData appendBytes:&version length:1];
-    [encodedData appendBytes:&type length:2];
-    [encodedData appendBytes:&flags_length length:4];
-    [encodedData appendBytes:&lastGoodStreamId length:4];
-    [encodedData appendBytes:&statusCode length:4];
-
-    [_delegate didEncodeData:encodedData frameEncoder:self];
-    return encodedData.length;
+    uint8_t *p = _frame;
+
+    p = writeControlFrameHeader(p, SPDY_GOAWAY_FRAME, 0, 8);
+    p = writeUInt32(p, goAwayFrame.lastGoodStreamId);
+    p = writeUInt32(p, goAwayFrame.statusCode);
+
+    return [self _emitFrame:p tag:0];
 }
 
 - (NSInteger)encodeHeadersFrame:(SPDYHeadersFrame *)headersFrame error:(NSError **)pError
@@ -233,50 +211,38 @@
         return -1;
     }
 
-    NSMutableData *encodedData = [[NSMutableData alloc] initWithCapacity:12 + _compressedLength];
+    uint8_t *frame = _compressed + HEADER_BLOCK_FRAME_PREFIX_LENGTH - 12;
+    uint8_t *p = frame;
+    uint8_t flags = SPDY_FLAG_FIN * headersFrame.last;
 
-    uint8_t control = 0x80;
-    uint8_t version = 3;
-    uint16_t type = htons(SPDY_HEADERS_FRAME);
-    uint32_t flags = SPDY_FLAG_FIN * headersFrame.last;
-    uint32_t flags_length = htonl(flags << 24 | 4 + _compressedLength);
-    uint32_t streamId = htonl(headersFrame.streamId);
+    p = writeControlFrameHeader(p, SPDY_HEADERS_FRAME, flags, (uint32_t)(4 + _compressedLength));
+    p = writeUInt32(p, headersFrame.streamId);
 
-    [encodedData appendBytes:&control length:1];
-    [encodedData appendBytes:&version length:1];
-    [encodedData appendBytes:&type length:2];
-    [encodedData appendBytes:&flags_length length:4];
-    [encodedData appendBytes:&streamId length:4];
-    [encodedData appendBytes:_compressed length:_compressedLength];
-
-    [_delegate didEncodeData:encodedData frameEncoder:self];
-    return encodedData.length;
+    NSUInteger length = (NSUInteger)(p - frame) + _compressedLength;
+    [_delegate didEncodeFrameHeader:frame length:length payload:nil tag:0 frameEncoder:self];
+    return length;
 }
 
 - (NSInteger)encodeWindowUpdateFrame:(SPDYWindowUpdateFrame *)windowUpdateFrame
 {
-    NSMutableData *encodedData = [[NSMutableData alloc] initWithCapacity:16];
-
-    uint8_t control = 0x80;
-    uint8_t version = 3;
-    uint16_t type = htons(SPDY_WINDOW_UPDATE_FRAME);
-    uint32_t flags_length = htonl(8); // no flags
-    uint32_t streamId = htonl(windowUpdateFrame.streamId);
-    uint32_t windowDelta = htonl(windowUpdateFrame.deltaWindowSize);
-
-    [encodedData appendBytes:&control length:1];
-    [encodedData appendBytes:&version length:1];
-    [encodedData appendBytes:&type length:2];
-    [encodedData appendBytes:&flags_length length:4];
-    [encodedData appendBytes:&streamId length:4];
-    [encodedData appendBytes:&windowDelta length:4];
-
-    [_delegate didEncodeData:encodedData frameEncoder:self];
-    return encodedData.length;
+    uint8_t *p = _frame;
+
+    p = writeControlFrameHeader(p, SPDY_WINDOW_UPDATE_FRAME, 0, 8);
+    p = writeUInt32(p, windowUpdateFrame.streamId);
+    p = writeUInt32(p, windowUpdateFrame.deltaWindowSize);
+
+    return [self _emitFrame:p tag:0];
 }
 
 #pragma mark private methods
 
+- (NSInteger)_emitFrame:(uint8_t *)frameEnd tag:(uint32_t)tag
+{
+    NSUInteger length = (NSUInteger)(frameEnd - _frame);
+    [_delegate didEncodeFrameHeader:_frame length:length payload:nil tag:tag frameEncoder:self];
+    return length;
+}
+
 - (bool)_encodeHeaders:(NSDictionary *)headers error:(NSError **)pError
 {
     _encodedHeadersLength = 0;
@@ -301,11 +267,15 @@
     }
 
     NSError *error = nil;
-    _compressedLength = [_compressor deflate:_encodedHeaders
-                                     availIn:_encodedHeadersLength
-                                outputBuffer:_compressed
-                                    availOut:MAX_COMPRESSED_HEADER_BLOCK_LENGTH
-                                       error:&error];
+    if (![self _reserveCompressed:HEADER_BLOCK_FRAME_PREFIX_LENGTH + COMPRESSED_BOUND(_encodedHeadersLength)]) {
+        error = SPDY_CODEC_ERROR(SPDYHeaderBlockEncodingError, @"unable to allocate header buffer");
+    } else {
+        _compressedLength = [_compressor deflate:_encodedHeaders
+                                         availIn:_encodedHeadersLength
+                                    outputBuffer:_compressed + HEADER_BLOCK_FRAME_PREFIX_LENGTH
+                                        availOut:_compressedCapacity - HEADER_BLOCK_FRAME_PREFIX_LENGTH
+                                           error:&error];
+    }
     if (pError) {
         *pError = error;
     }
@@ -314,12 +284,7 @@
 
 - (bool)_writeUInt32:(uint32_t)value error:(NSError **)pError
 {
-    if (_encodedHeadersLength + sizeof(uint32_t) > MAX_HEADER_BLOCK_LENGTH) {
-        if (pError) {
-            NSString *message = [NSString stringWithFormat:@"encoded headers exceeds %d bytes",
-                                                           MAX_HEADER_BLOCK_LENGTH];
-            *pError = SPDY_CODEC_ERROR(SPDYHeaderBlockEncodingError, message);
-        }
+    if (![self _reserveEncodedHeaders:sizeof(uint32_t) error:pError]) {
         return NO;
     }
     *((uint32_t *)(_encodedHeaders + _encodedHeadersLength)) = htonl(value);
@@ -332,8 +297,12 @@
     NSRange leftover;
     NSUInteger used;
 
+    if (![self _reserveEncodedHeaders:[value lengthOfBytesUsingEncoding:NSUTF8StringEncoding] error:pError]) {
+        return NO;
+    }
+
     [value getBytes:(_encodedHeaders + _encodedHeadersLength)
-          maxLength:(MAX_HEADER_BLOCK_LENGTH - _encodedHeadersLength)
+          maxLength:(_encodedHeadersCapacity - _encodedHeadersLength)
          usedLength:&used
            encoding:NSUTF8StringEncoding
             options:NSStringEncodingConversionAllowLossy
@@ -354,4 +323,60 @@
     return YES;
 }
 
+- (bool)_reserveEncodedHeaders:(NSUInteger)length error:(NSError **)pError
+{
+    NSUInteger required = _encodedHeadersLength + length;
+    if (required <= _encodedHeadersCapacity) {
+        return YES;
+    }
+
+    if (required > MAX_HEADER_BLOCK_LENGTH) {
+        if (pError) {
+            NSString *message = [NSString stringWithFormat:@"encoded headers exceeds %d bytes",
+                                                           MAX_HEADER_BLOCK_LENGTH];
+            *pError = SPDY_CODEC_ERROR(SPDYHeaderBlockEncodingError, message);
+        }
+        return NO;
+    }
+
+    NSUInteger capacity = _encodedHeadersCapacity;
+    while (capacity < required) {
+        capacity *= 2;
+    }
+    capacity = MIN(capacity, (NSUInteger)MAX_HEADER_BLOCK_LENGTH);
+
+    uint8_t *encodedHeaders = realloc(_encodedHeaders, sizeof(uint8_t) * capacity);
+    if (encodedHeaders == NULL) {
+        if (pError) {
+            *pError = SPDY_CODEC_ERROR(SPDYHeaderBlockEncodingError, @"unable to allocate header buffer");
+        }
+        return NO;
+    }
+
+    _encodedHeaders = encodedHeaders;
+    _encodedHeadersCapacity = capacity;
+    return YES;
+}
+
+- (bool)_reserveCompressed:(NSUInteger)length
+{
+    if (length <= _compressedCapacity) {
+        return YES;
+    }
+
+    NSUInteger capacity = _compressedCapacity;
+    while (capacity < length) {
+        capacity *= 2;
+    }
+
+    uint8_t *compressed = realloc(_compressed, sizeof(uint8_t) * capacity);
+    if (compressed == NULL) {
+        return NO;
+    }
+
+    _compressed = compressed;
+    _compressedCapacity = capacity;
+    return YES;
+}
+
 @end
@@ -0,0 +1,50 @@
+//
+//  SPDYHeaderBlock.h
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+  Immutable, indexed view of a decompressed SPDY/3 name/value header block.
+
+  Parsing copies the raw block once and records (offset, length) pairs for
+  each name and value; NSString objects are only created when a header is
+  actually read. Multi-valued headers (NUL-separated) materialize as NSArray,
+  matching the dictionary previously produced by SPDYFrameDecoder, so a
+  header block can be used anywhere an NSDictionary of headers is expected.
+*/
+@interface SPDYHeaderBlock : NSDictionary
+
+/**
+  Indexes a decompressed header block. Returns nil if the block is
+  malformed.
+*/
+- (id)initWithBytes:(const uint8_t *)bytes length:(NSUInteger)length;
+
+/**
+  Indexes a decompressed header block in place, taking ownership of the
+  malloc'd buffer, which is freed when the header block is deallocated (or
+  immediately, if the block is malformed and nil is returned).
+*/
+- (id)initWithBytesNoCopy:(uint8_t *)bytes length:(NSUInteger)length;
+
+/**
+  Returns YES if a header with the given name is present, without
+  materializing any strings.
+*/
+- (bool)containsHeader:(const char *)name length:(NSUInteger)length;
+
+/**
+  Builds the header fields for an NSHTTPURLResponse: pseudo-headers (those
+  prefixed with ':') are skipped and multiple values are joined with ", ".
+*/
+- (NSMutableDictionary *)mutableHTTPHeaderFields;
+
+@end
@@ -0,0 +1,370 @@
+//
+//  SPDYHeaderBlock.m
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#if !defined(__has_feature) || !__has_feature(objc_arc)
+#error "This file requires ARC support."
+#endif
+
+#import <libkern/OSAtomic.h>
+#import "SPDYHeaderBlock.h"
+
+#define MAX_STACK_KEY_LENGTH 256
+
+typedef struct {
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t valueOffset;
+    uint32_t valueLength;
+    uint32_t nameHash;
+    bool multiValued;
+} SPDYHeaderBlockEntry;
+
+static inline uint32_t readUInt32(const uint8_t *buffer) {
+    uint32_t value;
+    memcpy(&value, buffer, sizeof(value));
+    return ntohl(value);
+}
+
+/**
+  FNV-1a, seeded once per process so that a peer can't precompute names
+  that all land in the same slot of the index.
+*/
+static uint32_t hashName(const uint8_t *name, NSUInteger length)
+{
+    static uint32_t seed;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        seed = arc4random();
+    });
+
+    uint32_t hash = 2166136261u ^ seed;
+    for (NSUInteger i = 0; i < length; i++) {
+        hash ^= name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+  Publishes a lazily created object into a cache slot. If another thread got
+  there first, its object is kept and ours is released.
+*/
+static inline CFTypeRef publishCachedObject(CFTypeRef volatile *slot, id object)
+{
+    CFTypeRef retained = CFBridgingRetain(object);
+    if (!OSAtomicCompareAndSwapPtrBarrier(NULL, (void *)retained, (void * volatile *)slot)) {
+        CFRelease(retained);
+    }
+    return *slot;
+}
+
+@interface SPDYHeaderBlock ()
+- (NSInteger)_indexOfName:(const char *)name length:(NSUInteger)length hash:(uint32_t)hash;
+- (NSInteger)_indexOfName:(const char *)name length:(NSUInteger)length;
+- (NSString *)_nameAtIndex:(NSUInteger)index;
+- (id)_valueAtIndex:(NSUInteger)index;
+@end
+
+@implementation SPDYHeaderBlock
+{
+    SPDYHeaderBlockEntry *_entries;
+    uint8_t *_bytes;
+    NSUInteger _count;
+
+    // Open-addressed index from name hash to entry, holding entry index + 1 so 0 is empty
+    uint32_t *_slots;
+    NSUInteger _slotMask;
+
+    // Lazily materialized names, values and keys, owned via CFBridgingRetain. Each slot
+    // is filled at most once, with a compare-and-swap, so a header block may be read
+    // from any thread.
+    CFTypeRef volatile *_names;
+    CFTypeRef volatile *_values;
+    CFTypeRef volatile _keys;
+}
+
+- (id)initWithBytes:(const uint8_t *)bytes length:(NSUInteger)length
+{
+    uint8_t *copy = malloc(MAX(length, (NSUInteger)1));
+    if (copy == NULL) {
+        return nil;
+    }
+    memcpy(copy, bytes, length);
+    return [self initWithBytesNoCopy:copy length:length];
+}
+
+- (id)initWithBytesNoCopy:(uint8_t *)bytes length:(NSUInteger)length
+{
+    self = [super init];
+    if (self) {
+        _bytes = bytes;
+
+        if (length < 4 || length > UINT32_MAX) {
+            return nil;
+        }
+
+        // Every name/value pair takes at least 8 bytes of length prefixes,
+        // which bounds the index before trusting the advertised count.
+        NSUInteger headerCount = readUInt32(bytes);
+        if (headerCount > (length - 4) / 8) {
+            return nil;
+        }
+
+        // At most half full, so probe runs stay short
+        NSUInteger slotCount = 4;
+        while (slotCount < headerCount * 2) {
+            slotCount <<= 1;
+        }
+
+        _entries = malloc(sizeof(SPDYHeaderBlockEntry) * MAX(headerCount, (NSUInteger)1));
+        _slots = calloc(slotCount, sizeof(uint32_t));
+        _names = calloc(MAX(headerCount, (NSUInteger)1), sizeof(CFTypeRef));
+        _values = calloc(MAX(headerCount, (NSUInteger)1), sizeof(CFTypeRef));
+        if (_entries == NULL || _slots == NULL || _names == NULL || _values == NULL) {
+            return nil;
+        }
+        _slotMask = slotCount - 1;
+        _count = 0;
+
+        NSUInteger bufferIndex = 4;
+        while (headerCount > 0) {
+            SPDYHeaderBlockEntry entry;
+
+            /* Read header name */
+
+            if (bufferIndex + 4 > length) {
+                return nil;
+            }
+            entry.nameLength = readUInt32(_bytes + bufferIndex);
+            bufferIndex += 4;
+
+            if (entry.nameLength > length - bufferIndex) {
+                return nil;
+            }
+            entry.nameOffset = (uint32_t)bufferIndex;
+            bufferIndex += entry.nameLength;
+
+            /* Read header value */
+
+            if (bufferIndex + 4 > length) {
+                return nil;
+            }
+            entry.valueLength = readUInt32(_bytes + bufferIndex);
+            bufferIndex += 4;
+
+            if (entry.valueLength > length - bufferIndex) {
+                return nil;
+            }
+            entry.valueOffset = (uint32_t)bufferIndex;
+            bufferIndex += entry.valueLength;
+
+            // Interior NULs separate multiple values
+            entry.multiValued = NO;
+            for (NSUInteger i = 1; !entry.multiValued && i + 1 < entry.valueLength; i++) {
+                if (_bytes[entry.valueOffset + i] == '\0') {
+                    entry.multiValued = YES;
+                }
+            }
+
+            // Preserve dictionary semantics for repeated names: last one wins
+            entry.nameHash = hashName(_bytes + entry.nameOffset, entry.nameLength);
+            NSInteger existing = [self _indexOfName:(const char *)(_bytes + entry.nameOffset)
+                                             length:entry.nameLength
+                                               hash:entry.nameHash];
+            if (existing >= 0) {
+                _entries[existing] = entry;
+            } else {
+                NSUInteger slot = entry.nameHash & _slotMask;
+                while (_slots[slot] != 0) {
+                    slot = (slot + 1) & _slotMask;
+                }
+                _entries[_count++] = entry;
+                _slots[slot] = (uint32_t)_count;
+            }
+
+            headerCount--;
+        }
+
+        if (bufferIndex < length) {
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (id)init
+{
+    uint8_t empty[4] = { 0, 0, 0, 0 };
+    return [self initWithBytes:empty length:sizeof(empty)];
+}
+
+- (void)dealloc
+{
+    for (NSUInteger i = 0; i < _count; i++) {
+        if (_names && _names[i]) CFRelease(_names[i]);
+        if (_values && _values[i]) CFRelease(_values[i]);
+    }
+    if (_keys) CFRelease(_keys);
+    free((void *)_names);
+    free((void *)_values);
+    free(_slots);
+    free(_entries);
+    free(_bytes);
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    return self;
+}
+
+#pragma mark NSDictionary primitives
+
+- (NSUInteger)count
+{
+    return _count;
+}
+
+- (id)objectForKey:(id)key
+{
+    if (![key isKindOfClass:[NSString class]]) {
+        return nil;
+    }
+
+    NSString *name = key;
+    char buffer[MAX_STACK_KEY_LENGTH];
+    NSUInteger usedLength = 0;
+    NSRange remaining;
+    NSInteger index;
+
+    bool converted = [name getBytes:buffer
+                          maxLength:sizeof(buffer)
+                         usedLength:&usedLength
+                           encoding:NSUTF8StringEncoding
+                            options:0
+                              range:NSMakeRange(0, name.length)
+                     remainingRange:&remaining];
+
+    if (converted && remaining.length == 0) {
+        index = [self _indexOfName:buffer length:usedLength];
+    } else {
+        NSData *nameData = [name dataUsingEncoding:NSUTF8StringEncoding];
+        index = [self _indexOfName:nameData.bytes length:nameData.length];
+    }
+
+    return (index >= 0) ? [self _valueAtIndex:(NSUInteger)index] : nil;
+}
+
+- (NSEnumerator *)keyEnumerator
+{
+    if (!_keys) {
+        NSMutableArray *keys = [[NSMutableArray alloc] initWithCapacity:_count];
+        for (NSUInteger i = 0; i < _count; i++) {
+            NSString *name = [self _nameAtIndex:i];
+            if (name) {
+                [keys addObject:name];
+            }
+        }
+        publishCachedObject(&_keys, [keys copy]);
+    }
+    return [(__bridge NSArray *)_keys objectEnumerator];
+}
+
+#pragma mark public methods
+
+- (bool)containsHeader:(const char *)name length:(NSUInteger)length
+{
+    return [self _indexOfName:name length:length] >= 0;
+}
+
+- (NSMutableDictionary *)mutableHTTPHeaderFields
+{
+    NSMutableDictionary *fields = [[NSMutableDictionary alloc] initWithCapacity:_count];
+
+    for (NSUInteger i = 0; i < _count; i++) {
+        SPDYHeaderBlockEntry *entry = &_entries[i];
+        if (entry->nameLength > 0 && _bytes[entry->nameOffset] == ':') {
+            continue;
+        }
+
+        NSString *name = [self _nameAtIndex:i];
+        NSString *value;
+        if (entry->multiValued) {
+            NSString *joined = [[NSString alloc] initWithBytes:(_bytes + entry->valueOffset)
+                                                        length:entry->valueLength
+                                                      encoding:NSUTF8StringEncoding];
+            value = [joined stringByReplacingOccurrencesOfString:@"\0" withString:@", "];
+        } else {
+            value = [self _valueAtIndex:i];
+        }
+
+        if (name && value) {
+            fields[name] = value;
+        }
+    }
+
+    return fields;
+}
+
+#pragma mark private methods
+
+- (NSInteger)_indexOfName:(const char *)name length:(NSUInteger)length hash:(uint32_t)hash
+{
+    for (NSUInteger slot = hash & _slotMask; _slots[slot] != 0; slot = (slot + 1) & _slotMask) {
+        SPDYHeaderBlockEntry *entry = &_entries[_slots[slot] - 1];
+        if (entry->nameHash == hash && entry->nameLength == length &&
+            memcmp(_bytes + entry->nameOffset, name, length) == 0) {
+            return (NSInteger)(_slots[slot] - 1);
+        }
+    }
+    return -1;
+}
+
+- (NSInteger)_indexOfName:(const char *)name length:(NSUInteger)length
+{
+    return [self _indexOfName:name length:length hash:hashName((const uint8_t *)name, length)];
+}
+
+- (NSString *)_nameAtIndex:(NSUInteger)index
+{
+    if (!_names[index]) {
+        NSString *name = [[NSString alloc] initWithBytes:(_bytes + _entries[index].nameOffset)
+                                                  length:_entries[index].nameLength
+                                                encoding:NSUTF8StringEncoding];
+        if (!name) {
+            return nil;
+        }
+        publishCachedObject(&_names[index], name);
+    }
+
+    return (__bridge NSString *)_names[index];
+}
+
+- (id)_valueAtIndex:(NSUInteger)index
+{
+    if (!_values[index]) {
+        NSString *string = [[NSString alloc] initWithBytes:(_bytes + _entries[index].valueOffset)
+                                                    length:_entries[index].valueLength
+                                                  encoding:NSUTF8StringEncoding];
+        if (!string) {
+            return nil;
+        }
+
+        id value = string;
+        if (_entries[index].multiValued) {
+            value = [string componentsSeparatedByString:@"\0"];
+        }
+        publishCachedObject(&_values[index], value);
+    }
+
+    return (__bridge id)_values[index];
+}
+
+@end
@@ -13,5 +13,9 @@
 
 @interface SPDYHeaderBlockCompressor : NSObject
 - (id)initWithCompressionLevel:(NSUInteger)compressionLevel;
+
+// By default, new compressors clone a process-wide zlib state that has already been primed with
+// the SPDY dictionary for the requested level. Passing NO performs the full initialization.
+- (id)initWithCompressionLevel:(NSUInteger)compressionLevel usePrimedState:(bool)usePrimedState;
 - (NSUInteger)deflate:(uint8_t *)inputBuffer availIn:(NSUInteger)inputLength outputBuffer:(uint8_t *)outputBuffer availOut:(NSUInteger)outputLength error:(NSError **)pError;
 @end
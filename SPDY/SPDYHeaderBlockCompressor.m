@@ -15,6 +15,7 @@
 
 #import "SPDYDefinitions.h"
 #import "SPDYHeaderBlockCompressor.h"
+#import "SPDYZLibAllocator.h"
 #import "SPDYZLibCommon.h"
 
 // See https://groups.google.com/group/spdy-dev/browse_thread/thread/dfaf498542fac792
@@ -22,6 +23,50 @@
 #define ZLIB_WINDOW_SIZE 11
 #define ZLIB_MEMORY_LEVEL 1
 
+#define ZLIB_MAX_COMPRESSION_LEVEL 9
+
+static int initPrimedStream(z_stream *zlibStream, NSUInteger compressionLevel)
+{
+    bzero(zlibStream, sizeof(*zlibStream));
+
+    zlibStream->zalloc   = SPDYZLibAlloc;
+    zlibStream->zfree    = SPDYZLibFree;
+    zlibStream->opaque   = Z_NULL;
+
+    zlibStream->avail_in = 0;
+    zlibStream->next_in  = Z_NULL;
+
+    int status = deflateInit2(zlibStream, (int)compressionLevel, Z_DEFLATED, ZLIB_WINDOW_SIZE, ZLIB_MEMORY_LEVEL, Z_DEFAULT_STRATEGY);
+    NSCAssert(status == Z_OK, @"unable to initialize zlib stream");
+
+    if (status == Z_OK) {
+        status = deflateSetDictionary(zlibStream, kSPDYDict, sizeof(kSPDYDict));
+        NSCAssert(status == Z_OK, @"unable to set zlib dictionary");
+    }
+
+    return status;
+}
+
+// Process-wide template states, one per compression level, created on first use and never
+// mutated afterwards so that concurrent deflateCopy calls are safe.
+static z_stream *primedStreamForLevel(NSUInteger compressionLevel)
+{
+    static z_stream primedStreams[ZLIB_MAX_COMPRESSION_LEVEL + 1];
+    static bool primedStreamValid[ZLIB_MAX_COMPRESSION_LEVEL + 1];
+    static dispatch_once_t primedStreamOnce[ZLIB_MAX_COMPRESSION_LEVEL + 1];
+
+    if (compressionLevel > ZLIB_MAX_COMPRESSION_LEVEL) {
+        return NULL;
+    }
+
+    dispatch_once(&primedStreamOnce[compressionLevel], ^{
+        int status = initPrimedStream(&primedStreams[compressionLevel], compressionLevel);
+        primedStreamValid[compressionLevel] = (status == Z_OK);
+    });
+
+    return primedStreamValid[compressionLevel] ? &primedStreams[compressionLevel] : NULL;
+}
+
 @implementation SPDYHeaderBlockCompressor
 {
     z_stream _zlibStream;
@@ -34,23 +79,23 @@
 }
 
 - (id)initWithCompressionLevel:(NSUInteger)compressionLevel
+{
+    return [self initWithCompressionLevel:compressionLevel usePrimedState:YES];
+}
+
+- (id)initWithCompressionLevel:(NSUInteger)compressionLevel usePrimedState:(bool)usePrimedState
 {
     self = [super init];
     if (self) {
-        bzero(&_zlibStream, sizeof(_zlibStream));
-
-        _zlibStream.zalloc   = Z_NULL;
-        _zlibStream.zfree    = Z_NULL;
-        _zlibStream.opaque   = Z_NULL;
-
-        _zlibStream.avail_in = 0;
-        _zlibStream.next_in  = Z_NULL;
-
-        _zlibStreamStatus = deflateInit2(&_zlibStream, compressionLevel, Z_DEFLATED, ZLIB_WINDOW_SIZE, ZLIB_MEMORY_LEVEL, Z_DEFAULT_STRATEGY);
-        NSAssert(_zlibStreamStatus == Z_OK, @"unable to initialize zlib stream");
-
-        _zlibStreamStatus = deflateSetDictionary(&_zlibStream, kSPDYDict, sizeof(kSPDYDict));
-        NSAssert(_zlibStreamStatus == Z_OK, @"unable to set zlib dictionary");
+        z_stream *primedStream = usePrimedState ? primedStreamForLevel(compressionLevel) : NULL;
+
+        if (primedStream) {
+            // Copying the primed state skips re-hashing the dictionary for every session
+            _zlibStreamStatus = deflateCopy(&_zlibStream, primedStream);
+            NSAssert(_zlibStreamStatus == Z_OK, @"unable to copy zlib stream");
+        } else {
+            _zlibStreamStatus = initPrimedStream(&_zlibStream, compressionLevel);
+        }
     }
     return self;
 }
@@ -13,5 +13,5 @@
 
 
 @interface SPDYHeaderBlockDecompressor : NSObject
-- (NSUInteger)inflate:(uint8_t *)inputBuffer availIn:(NSUInteger)inputLength outputBuffer:(uint8_t *)outputBuffer availOut:(NSUInteger)outputLength error:(NSError **)pError;
+- (NSUInteger)inflate:(uint8_t *)inputBuffer availIn:(NSUInteger)inputLength outputBuffer:(uint8_t *)outputBuffer availOut:(NSUInteger)outputLength bytesConsumed:(NSUInteger *)pBytesConsumed error:(NSError **)pError;
 @end
@@ -15,6 +15,7 @@
 
 #import "SPDYDefinitions.h"
 #import "SPDYHeaderBlockDecompressor.h"
+#import "SPDYZLibAllocator.h"
 #import "SPDYZLibCommon.h"
 
 @implementation SPDYHeaderBlockDecompressor
@@ -29,8 +30,8 @@
     if (self) {
         bzero(&_zlibStream, sizeof(_zlibStream));
 
-        _zlibStream.zalloc   = Z_NULL;
-        _zlibStream.zfree    = Z_NULL;
+        _zlibStream.zalloc   = SPDYZLibAlloc;
+        _zlibStream.zfree    = SPDYZLibFree;
         _zlibStream.opaque   = Z_NULL;
 
         _zlibStream.avail_in = 0;
@@ -47,9 +48,15 @@
     inflateEnd(&_zlibStream);
 }
 
-// Always consumes ALL available input or sets an error, and returns the number of bytes written to the output buffer.
-- (NSUInteger)inflate:(uint8_t *)inputBuffer availIn:(NSUInteger)inputLength outputBuffer:(uint8_t *)outputBuffer availOut:(NSUInteger)outputLength error:(NSError **)pError
+// Consumes input until it is exhausted or the output buffer is full, and returns the number of
+// bytes written to the output buffer. When the output buffer is filled, the caller should provide
+// more space and call again (with any unconsumed input, or none) to drain pending output.
+- (NSUInteger)inflate:(uint8_t *)inputBuffer availIn:(NSUInteger)inputLength outputBuffer:(uint8_t *)outputBuffer availOut:(NSUInteger)outputLength bytesConsumed:(NSUInteger *)pBytesConsumed error:(NSError **)pError
 {
+    NSError *error = nil;
+
+    if (pBytesConsumed) *pBytesConsumed = 0;
+
     if (_zlibStreamStatus != Z_OK) {
         if (pError) *pError = SPDY_CODEC_ERROR(SPDYHeaderBlockDecodingError, @"invalid zlib stream state");
         return 0;
@@ -61,7 +68,7 @@
     _zlibStream.next_out = outputBuffer;
     _zlibStream.avail_out = (uInt)outputLength;
 
-    while (_zlibStream.avail_in > 0 && !*pError) {
+    do {
         _zlibStreamStatus = inflate(&_zlibStream, Z_SYNC_FLUSH);
 
         switch (_zlibStreamStatus) {
@@ -75,21 +82,23 @@
                 break;
 
             case Z_BUF_ERROR:
+                // No progress was possible (no input or no room for output); not fatal.
+                _zlibStreamStatus = Z_OK;
+                break;
+
             case Z_OK:
-                // For simplicity's sake, if avail_out == 0, we treat the header block
-                // as too large for this implementation to handle.
-                if (_zlibStream.avail_out == 0) {
-                    *pError = SPDY_CODEC_ERROR(SPDYHeaderBlockDecodingError, @"header block is too large");
-                }
                 break;
 
             case Z_STREAM_ERROR:
             case Z_DATA_ERROR:
             case Z_MEM_ERROR:
-                *pError = SPDY_CODEC_ERROR(SPDYHeaderBlockDecodingError, @"error decompressing header block");
+                error = SPDY_CODEC_ERROR(SPDYHeaderBlockDecodingError, @"error decompressing header block");
                 break;
         }
-    }
+    } while (_zlibStream.avail_in > 0 && _zlibStream.avail_out > 0 && _zlibStreamStatus == Z_OK && !error);
+
+    if (pBytesConsumed) *pBytesConsumed = inputLength - _zlibStream.avail_in;
+    if (pError) *pError = error;
 
     return _zlibStream.next_out - outputBuffer;
 }
@@ -16,11 +16,16 @@
 
 @property (nonatomic) NSUInteger blockedMs;
 @property (nonatomic) BOOL cellular;
+@property (nonatomic) BOOL coalesced;
 @property (nonatomic) NSUInteger connectedMs;
+@property (nonatomic) BOOL hedged;
+@property (nonatomic) BOOL hedgeWon;
 @property (nonatomic, copy) NSString *hostAddress;
 @property (nonatomic) NSUInteger hostPort;
 @property (nonatomic) NSInteger latencyMs;
 @property (nonatomic) SPDYProxyStatus proxyStatus;
+@property (nonatomic) BOOL pushed;
+@property (nonatomic) NSUInteger queuedMs;
 @property (nonatomic) NSUInteger rxBytes;
 @property (nonatomic) NSUInteger txBytes;
 @property (nonatomic) NSUInteger streamId;
@@ -48,4 +53,7 @@
 + (void)setMetadata:(SPDYMetadata *)metadata forAssociatedDictionary:(NSMutableDictionary *)dictionary;
 + (SPDYMetadata *)metadataForAssociatedDictionary:(NSDictionary *)dictionary;
 
+// Takes on the network measurements of the stream that actually carried a request
+- (void)setNetworkMetricsFromMetadata:(SPDYMetadata *)metadata;
+
 @end
\ No newline at end of file
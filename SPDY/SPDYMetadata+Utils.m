@@ -52,4 +52,29 @@ static NSString * const SPDYMetadataIdentifierKey = @"x-spdy-metadata-identifier
     return nil;
 }
 
+- (void)setNetworkMetricsFromMetadata:(SPDYMetadata *)metadata
+{
+    self.streamId = metadata.streamId;
+    self.rxBytes = metadata.rxBytes;
+    self.txBytes = metadata.txBytes;
+    self.blockedMs = metadata.blockedMs;
+    self.queuedMs = metadata.queuedMs;
+    self.cellular = metadata.cellular;
+    self.connectedMs = metadata.connectedMs;
+    self.hostAddress = metadata.hostAddress;
+    self.hostPort = metadata.hostPort;
+    self.latencyMs = metadata.latencyMs;
+    self.proxyStatus = metadata.proxyStatus;
+    self.viaProxy = metadata.viaProxy;
+    self.timeSessionConnected = metadata.timeSessionConnected;
+    self.timeStreamRequestStarted = metadata.timeStreamRequestStarted;
+    self.timeStreamRequestLastHeader = metadata.timeStreamRequestLastHeader;
+    self.timeStreamRequestEnded = metadata.timeStreamRequestEnded;
+    self.timeStreamResponseStarted = metadata.timeStreamResponseStarted;
+    self.timeStreamResponseLastHeader = metadata.timeStreamResponseLastHeader;
+    self.timeStreamResponseFirstData = metadata.timeStreamResponseFirstData;
+    self.timeStreamResponseLastData = metadata.timeStreamResponseLastData;
+    self.timeStreamResponseEnded = metadata.timeStreamResponseEnded;
+}
+
 @end
@@ -0,0 +1,57 @@
+//
+//  SPDYNetworkThread.h
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+  A single thread, owned by the library, on which every session manager and
+  session runs when SPDYConfiguration.enableSharedNetworkThread is set.
+
+  Session managers are confined to the thread that created them. Running
+  them all here lets requests loaded on different threads share sessions.
+  Work is handed over through a lock-free queue drained by a run loop source.
+*/
+@interface SPDYNetworkThread : NSObject
+
++ (SPDYNetworkThread *)sharedThread;
+
+/**
+  Runs the block on the network thread. Blocks run in the order they were
+  performed from any one thread. Safe to call from any thread, including
+  the network thread itself.
+*/
+- (void)performBlock:(dispatch_block_t)block;
+
+/**
+  @return YES if called on the network thread
+*/
+- (bool)isCurrentThread;
+
+@end
+
+/**
+  Forwards NSURLProtocolClient messages to the run loop a request was
+  started on, so a stream running on the network thread calls its client
+  from the thread the URL loading system expects.
+*/
+@interface SPDYRunLoopProtocolClient : NSObject <NSURLProtocolClient>
+
+- (id)initWithClient:(id<NSURLProtocolClient>)client
+            protocol:(NSURLProtocol *)protocol
+             runLoop:(CFRunLoopRef)runLoop;
+
+/**
+  Drops any messages still in flight. Must be called on the client's run
+  loop, once the request has been stopped.
+*/
+- (void)invalidate;
+
+@end
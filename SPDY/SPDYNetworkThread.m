@@ -0,0 +1,248 @@
+//
+//  SPDYNetworkThread.m
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#if !defined(__has_feature) || !__has_feature(objc_arc)
+#error "This file requires ARC support."
+#endif
+
+#import <libkern/OSAtomic.h>
+#import "SPDYCommonLogger.h"
+#import "SPDYNetworkThread.h"
+
+typedef struct SPDYNetworkThreadWork {
+    struct SPDYNetworkThreadWork *next;
+    CFTypeRef block;
+} SPDYNetworkThreadWork;
+
+static void SPDYNetworkThreadPerform(void *info);
+
+@interface SPDYNetworkThread ()
+- (void)_run:(dispatch_semaphore_t)started;
+- (void)_drain;
+@end
+
+@implementation SPDYNetworkThread
+{
+    NSThread *_thread;
+    CFRunLoopRef _runLoop;
+    CFRunLoopSourceRef _source;
+
+    // Pending work, newest first. Producers push with a compare-and-swap; the
+    // network thread takes the whole list at once, so there is no ABA hazard.
+    SPDYNetworkThreadWork * volatile _head;
+}
+
++ (SPDYNetworkThread *)sharedThread
+{
+    static SPDYNetworkThread *sharedThread;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        sharedThread = [[SPDYNetworkThread alloc] init];
+    });
+    return sharedThread;
+}
+
+- (id)init
+{
+    self = [super init];
+    if (self) {
+        _head = NULL;
+
+        dispatch_semaphore_t started = dispatch_semaphore_create(0);
+        _thread = [[NSThread alloc] initWithTarget:self selector:@selector(_run:) object:started];
+        _thread.name = @"com.twitter.SPDYNetworkThread";
+        [_thread start];
+        dispatch_semaphore_wait(started, DISPATCH_TIME_FOREVER);
+    }
+    return self;
+}
+
+- (void)performBlock:(dispatch_block_t)block
+{
+    SPDYNetworkThreadWork *work = malloc(sizeof(SPDYNetworkThreadWork));
+    work->block = (__bridge_retained CFTypeRef)[block copy];
+
+    do {
+        work->next = _head;
+    } while (!OSAtomicCompareAndSwapPtrBarrier(work->next, work, (void * volatile *)&_head));
+
+    CFRunLoopSourceSignal(_source);
+    CFRunLoopWakeUp(_runLoop);
+}
+
+- (bool)isCurrentThread
+{
+    return [NSThread currentThread] == _thread;
+}
+
+#pragma mark private methods
+
+- (void)_run:(dispatch_semaphore_t)started
+{
+    @autoreleasepool {
+        CFRunLoopSourceContext context = {
+            0, (__bridge void *)self,
+            NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+            SPDYNetworkThreadPerform
+        };
+        _runLoop = (CFRunLoopRef)CFRetain(CFRunLoopGetCurrent());
+        _source = CFRunLoopSourceCreate(kCFAllocatorDefault, 0, &context);
+        CFRunLoopAddSource(_runLoop, _source, kCFRunLoopDefaultMode);
+        SPDY_INFO(@"network thread started");
+        dispatch_semaphore_signal(started);
+    }
+
+    while (YES) {
+        @autoreleasepool {
+            [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate distantFuture]];
+        }
+    }
+}
+
+- (void)_drain
+{
+    SPDYNetworkThreadWork *work;
+    do {
+        work = _head;
+    } while (!OSAtomicCompareAndSwapPtrBarrier(work, NULL, (void * volatile *)&_head));
+
+    // Reverse into the order the work was performed in
+    SPDYNetworkThreadWork *ordered = NULL;
+    while (work) {
+        SPDYNetworkThreadWork *next = work->next;
+        work->next = ordered;
+        ordered = work;
+        work = next;
+    }
+
+    while (ordered) {
+        SPDYNetworkThreadWork *next = ordered->next;
+        @autoreleasepool {
+            dispatch_block_t block = (__bridge_transfer dispatch_block_t)ordered->block;
+            block();
+        }
+        free(ordered);
+        ordered = next;
+    }
+}
+
+@end
+
+static void SPDYNetworkThreadPerform(void *info)
+{
+    SPDYNetworkThread *networkThread = (__bridge SPDYNetworkThread *)info;
+    [networkThread _drain];
+}
+
+
+@implementation SPDYRunLoopProtocolClient
+{
+    id<NSURLProtocolClient> _client;
+    __weak NSURLProtocol *_protocol;
+    CFRunLoopRef _runLoop;
+    bool _invalidated;
+}
+
+- (id)initWithClient:(id<NSURLProtocolClient>)client
+            protocol:(NSURLProtocol *)protocol
+             runLoop:(CFRunLoopRef)runLoop
+{
+    self = [super init];
+    if (self) {
+        _client = client;
+        _protocol = protocol;
+        _runLoop = (CFRunLoopRef)CFRetain(runLoop);
+        _invalidated = NO;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    CFRelease(_runLoop);
+}
+
+- (void)invalidate
+{
+    _invalidated = YES;
+}
+
+- (void)_forward:(void (^)(id<NSURLProtocolClient> client, NSURLProtocol *protocol))message
+{
+    CFRunLoopPerformBlock(_runLoop, kCFRunLoopDefaultMode, ^{
+        // Checked on the client's run loop, where invalidate is called
+        NSURLProtocol *protocol = _protocol;
+        if (!_invalidated && protocol) {
+            message(_client, protocol);
+        }
+    });
+    CFRunLoopWakeUp(_runLoop);
+}
+
+#pragma mark NSURLProtocolClient
+
+- (void)URLProtocol:(NSURLProtocol *)protocol wasRedirectedToRequest:(NSURLRequest *)request redirectResponse:(NSURLResponse *)redirectResponse
+{
+    [self _forward:^(id<NSURLProtocolClient> client, NSURLProtocol *clientProtocol) {
+        [client URLProtocol:clientProtocol wasRedirectedToRequest:request redirectResponse:redirectResponse];
+    }];
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol cachedResponseIsValid:(NSCachedURLResponse *)cachedResponse
+{
+    [self _forward:^(id<NSURLProtocolClient> client, NSURLProtocol *clientProtocol) {
+        [client URLProtocol:clientProtocol cachedResponseIsValid:cachedResponse];
+    }];
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didReceiveResponse:(NSURLResponse *)response cacheStoragePolicy:(NSURLCacheStoragePolicy)policy
+{
+    [self _forward:^(id<NSURLProtocolClient> client, NSURLProtocol *clientProtocol) {
+        [client URLProtocol:clientProtocol didReceiveResponse:response cacheStoragePolicy:policy];
+    }];
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didLoadData:(NSData *)data
+{
+    [self _forward:^(id<NSURLProtocolClient> client, NSURLProtocol *clientProtocol) {
+        [client URLProtocol:clientProtocol didLoadData:data];
+    }];
+}
+
+- (void)URLProtocolDidFinishLoading:(NSURLProtocol *)protocol
+{
+    [self _forward:^(id<NSURLProtocolClient> client, NSURLProtocol *clientProtocol) {
+        [client URLProtocolDidFinishLoading:clientProtocol];
+    }];
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didFailWithError:(NSError *)error
+{
+    [self _forward:^(id<NSURLProtocolClient> client, NSURLProtocol *clientProtocol) {
+        [client URLProtocol:clientProtocol didFailWithError:error];
+    }];
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didReceiveAuthenticationChallenge:(NSURLAuthenticationChallenge *)challenge
+{
+    [self _forward:^(id<NSURLProtocolClient> client, NSURLProtocol *clientProtocol) {
+        [client URLProtocol:clientProtocol didReceiveAuthenticationChallenge:challenge];
+    }];
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didCancelAuthenticationChallenge:(NSURLAuthenticationChallenge *)challenge
+{
+    [self _forward:^(id<NSURLProtocolClient> client, NSURLProtocol *clientProtocol) {
+        [client URLProtocol:clientProtocol didCancelAuthenticationChallenge:challenge];
+    }];
+}
+
+@end
@@ -8,9 +8,13 @@
 
 #import "SPDYProtocol.h"
 
+@class SPDYOrigin;
+
 @interface SPDYProtocol (Project)
 
 @property (nonatomic, readonly) NSURLSession *associatedSession;
 @property (nonatomic, readonly, weak) NSURLSessionTask *associatedSessionTask;
 
++ (SPDYOrigin *)originForAlias:(SPDYOrigin *)alias;
+
 @end
@@ -31,6 +31,13 @@ typedef enum {
     SPDYProxyStatusConfigWithAuth   // info provided in SPDYConfiguration, proxy needs auth
 } SPDYProxyStatus;
 
+typedef enum {
+    SPDYSessionSelectionRoundRobin = 0,     // rotate through sessions with available capacity
+    SPDYSessionSelectionLeastLoaded,        // fewest in-flight streams
+    SPDYSessionSelectionLowestLatency,      // lowest smoothed PING round-trip time
+    SPDYSessionSelectionMostSendWindow      // most session send window remaining
+} SPDYSessionSelectionPolicy;
+
 @interface SPDYMetadata : NSObject
 
 // SPDY stream time spent blocked - while queued waiting for connection, flow control, etc.
@@ -39,9 +46,18 @@ typedef enum {
 // Boolean indicating whether session is over cellular or WIFI
 @property (nonatomic, readonly) BOOL cellular;
 
+// Indicates the response was shared with an identical request already in flight
+@property (nonatomic, readonly) BOOL coalesced;
+
 // SPDY stream creation time relative to session connection time.
 @property (nonatomic, readonly) NSUInteger connectedMs;
 
+// Indicates a duplicate of the request was sent on a second session after SPDYHedgeAfter
+@property (nonatomic, readonly) BOOL hedged;
+
+// Indicates the response was taken from the duplicate sent for a hedged request
+@property (nonatomic, readonly) BOOL hedgeWon;
+
 // IP address of remote side
 @property (nonatomic, copy, readonly) NSString *hostAddress;
 
@@ -54,6 +70,12 @@ typedef enum {
 // Indicates state of proxy configuration
 @property (nonatomic, readonly) SPDYProxyStatus proxyStatus;
 
+// Indicates the response was pushed by the server and served from the push cache
+@property (nonatomic, readonly) BOOL pushed;
+
+// SPDY stream time spent queued waiting for the global session and stream budget
+@property (nonatomic, readonly) NSUInteger queuedMs;
+
 // SPDY stream bytes received. Includes all SPDY headers and bodies.
 @property (nonatomic, readonly) NSUInteger rxBytes;
 
@@ -172,6 +194,14 @@ typedef enum {
 */
 + (bool)evaluateServerTrust:(SecTrustRef)trust forHost:(NSString *)host;
 
+/**
+  Internal hook for evaluating whether a session's server trust also covers
+  another host. Unlike evaluateServerTrust:forHost:, this fails when no
+  evaluator is registered and the system doesn't trust the certificate for
+  the host, since nothing else has checked it for that host.
+*/
++ (bool)evaluateServerTrust:(SecTrustRef)trust forCoalescedHost:(NSString *)host;
+
 /*
   Retrieve the SPDY metadata from the response returned in connection:didReceiveResponse.
   Should be called during the connectionDidFinishLoading callback only, and use at any other
@@ -205,6 +235,26 @@ typedef enum {
 */
 + (void)unregisterAllAliases;
 
+/**
+  Open sessions to an origin ahead of the first request for it, so that the
+  request doesn't wait on DNS, proxy resolution, TCP and TLS.
+
+  Sessions are warmed on the calling thread's run loop, the same way sessions
+  are opened for requests loaded on that thread, or on the shared network
+  thread if enableSharedNetworkThread is set. A session is ready once it
+  has connected, sent SETTINGS, and had its initial PING answered. Warmed
+  sessions that go unused are closed after preconnectIdleTimeout.
+
+  @param originString The scheme-host-port tuple for the endpoint, in URL
+  format, e.g. @"https://twitter.com:443"
+  @param sessions Number of sessions to warm, up to sessionPoolSize
+  @param completion Called on the calling thread with the number of ready
+  sessions, and an error if none became ready. May be nil.
+*/
++ (void)preconnectToOrigin:(NSString *)originString
+                  sessions:(NSUInteger)sessions
+                completion:(void (^)(NSUInteger readySessions, NSError *error))completion;
+
 @end
 
 /**
@@ -270,6 +320,53 @@ typedef enum {
 */
 @property NSUInteger sessionPoolSize;
 
+/**
+  How a stream without a request body picks a session from the pool.
+
+  Default is SPDYSessionSelectionLeastLoaded. Only sessions that are
+  connected, healthy and below their concurrent stream limit are
+  considered. Ties are broken by load, then round-trip time, then in turn.
+  This only matters when sessionPoolSize is greater than 1.
+*/
+@property SPDYSessionSelectionPolicy sessionSelectionPolicy;
+
+/**
+  How a stream with a request body picks a session from the pool.
+
+  Default is SPDYSessionSelectionMostSendWindow, so uploads go to the
+  session with the most flow-control credit left to send with.
+*/
+@property SPDYSessionSelectionPolicy uploadSessionSelectionPolicy;
+
+/**
+  The most sessions open at once across all origins, or 0 for no limit.
+
+  Default is 0. Once the limit is reached, an origin without a session
+  of its own keeps its requests queued until another origin's session
+  closes. Origins waiting on the budget take turns in proportion to
+  their originWeights.
+*/
+@property NSUInteger maxSessions;
+
+/**
+  The most streams in flight at once across all origins, or 0 for no
+  limit.
+
+  Default is 0. Requests beyond the limit stay queued with their origin
+  until streams close, and are then let through across the waiting
+  origins in proportion to their originWeights.
+*/
+@property NSUInteger maxConcurrentStreams;
+
+/**
+  Relative shares of the session and stream budget, keyed by origin,
+  e.g. @{ @"https://api.twitter.com" : @4 }.
+
+  Default is empty. Origins that aren't listed have a weight of 1. This
+  only matters once maxSessions or maxConcurrentStreams is reached.
+*/
+@property NSDictionary *originWeights;
+
 /**
   Initial session window size for client flow control.
 
@@ -285,6 +382,98 @@ typedef enum {
 */
 @property NSUInteger streamReceiveWindow;
 
+/**
+  Interval between keepalive PINGs on each session.
+
+  Default is 0, which disables keepalive PINGs. When set, PINGs are sent for
+  the life of the session, whether or not it has active streams. Responses
+  keep the session's round-trip time estimate, and so SPDYMetadata.latencyMs,
+  current.
+*/
+@property NSTimeInterval keepalivePingInterval;
+
+/**
+  Number of consecutive unanswered keepalive PINGs after which a session is
+  considered unhealthy.
+
+  Default is 2. An unhealthy session receives no new requests; new requests go
+  to a fresh session instead. It closes once its in-flight streams finish.
+*/
+@property NSUInteger keepaliveMaxMissedPings;
+
+/**
+  Time a session opened by preconnectToOrigin:sessions:completion: is kept
+  open without being given a request.
+
+  Default is 60.0s. A warmed session that hasn't carried a single stream by
+  then is closed.
+*/
+@property NSTimeInterval preconnectIdleTimeout;
+
+/**
+  Run every session on a single thread owned by the library.
+
+  Default is NO, in which case sessions belong to the thread that loads the
+  request, and each URL loading thread opens its own connections to an
+  origin. If YES, requests from all threads share one pool of sessions per
+  origin, and client callbacks are delivered back on the run loop each
+  request was started on.
+*/
+@property BOOL enableSharedNetworkThread;
+
+/**
+  Open streams on sessions that are still connecting.
+
+  Default is NO, in which case requests wait for the TCP and TLS handshakes
+  to complete before their SYN_STREAM is sent. If YES, the SYN_STREAM is
+  compressed and queued right away and leaves with the end of the handshake.
+  If the connection fails, the requests are retried on a new session.
+*/
+@property BOOL enableOptimisticDispatch;
+
+/**
+  Move to new sessions as soon as the network interface changes.
+
+  Default is NO, in which case sessions on the previous interface are used
+  until they fail. If YES, a change between WIFI and WWAN connects new
+  sessions on the new interface, which take all new requests, and the old
+  sessions are sent GOAWAY and closed once their streams finish. This only
+  applies on iOS.
+*/
+@property BOOL enableSessionMigration;
+
+/**
+  Time a request in flight on a session being migrated away from may wait
+  for its response to start before it's sent again on the new interface.
+
+  Default is 2.0s. Only requests that are safe to repeat are retried.
+*/
+@property NSTimeInterval sessionMigrationStallTimeout;
+
+/**
+  Send requests for an origin on another origin's session when both are
+  served from the same place.
+
+  Default is NO. If YES, an origin with no sessions of its own looks for an
+  open TLS session to another origin on the same scheme and port, with a
+  peer address its hostname resolves to, and whose certificate is also
+  valid for its hostname. If it finds one, requests use that session instead
+  of a new connection. Certificates are checked with the TLS trust evaluator
+  when one is set, and with the system's trust evaluation otherwise. Sessions
+  through a proxy are never shared.
+*/
+@property BOOL enableSessionCoalescing;
+
+/**
+  Size receive windows from the measured bandwidth-delay product.
+
+  Default is NO. If YES, session and stream windows start at the 64KB protocol
+  default and grow as round trips show the window limiting throughput, with
+  sessionReceiveWindow and streamReceiveWindow as ceilings. Grown windows are
+  shrunk back when sustained throughput no longer needs them.
+*/
+@property BOOL enableReceiveWindowAutoTuning;
+
 /**
   ZLib compression level to use for headers.
 
@@ -293,6 +482,23 @@ typedef enum {
 */
 @property NSUInteger headerCompressionLevel;
 
+/**
+  Maximum decompressed size of a single received header block.
+
+  Default is 128KB. Header buffers start small and grow on demand up to
+  this limit; a larger header block is treated as a protocol error.
+*/
+@property NSUInteger maxHeaderBlockLength;
+
+/**
+  Maximum number of request body bytes a stream may send before yielding to
+  the next stream of the same priority.
+
+  Default is 16KB. Streams of higher priority are always served first; this
+  only determines how uploads of equal priority are interleaved.
+*/
+@property NSUInteger sendQuantum;
+
 /**
   Enable or disable sending minor protocol version with settings id 0.
 
@@ -347,6 +553,41 @@ typedef enum {
 */
 @property NSInteger proxyPort;
 
+/**
+  Accept resources pushed by the server.
+
+  Default is NO. If YES, pushed responses are held in a bounded in-memory
+  cache and used to satisfy matching GET requests without a round trip.
+*/
+@property BOOL enableServerPush;
+
+/**
+  Maximum number of response body bytes held for pushed resources, per origin.
+
+  Default is 4MB. The oldest pushed responses are discarded first to make
+  room, and a single response larger than this is not cached.
+*/
+@property NSUInteger pushCacheMaxBytes;
+
+/**
+  Time a pushed response is kept waiting for a matching request.
+
+  Default is 60.0s, measured from when the server started the push.
+*/
+@property NSTimeInterval pushCacheMaxAge;
+
+/**
+  Share one stream between identical GET requests that are in flight at the
+  same time.
+
+  Default is NO. If YES, a GET with the same URL and request headers as one
+  still waiting on its response is not sent again; both receive the single
+  response. Canceling one of them doesn't affect the others. Responses
+  shared this way have SPDYMetadata.coalesced set, which can be used to
+  measure the hit rate.
+*/
+@property BOOL enableRequestCoalescing;
+
 /**
   Set whether a session is moved to the correct pool or not.
  
@@ -18,7 +18,10 @@
 #import "NSURLRequest+SPDYURLRequest.h"
 #import "SPDYCanonicalRequest.h"
 #import "SPDYCommonLogger.h"
+#import "SPDYConnectionBudget.h"
+#import "SPDYFrameDecoder.h"
 #import "SPDYMetadata+Utils.h"
+#import "SPDYNetworkThread.h"
 #import "SPDYOrigin.h"
 #import "SPDYProtocol+Project.h"
 #import "SPDYSession.h"
@@ -140,6 +143,7 @@ static dispatch_once_t initConfig;
 {
     SPDYStream *_stream;
     SPDYProtocolContext *_context;
+    SPDYRunLoopProtocolClient *_runLoopClient;
     NSURLSession *_associatedSession;
     NSURLSessionTask *_associatedSessionTask;
     struct {
@@ -179,6 +183,7 @@ static id<SPDYTLSTrustEvaluator> trustEvaluator;
     dispatch_barrier_async(configQueue, ^{
         currentConfiguration = [configuration copy];
     });
+    [[SPDYConnectionBudget sharedBudget] setConfiguration:configuration];
 }
 
 + (void)setLogger:(id<SPDYLogger>)logger
@@ -224,6 +229,26 @@ static id<SPDYTLSTrustEvaluator> trustEvaluator;
     return [evaluator evaluateServerTrust:trust forHost:host];
 }
 
++ (bool)evaluateServerTrust:(SecTrustRef)trust forCoalescedHost:(NSString *)host
+{
+    __block id<SPDYTLSTrustEvaluator> evaluator;
+    __block NSString *namedHost;
+
+    dispatch_sync(configQueue, ^{
+        evaluator = trustEvaluator;
+        namedHost = certificates[host];
+    });
+
+    if (namedHost != nil) host = namedHost;
+    if (evaluator != nil) {
+        return [evaluator evaluateServerTrust:trust forHost:host];
+    }
+
+    SecTrustResultType result;
+    OSStatus status = SecTrustEvaluate(trust, &result);
+    return status == errSecSuccess && (result == kSecTrustResultProceed || result == kSecTrustResultUnspecified);
+}
+
 + (SPDYMetadata *)metadataForResponse:(NSURLResponse *)response
 {
     NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse *)response;
@@ -303,6 +328,46 @@ static id<SPDYTLSTrustEvaluator> trustEvaluator;
     });
 }
 
++ (void)preconnectToOrigin:(NSString *)originString
+                  sessions:(NSUInteger)sessions
+                completion:(void (^)(NSUInteger readySessions, NSError *error))completion
+{
+    NSError *error;
+    SPDYOrigin *origin = [[SPDYOrigin alloc] initWithString:originString error:&error];
+    if (!origin) {
+        SPDY_ERROR(@"invalid origin: %@", originString);
+        if (completion) completion(0, error);
+        return;
+    }
+
+    SPDYOrigin *aliasedOrigin = [SPDYProtocol originForAlias:origin];
+    if (aliasedOrigin) {
+        origin = aliasedOrigin;
+    }
+
+    SPDY_INFO(@"preconnect %lu sessions to %@", (unsigned long)sessions, origin);
+    if (![SPDYProtocol currentConfiguration].enableSharedNetworkThread) {
+        SPDYSessionManager *manager = [SPDYSessionManager localManagerForOrigin:origin];
+        [manager preconnectSessions:sessions completion:completion];
+        return;
+    }
+
+    CFRunLoopRef callerRunLoop = CFRunLoopGetCurrent();
+    CFRetain(callerRunLoop);
+    [[SPDYNetworkThread sharedThread] performBlock:^{
+        SPDYSessionManager *manager = [SPDYSessionManager localManagerForOrigin:origin];
+        [manager preconnectSessions:sessions completion:^(NSUInteger readySessions, NSError *error) {
+            if (completion) {
+                CFRunLoopPerformBlock(callerRunLoop, kCFRunLoopDefaultMode, ^{
+                    completion(readySessions, error);
+                });
+                CFRunLoopWakeUp(callerRunLoop);
+            }
+            CFRelease(callerRunLoop);
+        }];
+    }];
+}
+
 + (SPDYOrigin *)originForAlias:(SPDYOrigin *)alias
 {
     __block SPDYOrigin *origin;
@@ -389,10 +454,30 @@ static id<SPDYTLSTrustEvaluator> trustEvaluator;
     if (request.SPDYURLSession) {
         [self detectSessionAndTaskThenContinueWithOrigin:origin];
     } else {
-        // Start the stream
+        [self _queueStreamWithOrigin:origin];
+    }
+}
+
+- (void)_queueStreamWithOrigin:(SPDYOrigin *)origin
+{
+    if (![SPDYProtocol currentConfiguration].enableSharedNetworkThread) {
         SPDYSessionManager *manager = [SPDYSessionManager localManagerForOrigin:origin];
         [manager queueStream:_stream];
+        return;
     }
+
+    // The stream runs on the network thread from here on, and reaches the client through
+    // this thread's run loop
+    _runLoopClient = [[SPDYRunLoopProtocolClient alloc] initWithClient:self.client
+                                                              protocol:self
+                                                               runLoop:CFRunLoopGetCurrent()];
+    _stream.client = _runLoopClient;
+
+    SPDYStream *stream = _stream;
+    [[SPDYNetworkThread sharedThread] performBlock:^{
+        SPDYSessionManager *manager = [SPDYSessionManager localManagerForOrigin:origin];
+        [manager queueStream:stream];
+    }];
 }
 
 - (void)detectSessionAndTaskThenContinueWithOrigin:(SPDYOrigin *)origin
@@ -436,8 +521,7 @@ static id<SPDYTLSTrustEvaluator> trustEvaluator;
                 }
 
                 // Start the stream
-                SPDYSessionManager *manager = [SPDYSessionManager localManagerForOrigin:origin];
-                [manager queueStream:_stream];
+                [self _queueStreamWithOrigin:origin];
             }
         };
 
@@ -451,7 +535,15 @@ static id<SPDYTLSTrustEvaluator> trustEvaluator;
 {
     SPDY_INFO(@"stop loading %@", self.request.URL.absoluteString);
 
-    if (_stream && !_stream.closed) {
+    if (_runLoopClient) {
+        [_runLoopClient invalidate];
+        SPDYStream *stream = _stream;
+        [[SPDYNetworkThread sharedThread] performBlock:^{
+            if (!stream.closed) {
+                [stream cancel];
+            }
+        }];
+    } else if (_stream && !_stream.closed) {
         [_stream cancel];
     }
     _flags.didStopLoading = 1;
@@ -593,7 +685,14 @@ static SPDYConfiguration *defaultConfiguration;
 {
     defaultConfiguration = [[SPDYConfiguration alloc] init];
     defaultConfiguration.headerCompressionLevel = 9;
+    defaultConfiguration.maxHeaderBlockLength = DEFAULT_MAX_HEADER_BLOCK_LENGTH;
+    defaultConfiguration.sendQuantum = 16384;
     defaultConfiguration.sessionPoolSize = 1;
+    defaultConfiguration.sessionSelectionPolicy = SPDYSessionSelectionLeastLoaded;
+    defaultConfiguration.uploadSessionSelectionPolicy = SPDYSessionSelectionMostSendWindow;
+    defaultConfiguration.maxSessions = 0;
+    defaultConfiguration.maxConcurrentStreams = 0;
+    defaultConfiguration.originWeights = @{};
     defaultConfiguration.sessionReceiveWindow = 10485760;
     defaultConfiguration.streamReceiveWindow = 10485760;
     defaultConfiguration.enableSettingsMinorVersion = NO;
@@ -604,6 +703,19 @@ static SPDYConfiguration *defaultConfiguration;
     defaultConfiguration.proxyHost = nil;
     defaultConfiguration.proxyPort = 0;
     defaultConfiguration.enforceSessionPoolCorrectness = NO;
+    defaultConfiguration.enableServerPush = NO;
+    defaultConfiguration.pushCacheMaxBytes = 4194304;
+    defaultConfiguration.pushCacheMaxAge = 60.0;
+    defaultConfiguration.enableRequestCoalescing = NO;
+    defaultConfiguration.enableReceiveWindowAutoTuning = NO;
+    defaultConfiguration.keepalivePingInterval = 0;
+    defaultConfiguration.keepaliveMaxMissedPings = 2;
+    defaultConfiguration.preconnectIdleTimeout = 60.0;
+    defaultConfiguration.enableSharedNetworkThread = NO;
+    defaultConfiguration.enableOptimisticDispatch = NO;
+    defaultConfiguration.enableSessionMigration = NO;
+    defaultConfiguration.sessionMigrationStallTimeout = 2.0;
+    defaultConfiguration.enableSessionCoalescing = NO;
 }
 
 + (SPDYConfiguration *)defaultConfiguration
@@ -615,7 +727,14 @@ static SPDYConfiguration *defaultConfiguration;
 {
     SPDYConfiguration *copy = [[SPDYConfiguration allocWithZone:zone] init];
     copy.headerCompressionLevel = _headerCompressionLevel;
+    copy.maxHeaderBlockLength = _maxHeaderBlockLength;
+    copy.sendQuantum = _sendQuantum;
     copy.sessionPoolSize = _sessionPoolSize;
+    copy.sessionSelectionPolicy = _sessionSelectionPolicy;
+    copy.uploadSessionSelectionPolicy = _uploadSessionSelectionPolicy;
+    copy.maxSessions = _maxSessions;
+    copy.maxConcurrentStreams = _maxConcurrentStreams;
+    copy.originWeights = _originWeights;
     copy.sessionReceiveWindow = _sessionReceiveWindow;
     copy.streamReceiveWindow = _streamReceiveWindow;
     copy.enableSettingsMinorVersion = _enableSettingsMinorVersion;
@@ -626,6 +745,19 @@ static SPDYConfiguration *defaultConfiguration;
     copy.proxyHost = _proxyHost;
     copy.proxyPort = _proxyPort;
     copy.enforceSessionPoolCorrectness = _enforceSessionPoolCorrectness;
+    copy.enableServerPush = _enableServerPush;
+    copy.pushCacheMaxBytes = _pushCacheMaxBytes;
+    copy.pushCacheMaxAge = _pushCacheMaxAge;
+    copy.enableRequestCoalescing = _enableRequestCoalescing;
+    copy.enableReceiveWindowAutoTuning = _enableReceiveWindowAutoTuning;
+    copy.keepalivePingInterval = _keepalivePingInterval;
+    copy.keepaliveMaxMissedPings = _keepaliveMaxMissedPings;
+    copy.preconnectIdleTimeout = _preconnectIdleTimeout;
+    copy.enableSharedNetworkThread = _enableSharedNetworkThread;
+    copy.enableOptimisticDispatch = _enableOptimisticDispatch;
+    copy.enableSessionMigration = _enableSessionMigration;
+    copy.sessionMigrationStallTimeout = _sessionMigrationStallTimeout;
+    copy.enableSessionCoalescing = _enableSessionCoalescing;
     return copy;
 }
 
@@ -0,0 +1,67 @@
+//
+//  SPDYPushCache.h
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#import <Foundation/Foundation.h>
+
+@class SPDYPushCache;
+@class SPDYStream;
+
+@protocol SPDYPushCacheDelegate <NSObject>
+
+/**
+  Called when a stream that was waiting on an in-progress push can no longer
+  be served by it, because the push failed or was evicted. The stream should
+  be loaded over the network instead.
+*/
+- (void)pushCache:(SPDYPushCache *)pushCache failedToServeStream:(SPDYStream *)stream;
+
+@end
+
+/**
+  Bounded, in-memory cache of server-pushed responses, keyed by the canonical
+  URL of the pushed resource.
+
+  Like the session manager that owns it, a push cache is confined to a single
+  thread. A pushed response is served at most once, and is discarded if it
+  hasn't been requested by the time it expires.
+*/
+@interface SPDYPushCache : NSObject
+
+@property (nonatomic, weak) id<SPDYPushCacheDelegate> delegate;
+
+/**
+  @return number of pushed responses, complete or in progress
+*/
+@property (nonatomic, readonly) NSUInteger count;
+
+/**
+  @return number of response body bytes currently held
+*/
+@property (nonatomic, readonly) NSUInteger bytesCached;
+
+- (id)initWithMaxBytes:(NSUInteger)maxBytes maxAge:(NSTimeInterval)maxAge;
+
+/**
+  Starts caching the response to a pushed stream. The stream's request must be
+  the canonical request for the pushed resource. Returns NO if a response for
+  the same resource is already cached or in progress, in which case the push
+  should be declined.
+*/
+- (bool)addPushedStream:(SPDYStream *)stream;
+
+/**
+  Serves a local stream from a matching pushed response. If the push is still
+  in progress, the stream waits for it to complete. Returns NO if there is no
+  match and the stream should be loaded over the network.
+*/
+- (bool)serveStream:(SPDYStream *)stream;
+
+@end
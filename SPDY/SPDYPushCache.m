@@ -0,0 +1,326 @@
+//
+//  SPDYPushCache.m
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#if !defined(__has_feature) || !__has_feature(objc_arc)
+#error "This file requires ARC support."
+#endif
+
+#import "SPDYCommonLogger.h"
+#import "SPDYMetadata+Utils.h"
+#import "SPDYPushCache.h"
+#import "SPDYStopwatch.h"
+#import "SPDYStream.h"
+
+@class SPDYPushCacheEntry;
+
+@interface SPDYPushCache () <SPDYStreamDelegate>
+- (bool)_entry:(SPDYPushCacheEntry *)entry didLoadLength:(NSUInteger)length;
+- (void)_entryDidFinish:(SPDYPushCacheEntry *)entry;
+- (void)_entryDidFail:(SPDYPushCacheEntry *)entry;
+- (void)_removeEntry:(SPDYPushCacheEntry *)entry;
+- (void)_removeExpiredEntries;
+- (void)_serveStream:(SPDYStream *)stream fromEntry:(SPDYPushCacheEntry *)entry;
+@end
+
+/**
+  Records the response to a pushed stream. The pushed SPDYStream treats the
+  entry as its URL loading client, so its response goes through exactly the
+  same processing (decompression, metadata) as any other.
+*/
+@interface SPDYPushCacheEntry : NSObject <NSURLProtocolClient>
+@property (nonatomic, readonly) NSString *key;
+@property (nonatomic, readonly) SPDYMetadata *metadata;
+@property (nonatomic, readonly) NSURLResponse *response;
+@property (nonatomic, readonly) NSMutableData *data;
+@property (nonatomic, readonly) NSMutableArray *waitingStreams;
+@property (nonatomic, readonly) CFAbsoluteTime expiry;
+@property (nonatomic, readonly) bool complete;
+@property (nonatomic) bool removed;
+@property (nonatomic, weak) SPDYStream *pushedStream;
+- (id)initWithStream:(SPDYStream *)stream key:(NSString *)key expiry:(CFAbsoluteTime)expiry cache:(SPDYPushCache *)cache;
+@end
+
+@implementation SPDYPushCacheEntry
+{
+    __weak SPDYPushCache *_cache;
+}
+
+- (id)initWithStream:(SPDYStream *)stream key:(NSString *)key expiry:(CFAbsoluteTime)expiry cache:(SPDYPushCache *)cache
+{
+    self = [super init];
+    if (self) {
+        _key = key;
+        _metadata = stream.metadata;
+        _data = [[NSMutableData alloc] init];
+        _waitingStreams = [[NSMutableArray alloc] init];
+        _expiry = expiry;
+        _pushedStream = stream;
+        _cache = cache;
+    }
+    return self;
+}
+
+#pragma mark NSURLProtocolClient
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didReceiveResponse:(NSURLResponse *)response cacheStoragePolicy:(NSURLCacheStoragePolicy)policy
+{
+    _response = response;
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didLoadData:(NSData *)data
+{
+    if (_removed) return;
+
+    [_data appendData:data];
+    if (![_cache _entry:self didLoadLength:data.length]) {
+        SPDY_WARNING(@"pushed response for %@ exceeds push cache limit", _key);
+        [_cache _entryDidFail:self];
+    }
+}
+
+- (void)URLProtocolDidFinishLoading:(NSURLProtocol *)protocol
+{
+    if (_removed) return;
+
+    if (_response) {
+        _complete = YES;
+        [_cache _entryDidFinish:self];
+    } else {
+        [_cache _entryDidFail:self];
+    }
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didFailWithError:(NSError *)error
+{
+    if (_removed) return;
+
+    SPDY_DEBUG(@"pushed response for %@ failed: %@", _key, error);
+    [_cache _entryDidFail:self];
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol wasRedirectedToRequest:(NSURLRequest *)request redirectResponse:(NSURLResponse *)redirectResponse
+{
+    // Redirects are left to the network, which will follow them on the app's behalf
+    if (_removed) return;
+
+    [_cache _entryDidFail:self];
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol cachedResponseIsValid:(NSCachedURLResponse *)cachedResponse
+{
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didReceiveAuthenticationChallenge:(NSURLAuthenticationChallenge *)challenge
+{
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didCancelAuthenticationChallenge:(NSURLAuthenticationChallenge *)challenge
+{
+}
+
+@end
+
+@implementation SPDYPushCache
+{
+    NSMutableDictionary *_entries;
+    NSMutableArray *_entryOrder;  // oldest first
+    NSUInteger _maxBytes;
+    NSTimeInterval _maxAge;
+}
+
+- (id)initWithMaxBytes:(NSUInteger)maxBytes maxAge:(NSTimeInterval)maxAge
+{
+    self = [super init];
+    if (self) {
+        _entries = [[NSMutableDictionary alloc] init];
+        _entryOrder = [[NSMutableArray alloc] init];
+        _maxBytes = maxBytes;
+        _maxAge = maxAge;
+        _bytesCached = 0;
+    }
+    return self;
+}
+
+- (NSUInteger)count
+{
+    return _entries.count;
+}
+
+- (bool)addPushedStream:(SPDYStream *)stream
+{
+    NSString *key = stream.request.URL.absoluteString;
+    if (key == nil || _maxBytes == 0) {
+        return NO;
+    }
+
+    [self _removeExpiredEntries];
+    if (_entries[key]) {
+        return NO;
+    }
+
+    CFAbsoluteTime expiry = CFAbsoluteTimeGetCurrent() + _maxAge;
+    SPDYPushCacheEntry *entry = [[SPDYPushCacheEntry alloc] initWithStream:stream key:key expiry:expiry cache:self];
+    _entries[key] = entry;
+    [_entryOrder addObject:entry];
+
+    stream.client = entry;
+    stream.metadata.pushed = YES;
+
+    SPDY_DEBUG(@"caching pushed response for %@", key);
+    return YES;
+}
+
+- (bool)serveStream:(SPDYStream *)stream
+{
+    NSURLRequest *request = stream.request;
+    if (![request.HTTPMethod isEqualToString:@"GET"] || request.HTTPBody || request.HTTPBodyStream) {
+        return NO;
+    }
+
+    [self _removeExpiredEntries];
+
+    SPDYPushCacheEntry *entry = _entries[request.URL.absoluteString];
+    if (!entry) {
+        return NO;
+    }
+
+    if (entry.complete) {
+        [self _removeEntry:entry];
+        [self _serveStream:stream fromEntry:entry];
+    } else {
+        SPDY_DEBUG(@"waiting on pushed response for %@", entry.key);
+        [entry.waitingStreams addObject:stream];
+        stream.delegate = self;
+    }
+
+    return YES;
+}
+
+#pragma mark SPDYStreamDelegate
+
+- (void)streamCanceled:(SPDYStream *)stream
+{
+    stream.delegate = nil;
+    for (SPDYPushCacheEntry *entry in _entryOrder) {
+        [entry.waitingStreams removeObjectIdenticalTo:stream];
+    }
+}
+
+#pragma mark private methods
+
+- (bool)_entry:(SPDYPushCacheEntry *)entry didLoadLength:(NSUInteger)length
+{
+    _bytesCached += length;
+
+    if (entry.data.length > _maxBytes) {
+        return NO;
+    }
+
+    // Make room by evicting the oldest responses, complete or not
+    for (SPDYPushCacheEntry *oldEntry in [_entryOrder copy]) {
+        if (_bytesCached <= _maxBytes) {
+            break;
+        }
+        if (oldEntry != entry) {
+            SPDY_DEBUG(@"evicting pushed response for %@", oldEntry.key);
+            [self _entryDidFail:oldEntry];
+        }
+    }
+
+    return YES;
+}
+
+- (void)_entryDidFinish:(SPDYPushCacheEntry *)entry
+{
+    if (entry.waitingStreams.count == 0) {
+        return;
+    }
+
+    [self _removeEntry:entry];
+    for (SPDYStream *stream in [entry.waitingStreams copy]) {
+        [self _serveStream:stream fromEntry:entry];
+    }
+    [entry.waitingStreams removeAllObjects];
+}
+
+- (void)_entryDidFail:(SPDYPushCacheEntry *)entry
+{
+    [self _removeEntry:entry];
+
+    // Give up on the push and send anyone waiting on it to the network
+    SPDYStream *pushedStream = entry.pushedStream;
+    if (!entry.complete && pushedStream && !pushedStream.closed) {
+        [pushedStream cancel];
+    }
+
+    NSArray *waitingStreams = [entry.waitingStreams copy];
+    [entry.waitingStreams removeAllObjects];
+    for (SPDYStream *stream in waitingStreams) {
+        stream.delegate = nil;
+        [_delegate pushCache:self failedToServeStream:stream];
+    }
+}
+
+- (void)_removeEntry:(SPDYPushCacheEntry *)entry
+{
+    if (entry.removed) {
+        return;
+    }
+
+    entry.removed = YES;
+    [_entries removeObjectForKey:entry.key];
+    [_entryOrder removeObjectIdenticalTo:entry];
+    _bytesCached -= entry.data.length;
+}
+
+- (void)_removeExpiredEntries
+{
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    while (_entryOrder.count > 0) {
+        SPDYPushCacheEntry *oldestEntry = _entryOrder[0];
+        if (oldestEntry.expiry > now) {
+            break;
+        }
+        SPDY_DEBUG(@"pushed response for %@ expired", oldestEntry.key);
+        [self _entryDidFail:oldestEntry];
+    }
+}
+
+- (void)_serveStream:(SPDYStream *)stream fromEntry:(SPDYPushCacheEntry *)entry
+{
+    SPDY_DEBUG(@"serving %@ from pushed response", entry.key);
+
+    stream.delegate = nil;
+
+    SPDYMetadata *metadata = stream.metadata;
+    [metadata setNetworkMetricsFromMetadata:entry.metadata];
+    metadata.pushed = YES;
+    metadata.timeStreamClosed = [SPDYStopwatch currentSystemTime];
+
+    // The response must carry the request's metadata, not the pushed stream's
+    NSHTTPURLResponse *pushedResponse = (NSHTTPURLResponse *)entry.response;
+    NSMutableDictionary *headers = [pushedResponse.allHeaderFields mutableCopy];
+    [SPDYMetadata setMetadata:metadata forAssociatedDictionary:headers];
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:pushedResponse.URL
+                                                              statusCode:pushedResponse.statusCode
+                                                             HTTPVersion:@"HTTP/1.1"
+                                                            headerFields:headers];
+
+    id<NSURLProtocolClient> client = stream.client;
+    SPDYProtocol *protocol = stream.protocol;
+    [client URLProtocol:protocol didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageAllowed];
+    if (entry.data.length > 0) {
+        [client URLProtocol:protocol didLoadData:entry.data];
+    }
+    [client URLProtocolDidFinishLoading:protocol];
+}
+
+@end
@@ -0,0 +1,53 @@
+//
+//  SPDYReceiveWindowTuner.h
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#import <Foundation/Foundation.h>
+#import "SPDYDefinitions.h"
+
+/**
+  Sizes a receive window from the measured bandwidth-delay product.
+
+  A sample counts the bytes received during one round trip, timed by a PING.
+  If a sample fills most of the current window, the window was the bottleneck
+  and is grown to twice the sample. If samples stay well below the window, the
+  sender or the consumer has slowed, and the window is shrunk back towards its
+  minimum. Only one sample is taken at a time.
+*/
+@interface SPDYReceiveWindowTuner : NSObject
+
+/**
+  @return the window size that should currently be granted to the peer
+*/
+@property (nonatomic, readonly) uint32_t windowSize;
+
+/**
+  @return most recent bytes-per-second estimate, or 0 before the first sample
+*/
+@property (nonatomic, readonly) double bandwidth;
+
+/**
+  @return YES while a sample is in progress
+*/
+@property (nonatomic, readonly) bool sampling;
+
+- (id)initWithWindowSize:(uint32_t)windowSize
+           minWindowSize:(uint32_t)minWindowSize
+           maxWindowSize:(uint32_t)maxWindowSize;
+
+- (void)startSample;
+- (void)didReceiveBytes:(NSUInteger)length;
+
+/**
+  Ends the current sample. Returns YES if windowSize changed.
+*/
+- (bool)finishSampleWithRoundTripTime:(SPDYTimeInterval)roundTripTime;
+
+@end
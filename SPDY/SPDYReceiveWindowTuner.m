@@ -0,0 +1,97 @@
+//
+//  SPDYReceiveWindowTuner.m
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#if !defined(__has_feature) || !__has_feature(objc_arc)
+#error "This file requires ARC support."
+#endif
+
+#import "SPDYCommonLogger.h"
+#import "SPDYReceiveWindowTuner.h"
+
+// Consecutive under-filled samples required before shrinking, so a single
+// idle round trip between responses doesn't throw away a grown window
+#define SHRINK_SAMPLE_THRESHOLD 3
+
+@implementation SPDYReceiveWindowTuner
+{
+    uint32_t _minWindowSize;
+    uint32_t _maxWindowSize;
+    NSUInteger _sampleBytes;
+    NSUInteger _underfilledSamples;
+}
+
+- (id)initWithWindowSize:(uint32_t)windowSize
+           minWindowSize:(uint32_t)minWindowSize
+           maxWindowSize:(uint32_t)maxWindowSize
+{
+    self = [super init];
+    if (self) {
+        _minWindowSize = MIN(minWindowSize, maxWindowSize);
+        _maxWindowSize = maxWindowSize;
+        _windowSize = MAX(MIN(windowSize, _maxWindowSize), _minWindowSize);
+        _bandwidth = 0;
+        _sampling = NO;
+        _sampleBytes = 0;
+        _underfilledSamples = 0;
+    }
+    return self;
+}
+
+- (void)startSample
+{
+    _sampling = YES;
+    _sampleBytes = 0;
+}
+
+- (void)didReceiveBytes:(NSUInteger)length
+{
+    if (_sampling) {
+        _sampleBytes += length;
+    }
+}
+
+- (bool)finishSampleWithRoundTripTime:(SPDYTimeInterval)roundTripTime
+{
+    if (!_sampling) {
+        return NO;
+    }
+
+    _sampling = NO;
+    if (roundTripTime <= 0) {
+        return NO;
+    }
+
+    _bandwidth = _sampleBytes / roundTripTime;
+    uint32_t previousWindowSize = _windowSize;
+
+    if (_sampleBytes >= (NSUInteger)_windowSize * 2 / 3) {
+        // The window was the bottleneck for this round trip
+        _underfilledSamples = 0;
+        _windowSize = (uint32_t)MIN(_sampleBytes * 2, (NSUInteger)_maxWindowSize);
+    } else if (_sampleBytes < _windowSize / 4) {
+        if (++_underfilledSamples >= SHRINK_SAMPLE_THRESHOLD) {
+            _underfilledSamples = 0;
+            _windowSize = MAX(_windowSize / 2, _minWindowSize);
+        }
+    } else {
+        _underfilledSamples = 0;
+    }
+
+    if (_windowSize != previousWindowSize) {
+        SPDY_DEBUG(@"receive window %u -> %u (%lu bytes in %.1fms)",
+            previousWindowSize, _windowSize, (unsigned long)_sampleBytes, roundTripTime * 1000);
+        return YES;
+    }
+
+    return NO;
+}
+
+@end
@@ -0,0 +1,55 @@
+//
+//  SPDYRequestCoalescer.h
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#import <Foundation/Foundation.h>
+
+@class SPDYStream;
+
+/**
+  Shares one network stream between identical GET requests that are in flight
+  at the same time.
+
+  Requests are identical when they have the same URL and the same request
+  headers, since any header may be named by the response's Vary. The first
+  request for a resource is sent on a new stream owned by the coalescer, and
+  every request that arrives before its response fans out from that stream.
+  A request that arrives after the response has started is sent on its own.
+
+  Each coalesced request can be canceled independently. The shared stream is
+  only canceled once no request is left waiting on it. Like the session
+  manager that owns it, a coalescer is confined to a single thread.
+*/
+@interface SPDYRequestCoalescer : NSObject
+
+/**
+  @return number of requests that were eligible for coalescing
+*/
+@property (nonatomic, readonly) NSUInteger requestCount;
+
+/**
+  @return number of requests served by a stream already in flight
+*/
+@property (nonatomic, readonly) NSUInteger coalescedCount;
+
+/**
+  @return number of shared streams in flight
+*/
+@property (nonatomic, readonly) NSUInteger count;
+
+/**
+  Attaches a local stream to the in-flight request for the same resource.
+  Returns the stream that should be loaded over the network: the given stream
+  if it can't be coalesced, a new shared stream if this is the first request
+  for the resource, or nil if the stream joined a request already in flight.
+*/
+- (SPDYStream *)coalesceStream:(SPDYStream *)stream;
+
+@end
@@ -0,0 +1,258 @@
+//
+//  SPDYRequestCoalescer.m
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#if !defined(__has_feature) || !__has_feature(objc_arc)
+#error "This file requires ARC support."
+#endif
+
+#import "NSURLRequest+SPDYURLRequest.h"
+#import "SPDYCommonLogger.h"
+#import "SPDYMetadata+Utils.h"
+#import "SPDYRequestCoalescer.h"
+#import "SPDYStopwatch.h"
+#import "SPDYStream.h"
+
+@class SPDYCoalescedRequest;
+
+@interface SPDYRequestCoalescer () <SPDYStreamDelegate>
+- (void)_requestDidReceiveResponse:(SPDYCoalescedRequest *)request;
+- (void)_removeRequest:(SPDYCoalescedRequest *)request;
+@end
+
+/**
+  Fans the response on a shared stream out to the local streams waiting on
+  it. The shared stream treats the request as its URL loading client, so the
+  response goes through the usual processing (decompression, metadata) once.
+*/
+@interface SPDYCoalescedRequest : NSObject <NSURLProtocolClient>
+@property (nonatomic, readonly) id key;
+@property (nonatomic, readonly) SPDYStream *sharedStream;
+@property (nonatomic, readonly) NSMutableArray *streams;
+@property (nonatomic) bool removed;
+- (id)initWithStream:(SPDYStream *)stream key:(id)key coalescer:(SPDYRequestCoalescer *)coalescer;
+@end
+
+@implementation SPDYCoalescedRequest
+{
+    __weak SPDYRequestCoalescer *_coalescer;
+}
+
+- (id)initWithStream:(SPDYStream *)stream key:(id)key coalescer:(SPDYRequestCoalescer *)coalescer
+{
+    self = [super init];
+    if (self) {
+        _key = key;
+        _streams = [[NSMutableArray alloc] init];
+        _coalescer = coalescer;
+
+        // The shared stream borrows the first request's protocol, which the session needs
+        // to address the stream and build its SYN_STREAM, but reports only to us
+        _sharedStream = [[SPDYStream alloc] initWithProtocol:stream.protocol];
+        _sharedStream.client = self;
+    }
+    return self;
+}
+
+- (void)_finishStream:(SPDYStream *)stream
+{
+    stream.delegate = nil;
+
+    SPDYMetadata *metadata = stream.metadata;
+    [metadata setNetworkMetricsFromMetadata:_sharedStream.metadata];
+    metadata.timeStreamClosed = [SPDYStopwatch currentSystemTime];
+}
+
+#pragma mark NSURLProtocolClient
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didReceiveResponse:(NSURLResponse *)response cacheStoragePolicy:(NSURLCacheStoragePolicy)policy
+{
+    if (_removed) return;
+
+    [_coalescer _requestDidReceiveResponse:self];
+
+    // Each request gets its own copy of the response, so that it carries that request's metadata
+    NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse *)response;
+    for (SPDYStream *stream in [_streams copy]) {
+        NSMutableDictionary *headers = [httpResponse.allHeaderFields mutableCopy];
+        [SPDYMetadata setMetadata:stream.metadata forAssociatedDictionary:headers];
+        NSHTTPURLResponse *streamResponse = [[NSHTTPURLResponse alloc] initWithURL:stream.request.URL
+                                                                        statusCode:httpResponse.statusCode
+                                                                       HTTPVersion:@"HTTP/1.1"
+                                                                      headerFields:headers];
+        [stream.client URLProtocol:stream.protocol didReceiveResponse:streamResponse cacheStoragePolicy:policy];
+    }
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didLoadData:(NSData *)data
+{
+    if (_removed) return;
+
+    for (SPDYStream *stream in [_streams copy]) {
+        [stream.client URLProtocol:stream.protocol didLoadData:data];
+    }
+}
+
+- (void)URLProtocolDidFinishLoading:(NSURLProtocol *)protocol
+{
+    if (_removed) return;
+
+    [_coalescer _removeRequest:self];
+    for (SPDYStream *stream in _streams) {
+        [self _finishStream:stream];
+        stream.localSideClosed = YES;
+        stream.remoteSideClosed = YES;
+    }
+    [_streams removeAllObjects];
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didFailWithError:(NSError *)error
+{
+    if (_removed) return;
+
+    SPDY_DEBUG(@"coalesced request for %@ failed: %@", _sharedStream.request.URL, error);
+    [_coalescer _removeRequest:self];
+    for (SPDYStream *stream in _streams) {
+        [self _finishStream:stream];
+        [stream closeWithError:error];
+    }
+    [_streams removeAllObjects];
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol wasRedirectedToRequest:(NSURLRequest *)request redirectResponse:(NSURLResponse *)redirectResponse
+{
+    if (_removed) return;
+
+    // Every request follows the redirect on its own, just as it would have without coalescing
+    [_coalescer _removeRequest:self];
+    for (SPDYStream *stream in _streams) {
+        [self _finishStream:stream];
+        NSMutableURLRequest *redirect = [request mutableCopy];
+        redirect.SPDYPriority = stream.request.SPDYPriority;
+        [stream.client URLProtocol:stream.protocol wasRedirectedToRequest:redirect redirectResponse:redirectResponse];
+    }
+    [_streams removeAllObjects];
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol cachedResponseIsValid:(NSCachedURLResponse *)cachedResponse
+{
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didReceiveAuthenticationChallenge:(NSURLAuthenticationChallenge *)challenge
+{
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didCancelAuthenticationChallenge:(NSURLAuthenticationChallenge *)challenge
+{
+}
+
+@end
+
+@implementation SPDYRequestCoalescer
+{
+    NSMutableDictionary *_requests;  // pending a response, by key
+    NSMutableArray *_activeRequests; // all requests with a shared stream in flight
+}
+
+- (id)init
+{
+    self = [super init];
+    if (self) {
+        _requests = [[NSMutableDictionary alloc] init];
+        _activeRequests = [[NSMutableArray alloc] init];
+        _requestCount = 0;
+        _coalescedCount = 0;
+    }
+    return self;
+}
+
+- (NSUInteger)count
+{
+    return _activeRequests.count;
+}
+
+- (SPDYStream *)coalesceStream:(SPDYStream *)stream
+{
+    NSURLRequest *request = stream.request;
+    if (![request.HTTPMethod isEqualToString:@"GET"] ||
+        request.HTTPBody || request.HTTPBodyStream ||
+        request.SPDYBodyFile || request.SPDYBodyStream ||
+        request.URL.absoluteString == nil) {
+        return stream;
+    }
+
+    // Any request header might be named by the response's Vary, so all of them are part of the key
+    NSArray *key = @[ request.URL.absoluteString, request.allHTTPHeaderFields ?: @{} ];
+    _requestCount += 1;
+
+    SPDYCoalescedRequest *coalescedRequest = _requests[key];
+    if (coalescedRequest) {
+        SPDY_DEBUG(@"coalescing request for %@ onto stream in flight", request.URL);
+        _coalescedCount += 1;
+        stream.metadata.coalesced = YES;
+        stream.delegate = self;
+        [coalescedRequest.streams addObject:stream];
+        return nil;
+    }
+
+    coalescedRequest = [[SPDYCoalescedRequest alloc] initWithStream:stream key:key coalescer:self];
+    _requests[key] = coalescedRequest;
+    [_activeRequests addObject:coalescedRequest];
+
+    stream.delegate = self;
+    [coalescedRequest.streams addObject:stream];
+    return coalescedRequest.sharedStream;
+}
+
+#pragma mark SPDYStreamDelegate
+
+- (void)streamCanceled:(SPDYStream *)stream
+{
+    stream.delegate = nil;
+
+    for (SPDYCoalescedRequest *request in [_activeRequests copy]) {
+        if (![request.streams containsObject:stream]) continue;
+
+        [request.streams removeObjectIdenticalTo:stream];
+        if (request.streams.count == 0) {
+            // Nobody is left waiting, so stop spending bytes on the shared stream
+            SPDY_DEBUG(@"canceling shared stream for %@", request.sharedStream.request.URL);
+            [self _removeRequest:request];
+            SPDYStream *sharedStream = request.sharedStream;
+            if (!sharedStream.closed) {
+                [sharedStream cancel];
+            }
+        }
+        break;
+    }
+}
+
+#pragma mark private methods
+
+- (void)_requestDidReceiveResponse:(SPDYCoalescedRequest *)request
+{
+    // Later requests can't be given the part of the response they missed
+    if (_requests[request.key] == request) {
+        [_requests removeObjectForKey:request.key];
+    }
+}
+
+- (void)_removeRequest:(SPDYCoalescedRequest *)request
+{
+    if (request.removed) {
+        return;
+    }
+
+    request.removed = YES;
+    [self _requestDidReceiveResponse:request];
+    [_activeRequests removeObjectIdenticalTo:request];
+}
+
+@end
@@ -0,0 +1,87 @@
+//
+//  SPDYRequestHedger.h
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#import <Foundation/Foundation.h>
+
+@class SPDYRequestHedger;
+@class SPDYSession;
+@class SPDYStream;
+
+@protocol SPDYRequestHedgerDelegate <NSObject>
+
+/**
+  Opens a request's hedge stream on a session other than the one carrying
+  its original stream.
+  @return NO if no other session can take the stream right now
+*/
+- (bool)requestHedger:(SPDYRequestHedger *)hedger openHedgeStream:(SPDYStream *)stream avoidingSession:(SPDYSession *)session;
+
+@end
+
+/**
+  Sends a second copy of a slow idempotent request on another session, and
+  keeps whichever copy receives its response first.
+
+  A hedged request is loaded over the network by streams owned by the hedger,
+  never by the request's own stream. The original stream is sent right away,
+  and once it has waited SPDYHedgeAfter for a SYN_REPLY, a hedge stream is
+  opened on a different session. The first stream to be answered is
+  forwarded to the request and the other is reset. If one stream fails while
+  the other is still waiting, the request keeps waiting. Like the session
+  manager that owns it, a hedger is confined to a single thread.
+*/
+@interface SPDYRequestHedger : NSObject
+
+@property (nonatomic, weak) id<SPDYRequestHedgerDelegate> delegate;
+
+/**
+  @return number of requests that were eligible for hedging
+*/
+@property (nonatomic, readonly) NSUInteger requestCount;
+
+/**
+  @return number of requests a hedge stream was sent for
+*/
+@property (nonatomic, readonly) NSUInteger hedgedCount;
+
+/**
+  @return number of hedged requests answered first on the hedge stream
+*/
+@property (nonatomic, readonly) NSUInteger hedgeWonCount;
+
+/**
+  @return number of hedged requests in flight
+*/
+@property (nonatomic, readonly) NSUInteger count;
+
+- (id)initWithRunLoopModes:(NSArray *)runLoopModes;
+
+/**
+  Takes over loading a local stream. Returns the stream that should be
+  loaded over the network: the given stream if it can't be hedged, or else a
+  new original stream owned by the hedger.
+*/
+- (SPDYStream *)hedgeStream:(SPDYStream *)stream;
+
+/**
+  Starts the hedge delay for an original stream once it has been opened on a
+  session. Other streams are ignored.
+*/
+- (void)stream:(SPDYStream *)stream openedOnSession:(SPDYSession *)session;
+
+/**
+  Hedge streams are only worth sending right away, so one that its session
+  refused is dropped rather than queued again.
+  @return YES if the stream was a hedge stream, and has been dropped
+*/
+- (bool)dropRefusedStream:(SPDYStream *)stream;
+
+@end
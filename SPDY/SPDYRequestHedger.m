@@ -0,0 +1,361 @@
+//
+//  SPDYRequestHedger.m
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#if !defined(__has_feature) || !__has_feature(objc_arc)
+#error "This file requires ARC support."
+#endif
+
+#import "NSURLRequest+SPDYURLRequest.h"
+#import "SPDYCommonLogger.h"
+#import "SPDYMetadata+Utils.h"
+#import "SPDYRequestHedger.h"
+#import "SPDYStopwatch.h"
+#import "SPDYStream.h"
+
+@class SPDYHedgedRequest;
+
+@interface SPDYRequestHedger () <SPDYStreamDelegate>
+- (void)_request:(SPDYHedgedRequest *)request answeredOnHedge:(bool)hedge;
+- (void)_removeRequest:(SPDYHedgedRequest *)request;
+@end
+
+/**
+  One network stream carrying a hedged request. Each stream has its own
+  client, since both streams report with the same protocol.
+*/
+@interface SPDYHedgeAttempt : NSObject <NSURLProtocolClient>
+@property (nonatomic, readonly) SPDYStream *stream;
+@property (nonatomic) bool failed;
+- (id)initWithRequest:(SPDYHedgedRequest *)request;
+- (void)cancel;
+@end
+
+@interface SPDYHedgedRequest : NSObject
+@property (nonatomic, readonly) SPDYStream *stream;
+@property (nonatomic, readonly) SPDYHedgeAttempt *original;
+@property (nonatomic) SPDYHedgeAttempt *hedge;
+@property (nonatomic) SPDYHedgeAttempt *winner;
+@property (nonatomic, weak) SPDYSession *originalSession;
+@property (nonatomic) NSTimer *timer;
+@property (nonatomic) bool removed;
+- (id)initWithStream:(SPDYStream *)stream hedger:(SPDYRequestHedger *)hedger;
+- (bool)attemptAnswered:(SPDYHedgeAttempt *)attempt;
+- (void)attempt:(SPDYHedgeAttempt *)attempt failedWithError:(NSError *)error;
+- (void)finishWithAttempt:(SPDYHedgeAttempt *)attempt error:(NSError *)error;
+@end
+
+@implementation SPDYHedgeAttempt
+{
+    __weak SPDYHedgedRequest *_request;
+}
+
+- (id)initWithRequest:(SPDYHedgedRequest *)request
+{
+    self = [super init];
+    if (self) {
+        _request = request;
+
+        // Borrows the request's protocol, which the session needs to address the stream
+        // and build its SYN_STREAM, but reports only to us
+        SPDYStream *stream = request.stream;
+        _stream = [[SPDYStream alloc] initWithProtocol:stream.protocol];
+        _stream.request = stream.request;
+        _stream.priority = stream.priority;
+        _stream.client = self;
+        _failed = NO;
+    }
+    return self;
+}
+
+- (void)cancel
+{
+    _stream.client = nil;
+    if (!_stream.closed) {
+        [_stream cancel];
+    }
+}
+
+#pragma mark NSURLProtocolClient
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didReceiveResponse:(NSURLResponse *)response cacheStoragePolicy:(NSURLCacheStoragePolicy)policy
+{
+    if (![_request attemptAnswered:self]) return;
+
+    // The response must carry the request's metadata, not this stream's
+    SPDYStream *stream = _request.stream;
+    [stream.metadata setNetworkMetricsFromMetadata:_stream.metadata];
+
+    NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse *)response;
+    NSMutableDictionary *headers = [httpResponse.allHeaderFields mutableCopy];
+    [SPDYMetadata setMetadata:stream.metadata forAssociatedDictionary:headers];
+    NSHTTPURLResponse *streamResponse = [[NSHTTPURLResponse alloc] initWithURL:httpResponse.URL
+                                                                    statusCode:httpResponse.statusCode
+                                                                   HTTPVersion:@"HTTP/1.1"
+                                                                  headerFields:headers];
+    [stream.client URLProtocol:stream.protocol didReceiveResponse:streamResponse cacheStoragePolicy:policy];
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didLoadData:(NSData *)data
+{
+    if (_request.winner != self) return;
+
+    SPDYStream *stream = _request.stream;
+    [stream.client URLProtocol:stream.protocol didLoadData:data];
+}
+
+- (void)URLProtocolDidFinishLoading:(NSURLProtocol *)protocol
+{
+    if (![_request attemptAnswered:self]) return;
+
+    [_request finishWithAttempt:self error:nil];
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didFailWithError:(NSError *)error
+{
+    [_request attempt:self failedWithError:error];
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol wasRedirectedToRequest:(NSURLRequest *)request redirectResponse:(NSURLResponse *)redirectResponse
+{
+    if (![_request attemptAnswered:self]) return;
+
+    // The stream stays open until the request is stopped, which cancels it through the hedger
+    SPDYStream *stream = _request.stream;
+    [stream.client URLProtocol:stream.protocol wasRedirectedToRequest:request redirectResponse:redirectResponse];
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol cachedResponseIsValid:(NSCachedURLResponse *)cachedResponse
+{
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didReceiveAuthenticationChallenge:(NSURLAuthenticationChallenge *)challenge
+{
+}
+
+- (void)URLProtocol:(NSURLProtocol *)protocol didCancelAuthenticationChallenge:(NSURLAuthenticationChallenge *)challenge
+{
+}
+
+@end
+
+@implementation SPDYHedgedRequest
+{
+    __weak SPDYRequestHedger *_hedger;
+}
+
+- (id)initWithStream:(SPDYStream *)stream hedger:(SPDYRequestHedger *)hedger
+{
+    self = [super init];
+    if (self) {
+        _stream = stream;
+        _hedger = hedger;
+        _original = [[SPDYHedgeAttempt alloc] initWithRequest:self];
+    }
+    return self;
+}
+
+- (bool)attemptAnswered:(SPDYHedgeAttempt *)attempt
+{
+    if (_removed) return NO;
+    if (_winner) return _winner == attempt;
+
+    _winner = attempt;
+    [_timer invalidate];
+    _timer = nil;
+
+    SPDYHedgeAttempt *loser = (attempt == _original) ? _hedge : _original;
+    if (loser) {
+        SPDY_DEBUG(@"hedged request for %@ answered first on %@ stream", _stream.request.URL, (attempt == _hedge) ? @"hedge" : @"original");
+        [loser cancel];
+    }
+
+    [_hedger _request:self answeredOnHedge:(attempt == _hedge)];
+    return YES;
+}
+
+- (void)attempt:(SPDYHedgeAttempt *)attempt failedWithError:(NSError *)error
+{
+    if (_removed) return;
+
+    attempt.failed = YES;
+
+    // Only give up once neither stream can still be answered
+    SPDYHedgeAttempt *other = (attempt == _original) ? _hedge : _original;
+    if (!_winner && other && !other.failed) {
+        SPDY_DEBUG(@"hedged request for %@ still waiting after stream failed: %@", _stream.request.URL, error);
+        return;
+    }
+
+    [self finishWithAttempt:attempt error:error];
+}
+
+- (void)finishWithAttempt:(SPDYHedgeAttempt *)attempt error:(NSError *)error
+{
+    [_hedger _removeRequest:self];
+
+    _stream.delegate = nil;
+    SPDYMetadata *metadata = _stream.metadata;
+    [metadata setNetworkMetricsFromMetadata:attempt.stream.metadata];
+    metadata.timeStreamClosed = [SPDYStopwatch currentSystemTime];
+
+    if (error) {
+        [_stream closeWithError:error];
+    } else {
+        _stream.localSideClosed = YES;
+        _stream.remoteSideClosed = YES;
+    }
+}
+
+@end
+
+@implementation SPDYRequestHedger
+{
+    NSArray *_runLoopModes;
+    NSMutableArray *_activeRequests;
+}
+
+- (id)initWithRunLoopModes:(NSArray *)runLoopModes
+{
+    self = [super init];
+    if (self) {
+        _runLoopModes = runLoopModes;
+        _activeRequests = [[NSMutableArray alloc] init];
+        _requestCount = 0;
+        _hedgedCount = 0;
+        _hedgeWonCount = 0;
+    }
+    return self;
+}
+
+- (NSUInteger)count
+{
+    return _activeRequests.count;
+}
+
+- (SPDYStream *)hedgeStream:(SPDYStream *)stream
+{
+    if (stream.request.SPDYHedgeAfter <= 0 || !stream.idempotent) {
+        return stream;
+    }
+
+    _requestCount += 1;
+
+    SPDYHedgedRequest *request = [[SPDYHedgedRequest alloc] initWithStream:stream hedger:self];
+    [_activeRequests addObject:request];
+    stream.delegate = self;
+
+    return request.original.stream;
+}
+
+- (void)stream:(SPDYStream *)stream openedOnSession:(SPDYSession *)session
+{
+    for (SPDYHedgedRequest *request in _activeRequests) {
+        if (request.original.stream != stream) continue;
+
+        // A stream refused and opened again waits the full delay on its new session
+        request.originalSession = session;
+        if (request.stream.metadata.hedged) break;
+
+        NSTimeInterval hedgeAfter = request.stream.request.SPDYHedgeAfter;
+        if (request.timer) {
+            CFRunLoopTimerSetNextFireDate((__bridge CFRunLoopTimerRef)request.timer, CFAbsoluteTimeGetCurrent() + hedgeAfter);
+        } else {
+            request.timer = [NSTimer timerWithTimeInterval:hedgeAfter
+                                                    target:self
+                                                  selector:@selector(_hedgeTimerFired:)
+                                                  userInfo:request
+                                                   repeats:NO];
+            for (NSString *runLoopMode in _runLoopModes) {
+                CFRunLoopAddTimer(CFRunLoopGetCurrent(), (__bridge CFRunLoopTimerRef)request.timer, (__bridge CFStringRef)runLoopMode);
+            }
+        }
+        break;
+    }
+}
+
+- (bool)dropRefusedStream:(SPDYStream *)stream
+{
+    for (SPDYHedgedRequest *request in _activeRequests) {
+        if (request.hedge.stream != stream) continue;
+
+        SPDY_DEBUG(@"dropping refused hedge stream for %@", stream.request.URL);
+        stream.client = nil;
+        request.hedge = nil;
+        return YES;
+    }
+    return NO;
+}
+
+#pragma mark SPDYStreamDelegate
+
+- (void)streamCanceled:(SPDYStream *)stream
+{
+    stream.delegate = nil;
+
+    for (SPDYHedgedRequest *request in [_activeRequests copy]) {
+        if (request.stream != stream) continue;
+
+        [self _removeRequest:request];
+        [request.original cancel];
+        [request.hedge cancel];
+        break;
+    }
+}
+
+#pragma mark private methods
+
+- (void)_hedgeTimerFired:(NSTimer *)timer
+{
+    SPDYHedgedRequest *request = timer.userInfo;
+    request.timer = nil;
+    if (request.removed || request.winner || request.hedge) return;
+
+    // Nothing to gain while the original stream is back in the queue or already done
+    SPDYStream *originalStream = request.original.stream;
+    SPDYSession *originalSession = request.originalSession;
+    if (originalStream.receivedReply || originalStream.closed || originalStream.streamId == 0 || !originalSession) {
+        return;
+    }
+
+    request.hedge = [[SPDYHedgeAttempt alloc] initWithRequest:request];
+    if (![_delegate requestHedger:self openHedgeStream:request.hedge.stream avoidingSession:originalSession]) {
+        SPDY_DEBUG(@"no other session available to hedge request for %@", originalStream.request.URL);
+        request.hedge = nil;
+        return;
+    }
+
+    _hedgedCount += 1;
+    request.stream.metadata.hedged = YES;
+    SPDY_INFO(@"hedged request for %@, %lu of %lu requests hedged", originalStream.request.URL, (unsigned long)_hedgedCount, (unsigned long)_requestCount);
+}
+
+- (void)_request:(SPDYHedgedRequest *)request answeredOnHedge:(bool)hedge
+{
+    if (hedge) {
+        _hedgeWonCount += 1;
+        request.stream.metadata.hedgeWon = YES;
+        SPDY_DEBUG(@"hedge streams answered first for %lu of %lu hedged requests", (unsigned long)_hedgeWonCount, (unsigned long)_hedgedCount);
+    }
+}
+
+- (void)_removeRequest:(SPDYHedgedRequest *)request
+{
+    if (request.removed) {
+        return;
+    }
+
+    request.removed = YES;
+    [request.timer invalidate];
+    request.timer = nil;
+    [_activeRequests removeObjectIdenticalTo:request];
+}
+
+@end
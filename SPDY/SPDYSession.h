@@ -10,18 +10,23 @@
 //
 
 #import <Foundation/Foundation.h>
+#import "SPDYDefinitions.h"
 
 @class SPDYConfiguration;
 @class SPDYOrigin;
 @class SPDYProtocol;
+@class SPDYPushCache;
 @class SPDYSessionManager;
 @class SPDYSession;
 @class SPDYStream;
 
 @protocol SPDYSessionDelegate <NSObject>
 - (void)session:(SPDYSession *)session capacityIncreased:(NSUInteger)capacity;
+- (void)session:(SPDYSession *)session closedStream:(SPDYStream *)stream;
 - (void)session:(SPDYSession *)session connectedToNetwork:(bool)cellular;
 - (void)session:(SPDYSession *)session refusedStream:(SPDYStream *)stream;
+- (void)sessionBecameUnhealthy:(SPDYSession *)session;
+- (void)sessionEstablished:(SPDYSession *)session;
 - (void)sessionClosed:(SPDYSession *)session;
 @end
 
@@ -30,6 +35,17 @@
 @property (nonatomic, weak) id<SPDYSessionDelegate> delegate;
 @property (nonatomic, readonly) SPDYOrigin *origin;
 
+/**
+  @return address of the connected server, or nil if not connected directly
+*/
+@property (nonatomic, readonly) NSString *peerAddress;
+
+/**
+  Cache that receives streams pushed by the server. Pushes are refused when nil
+  or when server push isn't enabled in the session's configuration.
+*/
+@property (nonatomic) SPDYPushCache *pushCache;
+
 /**
   @return available capacity for new local streams
 */
@@ -60,6 +76,37 @@
 */
 @property (nonatomic, readonly) bool isOpen;
 
+/**
+  @return NO once too many consecutive keepalive PINGs have gone unanswered
+*/
+@property (nonatomic, readonly) bool isHealthy;
+
+/**
+  @return smoothed PING round-trip time in seconds, or -1 before the first response
+*/
+@property (nonatomic, readonly) SPDYTimeInterval smoothedRoundTripTime;
+
+/**
+  @return mean deviation of PING round-trip times in seconds
+*/
+@property (nonatomic, readonly) SPDYTimeInterval roundTripTimeVariance;
+
+/**
+  @return bytes that may still be sent before the peer grants more session window
+*/
+@property (nonatomic, readonly) uint32_t sendWindowSize;
+
+/**
+  @return number of WINDOW_UPDATE frames sent
+*/
+@property (nonatomic, readonly) NSUInteger windowUpdatesSent;
+
+/**
+  @return number of WINDOW_UPDATE frames avoided by gathering window credit
+  until the end of each batch of decoded input
+*/
+@property (nonatomic, readonly) NSUInteger windowUpdatesCoalesced;
+
 - (id)initWithOrigin:(SPDYOrigin *)origin
             delegate:(id<SPDYSessionDelegate>)delegate
        configuration:(SPDYConfiguration *)configuration
@@ -68,4 +115,33 @@
 - (void)openStream:(SPDYStream *)stream;
 - (void)close;
 
+/**
+  @return YES if the session is open, healthy and connected over TLS with
+  the same scheme and port as the given origin, and its server's
+  certificate is also valid for the origin's host. Streams for that origin
+  may then be opened on it. Does not check peerAddress.
+*/
+- (bool)canCoalesceOrigin:(SPDYOrigin *)origin;
+
+/**
+  Sends GOAWAY so the session takes no new streams, but lets the ones in
+  flight finish. The session closes once the last of them does.
+*/
+- (void)drain;
+
+/**
+  Resets local streams that haven't received a reply and are safe to send
+  again, and hands them back to the delegate through session:refusedStream:
+  to be retried on another session.
+
+  @return number of streams handed back
+*/
+- (NSUInteger)refuseStreamsWithoutReply;
+
+/**
+  Sends the initial PING if it hasn't been sent already. Once the peer
+  answers it, isEstablished becomes YES and the delegate is notified.
+*/
+- (void)establish;
+
 @end
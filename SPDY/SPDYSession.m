@@ -17,6 +17,7 @@
 #import <netinet/tcp.h>
 #import "NSURLRequest+SPDYURLRequest.h"
 #import "SPDYSession.h"
+#import "SPDYCanonicalRequest.h"
 #import "SPDYCommonLogger.h"
 #import "SPDYFrameDecoder.h"
 #import "SPDYFrameEncoder.h"
@@ -24,28 +25,81 @@
 #import "SPDYOrigin.h"
 #import "SPDYOriginEndpoint.h"
 #import "SPDYProtocol+Project.h"
+#import "SPDYPushCache.h"
+#import "SPDYReceiveWindowTuner.h"
 #import "SPDYSettingsStore.h"
 #import "SPDYSocket.h"
 #import "SPDYStopwatch.h"
 #import "SPDYStream.h"
 #import "SPDYStreamManager.h"
 
-// The input buffer should be more than twice MAX_CHUNK_LENGTH and
-// MAX_COMPRESSED_HEADER_BLOCK_LENGTH to avoid having to resize the
-// buffer.
+// The input buffer has a fixed size. The frame decoder streams DATA payloads
+// and header blocks out as they arrive, so at most a partial frame header is
+// ever left unconsumed. Once reads pass the high-water mark, that remainder is
+// moved to the front rather than letting the buffer grow.
 #define DEFAULT_WINDOW_SIZE            65536
-#define INITIAL_INPUT_BUFFER_SIZE      65536
+#define INPUT_BUFFER_SIZE              65536
+#define INPUT_BUFFER_HIGH_WATER_MARK   49152
 #define LOCAL_MAX_CONCURRENT_STREAMS   0
+#define LOCAL_MAX_PUSHED_STREAMS       16
 #define REMOTE_MAX_CONCURRENT_STREAMS  INT32_MAX
+#define WINDOW_SAMPLE_PING_ID          3
+#define FIRST_KEEPALIVE_PING_ID        5
 
 @interface SPDYSession () <SPDYFrameDecoderDelegate, SPDYFrameEncoderDelegate, SPDYStreamDelegate, SPDYSocketDelegate>
 @property (nonatomic, readonly) SPDYStreamId nextStreamId;
+- (void)_setConnectionMetadataForStream:(SPDYStream *)stream;
 - (void)_sendSynStream:(SPDYStream *)stream streamId:(SPDYStreamId)streamId closeLocal:(bool)close;
-- (void)_sendData:(SPDYStream *)stream;
+- (void)_sendData;
+- (NSUInteger)_sendData:(SPDYStream *)stream maxLength:(NSUInteger)maxLength;
+- (NSUInteger)_removeUnsentDataForStream:(SPDYStream *)stream;
 - (void)_sendWindowUpdate:(uint32_t)deltaWindowSize streamId:(SPDYStreamId)streamId;
+- (void)_queueWindowUpdate:(uint32_t)deltaWindowSize stream:(SPDYStream *)stream;
+- (void)_flushWindowUpdates;
+- (void)_compactInputBuffer;
+- (void)_sampleReceivedLength:(NSUInteger)length;
+- (void)_didMeasureRoundTripTime:(SPDYTimeInterval)roundTripTime;
+- (void)_startKeepalive;
+- (void)_stopKeepalive;
+- (void)_keepaliveTimerFired;
+- (void)_updateReceiveWindows;
 - (void)_sendPingResponse:(SPDYPingFrame *)pingFrame;
 - (void)_sendRstStream:(SPDYStreamStatus)status streamId:(SPDYStreamId)streamId;
 - (void)_sendGoAway:(SPDYSessionStatus)status;
+- (bool)_serverTrustCoversHost:(NSString *)host;
+@end
+
+// A repeating timer retains its target, so the keepalive timer fires through
+// this instead, and the session can still be released while the timer runs
+@interface SPDYKeepaliveTimerTarget : NSObject
+- (id)initWithSession:(SPDYSession *)session;
+- (void)timerFired:(NSTimer *)timer;
+@end
+
+@implementation SPDYKeepaliveTimerTarget
+{
+    __weak SPDYSession *_session;
+}
+
+- (id)initWithSession:(SPDYSession *)session
+{
+    self = [super init];
+    if (self) {
+        _session = session;
+    }
+    return self;
+}
+
+- (void)timerFired:(NSTimer *)timer
+{
+    SPDYSession *session = _session;
+    if (session) {
+        [session _keepaliveTimerFired];
+    } else {
+        [timer invalidate];
+    }
+}
+
 @end
 
 @implementation SPDYSession
@@ -56,9 +110,20 @@
     SPDYStreamManager *_activeStreams;
     SPDYSocket *_socket;
     NSMutableData *_inputBuffer;
+    NSMutableArray *_streamsPendingWindowUpdate;
+    NSMutableDictionary *_coalescedHosts;
+    NSMutableIndexSet *_unwrittenSynStreamIds;
+    id _serverTrust;
 
     SPDYStreamId _lastGoodStreamId;
     SPDYStopwatch *_sessionPingStopwatch;
+    SPDYReceiveWindowTuner *_receiveWindowTuner;
+    SPDYTimeInterval _windowSamplePingTime;
+    NSTimer *_keepaliveTimer;
+    SPDYPingId _nextKeepalivePingId;
+    SPDYPingId _keepalivePingId;
+    SPDYTimeInterval _keepalivePingTime;
+    NSUInteger _missedKeepalivePings;
     SPDYTimeInterval _sessionLatency;
     NSUInteger _bufferReadIndex;
     NSUInteger _bufferWriteIndex;
@@ -66,16 +131,25 @@
     uint32_t _initialReceiveWindowSize;
     uint32_t _sessionSendWindowSize;
     uint32_t _sessionReceiveWindowSize;
+    uint32_t _sessionReceiveWindowTarget;
+    uint32_t _streamReceiveWindowTarget;
+    uint32_t _pendingSessionWindowDelta;
     uint32_t _localMaxConcurrentStreams;
     uint32_t _remoteMaxConcurrentStreams;
+    NSUInteger _sendQuantum;
     bool _cellular;
     bool _connected;
     bool _disconnected;
+    bool _enableOptimisticDispatch;
     bool _enableSettingsMinorVersion;
     bool _enableTCPNoDelay;
     bool _established;
+    bool _sentInitialPing;
     bool _receivedGoAwayFrame;
     bool _sentGoAwayFrame;
+    bool _sendingData;
+    bool _sendDataRequested;
+    bool _unhealthy;
     SPDYStopwatch *_connectedStopwatch;
 }
 
@@ -122,23 +196,49 @@
             }
 
             _frameDecoder = [[SPDYFrameDecoder alloc] initWithDelegate:self];
+            _frameDecoder.maxHeaderBlockLength = configuration.maxHeaderBlockLength;
             _frameEncoder = [[SPDYFrameEncoder alloc] initWithDelegate:self
                                                 headerCompressionLevel:configuration.headerCompressionLevel];
             _activeStreams = [[SPDYStreamManager alloc] init];
-            _inputBuffer = [[NSMutableData alloc] initWithCapacity:INITIAL_INPUT_BUFFER_SIZE];
+            _inputBuffer = [[NSMutableData alloc] initWithLength:INPUT_BUFFER_SIZE];
+            _streamsPendingWindowUpdate = [[NSMutableArray alloc] init];
+            _coalescedHosts = [[NSMutableDictionary alloc] init];
+            _unwrittenSynStreamIds = [[NSMutableIndexSet alloc] init];
 
             _lastGoodStreamId = 0;
             _nextStreamId = 1;
             _bufferReadIndex = 0;
             _bufferWriteIndex = 0;
             _sessionLatency = -1;
+            _smoothedRoundTripTime = -1;
+            _roundTripTimeVariance = 0;
+            _nextKeepalivePingId = FIRST_KEEPALIVE_PING_ID;
+            _keepalivePingId = 0;
+            _missedKeepalivePings = 0;
+            _unhealthy = NO;
+            _pendingSessionWindowDelta = 0;
+            _windowUpdatesSent = 0;
+            _windowUpdatesCoalesced = 0;
 
             _initialSendWindowSize = DEFAULT_WINDOW_SIZE;
             _initialReceiveWindowSize = (uint32_t)configuration.streamReceiveWindow;
-            _localMaxConcurrentStreams = LOCAL_MAX_CONCURRENT_STREAMS;
+            _sessionReceiveWindowTarget = (uint32_t)configuration.sessionReceiveWindow;
+            if (configuration.enableReceiveWindowAutoTuning) {
+                // Start at the protocol default and let measured round trips grow the windows
+                uint32_t maxWindowSize = (uint32_t)MAX(configuration.sessionReceiveWindow, configuration.streamReceiveWindow);
+                _receiveWindowTuner = [[SPDYReceiveWindowTuner alloc] initWithWindowSize:DEFAULT_WINDOW_SIZE
+                                                                           minWindowSize:DEFAULT_WINDOW_SIZE
+                                                                           maxWindowSize:maxWindowSize];
+                _initialReceiveWindowSize = MIN(_initialReceiveWindowSize, (uint32_t)DEFAULT_WINDOW_SIZE);
+                _sessionReceiveWindowTarget = MIN(_sessionReceiveWindowTarget, (uint32_t)DEFAULT_WINDOW_SIZE);
+            }
+            _streamReceiveWindowTarget = _initialReceiveWindowSize;
+            _localMaxConcurrentStreams = configuration.enableServerPush ? LOCAL_MAX_PUSHED_STREAMS : LOCAL_MAX_CONCURRENT_STREAMS;
             _remoteMaxConcurrentStreams = REMOTE_MAX_CONCURRENT_STREAMS;
+            _enableOptimisticDispatch = configuration.enableOptimisticDispatch;
             _enableSettingsMinorVersion = configuration.enableSettingsMinorVersion;
             _enableTCPNoDelay = configuration.enableTCPNoDelay;
+            _sendQuantum = MAX(configuration.sendQuantum, (NSUInteger)1);
 
             SPDYSettings *settings = [SPDYSettingsStore settingsForOrigin:_origin];
             if (settings != NULL) {
@@ -152,7 +252,7 @@
             }
 
             _sessionSendWindowSize = DEFAULT_WINDOW_SIZE;
-            _sessionReceiveWindowSize = (uint32_t)configuration.sessionReceiveWindow;
+            _sessionReceiveWindowSize = _sessionReceiveWindowTarget;
 
             _connected = NO;
             _disconnected = NO;
@@ -162,15 +262,19 @@
             [_socket readDataWithTimeout:(NSTimeInterval)-1
                                   buffer:_inputBuffer
                             bufferOffset:_bufferWriteIndex
+                               maxLength:_inputBuffer.length - _bufferWriteIndex
                                      tag:0];
 
             [self _sendServerPersistedSettings:settings];
             [self _sendClientSettings];
 
-            uint32_t deltaWindowSize = _sessionReceiveWindowSize - DEFAULT_WINDOW_SIZE;
-            [self _sendWindowUpdate:deltaWindowSize streamId:kSPDYSessionStreamId];
+            if (_sessionReceiveWindowSize > DEFAULT_WINDOW_SIZE) {
+                uint32_t deltaWindowSize = _sessionReceiveWindowSize - DEFAULT_WINDOW_SIZE;
+                [self _sendWindowUpdate:deltaWindowSize streamId:kSPDYSessionStreamId];
+            }
+            _sentInitialPing = NO;
             if (_enableTCPNoDelay) {
-                [self _sendPing:1];
+                [self establish];
             }
         } else {
             self = nil;
@@ -190,11 +294,10 @@
     if (_sessionLatency >= 0) {
         stream.metadata.latencyMs = (NSInteger)(_sessionLatency * 1000);
     }
-    stream.metadata.timeSessionConnected = _connectedStopwatch.startSystemTime;
-    stream.metadata.connectedMs = _connectedStopwatch.elapsedSeconds * 1000;
-    stream.metadata.hostAddress = _socket.connectedHost;
-    stream.metadata.hostPort = _socket.connectedPort;
-    stream.metadata.viaProxy = _socket.connectedToProxy;
+    if (_connected) {
+        [self _setConnectionMetadataForStream:stream];
+        stream.metadata.connectedMs = _connectedStopwatch.elapsedSeconds * 1000;
+    }
     stream.metadata.cellular = _cellular;
 
     [stream startWithStreamId:streamId
@@ -209,13 +312,16 @@
         stream.localSideClosed = YES;
     } else {
         [self _sendSynStream:stream streamId:streamId closeLocal:NO];
-        [self _sendData:stream];
+        [self _sendData];
     }
 }
 
 - (NSUInteger)capacity
 {
-    return (self.isOpen && _connected) * MAX(0, _remoteMaxConcurrentStreams - _activeStreams.localCount);
+    // Streams opened while still connecting have their frames held in the socket's
+    // write queue, and leave together with the end of the handshake
+    bool ready = _connected || _enableOptimisticDispatch;
+    return (self.isOpen && ready && !_unhealthy) * MAX(0, _remoteMaxConcurrentStreams - _activeStreams.localCount);
 }
 
 - (NSUInteger)load
@@ -225,6 +331,7 @@
 
 - (void)dealloc
 {
+    [_keepaliveTimer invalidate];
     _frameDecoder.delegate = nil;
     _frameEncoder.delegate = nil;
 }
@@ -249,13 +356,95 @@
     return (!_receivedGoAwayFrame && !_sentGoAwayFrame && !_disconnected);
 }
 
+- (bool)isHealthy
+{
+    return !_unhealthy;
+}
+
+- (uint32_t)sendWindowSize
+{
+    return _sessionSendWindowSize;
+}
+
 - (void)close
 {
     [self _closeWithStatus:SPDY_SESSION_OK];
 }
 
+- (bool)canCoalesceOrigin:(SPDYOrigin *)origin
+{
+    if (!self.isOpen || _unhealthy || !_connected || !_serverTrust) return NO;
+    if (![origin.scheme isEqualToString:_origin.scheme] || origin.port != _origin.port) return NO;
+    if ([origin.host isEqualToString:_origin.host]) return YES;
+
+    NSNumber *covered = _coalescedHosts[origin.host];
+    if (!covered) {
+        covered = @([self _serverTrustCoversHost:origin.host]);
+        _coalescedHosts[origin.host] = covered;
+        SPDY_DEBUG(@"%@ certificate %@ %@", self, covered.boolValue ? @"covers" : @"does not cover", origin.host);
+    }
+    return covered.boolValue;
+}
+
+- (void)drain
+{
+    SPDY_INFO(@"%@ draining %lu streams", self, (unsigned long)_activeStreams.localCount);
+
+    if (!_sentGoAwayFrame) {
+        [self _sendGoAway:SPDY_SESSION_OK];
+    }
+
+    if (_activeStreams.count == 0) {
+        [self close];
+    }
+}
+
+- (NSUInteger)refuseStreamsWithoutReply
+{
+    NSMutableArray *refusedStreams = [[NSMutableArray alloc] init];
+    for (SPDYStream *stream in _activeStreams) {
+        if (stream.local && !stream.receivedReply && stream.idempotent) {
+            [refusedStreams addObject:stream];
+        }
+    }
+
+    for (SPDYStream *stream in [refusedStreams copy]) {
+        // Note: reset clears the stream id, so hold on to it to clean up after the stream
+        SPDYStreamId streamId = stream.streamId;
+        if (![stream reset]) {
+            [refusedStreams removeObjectIdenticalTo:stream];
+            continue;
+        }
+
+        NSUInteger payloadLength = 0;
+        [_socket removeUnsentWritesForStreamId:streamId payloadLength:&payloadLength];
+        _sessionSendWindowSize += (uint32_t)payloadLength;
+
+        [self _sendRstStream:SPDY_STREAM_CANCEL streamId:streamId];
+        [_activeStreams removeStreamWithStreamId:streamId];
+        [_streamsPendingWindowUpdate removeObjectIdenticalTo:stream];
+        [_delegate session:self refusedStream:stream];
+    }
+
+    if (!self.isOpen && _activeStreams.count == 0) {
+        [self close];
+    }
+
+    return refusedStreams.count;
+}
+
+- (void)establish
+{
+    if (!_sentInitialPing && self.isOpen) {
+        _sentInitialPing = YES;
+        [self _sendPing:1];
+    }
+}
+
 - (void)_closeWithStatus:(SPDYSessionStatus)status
 {
+    [self _stopKeepalive];
+
     if (!_sentGoAwayFrame) {
         [self _sendGoAway:status];
     }
@@ -279,6 +468,8 @@
     }
 
     [_activeStreams removeAllStreams];
+    [_streamsPendingWindowUpdate removeAllObjects];
+    _pendingSessionWindowDelta = 0;
     [_socket disconnectAfterWrites];
 }
 
@@ -286,7 +477,14 @@
 
 - (bool)socket:(SPDYSocket *)socket securedWithTrust:(SecTrustRef)trust
 {
-    return [SPDYProtocol evaluateServerTrust:trust forHost:_origin.host];
+    bool trusted = [SPDYProtocol evaluateServerTrust:trust forHost:_origin.host];
+
+    // Kept to check whether the certificate also covers other origins' hosts
+    if (trusted && trust) {
+        _serverTrust = (__bridge id)trust;
+    }
+
+    return trusted;
 }
 
 - (void)socket:(SPDYSocket *)socket didConnectToHost:(NSString *)host port:(in_port_t)port
@@ -294,6 +492,9 @@
     [_connectedStopwatch reset];
     SPDY_INFO(@"%@ connected to %@ (%@:%u)", self, _origin, host, port);
 
+    // Through a proxy, the address is the proxy's and says nothing about the origin
+    _peerAddress = socket.connectedToProxy ? nil : host;
+
     if (_cellular != socket.isCellular) {
         SPDY_WARNING(@"%@ expected network type %@ but socket is %@",
                 self, _cellular ? @"cellular" : @"wifi",
@@ -307,7 +508,13 @@
         }
     }
 
+    // Streams opened before the connection completed learn where they went now
+    for (SPDYStream *stream in _activeStreams) {
+        [self _setConnectionMetadataForStream:stream];
+    }
+
     _connected = YES;
+    [self _startKeepalive];
     [_delegate session:self connectedToNetwork:_cellular];
 
     if(_enableTCPNoDelay){
@@ -338,23 +545,39 @@
 
     _bufferReadIndex += bytesRead;
 
+    // Grant the window credit gathered while decoding this batch
+    [self _flushWindowUpdates];
+
     // If we've successfully decoded all available input, reset the buffer
     if (_bufferReadIndex == _bufferWriteIndex) {
         _bufferReadIndex = 0;
         _bufferWriteIndex = 0;
+    } else if (_bufferWriteIndex >= INPUT_BUFFER_HIGH_WATER_MARK) {
+        [self _compactInputBuffer];
+    }
+
+    // Reads are bounded by the space left so the socket never grows the buffer
+    if (_bufferWriteIndex < INPUT_BUFFER_SIZE && _inputBuffer.length != INPUT_BUFFER_SIZE) {
+        _inputBuffer.length = INPUT_BUFFER_SIZE;
     }
 
     SPDY_DEBUG(@"socket scheduling read[%li] (%lu:%lu)", (tag + 1), (unsigned long)_bufferReadIndex, (unsigned long)_bufferWriteIndex);
     [socket readDataWithTimeout:(NSTimeInterval)-1
                          buffer:_inputBuffer
                    bufferOffset:_bufferWriteIndex
+                      maxLength:_inputBuffer.length - _bufferWriteIndex
                             tag:(tag + 1)];
 }
 
 - (void)socket:(SPDYSocket *)socket didWriteDataWithTag:(long)tag
 {
-    if (tag == 1) {
+    if (tag < 0) {
+        [_unwrittenSynStreamIds removeIndex:(NSUInteger)-tag];
+    } else if (tag == 1) {
         [_sessionPingStopwatch reset];
+    } else if (_keepalivePingId && tag == _keepalivePingId) {
+        // Time from when the PING actually left, not from when it was queued
+        _keepalivePingTime = [SPDYStopwatch currentSystemTime];
     }
 }
 
@@ -377,7 +600,14 @@
     SPDY_WARNING(@"%@ connection error: %@", self, error);
     for (SPDYStream *stream in _activeStreams) {
         stream.delegate = nil;
-        [stream closeWithError:error];
+
+        // Nothing reaches the peer before the socket connects, so streams opened while
+        // connecting can be safely retried on another session
+        if (!_connected && stream.local && [stream reset]) {
+            [_delegate session:self refusedStream:stream];
+        } else {
+            [stream closeWithError:error];
+        }
     }
     [_activeStreams removeAllStreams];
 }
@@ -386,6 +616,7 @@
 {
     SPDY_INFO(@"%@ connection closed", self);
 
+    [self _stopKeepalive];
     _connected = NO;
     _disconnected = YES;
     _socket = nil;
@@ -396,14 +627,90 @@
 
 #pragma mark SPDYFrameEncoderDelegate
 
-- (void)didEncodeData:(NSData *)data frameEncoder:(SPDYFrameEncoder *)encoder
+/**
+  Flow control, liveness and stream resets are latency sensitive and may jump
+  queued DATA frames. Frames that open, continue or end streams must not, as
+  their order relative to DATA frames is significant.
+*/
+static inline SPDYSocketWritePriority writePriorityForFrame(const uint8_t *header, NSUInteger headerLength)
+{
+    if (headerLength < 4 || (header[0] & 0x80) == 0) {
+        return SPDYSocketWritePriorityNormal;
+    }
+
+    switch (((uint16_t)header[2] << 8) | header[3]) {
+        case SPDY_RST_STREAM_FRAME:
+        case SPDY_SETTINGS_FRAME:
+        case SPDY_PING_FRAME:
+        case SPDY_WINDOW_UPDATE_FRAME:
+            return SPDYSocketWritePriorityUrgent;
+        default:
+            return SPDYSocketWritePriorityNormal;
+    }
+}
+
+// DATA frames are tagged with their stream id so they can be withdrawn if the stream is reset
+static inline SPDYStreamId streamIdForDataFrame(const uint8_t *header, NSUInteger headerLength)
+{
+    if (headerLength < 4 || (header[0] & 0x80) != 0) {
+        return 0;
+    }
+    return ((SPDYStreamId)(header[0] & 0x7f) << 24) | ((SPDYStreamId)header[1] << 16) |
+           ((SPDYStreamId)header[2] << 8) | header[3];
+}
+
+static inline uint16_t typeForControlFrame(const uint8_t *header, NSUInteger headerLength)
 {
-    [_socket writeData:data withTimeout:(NSTimeInterval)-1 tag:0];
+    if (headerLength < 4 || (header[0] & 0x80) == 0) {
+        return 0;
+    }
+    return ((uint16_t)header[2] << 8) | header[3];
+}
+
+// SYN_STREAM and RST_STREAM carry their stream id right after the common header
+static inline SPDYStreamId streamIdForControlFrame(const uint8_t *header, NSUInteger headerLength)
+{
+    if (headerLength < 12) {
+        return 0;
+    }
+    return ((SPDYStreamId)(header[8] & 0x7f) << 24) | ((SPDYStreamId)header[9] << 16) |
+           ((SPDYStreamId)header[10] << 8) | header[11];
 }
 
-- (void)didEncodeData:(NSData *)data withTag:(uint32_t)tag frameEncoder:(SPDYFrameEncoder *)encoder
+- (void)didEncodeFrameHeader:(const uint8_t *)header
+                      length:(NSUInteger)headerLength
+                     payload:(NSData *)payload
+                         tag:(uint32_t)tag
+                frameEncoder:(SPDYFrameEncoder *)encoder
 {
-    [_socket writeData:data withTimeout:(NSTimeInterval)-1 tag:tag];
+    SPDYSocketWritePriority priority = writePriorityForFrame(header, headerLength);
+    long writeTag = tag;
+
+    // A SYN_STREAM can't be withdrawn once its header block has been compressed, so it's
+    // tracked until written, and a reset for its stream may not jump ahead of it
+    switch (typeForControlFrame(header, headerLength)) {
+        case SPDY_SYN_STREAM_FRAME: {
+            SPDYStreamId streamId = streamIdForControlFrame(header, headerLength);
+            [_unwrittenSynStreamIds addIndex:streamId];
+            writeTag = -(long)streamId;
+            break;
+        }
+        case SPDY_RST_STREAM_FRAME:
+            if ([_unwrittenSynStreamIds containsIndex:streamIdForControlFrame(header, headerLength)]) {
+                priority = SPDYSocketWritePriorityNormal;
+            }
+            break;
+        default:
+            break;
+    }
+
+    [_socket writeHeader:header
+                  length:headerLength
+                 payload:payload
+                streamId:streamIdForDataFrame(header, headerLength)
+             withTimeout:(NSTimeInterval)-1
+                priority:priority
+                     tag:writeTag];
 }
 
 #pragma mark SPDYFrameDecoderDelegate
@@ -456,11 +763,16 @@
     // Update session receive window size
     _sessionReceiveWindowSize -= dataFrame.data.length;
 
-    // Send a WINDOW_UPDATE frame if less than half the session window size remains
-    if (_sessionReceiveWindowSize <= _initialReceiveWindowSize / 2) {
-        uint32_t deltaWindowSize = _initialReceiveWindowSize - _sessionReceiveWindowSize;
-        [self _sendWindowUpdate:deltaWindowSize streamId:kSPDYSessionStreamId];
-        _sessionReceiveWindowSize = _initialReceiveWindowSize;
+    // Queue a WINDOW_UPDATE frame if less than half the session window size remains
+    if (_sessionReceiveWindowSize <= _sessionReceiveWindowTarget / 2) {
+        uint32_t deltaWindowSize = _sessionReceiveWindowTarget - _sessionReceiveWindowSize;
+        [self _queueWindowUpdate:deltaWindowSize stream:nil];
+        _sessionReceiveWindowSize = _sessionReceiveWindowTarget;
+    }
+
+    // Chunks split out below were already counted as part of the frame they came from
+    if (_receiveWindowTuner && dataFrame.encodedLength > 0) {
+        [self _sampleReceivedLength:dataFrame.data.length];
     }
 
     // Check if we received a data frame for a valid Stream-ID
@@ -479,8 +791,9 @@
         return;
     }
 
-    // Check if we received a data frame before receiving a SYN_REPLY
-    if (stream.local && !stream.receivedReply) {
+    // Check if we received a data frame before receiving a SYN_REPLY, or, for a pushed stream,
+    // before its response headers
+    if (!stream.receivedReply) {
         SPDY_WARNING(@"received data before SYN_REPLY");
         [self _sendRstStream:SPDY_STREAM_PROTOCOL_ERROR streamId:streamId];
         [stream closeWithError:SPDY_STREAM_ERROR(SPDYStreamProtocolError, @"received data before syn reply")];
@@ -534,11 +847,11 @@
     // Update receive window size
     stream.receiveWindowSize -= (uint32_t)dataFrame.data.length;
 
-    // Send a WINDOW_UPDATE frame if less than half the window size remains
-    if (stream.receiveWindowSize <= _initialReceiveWindowSize / 2 && !dataFrame.last) {
+    // Queue a WINDOW_UPDATE frame if less than half the window size remains
+    if (stream.receiveWindowSize <= _streamReceiveWindowTarget / 2 && !dataFrame.last) {
         // stream.receiveWindowSizeLowerBound = 0;
-        [self _sendWindowUpdate:_initialReceiveWindowSize - stream.receiveWindowSize streamId:streamId];
-        stream.receiveWindowSize = _initialReceiveWindowSize;
+        [self _queueWindowUpdate:_streamReceiveWindowTarget - stream.receiveWindowSize stream:stream];
+        stream.receiveWindowSize = _streamReceiveWindowTarget;
     }
 
     [stream didLoadData:dataFrame.data];
@@ -562,6 +875,11 @@
      *
      * The recipient can reject a stream by sending a stream error with the
      * status code REFUSED_STREAM.
+     *
+     * A server push must be unidirectional, associated with an open stream the
+     * client initiated, and carry the :scheme, :host and :path of the pushed
+     * resource. If any of these is missing, the recipient must issue a stream
+     * error with the status code PROTOCOL_ERROR.
      */
 
     SPDYStreamId streamId = synStreamFrame.streamId;
@@ -578,11 +896,48 @@
         return;
     }
 
-    SPDYStream *stream = [[SPDYStream alloc] init];
+    _lastGoodStreamId = streamId;
+
+    SPDYStream *associatedStream = _activeStreams[synStreamFrame.associatedToStreamId];
+    if (!_pushCache || !synStreamFrame.unidirectional || !associatedStream.local || associatedStream.closed) {
+        [self _sendRstStream:SPDY_STREAM_REFUSED_STREAM streamId:streamId];
+        return;
+    }
+
+    NSDictionary *headers = synStreamFrame.headers;
+    NSString *scheme = headers[@":scheme"];
+    NSString *host = headers[@":host"];
+    NSString *path = headers[@":path"];
+    NSURL *url = nil;
+    if (scheme && host && path) {
+        url = [[NSURL alloc] initWithString:[NSString stringWithFormat:@"%@://%@%@", scheme, host, path]];
+    }
+
+    if (!url) {
+        SPDY_WARNING(@"received SYN_STREAM.%u without a valid pushed resource", streamId);
+        [self _sendRstStream:SPDY_STREAM_PROTOCOL_ERROR streamId:streamId];
+        return;
+    }
+
+    // Only accept pushes for the origin of the stream they're associated with, which
+    // may be another origin sharing this session
+    SPDYOrigin *pushedOrigin = [[SPDYOrigin alloc] initWithURL:url error:nil];
+    SPDYOrigin *associatedOrigin = [[SPDYOrigin alloc] initWithURL:associatedStream.request.URL error:nil];
+    if (!associatedOrigin || ![pushedOrigin isEqual:associatedOrigin]) {
+        SPDY_WARNING(@"refusing push of %@ associated with %@", url, associatedStream.request.URL);
+        [self _sendRstStream:SPDY_STREAM_REFUSED_STREAM streamId:streamId];
+        return;
+    }
+
+    SPDYStream *stream = [[SPDYStream alloc] initWithProtocol:nil];
+    stream.local = NO;
     stream.priority = synStreamFrame.priority;
-    stream.remoteSideClosed = synStreamFrame.last;
-    stream.sendWindowSize = _initialSendWindowSize;
-    stream.receiveWindowSize = _initialReceiveWindowSize;
+    stream.request = SPDYCanonicalRequestForRequest([[NSURLRequest alloc] initWithURL:url]);
+    [stream startWithStreamId:streamId
+               sendWindowSize:_initialSendWindowSize
+            receiveWindowSize:_initialReceiveWindowSize];
+    stream.delegate = self;
+    stream.localSideClosed = YES;
     stream.metadata.rxBytes += synStreamFrame.encodedLength;
 
     SPDYTimeInterval now = [SPDYStopwatch currentSystemTime];
@@ -590,9 +945,28 @@
     stream.metadata.timeStreamRequestLastHeader = now;
     stream.metadata.timeStreamResponseStarted = now;
     stream.metadata.timeStreamResponseLastHeader = now;
+    if (_sessionLatency >= 0) {
+        stream.metadata.latencyMs = (NSInteger)(_sessionLatency * 1000);
+    }
 
-    _lastGoodStreamId = streamId;
+    if (![_pushCache addPushedStream:stream]) {
+        SPDY_DEBUG(@"declining duplicate push of %@", url);
+        stream.delegate = nil;
+        [self _sendRstStream:SPDY_STREAM_CANCEL streamId:streamId];
+        return;
+    }
+
+    SPDY_DEBUG(@"accepted push of %@ on SYN_STREAM.%u", url, streamId);
     _activeStreams[streamId] = stream;
+
+    // Response headers may arrive here or in a subsequent HEADERS frame
+    if (headers[@":status"]) {
+        [stream didReceiveResponse:headers];
+    }
+
+    if (!stream.closed) {
+        stream.remoteSideClosed = synStreamFrame.last;
+    }
 }
 
 - (void)didReadSynReplyFrame:(SPDYSynReplyFrame *)synReplyFrame frameDecoder:(SPDYFrameDecoder *)frameDecoder
@@ -655,6 +1029,9 @@
     SPDY_DEBUG(@"received RST_STREAM.%u (%u)", streamId, rstStreamFrame.statusCode);
 
     if (stream) {
+        // Whether refused or reset, the server will discard anything still queued for the stream
+        bool refunded = [self _removeUnsentDataForStream:stream] > 0;
+
         if (rstStreamFrame.statusCode == SPDY_STREAM_REFUSED_STREAM && [stream reset]) {
             [_delegate session:self refusedStream:stream];
             return;
@@ -662,6 +1039,10 @@
 
         stream.metadata.rxBytes += rstStreamFrame.encodedLength;
         [stream closeWithError:SPDY_STREAM_ERROR((SPDYStreamError)rstStreamFrame.statusCode, @"SPDY stream closed.")];
+
+        if (refunded) {
+            [self _sendData];
+        }
     }
 }
 
@@ -711,9 +1092,9 @@
         for (SPDYStream *stream in _activeStreams) {
             if (!stream.localSideClosed) {
                 stream.sendWindowSize = stream.sendWindowSize + deltaWindowSize;
-                [self _sendData:stream];
             }
         }
+        [self _sendData];
     }
 
     if (capacityIncreased) {
@@ -736,9 +1117,28 @@
 
     if (pingId & 1) {
         if (pingId == 1) {
-            _sessionLatency = _sessionPingStopwatch.elapsedSeconds;
-            SPDY_DEBUG(@"received PING.%u response (%f)", pingId, _sessionLatency);
-            _established = YES;
+            SPDYTimeInterval roundTripTime = _sessionPingStopwatch.elapsedSeconds;
+            SPDY_DEBUG(@"received PING.%u response (%f)", pingId, roundTripTime);
+            [self _didMeasureRoundTripTime:roundTripTime];
+            if (!_established) {
+                _established = YES;
+                [_delegate sessionEstablished:self];
+            }
+        } else if (pingId == WINDOW_SAMPLE_PING_ID && _receiveWindowTuner.sampling) {
+            SPDYTimeInterval roundTripTime = [SPDYStopwatch currentSystemTime] - _windowSamplePingTime;
+            [self _didMeasureRoundTripTime:roundTripTime];
+            if ([_receiveWindowTuner finishSampleWithRoundTripTime:roundTripTime]) {
+                [self _updateReceiveWindows];
+            }
+        } else if (pingId >= FIRST_KEEPALIVE_PING_ID) {
+            // Any keepalive response shows the connection is alive, but only the latest is timed
+            _missedKeepalivePings = 0;
+            if (pingId == _keepalivePingId) {
+                SPDYTimeInterval roundTripTime = [SPDYStopwatch currentSystemTime] - _keepalivePingTime;
+                SPDY_DEBUG(@"received PING.%u response (%f)", pingId, roundTripTime);
+                [self _didMeasureRoundTripTime:roundTripTime];
+                _keepalivePingId = 0;
+            }
         }
     } else {
         SPDY_DEBUG(@"received PING.%u", pingId);
@@ -798,7 +1198,14 @@
         return;
     }
 
-    stream.remoteSideClosed = headersFrame.last;
+    // Pushed streams may deliver their response headers after the SYN_STREAM
+    if (!stream.local && !stream.receivedReply && headersFrame.headers[@":status"]) {
+        [stream didReceiveResponse:headersFrame.headers];
+    }
+
+    if (!stream.closed) {
+        stream.remoteSideClosed = headersFrame.last;
+    }
 }
 
 - (void)didReadWindowUpdateFrame:(SPDYWindowUpdateFrame *)windowUpdateFrame frameDecoder:(SPDYFrameDecoder *)frameDecoder
@@ -824,10 +1231,7 @@
         }
 
         _sessionSendWindowSize += windowUpdateFrame.deltaWindowSize;
-        for (SPDYStream *stream in _activeStreams) {
-            [self _sendData:stream];
-            if (_sessionSendWindowSize == 0) break;
-        }
+        [self _sendData];
 
         return;
     }
@@ -846,7 +1250,7 @@
     }
 
     stream.sendWindowSize += windowUpdateFrame.deltaWindowSize;
-    [self _sendData:stream];
+    [self _sendData];
 }
 
 #pragma mark SPDYStreamDelegate
@@ -856,6 +1260,7 @@
     SPDY_INFO(@"stream %u canceled", stream.streamId);
     NSAssert(_activeStreams[stream.streamId], @"stream delegate must be managing stream");
 
+    bool refunded = [self _removeUnsentDataForStream:stream] > 0;
     [self _sendRstStream:SPDY_STREAM_CANCEL streamId:stream.streamId];
 
     // closeWithError will end up calling back into streamClosed below. It will also call out to
@@ -863,6 +1268,11 @@
     // we must stop making delegate calls out to the app.
     stream.client = nil;
     [stream closeWithError:SPDY_STREAM_ERROR(SPDYStreamCancel, @"stream canceled")];
+
+    // Other streams may now use the refunded session window
+    if (refunded) {
+        [self _sendData];
+    }
 }
 
 - (void)streamClosed:(SPDYStream *)stream
@@ -879,7 +1289,8 @@
     stream.metadata.timeStreamClosed = now;
 
     [_activeStreams removeStreamWithStreamId:stream.streamId];
-    if (!_receivedGoAwayFrame) {
+    [_delegate session:self closedStream:stream];
+    if (self.isOpen && !_unhealthy) {
         [_delegate session:self capacityIncreased:1];
     } else if (_activeStreams.count == 0) {
         [self close];
@@ -889,17 +1300,37 @@
 - (void)streamDataAvailable:(SPDYStream *)stream
 {
     SPDY_DEBUG(@"request body stream data available");
-    [self _sendData:stream];
+    [self _sendData];
 }
 
 - (void)streamDataFinished:(SPDYStream *)stream
 {
     SPDY_DEBUG(@"request body stream finished");
-    [self _sendData:stream];
+    [self _sendData];
 }
 
 #pragma mark private methods
 
+- (void)_compactInputBuffer
+{
+    // Only the unconsumed remainder of a partial frame is moved; anything the
+    // decoder has already handed off (including DATA payloads) is never copied.
+    NSUInteger unconsumedLength = _bufferWriteIndex - _bufferReadIndex;
+    if (_bufferReadIndex > 0) {
+        uint8_t *bytes = (uint8_t *)_inputBuffer.mutableBytes;
+        memmove(bytes, bytes + _bufferReadIndex, unconsumedLength);
+        _bufferReadIndex = 0;
+        _bufferWriteIndex = unconsumedLength;
+        SPDY_DEBUG(@"compacted input buffer (%lu)", (unsigned long)unconsumedLength);
+    }
+
+    // A single frame header can't fill the buffer, but never schedule a read with no space
+    if (_bufferWriteIndex >= _inputBuffer.length) {
+        SPDY_WARNING(@"growing input buffer for unconsumed input (%lu)", (unsigned long)unconsumedLength);
+        [_inputBuffer increaseLengthBy:INPUT_BUFFER_SIZE];
+    }
+}
+
 - (void)_sendServerPersistedSettings:(SPDYSettings *)persistedSettings
 {
     if (persistedSettings != NULL) {
@@ -925,10 +1356,46 @@
     settingsFrame.settings[SPDY_SETTINGS_INITIAL_WINDOW_SIZE].flags = 0;
     settingsFrame.settings[SPDY_SETTINGS_INITIAL_WINDOW_SIZE].value = (int32_t)_initialReceiveWindowSize;
 
+    // Servers only initiate pushed streams, so this tells the server whether to push at all
+    settingsFrame.settings[SPDY_SETTINGS_MAX_CONCURRENT_STREAMS].set = YES;
+    settingsFrame.settings[SPDY_SETTINGS_MAX_CONCURRENT_STREAMS].flags = 0;
+    settingsFrame.settings[SPDY_SETTINGS_MAX_CONCURRENT_STREAMS].value = (int32_t)_localMaxConcurrentStreams;
+
     [_frameEncoder encodeSettingsFrame:settingsFrame];
     SPDY_DEBUG(@"sent client SETTINGS");
 }
 
+- (void)_setConnectionMetadataForStream:(SPDYStream *)stream
+{
+    stream.metadata.timeSessionConnected = _connectedStopwatch.startSystemTime;
+    stream.metadata.hostAddress = _socket.connectedHost;
+    stream.metadata.hostPort = _socket.connectedPort;
+    stream.metadata.viaProxy = _socket.connectedToProxy;
+}
+
+- (bool)_serverTrustCoversHost:(NSString *)host
+{
+    SecTrustRef serverTrust = (__bridge SecTrustRef)_serverTrust;
+    CFIndex certificateCount = SecTrustGetCertificateCount(serverTrust);
+    if (certificateCount == 0) return NO;
+
+    NSMutableArray *certificates = [[NSMutableArray alloc] initWithCapacity:certificateCount];
+    for (CFIndex i = 0; i < certificateCount; i++) {
+        [certificates addObject:(__bridge id)SecTrustGetCertificateAtIndex(serverTrust, i)];
+    }
+
+    // Evaluate the same chain again, this time naming the other host
+    SecPolicyRef policy = SecPolicyCreateSSL(true, (__bridge CFStringRef)host);
+    SecTrustRef hostTrust = NULL;
+    OSStatus status = SecTrustCreateWithCertificates((__bridge CFArrayRef)certificates, policy, &hostTrust);
+    CFRelease(policy);
+    if (status != errSecSuccess || !hostTrust) return NO;
+
+    bool covered = [SPDYProtocol evaluateServerTrust:hostTrust forCoalescedHost:host];
+    CFRelease(hostTrust);
+    return covered;
+}
+
 - (void)_sendSynStream:(SPDYStream *)stream streamId:(SPDYStreamId)streamId closeLocal:(bool)close
 {
     SPDYSynStreamFrame *synStreamFrame = [[SPDYSynStreamFrame alloc] init];
@@ -952,10 +1419,55 @@
     }
 }
 
-- (void)_sendData:(SPDYStream *)stream
+/**
+  Schedules DATA frames across all active streams.
+
+  Priority levels are strict: a level is given every opportunity to send,
+  within the limits of flow control, before any stream at a lower priority.
+  Within a level, streams take turns sending at most _sendQuantum bytes each,
+  and a stream that sent moves behind its peers so the next scheduling pass
+  starts with someone else.
+*/
+- (void)_sendData
+{
+    // Sending can call back into the session (e.g. a stream closing with an error, or
+    // signaling more data); note the request and go around again rather than recursing.
+    if (_sendingData) {
+        _sendDataRequested = YES;
+        return;
+    }
+
+    _sendingData = YES;
+    do {
+        _sendDataRequested = NO;
+
+        for (uint8_t priority = 0; priority < 8; priority++) {
+            bool sent;
+            do {
+                sent = NO;
+                for (SPDYStream *stream in [_activeStreams streamsWithPriority:priority]) {
+                    // Skip streams closed earlier in this round
+                    if (_activeStreams[stream.streamId] != stream) {
+                        continue;
+                    }
+
+                    if ([self _sendData:stream maxLength:_sendQuantum] > 0) {
+                        [_activeStreams rotateStream:stream];
+                        sent = YES;
+                    }
+                }
+            } while (sent && _sessionSendWindowSize > 0);
+        }
+    } while (_sendDataRequested);
+    _sendingData = NO;
+}
+
+- (NSUInteger)_sendData:(SPDYStream *)stream maxLength:(NSUInteger)maxLength
 {
     SPDYStreamId streamId = stream.streamId;
     uint32_t sendWindowSize = MIN(_sessionSendWindowSize, stream.sendWindowSize);
+    uint32_t sendLength = (uint32_t)MIN((NSUInteger)sendWindowSize, maxLength);
+    NSUInteger totalBytesSent = 0;
 
     // Only track flow control blocks
     if (stream.localSideClosed || !stream.hasDataAvailable || sendWindowSize > 0) {
@@ -964,9 +1476,9 @@
         [stream markBlocked];
     }
 
-    while (!stream.localSideClosed && stream.hasDataAvailable && sendWindowSize > 0) {
+    while (!stream.localSideClosed && stream.hasDataAvailable && sendLength > 0) {
         NSError *error;
-        NSData *data = [stream readData:sendWindowSize error:&error];
+        NSData *data = [stream readData:sendLength error:&error];
 
         if (data) {
             SPDYDataFrame *dataFrame = [[SPDYDataFrame alloc] init];
@@ -988,7 +1500,8 @@
 
             // SPDY window accounting
             uint32_t bytesSent = (uint32_t)data.length;
-            sendWindowSize -= bytesSent;
+            sendLength -= bytesSent;
+            totalBytesSent += bytesSent;
             _sessionSendWindowSize -= bytesSent;
             stream.sendWindowSize -= bytesSent;
             stream.localSideClosed = dataFrame.last;
@@ -996,7 +1509,7 @@
             if (error) {
                 [self _sendRstStream:SPDY_STREAM_INTERNAL_ERROR streamId:streamId];
                 [stream closeWithError:error];
-                return;
+                return totalBytesSent;
             }
 
             // -[SPDYStream hasDataAvailable] may return true if we need to perform
@@ -1024,6 +1537,28 @@
         }
         stream.localSideClosed = YES;
     }
+
+    return totalBytesSent;
+}
+
+/**
+  Withdraws DATA frames for the stream that are still queued on the socket,
+  refunding their payload to the session and stream send windows. Returns the
+  number of payload bytes refunded.
+*/
+- (NSUInteger)_removeUnsentDataForStream:(SPDYStream *)stream
+{
+    NSUInteger payloadLength = 0;
+    NSUInteger frameLength = [_socket removeUnsentWritesForStreamId:stream.streamId payloadLength:&payloadLength];
+
+    if (frameLength > 0) {
+        stream.metadata.txBytes -= MIN(frameLength, stream.metadata.txBytes);
+        _sessionSendWindowSize += (uint32_t)payloadLength;
+        stream.sendWindowSize += (uint32_t)payloadLength;
+        SPDY_DEBUG(@"removed unsent DATA.%u (%lu)", stream.streamId, (unsigned long)payloadLength);
+    }
+
+    return payloadLength;
 }
 
 - (void)_sendWindowUpdate:(uint32_t)deltaWindowSize streamId:(SPDYStreamId)streamId
@@ -1032,9 +1567,151 @@
     windowUpdateFrame.streamId = streamId;
     windowUpdateFrame.deltaWindowSize = deltaWindowSize;
     [_frameEncoder encodeWindowUpdateFrame:windowUpdateFrame];
+    _windowUpdatesSent++;
     SPDY_DEBUG(@"sent WINDOW_UPDATE.%u (+%lu)", streamId, (unsigned long)deltaWindowSize);
 }
 
+- (void)_queueWindowUpdate:(uint32_t)deltaWindowSize stream:(SPDYStream *)stream
+{
+    // Window accounting is refilled right away; only the frame granting the
+    // credit waits for the end of the decode pass. Each credit added to one
+    // already queued is a WINDOW_UPDATE that doesn't have to be sent.
+    if (stream) {
+        if (stream.pendingReceiveWindowDelta > 0) {
+            _windowUpdatesCoalesced++;
+        } else {
+            [_streamsPendingWindowUpdate addObject:stream];
+        }
+        stream.pendingReceiveWindowDelta += deltaWindowSize;
+    } else {
+        if (_pendingSessionWindowDelta > 0) {
+            _windowUpdatesCoalesced++;
+        }
+        _pendingSessionWindowDelta += deltaWindowSize;
+    }
+}
+
+- (void)_flushWindowUpdates
+{
+    if (_pendingSessionWindowDelta > 0) {
+        [self _sendWindowUpdate:_pendingSessionWindowDelta streamId:kSPDYSessionStreamId];
+        _pendingSessionWindowDelta = 0;
+    }
+
+    for (SPDYStream *stream in _streamsPendingWindowUpdate) {
+        uint32_t deltaWindowSize = stream.pendingReceiveWindowDelta;
+        stream.pendingReceiveWindowDelta = 0;
+
+        // No more credit is needed once the peer has finished the stream
+        if (stream.closed || stream.remoteSideClosed) {
+            _windowUpdatesCoalesced++;
+        } else {
+            [self _sendWindowUpdate:deltaWindowSize streamId:stream.streamId];
+        }
+    }
+    [_streamsPendingWindowUpdate removeAllObjects];
+}
+
+- (void)_sampleReceivedLength:(NSUInteger)length
+{
+    // Each sample spans one PING round trip, and counts the DATA that arrives while it's in flight
+    if (_receiveWindowTuner.sampling) {
+        [_receiveWindowTuner didReceiveBytes:length];
+    } else if (!_sentGoAwayFrame) {
+        [_receiveWindowTuner startSample];
+        _windowSamplePingTime = [SPDYStopwatch currentSystemTime];
+        [self _sendPing:WINDOW_SAMPLE_PING_ID];
+    }
+}
+
+- (void)_updateReceiveWindows
+{
+    uint32_t windowSize = _receiveWindowTuner.windowSize;
+    uint32_t sessionTarget = MAX(MIN(windowSize, (uint32_t)_configuration.sessionReceiveWindow), (uint32_t)DEFAULT_WINDOW_SIZE);
+    uint32_t streamTarget = MIN(windowSize, (uint32_t)_configuration.streamReceiveWindow);
+
+    // Growth is granted right away; a smaller target only limits future WINDOW_UPDATEs
+    if (sessionTarget > _sessionReceiveWindowSize) {
+        [self _sendWindowUpdate:sessionTarget - _sessionReceiveWindowSize streamId:kSPDYSessionStreamId];
+        _sessionReceiveWindowSize = sessionTarget;
+    }
+    _sessionReceiveWindowTarget = sessionTarget;
+
+    // A larger INITIAL_WINDOW_SIZE also applies the difference to every open stream
+    if (streamTarget > _initialReceiveWindowSize) {
+        uint32_t deltaWindowSize = streamTarget - _initialReceiveWindowSize;
+        _initialReceiveWindowSize = streamTarget;
+        for (SPDYStream *stream in _activeStreams) {
+            if (!stream.remoteSideClosed) {
+                stream.receiveWindowSize = stream.receiveWindowSize + deltaWindowSize;
+            }
+        }
+        [self _sendClientSettings];
+    }
+    _streamReceiveWindowTarget = streamTarget;
+}
+
+- (void)_didMeasureRoundTripTime:(SPDYTimeInterval)roundTripTime
+{
+    // Smoothed as in RFC 6298
+    if (_smoothedRoundTripTime < 0) {
+        _smoothedRoundTripTime = roundTripTime;
+        _roundTripTimeVariance = roundTripTime / 2;
+    } else {
+        _roundTripTimeVariance = 0.75 * _roundTripTimeVariance + 0.25 * fabs(_smoothedRoundTripTime - roundTripTime);
+        _smoothedRoundTripTime = 0.875 * _smoothedRoundTripTime + 0.125 * roundTripTime;
+    }
+    _sessionLatency = _smoothedRoundTripTime;
+}
+
+- (void)_startKeepalive
+{
+    NSTimeInterval interval = _configuration.keepalivePingInterval;
+    if (interval <= 0 || _keepaliveTimer) {
+        return;
+    }
+
+    _keepaliveTimer = [NSTimer timerWithTimeInterval:interval
+                                              target:[[SPDYKeepaliveTimerTarget alloc] initWithSession:self]
+                                            selector:@selector(timerFired:)
+                                            userInfo:nil
+                                             repeats:YES];
+    for (NSString *runLoopMode in _socket.runLoopModes) {
+        CFRunLoopAddTimer(CFRunLoopGetCurrent(), (__bridge CFRunLoopTimerRef)_keepaliveTimer, (__bridge CFStringRef)runLoopMode);
+    }
+}
+
+- (void)_stopKeepalive
+{
+    [_keepaliveTimer invalidate];
+    _keepaliveTimer = nil;
+}
+
+- (void)_keepaliveTimerFired
+{
+    if (_keepalivePingId) {
+        _missedKeepalivePings++;
+        SPDY_DEBUG(@"%@ missed PING.%u response (%lu)", self, _keepalivePingId, (unsigned long)_missedKeepalivePings);
+
+        if (!_unhealthy && _missedKeepalivePings >= MAX(_configuration.keepaliveMaxMissedPings, (NSUInteger)1)) {
+            SPDY_WARNING(@"%@ unhealthy after %lu unanswered PINGs", self, (unsigned long)_missedKeepalivePings);
+            _unhealthy = YES;
+            [_delegate sessionBecameUnhealthy:self];
+
+            // Let in-flight streams finish, since the connection may yet recover
+            if (_activeStreams.count == 0) {
+                [self close];
+                return;
+            }
+        }
+    }
+
+    _keepalivePingId = _nextKeepalivePingId;
+    _nextKeepalivePingId += 2;
+    _keepalivePingTime = [SPDYStopwatch currentSystemTime];
+    [self _sendPing:_keepalivePingId];
+}
+
 - (void)_sendPing:(SPDYPingId)pingId
 {
     SPDYPingFrame *pingFrame = [[SPDYPingFrame alloc] init];
@@ -18,4 +18,12 @@
 + (SPDYSessionManager *)localManagerForOrigin:(SPDYOrigin *)origin;
 - (void)queueStream:(SPDYStream *)stream;
 
+/**
+  Fills the active session pool with up to sessionCount sessions and sends
+  each one's initial PING. The completion is called once every session has
+  either been established or failed.
+*/
+- (void)preconnectSessions:(NSUInteger)sessionCount
+                completion:(void (^)(NSUInteger readySessions, NSError *error))completion;
+
 @end
@@ -13,15 +13,23 @@
 #error "This file requires ARC support."
 #endif
 
+#import <CFNetwork/CFNetwork.h>
 #import <SystemConfiguration/SystemConfiguration.h>
 #import "SPDYStreamManager.h"
 #import <arpa/inet.h>
+#import <netdb.h>
 #import "SPDYCommonLogger.h"
+#import "SPDYConnectionBudget.h"
+#import "SPDYMetadata+Utils.h"
 #import "SPDYOrigin.h"
-#import "SPDYProtocol.h"
+#import "SPDYProtocol+Project.h"
+#import "SPDYPushCache.h"
+#import "SPDYRequestCoalescer.h"
+#import "SPDYRequestHedger.h"
 #import "SPDYSession.h"
 #import "SPDYSessionManager.h"
 #import "SPDYSessionPool.h"
+#import "SPDYStopwatch.h"
 #import "SPDYStreamManager.h"
 #import "SPDYStream.h"
 #import "NSURLRequest+SPDYURLRequest.h"
@@ -29,23 +37,72 @@
 static NSString *const SPDYSessionManagerKey = @"com.twitter.SPDYSessionManager";
 
 static void SPDYReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkReachabilityFlags flags, void *info);
+static void SPDYHostResolutionCallback(CFHostRef host, CFHostInfoType typeInfo, const CFStreamError *error, void *info);
 
-@interface SPDYSessionManager () <SPDYSessionDelegate, SPDYStreamDelegate>
+@interface SPDYSessionManager () <SPDYConnectionBudgetClient, SPDYPushCacheDelegate, SPDYRequestHedgerDelegate, SPDYSessionDelegate, SPDYStreamDelegate>
 - (void)session:(SPDYSession *)session capacityIncreased:(NSUInteger)capacity;
+- (void)session:(SPDYSession *)session closedStream:(SPDYStream *)stream;
 - (void)session:(SPDYSession *)session connectedToNetwork:(bool)cellular;
 - (void)sessionClosed:(SPDYSession *)session;
+- (void)sessionBecameUnhealthy:(SPDYSession *)session;
+- (void)sessionEstablished:(SPDYSession *)session;
 - (void)streamCanceled:(SPDYStream *)stream;
 @end
 
+// Tracks one preconnect call until each of its sessions is established or fails
+@interface SPDYPreconnect : NSObject
+@property (nonatomic, copy) void (^completion)(NSUInteger readySessions, NSError *error);
+@property (nonatomic, readonly) NSMutableSet *pendingSessions;
+@property (nonatomic) NSUInteger sessionCount;
+@property (nonatomic) NSUInteger readySessions;
+@property (nonatomic) NSError *error;
+@property (nonatomic) bool waitingForBudget;
+@end
+
+@implementation SPDYPreconnect
+
+- (id)init
+{
+    self = [super init];
+    if (self) {
+        _pendingSessions = [[NSMutableSet alloc] init];
+        _sessionCount = 0;
+        _readySessions = 0;
+        _waitingForBudget = NO;
+    }
+    return self;
+}
+
+@end
+
 @implementation SPDYSessionManager
 {
     SPDYOrigin *_origin;
     SPDYSessionPool *_basePool;
     SPDYSessionPool *_wwanPool;
     SPDYStreamManager *_pendingStreams;
+    SPDYPushCache *_pushCache;
+    SPDYRequestCoalescer *_coalescer;
+    SPDYRequestHedger *_hedger;
     volatile BOOL _cellular;
     NSArray *_runLoopModes;
     NSTimer *_dispatchTimer;
+    NSMutableArray *_preconnects;
+    NSMapTable *_warmSessionDeadlines;
+    NSTimer *_warmSessionTimer;
+    NSMutableSet *_drainingSessions;
+    NSTimer *_migrationTimer;
+    __weak SPDYSession *_coalescedSession;
+    __weak SPDYSessionManager *_coalescedOwner;
+    NSHashTable *_coalescedManagers;
+    NSSet *_resolvedAddresses;
+    CFHostRef _hostRef;
+    NSHashTable *_budgetedSessions;
+    NSHashTable *_budgetedStreams;
+    NSUInteger _budgetedSessionCount;
+    NSUInteger _budgetedStreamCount;
+    NSMapTable *_budgetQueueStartTimes;
+    bool _waitingForBudget;
     SCNetworkReachabilityRef _rRef;
 }
 
@@ -75,6 +132,16 @@ static void SPDYReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkR
         _pendingStreams = [[SPDYStreamManager alloc] init];
         _basePool = [[SPDYSessionPool alloc] init];
         _wwanPool = [[SPDYSessionPool alloc] init];
+        _preconnects = [[NSMutableArray alloc] init];
+        _warmSessionDeadlines = [NSMapTable strongToStrongObjectsMapTable];
+        _drainingSessions = [[NSMutableSet alloc] init];
+        _coalescedManagers = [NSHashTable weakObjectsHashTable];
+        _budgetedSessions = [NSHashTable weakObjectsHashTable];
+        _budgetedStreams = [NSHashTable weakObjectsHashTable];
+        _budgetedSessionCount = 0;
+        _budgetedStreamCount = 0;
+        _budgetQueueStartTimes = [NSMapTable weakToStrongObjectsMapTable];
+        _waitingForBudget = NO;
         _cellular = NO;
 
         NSString *currentMode = [[NSRunLoop currentRunLoop] currentMode];
@@ -106,6 +173,10 @@ static void SPDYReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkR
 
 - (void)dealloc
 {
+    [_migrationTimer invalidate];
+    [self _stopResolvingHost];
+    [[SPDYConnectionBudget sharedBudget] releaseSessions:_budgetedSessionCount];
+    [[SPDYConnectionBudget sharedBudget] releaseStreams:_budgetedStreamCount];
     if (_rRef) {
         SCNetworkReachabilitySetDispatchQueue(_rRef, NULL);
         CFRelease(_rRef);
@@ -116,6 +187,36 @@ static void SPDYReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkR
 {
     NSAssert(stream.protocol != nil, @"can only enqueue local streams");
 
+    if (_pushCache && [_pushCache serveStream:stream]) {
+        return;
+    }
+
+    // Pushes for this origin on a shared session are cached by the session's own manager
+    SPDYPushCache *coalescedPushCache = _coalescedSession.pushCache;
+    if (coalescedPushCache && coalescedPushCache != _pushCache && [coalescedPushCache serveStream:stream]) {
+        return;
+    }
+
+    if (!_coalescer && [SPDYProtocol currentConfiguration].enableRequestCoalescing) {
+        _coalescer = [[SPDYRequestCoalescer alloc] init];
+    }
+
+    if (_coalescer) {
+        stream = [_coalescer coalesceStream:stream];
+        if (!stream) {
+            SPDY_DEBUG(@"coalesced %lu of %lu requests to %@", (unsigned long)_coalescer.coalescedCount, (unsigned long)_coalescer.requestCount, _origin);
+            return;
+        }
+    }
+
+    if (stream.request.SPDYHedgeAfter > 0) {
+        if (!_hedger) {
+            _hedger = [[SPDYRequestHedger alloc] initWithRunLoopModes:_runLoopModes];
+            _hedger.delegate = self;
+        }
+        stream = [_hedger hedgeStream:stream];
+    }
+
     SPDY_INFO(@"queueing request: %@", stream.request.URL);
     [_pendingStreams addStream:stream];
     stream.delegate = self;
@@ -147,6 +248,117 @@ static void SPDYReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkR
     }
 }
 
+- (void)preconnectSessions:(NSUInteger)sessionCount
+                completion:(void (^)(NSUInteger readySessions, NSError *error))completion
+{
+    SPDYPreconnect *preconnect = [[SPDYPreconnect alloc] init];
+    preconnect.completion = completion;
+    preconnect.sessionCount = sessionCount;
+    [self _startPreconnect:preconnect];
+}
+
+- (void)_startPreconnect:(SPDYPreconnect *)preconnect
+{
+    bool cellular = _cellular;
+    SPDYSessionPool *activePool = cellular ? _wwanPool : _basePool;
+    SPDYConfiguration *configuration = [SPDYProtocol currentConfiguration];
+    NSUInteger size = MIN(MAX(preconnect.sessionCount, (NSUInteger)1), configuration.sessionPoolSize);
+
+    NSMutableSet *existingSessions = [[NSMutableSet alloc] init];
+    for (SPDYSession *session in activePool) {
+        [existingSessions addObject:session];
+    }
+
+    if (activePool.count < size) {
+        SPDY_DEBUG(@"preconnecting %@ session pool", cellular ? @"WLAN" : @"WIFI");
+        preconnect.error = [self _fillSessionPool:activePool cellular:cellular size:size];
+    }
+
+    // Without a single session to warm, the global session budget is spent, and the
+    // preconnect is started again once it may not be
+    if (activePool.count == 0 && !preconnect.error && _waitingForBudget) {
+        SPDY_DEBUG(@"preconnect to %@ waiting for session budget", _origin);
+        preconnect.waitingForBudget = YES;
+        [_preconnects addObject:preconnect];
+        return;
+    }
+
+    CFAbsoluteTime deadline = CFAbsoluteTimeGetCurrent() + configuration.preconnectIdleTimeout;
+    for (SPDYSession *session in activePool) {
+        if (![existingSessions containsObject:session]) {
+            [_warmSessionDeadlines setObject:@(deadline) forKey:session];
+        }
+
+        if (session.isEstablished) {
+            preconnect.readySessions += 1;
+        } else if (session.isOpen && session.isHealthy) {
+            [preconnect.pendingSessions addObject:session];
+            [session establish];
+        }
+    }
+    [self _scheduleWarmSessionExpiry];
+
+    if (preconnect.pendingSessions.count > 0) {
+        [_preconnects addObject:preconnect];
+    } else {
+        [self _completePreconnect:preconnect];
+    }
+}
+
+#pragma mark SPDYPushCacheDelegate
+
+- (void)pushCache:(SPDYPushCache *)pushCache failedToServeStream:(SPDYStream *)stream
+{
+    SPDY_DEBUG(@"push for %@ unavailable, loading from network", stream.request.URL);
+    SPDYSessionManager *coalescedManager = [self _coalescedManagerForStream:stream];
+    if (coalescedManager) {
+        [coalescedManager queueStream:stream];
+    } else {
+        [self queueStream:stream];
+    }
+}
+
+#pragma mark SPDYRequestHedgerDelegate
+
+- (bool)requestHedger:(SPDYRequestHedger *)hedger openHedgeStream:(SPDYStream *)stream avoidingSession:(SPDYSession *)session
+{
+    // A hedge never takes capacity that a queued request is waiting for
+    if (_pendingStreams.count > 0) return NO;
+
+    SPDYSessionPool *activePool = _cellular ? _wwanPool : _basePool;
+    SPDYSessionSelectionPolicy policy = [SPDYProtocol currentConfiguration].sessionSelectionPolicy;
+    SPDYSession *hedgeSession = [activePool nextSessionWithPolicy:policy excludingSession:session];
+    if (!hedgeSession) return NO;
+
+    // Nor does it wait on, or count against the fairness of, the global budget
+    if (![[SPDYConnectionBudget sharedBudget] acquireStreamForClient:self waitIfUnavailable:NO]) return NO;
+    [_budgetedStreams addObject:stream];
+    _budgetedStreamCount += 1;
+
+    [_warmSessionDeadlines removeObjectForKey:hedgeSession];
+    [hedgeSession openStream:stream];
+    return YES;
+}
+
+#pragma mark SPDYConnectionBudgetClient
+
+- (SPDYOrigin *)origin
+{
+    return _origin;
+}
+
+- (NSArray *)runLoopModes
+{
+    return _runLoopModes;
+}
+
+- (void)connectionBudgetAvailable
+{
+    // Wait again only if the budget is still needed, so as not to hold up other origins
+    [self _withdrawFromBudget];
+    [self _dispatch];
+}
+
 #pragma mark SPDYStreamDelegate
 
 - (void)streamCanceled:(SPDYStream *)stream
@@ -174,15 +386,30 @@ static void SPDYReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkR
 
 #pragma mark private methods
 
-- (void)_fillSessionPool:(SPDYSessionPool *)sessionPool cellular:(bool)cellular
+- (NSError *)_fillSessionPool:(SPDYSessionPool *)sessionPool cellular:(bool)cellular size:(NSUInteger)size
 {
     NSParameterAssert(sessionPool);
     NSError *error = nil;
 
     SPDYConfiguration *configuration = [SPDYProtocol currentConfiguration];
-    NSUInteger size = configuration.sessionPoolSize;
 
+    if (configuration.enableServerPush && !_pushCache) {
+        _pushCache = [[SPDYPushCache alloc] initWithMaxBytes:configuration.pushCacheMaxBytes
+                                                      maxAge:configuration.pushCacheMaxAge];
+        _pushCache.delegate = self;
+    }
+
+    SPDYConnectionBudget *budget = [SPDYConnectionBudget sharedBudget];
     while (sessionPool.count < size) {
+        // Only an origin left without any session waits for the global budget
+        if (![budget acquireSessionForClient:self waitIfUnavailable:(sessionPool.count == 0)]) {
+            SPDY_DEBUG(@"session budget spent, %@ has %lu sessions", _origin, (unsigned long)sessionPool.count);
+            if (sessionPool.count == 0) {
+                [self _budgetUnavailable];
+            }
+            break;
+        }
+
         SPDYSession *session = [[SPDYSession alloc] initWithOrigin:_origin
                                                           delegate:self
                                                      configuration:configuration
@@ -190,74 +417,447 @@ static void SPDYReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkR
                                                              error:&error];
 
         if (!session || error) {
+            [budget releaseSessions:1];
             if (sessionPool.count == 0) {
+                NSMutableArray *failedStreams = [[NSMutableArray alloc] init];
                 for (SPDYStream *stream in _pendingStreams) {
-                    stream.delegate = nil;
-                    SPDYProtocol *protocol = stream.protocol;
-                    [protocol.client URLProtocol:protocol didFailWithError:error];
+                    [failedStreams addObject:stream];
                 }
                 [_pendingStreams removeAllStreams];
-                return;
+
+                // Each stream fails through its own client, which may be a coalesced or hedged
+                // request, or may have to reach its protocol on another thread
+                for (SPDYStream *stream in failedStreams) {
+                    stream.delegate = nil;
+                    [self _stopBudgetQueueClockForStream:stream];
+                    [stream closeWithError:error];
+                }
+                return error;
             } else {
                 SPDY_WARNING(@"failed allocating extra session to pool: %@", error);
                 continue;
             }
         }
 
+        // With a session of its own, this origin stops borrowing another's
+        [self _stopCoalescing];
+
+        session.pushCache = _pushCache;
         [sessionPool add:session];
         sessionPool.pendingCount += 1;
+        [_budgetedSessions addObject:session];
+        _budgetedSessionCount += 1;
         SPDY_DEBUG(@"%@ created", session);
+
+        // From here on, pending streams are waiting on the connection rather than the budget
+        for (SPDYStream *stream in _pendingStreams) {
+            [self _stopBudgetQueueClockForStream:stream];
+        }
     }
+
+    return nil;
 }
 
 - (void)_dispatch
 {
     if (_dispatchTimer) _dispatchTimer = nil;
-    if (_pendingStreams.count == 0) return;
+    [self _releaseBudget];
+
+    // A shared session that closed or became unhealthy no longer carries this origin's streams
+    if (_coalescedOwner && ![_coalescedSession canCoalesceOrigin:_origin]) {
+        [self _stopCoalescing];
+    }
+
+    [self _resumePreconnectsWaitingForBudget];
+
+    if (_pendingStreams.count == 0) {
+        if (![self _hasPreconnectWaitingForBudget]) {
+            [self _withdrawFromBudget];
+        }
+        return;
+    }
 
     bool cellular = _cellular;
     SPDYSessionPool *activePool = cellular ? _wwanPool : _basePool;
+    SPDYConfiguration *configuration = [SPDYProtocol currentConfiguration];
+
+    // Until this origin has sessions of its own, another origin's session may carry its streams
+    if (activePool.count == 0 && configuration.enableSessionCoalescing && [self _dispatchToCoalescedSession]) {
+        return;
+    }
 
     if (activePool.count == 0) {
         SPDY_DEBUG(@"filling %@ session pool", cellular ? @"WLAN" : @"WIFI");
-        [self _fillSessionPool:activePool cellular:cellular];
+        [self _fillSessionPool:activePool cellular:cellular size:configuration.sessionPoolSize];
+
         // Once the sessions finish connecting, we'll dispatch again. Until then let's keep
-        // the pending streams pending.
-        return;
+        // the pending streams pending, unless they may be opened on connecting sessions.
+        if (!configuration.enableOptimisticDispatch) {
+            return;
+        }
     }
 
-    SPDYSession *session;
-    double allocation = 1.0 / (activePool.pendingCount + 1);
-    double holdback = 1.0 - allocation;
+    SPDYConnectionBudget *budget = [SPDYConnectionBudget sharedBudget];
 
-    for (int i = 0; _pendingStreams.count > 0 && i < activePool.count; i++) {
-        session = [activePool nextSession];
+    // Place streams in priority order, choosing a session for each one, until no
+    // session in the pool has capacity left
+    while (_pendingStreams.count > 0) {
+        SPDYStream *stream = [_pendingStreams nextPriorityStream];
+        SPDYSessionSelectionPolicy policy = stream.hasDataPending ?
+            configuration.uploadSessionSelectionPolicy : configuration.sessionSelectionPolicy;
 
-        // TODO: by all accounts this should never happen; keeping cleanup temporarily
-        NSAssert(session, @"session pool should have sessions");
-        if (!session) {
-            SPDY_DEBUG(@"filling %@ session pool due to no session", cellular ? @"WLAN" : @"WIFI");
-            [self _fillSessionPool:activePool cellular:cellular];
-            return;
+        SPDYSession *session = [activePool nextSessionWithPolicy:policy];
+        if (!session) break;
+
+        // Streams over the global budget stay pending until streams close, here or elsewhere
+        if (![budget acquireStreamForClient:self waitIfUnavailable:YES]) {
+            [self _budgetUnavailable];
+            break;
+        }
+
+        [self _openStream:stream onSession:session];
+    }
+}
+
+- (void)_openStream:(SPDYStream *)stream onSession:(SPDYSession *)session
+{
+    [_pendingStreams removeStreamForProtocol:stream.protocol];
+    stream.delegate = nil;
+    [self _stopBudgetQueueClockForStream:stream];
+    [_budgetedStreams addObject:stream];
+    _budgetedStreamCount += 1;
+    [_warmSessionDeadlines removeObjectForKey:session];
+    [session openStream:stream];
+    [_hedger stream:stream openedOnSession:session];
+}
+
+- (void)_budgetUnavailable
+{
+    _waitingForBudget = YES;
+
+    // Queue time runs from when a stream is first held back by the budget
+    NSNumber *now = @([SPDYStopwatch currentSystemTime]);
+    for (SPDYStream *stream in _pendingStreams) {
+        if (![_budgetQueueStartTimes objectForKey:stream]) {
+            [_budgetQueueStartTimes setObject:now forKey:stream];
+        }
+    }
+}
+
+- (void)_stopBudgetQueueClockForStream:(SPDYStream *)stream
+{
+    NSNumber *startTime = [_budgetQueueStartTimes objectForKey:stream];
+    if (startTime) {
+        SPDYTimeInterval queuedTime = [SPDYStopwatch currentSystemTime] - startTime.doubleValue;
+        stream.metadata.queuedMs += (NSUInteger)(queuedTime * 1000);
+        [_budgetQueueStartTimes removeObjectForKey:stream];
+    }
+}
+
+- (void)_withdrawFromBudget
+{
+    if (_waitingForBudget) {
+        _waitingForBudget = NO;
+        [[SPDYConnectionBudget sharedBudget] withdrawClient:self];
+    }
+}
+
+// Returns the budget held for sessions and streams that have since closed
+- (void)_releaseBudget
+{
+    NSUInteger openStreamCount = 0;
+    for (SPDYStream *stream in [_budgetedStreams allObjects]) {
+        if (stream.closed) {
+            [_budgetedStreams removeObject:stream];
+        } else {
+            openStreamCount += 1;
+        }
+    }
+
+    SPDYConnectionBudget *budget = [SPDYConnectionBudget sharedBudget];
+    if (_budgetedStreamCount > openStreamCount) {
+        [budget releaseStreams:_budgetedStreamCount - openStreamCount];
+        _budgetedStreamCount = openStreamCount;
+    }
+
+    NSUInteger openSessionCount = [_budgetedSessions allObjects].count;
+    if (_budgetedSessionCount > openSessionCount) {
+        [budget releaseSessions:_budgetedSessionCount - openSessionCount];
+        _budgetedSessionCount = openSessionCount;
+    }
+}
+
+- (bool)_hasPreconnectWaitingForBudget
+{
+    for (SPDYPreconnect *preconnect in _preconnects) {
+        if (preconnect.waitingForBudget) return YES;
+    }
+    return NO;
+}
+
+- (void)_resumePreconnectsWaitingForBudget
+{
+    for (SPDYPreconnect *preconnect in [_preconnects copy]) {
+        if (!preconnect.waitingForBudget) continue;
+
+        [_preconnects removeObjectIdenticalTo:preconnect];
+        preconnect.waitingForBudget = NO;
+        [self _startPreconnect:preconnect];
+    }
+}
+
+- (void)_session:(SPDYSession *)session finishedPreconnectWithError:(NSError *)error
+{
+    for (SPDYPreconnect *preconnect in [_preconnects copy]) {
+        if (![preconnect.pendingSessions containsObject:session]) continue;
+
+        [preconnect.pendingSessions removeObject:session];
+        if (error) {
+            if (!preconnect.error) preconnect.error = error;
+        } else {
+            preconnect.readySessions += 1;
+        }
+
+        if (preconnect.pendingSessions.count == 0) {
+            [_preconnects removeObject:preconnect];
+            [self _completePreconnect:preconnect];
+        }
+    }
+}
+
+- (void)_completePreconnect:(SPDYPreconnect *)preconnect
+{
+    NSUInteger readySessions = preconnect.readySessions;
+    NSError *error = readySessions > 0 ? nil : preconnect.error;
+    SPDY_DEBUG(@"preconnect to %@ finished with %lu ready sessions", _origin, (unsigned long)readySessions);
+
+    if (preconnect.completion) {
+        preconnect.completion(readySessions, error);
+    }
+}
+
+- (void)_scheduleWarmSessionExpiry
+{
+    CFAbsoluteTime nextDeadline = 0;
+    for (SPDYSession *session in _warmSessionDeadlines) {
+        CFAbsoluteTime deadline = [[_warmSessionDeadlines objectForKey:session] doubleValue];
+        if (nextDeadline == 0 || deadline < nextDeadline) nextDeadline = deadline;
+    }
+
+    if (nextDeadline == 0) {
+        [_warmSessionTimer invalidate];
+        _warmSessionTimer = nil;
+    } else if (_warmSessionTimer) {
+        CFRunLoopTimerSetNextFireDate((__bridge CFRunLoopTimerRef)_warmSessionTimer, nextDeadline);
+    } else {
+        _warmSessionTimer = [NSTimer timerWithTimeInterval:MAX(nextDeadline - CFAbsoluteTimeGetCurrent(), 0)
+                                                    target:self
+                                                  selector:@selector(_expireWarmSessions)
+                                                  userInfo:nil
+                                                   repeats:NO];
+        for (NSString *runLoopMode in _runLoopModes) {
+            CFRunLoopAddTimer(CFRunLoopGetCurrent(), (__bridge CFRunLoopTimerRef)_warmSessionTimer, (__bridge CFStringRef)runLoopMode);
+        }
+    }
+}
+
+- (void)_expireWarmSessions
+{
+    _warmSessionTimer = nil;
+
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    NSMutableArray *expiredSessions = [[NSMutableArray alloc] init];
+    for (SPDYSession *session in _warmSessionDeadlines) {
+        if ([[_warmSessionDeadlines objectForKey:session] doubleValue] <= now) {
+            [expiredSessions addObject:session];
         }
+    }
+
+    for (SPDYSession *session in expiredSessions) {
+        [_warmSessionDeadlines removeObjectForKey:session];
+        if (session.load == 0) {
+            SPDY_INFO(@"%@ unused since preconnect, closing", session);
+            [session close];
+        }
+    }
+
+    [self _scheduleWarmSessionExpiry];
+}
+
+- (bool)_dispatchToCoalescedSession
+{
+    SPDYSession *session = _coalescedSession;
+    if (session && ![session canCoalesceOrigin:_origin]) {
+        SPDY_DEBUG(@"%@ can no longer carry streams for %@", session, _origin);
+        session = nil;
+    }
+
+    if (!session) {
+        [self _stopCoalescing];
+
+        // Streams stay pending while the host resolves, and are dispatched once it has
+        if (_hostRef) return YES;
+        if (!_resolvedAddresses) {
+            return [self _coalescingCandidates].count > 0 && [self _startResolvingHost];
+        }
+
+        session = [self _findCoalescableSession];
+        _resolvedAddresses = nil;
+        if (!session) return NO;
+
+        SPDY_INFO(@"coalescing %@ onto %@", _origin, session);
+        _coalescedSession = session;
+        _coalescedOwner = (SPDYSessionManager *)session.delegate;
+        [_coalescedOwner->_coalescedManagers addObject:self];
+    }
+
+    SPDYConnectionBudget *budget = [SPDYConnectionBudget sharedBudget];
+    while (_pendingStreams.count > 0 && session.capacity > 0) {
+        if (![budget acquireStreamForClient:self waitIfUnavailable:YES]) {
+            [self _budgetUnavailable];
+            break;
+        }
+        [self _openStream:[_pendingStreams nextPriorityStream] onSession:session];
+    }
+
+    return YES;
+}
+
+// Sessions of other origins on this thread that might be shared, before checking addresses
+- (NSArray *)_coalescingCandidates
+{
+    NSMutableArray *candidates = [[NSMutableArray alloc] init];
+    NSDictionary *originDictionary = [NSThread currentThread].threadDictionary[SPDYSessionManagerKey];
 
-        if (!session.isConnected) continue;
+    for (SPDYOrigin *origin in originDictionary) {
+        SPDYSessionManager *manager = originDictionary[origin];
+        if (manager == self) continue;
 
-        NSUInteger count = MIN(session.capacity, _pendingStreams.count);
-        if (count > 0) {
-            // Load-balance when a session has recently connected
-            if (!session.isEstablished) {
-                count = MIN(count, (NSUInteger)ceil(allocation * _pendingStreams.localCount - holdback * session.load));
+        SPDYSessionPool *pool = manager->_cellular ? manager->_wwanPool : manager->_basePool;
+        for (SPDYSession *session in pool) {
+            if (session.peerAddress && session.isOpen && session.origin.port == _origin.port &&
+                [session.origin.scheme isEqualToString:_origin.scheme]) {
+                [candidates addObject:session];
             }
+        }
+    }
+
+    return candidates;
+}
+
+- (SPDYSession *)_findCoalescableSession
+{
+    SPDYSession *bestSession = nil;
+    for (SPDYSession *session in [self _coalescingCandidates]) {
+        if (![_resolvedAddresses containsObject:session.peerAddress]) continue;
+        if (![session canCoalesceOrigin:_origin]) continue;
+
+        if (!bestSession || session.load < bestSession.load) {
+            bestSession = session;
+        }
+    }
+    return bestSession;
+}
+
+// Streams may outlive the other origin's use of our session, so they're matched to their
+// manager by origin rather than by whether it's still coalescing onto us
+- (SPDYSessionManager *)_coalescedManagerForStream:(SPDYStream *)stream
+{
+    if ([stream.request.URL.host isEqualToString:_origin.host]) return nil;
+
+    SPDYOrigin *origin = [[SPDYOrigin alloc] initWithURL:stream.request.URL error:nil];
+    SPDYOrigin *aliasedOrigin = [SPDYProtocol originForAlias:origin];
+    if (aliasedOrigin) {
+        origin = aliasedOrigin;
+    }
 
-            for (int j = 0; j < count; j++) {
-                SPDYStream *stream = [_pendingStreams nextPriorityStream];
-                [_pendingStreams removeStreamForProtocol:stream.protocol];
-                stream.delegate = nil;
-                [session openStream:stream];
+    if (!origin || [origin isEqual:_origin]) return nil;
+
+    NSDictionary *originDictionary = [NSThread currentThread].threadDictionary[SPDYSessionManagerKey];
+    return originDictionary[origin];
+}
+
+- (void)_stopCoalescing
+{
+    if (_coalescedOwner) {
+        SPDY_DEBUG(@"%@ no longer coalescing onto %@", _origin, _coalescedOwner->_origin);
+        [_coalescedOwner->_coalescedManagers removeObject:self];
+        _coalescedOwner = nil;
+    }
+    _coalescedSession = nil;
+}
+
+- (void)_dispatchCoalescedManagers
+{
+    for (SPDYSessionManager *manager in [_coalescedManagers allObjects]) {
+        [manager _dispatch];
+    }
+}
+
+- (bool)_startResolvingHost
+{
+    NSString *host = _origin.host;
+
+    // Literal addresses need no lookup
+    struct in6_addr address;
+    if (inet_pton(AF_INET, host.UTF8String, &address) == 1 || inet_pton(AF_INET6, host.UTF8String, &address) == 1) {
+        _resolvedAddresses = [NSSet setWithObject:host];
+        return [self _dispatchToCoalescedSession];
+    }
+
+    _hostRef = CFHostCreateWithName(kCFAllocatorDefault, (__bridge CFStringRef)host);
+    CFHostClientContext context = {0, (__bridge void *)self, NULL, NULL, NULL};
+    CFHostSetClient(_hostRef, SPDYHostResolutionCallback, &context);
+    for (NSString *runLoopMode in _runLoopModes) {
+        CFHostScheduleWithRunLoop(_hostRef, CFRunLoopGetCurrent(), (__bridge CFStringRef)runLoopMode);
+    }
+
+    CFStreamError error;
+    if (!CFHostStartInfoResolution(_hostRef, kCFHostAddresses, &error)) {
+        SPDY_WARNING(@"unable to resolve %@ for session coalescing, error %d", host, (int)error.error);
+        [self _stopResolvingHost];
+        return NO;
+    }
+
+    SPDY_DEBUG(@"resolving %@ for session coalescing", host);
+    return YES;
+}
+
+- (void)_stopResolvingHost
+{
+    if (!_hostRef) return;
+
+    CFHostCancelInfoResolution(_hostRef, kCFHostAddresses);
+    CFHostSetClient(_hostRef, NULL, NULL);
+    for (NSString *runLoopMode in _runLoopModes) {
+        CFHostUnscheduleFromRunLoop(_hostRef, CFRunLoopGetCurrent(), (__bridge CFStringRef)runLoopMode);
+    }
+    CFRelease(_hostRef);
+    _hostRef = NULL;
+}
+
+- (void)_hostResolved:(bool)success
+{
+    NSMutableSet *addresses = [[NSMutableSet alloc] init];
+
+    Boolean hasBeenResolved = false;
+    CFArrayRef addressing = success ? CFHostGetAddressing(_hostRef, &hasBeenResolved) : NULL;
+    if (addressing && hasBeenResolved) {
+        for (NSData *addressData in (__bridge NSArray *)addressing) {
+            char addressBuffer[NI_MAXHOST];
+            const struct sockaddr *sockaddr = (const struct sockaddr *)addressData.bytes;
+            if (getnameinfo(sockaddr, (socklen_t)addressData.length, addressBuffer, sizeof(addressBuffer), NULL, 0, NI_NUMERICHOST) == 0) {
+                [addresses addObject:[NSString stringWithCString:addressBuffer encoding:NSASCIIStringEncoding]];
             }
         }
     }
+
+    [self _stopResolvingHost];
+    SPDY_DEBUG(@"resolved %@ to %@", _origin.host, addresses);
+
+    // An empty set still ends the lookup, so the pool is filled as usual
+    _resolvedAddresses = addresses;
+    [self _dispatch];
 }
 
 #pragma mark SPDYSessionDelegate
@@ -265,6 +865,24 @@ static void SPDYReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkR
 - (void)session:(SPDYSession *)session capacityIncreased:(NSUInteger)capacity
 {
     [self _dispatch];
+    [self _dispatchCoalescedManagers];
+}
+
+- (void)session:(SPDYSession *)session closedStream:(SPDYStream *)stream
+{
+    // Streams for other origins sharing the session were budgeted by their own managers
+    SPDYSessionManager *coalescedManager = [self _coalescedManagerForStream:stream];
+    if (coalescedManager) {
+        [coalescedManager session:session closedStream:stream];
+        return;
+    }
+
+    // Every stream gives back its budget as it closes, even on a session that is draining
+    // or unhealthy and so won't report the capacity
+    if ([_budgetedStreams containsObject:stream]) {
+        [_budgetedStreams removeObject:stream];
+        [self _releaseBudget];
+    }
 }
 
 - (void)session:(SPDYSession *)session connectedToNetwork:(bool)cellular
@@ -306,20 +924,75 @@ static void SPDYReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkR
 {
     SPDY_DEBUG(@"%@ closed", session);
 
+    [_warmSessionDeadlines removeObjectForKey:session];
+    [_drainingSessions removeObject:session];
+    [self _session:session finishedPreconnectWithError:SPDY_SOCKET_ERROR(SPDYSocketTransportError, @"session closed before it was established")];
+
     if ([_basePool contains:session]) {
         [_basePool remove:session];
     } else if ([_wwanPool contains:session]) {
         [_wwanPool remove:session];
     }
 
+    [_budgetedSessions removeObject:session];
+    [self _releaseBudget];
+
+    // Streams opened on a session that failed to connect were handed back to us, and
+    // won't be dispatched by a connection callback
+    if (_pendingStreams.count > 0 && [SPDYProtocol currentConfiguration].enableOptimisticDispatch) {
+        [self _dispatch];
+    }
+    [self _dispatchCoalescedManagers];
+
 //    SPDYSessionPool * __strong *pool = session.isCellular ? &_wwanPool : &_basePool;
 //    if (*pool && [*pool remove:session] == 0) {
 //        *pool = nil;
 //    }
 }
 
+- (void)sessionBecameUnhealthy:(SPDYSession *)session
+{
+    SPDY_WARNING(@"%@ unhealthy, removing from pool", session);
+
+    [_warmSessionDeadlines removeObjectForKey:session];
+    [self _session:session finishedPreconnectWithError:SPDY_SOCKET_ERROR(SPDYSocketReadTimeout, @"session stopped answering PINGs")];
+
+    // The session drains its in-flight streams on its own; replace it for anything new
+    if ([_basePool contains:session]) {
+        [_basePool remove:session];
+    } else if ([_wwanPool contains:session]) {
+        [_wwanPool remove:session];
+    }
+
+    [self _dispatch];
+    [self _dispatchCoalescedManagers];
+}
+
+- (void)sessionEstablished:(SPDYSession *)session
+{
+    SPDY_DEBUG(@"%@ established", session);
+    [self _session:session finishedPreconnectWithError:nil];
+}
+
 - (void)session:(SPDYSession *)session refusedStream:(SPDYStream *)stream
 {
+    // A refused stream gives back its budget, and takes it again if it's opened again
+    if ([_budgetedStreams containsObject:stream]) {
+        [_budgetedStreams removeObject:stream];
+        [self _releaseBudget];
+    }
+
+    if (_hedger && [_hedger dropRefusedStream:stream]) {
+        return;
+    }
+
+    // Streams for other origins sharing the session go back to their own managers
+    SPDYSessionManager *coalescedManager = [self _coalescedManagerForStream:stream];
+    if (coalescedManager) {
+        [coalescedManager session:session refusedStream:stream];
+        return;
+    }
+
     SPDY_INFO(@"re-queueing request: %@", stream.protocol.request.URL);
     [_pendingStreams addStream:stream];
     stream.delegate = self;
@@ -332,17 +1005,90 @@ static void SPDYReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkR
         return;
     }
 
+    bool wasCellular = _cellular;
 #if TARGET_OS_IPHONE
     _cellular = (flags & kSCNetworkReachabilityFlagsIsWWAN) != 0;
 #endif
     SPDY_DEBUG(@"reachability updated: %@, flags 0x%x", _cellular ? @"WWAN" : @"WIFI", flags);
 
+    if (_cellular != wasCellular && [SPDYProtocol currentConfiguration].enableSessionMigration) {
+        [self _migrateSessionsFromPool:(wasCellular ? _wwanPool : _basePool)];
+    }
+
     [self _dispatch];
 }
 
+- (void)_migrateSessionsFromPool:(SPDYSessionPool *)oldPool
+{
+    if (oldPool.count == 0) return;
+
+    bool cellular = _cellular;
+    SPDYSessionPool *activePool = cellular ? _wwanPool : _basePool;
+    SPDYConfiguration *configuration = [SPDYProtocol currentConfiguration];
+    SPDY_INFO(@"migrating sessions to %@ from %@ to %@", _origin, cellular ? @"WIFI" : @"WWAN", cellular ? @"WWAN" : @"WIFI");
+
+    // Make before break: start connecting on the new network before giving up on the old one
+    if (activePool.count == 0) {
+        [self _fillSessionPool:activePool cellular:cellular size:configuration.sessionPoolSize];
+        for (SPDYSession *session in activePool) {
+            [session establish];
+        }
+    }
+
+    NSMutableArray *oldSessions = [[NSMutableArray alloc] init];
+    for (SPDYSession *session in oldPool) {
+        [oldSessions addObject:session];
+    }
+
+    for (SPDYSession *session in oldSessions) {
+        [oldPool remove:session];
+        [_warmSessionDeadlines removeObjectForKey:session];
+        [_drainingSessions addObject:session];
+        [session drain];
+    }
+    oldPool.pendingCount = 0;
+    [self _scheduleWarmSessionExpiry];
+
+    // Streams still waiting on a reply from the old network by then are sent again on the new one
+    [_migrationTimer invalidate];
+    _migrationTimer = [NSTimer timerWithTimeInterval:configuration.sessionMigrationStallTimeout
+                                              target:self
+                                            selector:@selector(_retryStalledStreams)
+                                            userInfo:nil
+                                             repeats:NO];
+    for (NSString *runLoopMode in _runLoopModes) {
+        CFRunLoopAddTimer(CFRunLoopGetCurrent(), (__bridge CFRunLoopTimerRef)_migrationTimer, (__bridge CFStringRef)runLoopMode);
+    }
+}
+
+- (void)_retryStalledStreams
+{
+    _migrationTimer = nil;
+
+    NSUInteger retriedCount = 0;
+    for (SPDYSession *session in [_drainingSessions copy]) {
+        retriedCount += [session refuseStreamsWithoutReply];
+    }
+
+    if (retriedCount > 0) {
+        SPDY_INFO(@"retrying %lu stalled streams to %@ after migration", (unsigned long)retriedCount, _origin);
+        [self _dispatch];
+    }
+}
+
 @end
 
 
+static void SPDYHostResolutionCallback(CFHostRef host, CFHostInfoType typeInfo, const CFStreamError *error, void *pManager)
+{
+    if (pManager) {
+        @autoreleasepool {
+            SPDYSessionManager * volatile manager = (__bridge SPDYSessionManager *)pManager;
+            [manager _hostResolved:(error == NULL || error->error == 0)];
+        }
+    }
+}
+
 static void SPDYReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkReachabilityFlags flags, void *pManager)
 {
     if (pManager) {
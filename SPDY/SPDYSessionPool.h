@@ -10,11 +10,12 @@
 //
 
 #import <Foundation/Foundation.h>
+#import "SPDYProtocol.h"
 
 @class SPDYSession;
 @class SPDYSessionManager;
 
-@interface SPDYSessionPool : NSObject
+@interface SPDYSessionPool : NSObject <NSFastEnumeration>
 
 @property (nonatomic, assign, readonly) NSUInteger count;
 @property (nonatomic, assign) NSUInteger pendingCount;
@@ -25,4 +26,16 @@
 - (NSUInteger)remove:(SPDYSession *)session;
 - (SPDYSession *)nextSession;
 
+/**
+  @return the session best suited to take one more stream under the given
+  policy, or nil if no session is connected (or connecting, with optimistic
+  dispatch), healthy and below its concurrent stream limit
+*/
+- (SPDYSession *)nextSessionWithPolicy:(SPDYSessionSelectionPolicy)policy;
+
+/**
+  Like nextSessionWithPolicy:, but never returns the excluded session.
+*/
+- (SPDYSession *)nextSessionWithPolicy:(SPDYSessionSelectionPolicy)policy excludingSession:(SPDYSession *)excludedSession;
+
 @end
@@ -16,16 +16,52 @@
 #import "SPDYSession.h"
 #import "SPDYSessionPool.h"
 
+// Orders sessions by round-trip time, treating a session that hasn't been
+// measured yet as slower than any that has
+static NSComparisonResult SPDYCompareRoundTripTimes(SPDYSession *session1, SPDYSession *session2)
+{
+    SPDYTimeInterval rtt1 = session1.smoothedRoundTripTime;
+    SPDYTimeInterval rtt2 = session2.smoothedRoundTripTime;
+
+    if (rtt1 == rtt2 || (rtt1 < 0 && rtt2 < 0)) return NSOrderedSame;
+    if (rtt2 < 0) return NSOrderedAscending;
+    if (rtt1 < 0) return NSOrderedDescending;
+    return rtt1 < rtt2 ? NSOrderedAscending : NSOrderedDescending;
+}
+
+static bool SPDYSessionIsPreferred(SPDYSession *candidate, SPDYSession *best, SPDYSessionSelectionPolicy policy)
+{
+    switch (policy) {
+        case SPDYSessionSelectionLowestLatency: {
+            NSComparisonResult result = SPDYCompareRoundTripTimes(candidate, best);
+            if (result != NSOrderedSame) return result == NSOrderedAscending;
+            break;
+        }
+        case SPDYSessionSelectionMostSendWindow:
+            if (candidate.sendWindowSize != best.sendWindowSize) {
+                return candidate.sendWindowSize > best.sendWindowSize;
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (candidate.load != best.load) return candidate.load < best.load;
+    return SPDYCompareRoundTripTimes(candidate, best) == NSOrderedAscending;
+}
+
 @implementation SPDYSessionPool
 {
-    NSMutableArray *_sessions;
+    NSMutableOrderedSet *_sessions;
+    NSUInteger _nextIndex;
 }
 
 - (id)init
 {
     self = [super init];
     if (self) {
-        _sessions = [[NSMutableArray alloc] init];
+        _sessions = [[NSMutableOrderedSet alloc] init];
+        _nextIndex = 0;
     }
     return self;
 }
@@ -47,34 +83,73 @@
 
 - (NSUInteger)remove:(SPDYSession *)session
 {
-    [_sessions removeObject:session];
+    NSUInteger index = [_sessions indexOfObject:session];
+    if (index != NSNotFound) {
+        [_sessions removeObjectAtIndex:index];
+
+        // Keep the rotation pointing at the same next session
+        if (index < _nextIndex) _nextIndex -= 1;
+    }
     return _sessions.count;
 }
 
 - (SPDYSession *)nextSession
 {
-    SPDYSession *session;
+    while (_sessions.count > 0) {
+        NSUInteger index = _nextIndex % _sessions.count;
+        SPDYSession *session = _sessions[index];
+        NSAssert(session.isOpen, @"Should never contain closed sessions.");
+
+        if (session.isOpen) {
+            _nextIndex = index + 1;
+            return session;
+        }
 
-    if (_sessions.count == 0) {
-        return nil;
+        [_sessions removeObjectAtIndex:index];
+        _nextIndex = index;
     }
 
-    session = _sessions[0];
-    NSAssert(session.isOpen, @"Should never contain closed sessions.");
+    return nil;
+}
+
+- (SPDYSession *)nextSessionWithPolicy:(SPDYSessionSelectionPolicy)policy
+{
+    return [self nextSessionWithPolicy:policy excludingSession:nil];
+}
+
+- (SPDYSession *)nextSessionWithPolicy:(SPDYSessionSelectionPolicy)policy excludingSession:(SPDYSession *)excludedSession
+{
+    NSUInteger count = _sessions.count;
+    SPDYSession *bestSession = nil;
+    NSUInteger bestIndex = 0;
 
-    // TODO: clean this up
-    while (!session.isOpen) {
-        if ([self remove:session] == 0) return nil;
-        session = _sessions[0];
+    // Scanning from the rotation point and only replacing on a strictly better
+    // session spreads streams evenly across sessions that compare equal
+    for (NSUInteger i = 0; i < count; i++) {
+        NSUInteger index = (_nextIndex + i) % count;
+        SPDYSession *session = _sessions[index];
+        if (session == excludedSession) continue;
+
+        // Zero unless the session is open, connected (or may dispatch while connecting) and healthy
+        if (session.capacity == 0) continue;
+
+        if (bestSession == nil || SPDYSessionIsPreferred(session, bestSession, policy)) {
+            bestSession = session;
+            bestIndex = index;
+            if (policy == SPDYSessionSelectionRoundRobin) break;
+        }
     }
 
-    // Rotate
-    if (_sessions.count > 1) {
-        [_sessions removeObjectAtIndex:0];
-        [_sessions addObject:session];
+    if (bestSession) {
+        _nextIndex = bestIndex + 1;
     }
 
-    return session;
+    return bestSession;
+}
+
+- (NSUInteger)countByEnumeratingWithState:(NSFastEnumerationState *)state objects:(id __unsafe_unretained [])buffer count:(NSUInteger)len
+{
+    return [_sessions countByEnumeratingWithState:state objects:buffer count:len];
 }
 
 @end
@@ -19,6 +19,16 @@
 
 extern NSString *const SPDYSocketException;
 
+/**
+  Urgent writes are queued ahead of any normal writes that have not yet
+  started, but behind writes already (even partially) on the wire, other
+  urgent writes, and TLS or proxy handshakes.
+*/
+typedef enum {
+    SPDYSocketWritePriorityNormal = 0,
+    SPDYSocketWritePriorityUrgent
+} SPDYSocketWritePriority;
+
 #pragma mark SPDYSocketDelegate
 
 @protocol SPDYSocketDelegate <NSObject>
@@ -303,6 +313,57 @@ extern NSString *const SPDYSocketException;
 */
 - (void)writeData:(NSData *)data withTimeout:(NSTimeInterval)timeout tag:(long)tag;
 
+/**
+  Asynchronously writes data to the socket with the given priority.
+
+  @param timeout  use a negative value for no timeout
+  @param priority SPDYSocketWritePriorityUrgent to write ahead of queued
+                  normal writes that have not yet started
+  @param tag      an arbitrary tag to associate with the delegate callback
+*/
+- (void)writeData:(NSData *)data
+      withTimeout:(NSTimeInterval)timeout
+         priority:(SPDYSocketWritePriority)priority
+              tag:(long)tag;
+
+/**
+  Asynchronously writes a header followed by a payload as a single write.
+
+  The header bytes are copied and need only remain valid for the duration of
+  the call; the payload is retained rather than copied. When the write is
+  complete the socket:didWriteDataWithTag: delegate method will be called.
+
+  @param header        bytes to write ahead of the payload, may be NULL if
+                       headerLength is 0
+  @param headerLength  number of header bytes
+  @param payload       data to write after the header, may be nil
+  @param streamId      the stream a DATA frame belongs to, or 0; nonzero
+                       writes may be withdrawn with
+                       removeUnsentWritesForStreamId:payloadLength:
+  @param timeout       use a negative value for no timeout
+  @param priority      SPDYSocketWritePriorityUrgent to write ahead of queued
+                       normal writes that have not yet started
+  @param tag           an arbitrary tag to associate with the delegate callback
+*/
+- (void)writeHeader:(const uint8_t *)header
+             length:(NSUInteger)headerLength
+            payload:(NSData *)payload
+           streamId:(uint32_t)streamId
+        withTimeout:(NSTimeInterval)timeout
+           priority:(SPDYSocketWritePriority)priority
+                tag:(long)tag;
+
+/**
+  Removes queued writes for the given stream id that have not had any bytes
+  written. Writes already (even partially) on the wire are left alone, so a
+  frame is never cut short. No delegate callbacks are made for removed writes.
+
+  @param streamId       stream id the writes were queued with, must not be 0
+  @param pPayloadLength if not NULL, set to the total payload length removed
+  @return total number of bytes removed, headers included
+*/
+- (NSUInteger)removeUnsentWritesForStreamId:(uint32_t)streamId payloadLength:(NSUInteger *)pPayloadLength;
+
 /**
   Secures the connection using TLS.
 
@@ -31,7 +31,8 @@
 
 #define READ_QUEUE_CAPACITY  64    // Initial capacity
 #define WRITE_QUEUE_CAPACITY 64    // Initial capacity
-#define WRITE_CHUNK_SIZE     2852  // Limit on size of each write pass
+#define WRITE_GATHER_SIZE    16384 // Limit on size of each write pass, one maximal TLS record
+#define WRITE_OP_POOL_SIZE   16    // Completed write ops kept for reuse
 
 #define DEBUG_THREAD_SAFETY 0
 
@@ -113,7 +114,12 @@ typedef enum : uint16_t {
 - (void)_timeoutRead:(NSTimer *)timer;
 
 // Writing
+- (void)_enqueueWrite:(SPDYSocketWriteOp *)writeOp priority:(SPDYSocketWritePriority)priority;
 - (void)_write;
+- (NSUInteger)_gatherWrite:(const uint8_t **)pBytes;
+- (CFIndex)_writeBytes:(const uint8_t *)bytes length:(NSUInteger)length;
+- (bool)_advanceWrite;
+- (void)_startWriteTimer;
 - (void)_finishWrite;
 - (void)_endWrite;
 - (void)_scheduleWrite;
@@ -168,8 +174,10 @@ static void SPDYSocketCFWriteStreamCallback(CFWriteStreamRef stream, CFStreamEve
     NSMutableData *_unreadData;
 
     NSMutableArray *_writeQueue;
+    NSMutableArray *_writeOpPool;
     SPDYSocketWriteOp *_currentWriteOp;
     NSTimer *_writeTimer;
+    uint8_t *_gatherBuffer;
 
     id<SPDYSocketDelegate> _delegate;
     uint16_t _flags;
@@ -193,6 +201,8 @@ static void SPDYSocketCFWriteStreamCallback(CFWriteStreamRef stream, CFStreamEve
         _socket6FD = 0;
         _readQueue = [[NSMutableArray alloc] initWithCapacity:READ_QUEUE_CAPACITY];
         _writeQueue = [[NSMutableArray alloc] initWithCapacity:WRITE_QUEUE_CAPACITY];
+        _writeOpPool = [[NSMutableArray alloc] initWithCapacity:WRITE_OP_POOL_SIZE];
+        _gatherBuffer = malloc(WRITE_GATHER_SIZE);
         _runLoopModes = @[NSDefaultRunLoopMode];
 
         NSAssert(sizeof(CFSocketContext) == sizeof(CFStreamClientContext), @"CFSocketContext != CFStreamClientContext");
@@ -209,6 +219,7 @@ static void SPDYSocketCFWriteStreamCallback(CFWriteStreamRef stream, CFStreamEve
 {
     [self _close];
     [NSObject cancelPreviousPerformRequestsWithTarget:self];
+    free(_gatherBuffer);
 }
 
 
@@ -1564,6 +1575,14 @@ static void SPDYSocketCFWriteStreamCallback(CFWriteStreamRef stream, CFStreamEve
 #pragma mark Writing
 
 - (void)writeData:(NSData *)data withTimeout:(NSTimeInterval)timeout tag:(long)tag
+{
+    [self writeData:data withTimeout:timeout priority:SPDYSocketWritePriorityNormal tag:tag];
+}
+
+- (void)writeData:(NSData *)data
+      withTimeout:(NSTimeInterval)timeout
+         priority:(SPDYSocketWritePriority)priority
+              tag:(long)tag
 {
     CHECK_THREAD_SAFETY();
 
@@ -1572,9 +1591,107 @@ static void SPDYSocketCFWriteStreamCallback(CFWriteStreamRef stream, CFStreamEve
 
     SPDYSocketWriteOp *writeOp = [[SPDYSocketWriteOp alloc] initWithData:data timeout:timeout tag:tag];
 
-    [_writeQueue addObject:writeOp];
-    [self _scheduleWrite];
+    [self _enqueueWrite:writeOp priority:priority];
+}
+
+- (void)writeHeader:(const uint8_t *)header
+             length:(NSUInteger)headerLength
+            payload:(NSData *)payload
+           streamId:(uint32_t)streamId
+        withTimeout:(NSTimeInterval)timeout
+           priority:(SPDYSocketWritePriority)priority
+                tag:(long)tag
+{
+    CHECK_THREAD_SAFETY();
+
+    if (_flags & kForbidReadsWrites) return;
+    if (headerLength + payload.length == 0) return;
+
+    SPDYSocketWriteOp *writeOp;
+
+    // Oversized headers (SETTINGS, header blocks) are rare enough to simply be copied out
+    if (headerLength > WRITE_OP_HEADER_SIZE) {
+        NSMutableData *data = [[NSMutableData alloc] initWithCapacity:headerLength + payload.length];
+        [data appendBytes:header length:headerLength];
+        if (payload) {
+            [data appendData:payload];
+        }
+        writeOp = [[SPDYSocketWriteOp alloc] initWithData:data timeout:timeout tag:tag];
+        writeOp->_streamId = streamId;
+        [self _enqueueWrite:writeOp priority:priority];
+        return;
+    }
+
+    writeOp = [_writeOpPool lastObject];
+    if (writeOp) {
+        [_writeOpPool removeLastObject];
+        [writeOp setHeader:header length:headerLength payload:payload timeout:timeout tag:tag];
+    } else {
+        writeOp = [[SPDYSocketWriteOp alloc] initWithHeader:header
+                                                     length:headerLength
+                                                    payload:payload
+                                                    timeout:timeout
+                                                        tag:tag];
+    }
+    writeOp->_streamId = streamId;
+
+    [self _enqueueWrite:writeOp priority:priority];
+}
+
+- (NSUInteger)removeUnsentWritesForStreamId:(uint32_t)streamId payloadLength:(NSUInteger *)pPayloadLength
+{
+    CHECK_THREAD_SAFETY();
+    NSAssert(streamId != 0, @"writes without a stream id can't be removed");
+
+    NSMutableIndexSet *indexes = [[NSMutableIndexSet alloc] init];
+    NSUInteger bytesRemoved = 0;
+    NSUInteger payloadLength = 0;
+
+    // The current op is left alone even if unstarted, as it belongs to the write loop
+    for (NSUInteger index = 0; index < _writeQueue.count; index++) {
+        SPDYSocketWriteOp *writeOp = _writeQueue[index];
+        if ([writeOp class] == [SPDYSocketWriteOp class] &&
+            writeOp->_streamId == streamId && writeOp->_bytesWritten == 0) {
+            [indexes addIndex:index];
+            bytesRemoved += [writeOp length];
+            payloadLength += writeOp->_buffer.length;
+
+            if (_writeOpPool.count < WRITE_OP_POOL_SIZE) {
+                writeOp->_buffer = nil;
+                [_writeOpPool addObject:writeOp];
+            }
+        }
+    }
+    [_writeQueue removeObjectsAtIndexes:indexes];
+
+    if (pPayloadLength) {
+        *pPayloadLength = payloadLength;
+    }
+    return bytesRemoved;
+}
+
+- (void)_enqueueWrite:(SPDYSocketWriteOp *)writeOp priority:(SPDYSocketWritePriority)priority
+{
+    NSUInteger index = _writeQueue.count;
+
+    // Walk back over normal ops that have not had any bytes written, including as part of
+    // a gathered write still being credited. Anything else (started ops, earlier urgent ops,
+    // TLS and proxy ops) must stay ahead, so frames are never split and handshakes never
+    // reordered.
+    if (priority == SPDYSocketWritePriorityUrgent) {
+        writeOp->_urgent = YES;
+        while (index > 0) {
+            SPDYSocketWriteOp *queuedOp = _writeQueue[index - 1];
+            if ([queuedOp class] != [SPDYSocketWriteOp class] ||
+                queuedOp->_urgent || queuedOp->_bytesWritten > 0) {
+                break;
+            }
+            index--;
+        }
+    }
 
+    [_writeQueue insertObject:writeOp atIndex:index];
+    [self _scheduleWrite];
 }
 
 - (void)_scheduleWrite
@@ -1599,15 +1716,7 @@ static void SPDYSocketCFWriteStreamCallback(CFWriteStreamRef stream, CFStreamEve
 
                 [self _tryTLSHandshake];
             } else {
-                if (_currentWriteOp->_timeout >= 0.0) {
-                    _writeTimer = [NSTimer timerWithTimeInterval:_currentWriteOp->_timeout
-                                                            target:self
-                                                          selector:@selector(_timeoutWrite:)
-                                                          userInfo:nil
-                                                           repeats:NO];
-                    [self _addTimer:_writeTimer];
-                }
-
+                [self _startWriteTimer];
                 [self _write];
             }
         } else if (_flags & kDisconnectAfterWrites) {
@@ -1622,30 +1731,107 @@ static void SPDYSocketCFWriteStreamCallback(CFWriteStreamRef stream, CFStreamEve
     }
 }
 
+- (void)_startWriteTimer
+{
+    if (_currentWriteOp->_timeout >= 0.0) {
+        _writeTimer = [NSTimer timerWithTimeInterval:_currentWriteOp->_timeout
+                                              target:self
+                                            selector:@selector(_timeoutWrite:)
+                                            userInfo:nil
+                                             repeats:NO];
+        [self _addTimer:_writeTimer];
+    }
+}
+
 - (bool)_writeStreamReady
 {
     return (_flags & kSocketCanAcceptBytes) || CFWriteStreamCanAcceptBytes(_writeStream);
 }
 
+/**
+  Only plain write ops may share a write pass; TLS and proxy ops must go out
+  (or take effect) on their own.
+*/
+static inline bool isGatherable(id op)
+{
+    return [op class] == [SPDYSocketWriteOp class];
+}
+
+/**
+  Prepares the next write pass, returning a pointer to and the length of the
+  bytes to write. The remainder of the current op is coalesced with as many of
+  the following queued ops as fit in the gather buffer, except that a large
+  payload is written straight from its own buffer rather than copied.
+*/
+- (NSUInteger)_gatherWrite:(const uint8_t **)pBytes
+{
+    SPDYSocketWriteOp *writeOp = _currentWriteOp;
+    NSUInteger remaining = [writeOp length] - writeOp->_bytesWritten;
+
+    if (!isGatherable(writeOp) ||
+        (writeOp->_bytesWritten >= writeOp->_headerLength && remaining >= WRITE_GATHER_SIZE)) {
+        *pBytes = (const uint8_t *)writeOp->_buffer.bytes + (writeOp->_bytesWritten - writeOp->_headerLength);
+        return MIN(remaining, (NSUInteger)WRITE_GATHER_SIZE);
+    }
+
+    NSUInteger length = [writeOp copyBytesFromOffset:writeOp->_bytesWritten
+                                            toBuffer:_gatherBuffer
+                                           maxLength:WRITE_GATHER_SIZE];
+
+    for (SPDYSocketWriteOp *queuedOp in _writeQueue) {
+        if (length == WRITE_GATHER_SIZE || !isGatherable(queuedOp)) {
+            break;
+        }
+        length += [queuedOp copyBytesFromOffset:0
+                                       toBuffer:_gatherBuffer + length
+                                      maxLength:WRITE_GATHER_SIZE - length];
+    }
+
+    *pBytes = _gatherBuffer;
+    return length;
+}
+
+- (CFIndex)_writeBytes:(const uint8_t *)bytes length:(NSUInteger)length
+{
+    return CFWriteStreamWrite(_writeStream, bytes, (CFIndex)length);
+}
+
+/**
+  Promotes the next queued op to be the current write without a run loop
+  round trip. Returns NO if there is nothing that can join the current write
+  pass, in which case _dequeueWrite takes over.
+*/
+- (bool)_advanceWrite
+{
+    if (_writeQueue.count == 0 || !isGatherable(_writeQueue[0])) {
+        return NO;
+    }
+
+    _currentWriteOp = _writeQueue[0];
+    [_writeQueue removeObjectAtIndex:0];
+    [self _startWriteTimer];
+    return YES;
+}
+
 - (void)_write
 {
     if (_currentWriteOp == nil || _writeStream == NULL) {
         return;
     }
 
+    // Proxy connect has to be written on its own. We need to block other writes until the
+    // read is finished, so we're just going to sit on this op once it has been written. It
+    // will be cleared in _onProxyResponse.
+    bool isProxyOp = [_currentWriteOp isKindOfClass:[SPDYSocketProxyWriteOp class]];
     NSUInteger newBytesWritten = 0;
-    bool writeComplete = NO;
-
-    while (!(writeComplete = (_currentWriteOp->_buffer.length == _currentWriteOp->_bytesWritten))&&
-            [self _writeStreamReady]) {
 
-        NSUInteger bytesRemaining = _currentWriteOp->_buffer.length - _currentWriteOp->_bytesWritten;
-        NSUInteger bytesToWrite = (bytesRemaining < WRITE_CHUNK_SIZE) ? bytesRemaining : WRITE_CHUNK_SIZE;
-        uint8_t *writeIndex = (uint8_t *)(_currentWriteOp->_buffer.bytes + _currentWriteOp->_bytesWritten);
+    while (_currentWriteOp->_bytesWritten < [_currentWriteOp length] && [self _writeStreamReady]) {
+        const uint8_t *writeIndex;
+        NSUInteger bytesToWrite = [self _gatherWrite:&writeIndex];
 
         NSAssert(bytesToWrite > 0, @"can't write 0 bytes");
 
-        CFIndex bytesWritten = CFWriteStreamWrite(_writeStream, writeIndex, bytesToWrite);
+        CFIndex bytesWritten = [self _writeBytes:writeIndex length:bytesToWrite];
         _flags &= ~kSocketCanAcceptBytes;
 
         if (bytesWritten < 0) {
@@ -1653,24 +1839,51 @@ static void SPDYSocketCFWriteStreamCallback(CFWriteStreamRef stream, CFStreamEve
             return;
         } else if (bytesWritten == 0) {
             SPDY_INFO(@"socket at end of write stream");
-        } else {
-            _currentWriteOp->_bytesWritten += bytesWritten;
-            newBytesWritten += bytesWritten;
+            continue;
         }
-    }
 
-    if ([_currentWriteOp isKindOfClass:[SPDYSocketProxyWriteOp class]]) {
-        // Proxy connect has been written. We need to block other writes until the read is
-        // finished, so we're just going to sit on this op. It will be cleared in _onProxyResponse.
-    } else if (writeComplete) {
-        [self _finishWrite];
-        [self _scheduleWrite];
-    } else if (newBytesWritten > 0) {
-        // Note we will never call this when a proxy connect is happening
-        if ([_delegate respondsToSelector:@selector(socket:didWritePartialDataOfLength:tag:)]) {
-            [_delegate socket:self didWritePartialDataOfLength:newBytesWritten tag:_currentWriteOp->_tag];
+        // Credit the bytes to each op covered by this pass before completing any of them, so
+        // that urgent writes queued from a completion callback land behind everything already
+        // written.
+        SPDYSocketWriteOp *writeOp = _currentWriteOp;
+        NSUInteger queueIndex = 0;
+        NSUInteger bytesToCredit = (NSUInteger)bytesWritten;
+        while (bytesToCredit > 0) {
+            NSUInteger credit = MIN(bytesToCredit, [writeOp length] - writeOp->_bytesWritten);
+            writeOp->_bytesWritten += credit;
+            bytesToCredit -= credit;
+
+            if (writeOp == _currentWriteOp) {
+                newBytesWritten += credit;
+            }
+
+            if (bytesToCredit > 0) {
+                NSAssert(queueIndex < _writeQueue.count, @"wrote %lu bytes past the gathered ops", (unsigned long)bytesToCredit);
+                writeOp = _writeQueue[queueIndex++];
+            }
+        }
+
+        // Complete the written ops in queue order
+        while (_currentWriteOp->_bytesWritten == [_currentWriteOp length] && !isProxyOp) {
+            [self _finishWrite];
+
+            if (_writeStream == NULL) {
+                return; // delegate disconnected
+            }
+
+            if (![self _advanceWrite]) {
+                [self _scheduleWrite];
+                return;
+            }
+            newBytesWritten = _currentWriteOp->_bytesWritten;
         }
     }
+
+    // Note we will never call this when a proxy connect is happening
+    if (!isProxyOp && newBytesWritten > 0 &&
+            [_delegate respondsToSelector:@selector(socket:didWritePartialDataOfLength:tag:)]) {
+        [_delegate socket:self didWritePartialDataOfLength:newBytesWritten tag:_currentWriteOp->_tag];
+    }
 }
 
 - (void)_finishWrite
@@ -1692,6 +1905,11 @@ static void SPDYSocketCFWriteStreamCallback(CFWriteStreamRef stream, CFStreamEve
     [_writeTimer invalidate];
     _writeTimer = nil;
 
+    // Plain write ops are recycled; proxy and TLS ops are one-offs
+    if ([_currentWriteOp class] == [SPDYSocketWriteOp class] && _writeOpPool.count < WRITE_OP_POOL_SIZE) {
+        _currentWriteOp->_buffer = nil;
+        [_writeOpPool addObject:_currentWriteOp];
+    }
     _currentWriteOp = nil;
 }
 
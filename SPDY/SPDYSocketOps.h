@@ -13,6 +13,7 @@
 
 #define PROXY_READ_SIZE      8192  // Max size of proxy response
 #define READ_CHUNK_SIZE      65536 // Limit on size of each read pass
+#define WRITE_OP_HEADER_SIZE 32    // Inline storage for frame headers and small control frames
 
 /**
   Encompasses the instructions for any given read operation.
@@ -68,6 +69,10 @@
 
 /**
   Encompasses the instructions for any given write operation.
+
+  A write consists of an optional header, copied inline into _header, followed
+  by the bytes of _buffer. This lets a frame header and its (retained, uncopied)
+  payload be written as a single operation.
 */
 @interface SPDYSocketWriteOp : NSObject {
 @public
@@ -75,9 +80,37 @@
     NSUInteger _bytesWritten;
     NSTimeInterval _timeout;
     long _tag;
+    NSUInteger _headerLength;
+    uint8_t _header[WRITE_OP_HEADER_SIZE];
+    uint32_t _streamId;
+    bool _urgent;
 }
 
 - (id)initWithData:(NSData *)data timeout:(NSTimeInterval)timeout tag:(long)tag;
+- (id)initWithHeader:(const uint8_t *)header
+              length:(NSUInteger)headerLength
+             payload:(NSData *)payload
+             timeout:(NSTimeInterval)timeout
+                 tag:(long)tag;
+
+/**
+  Reinitializes a completed op so that it can be recycled. headerLength must
+  not exceed WRITE_OP_HEADER_SIZE.
+*/
+- (void)setHeader:(const uint8_t *)header
+           length:(NSUInteger)headerLength
+          payload:(NSData *)payload
+          timeout:(NSTimeInterval)timeout
+              tag:(long)tag;
+
+// Total number of bytes to be written, header included
+- (NSUInteger)length;
+
+/**
+  Copies up to maxLength bytes of the header and payload, starting at offset,
+  into buffer. Returns the number of bytes copied.
+*/
+- (NSUInteger)copyBytesFromOffset:(NSUInteger)offset toBuffer:(uint8_t *)buffer maxLength:(NSUInteger)maxLength;
 
 @end
 
@@ -174,22 +174,74 @@
 @implementation SPDYSocketWriteOp
 
 - (id)initWithData:(NSData *)data timeout:(NSTimeInterval)timeout tag:(long)tag
+{
+    return [self initWithHeader:NULL length:0 payload:data timeout:timeout tag:tag];
+}
+
+- (id)initWithHeader:(const uint8_t *)header
+              length:(NSUInteger)headerLength
+             payload:(NSData *)payload
+             timeout:(NSTimeInterval)timeout
+                 tag:(long)tag
 {
     self = [super init];
     if (self) {
-        _buffer = data;
-        _bytesWritten = 0;
-        _timeout = timeout;
-        _tag = tag;
+        [self setHeader:header length:headerLength payload:payload timeout:timeout tag:tag];
     }
     return self;
 }
 
+- (void)setHeader:(const uint8_t *)header
+           length:(NSUInteger)headerLength
+          payload:(NSData *)payload
+          timeout:(NSTimeInterval)timeout
+              tag:(long)tag
+{
+    NSAssert(headerLength <= WRITE_OP_HEADER_SIZE, @"header of %lu bytes exceeds inline storage",
+             (unsigned long)headerLength);
+
+    if (headerLength > 0) {
+        memcpy(_header, header, headerLength);
+    }
+    _headerLength = headerLength;
+    _buffer = payload;
+    _bytesWritten = 0;
+    _timeout = timeout;
+    _tag = tag;
+    _streamId = 0;
+    _urgent = NO;
+}
+
+- (NSUInteger)length
+{
+    return _headerLength + _buffer.length;
+}
+
+- (NSUInteger)copyBytesFromOffset:(NSUInteger)offset toBuffer:(uint8_t *)buffer maxLength:(NSUInteger)maxLength
+{
+    NSUInteger copied = 0;
+
+    if (offset < _headerLength) {
+        copied = MIN(_headerLength - offset, maxLength);
+        memcpy(buffer, _header + offset, copied);
+        offset += copied;
+    }
+
+    NSUInteger payloadOffset = offset - _headerLength;
+    if (copied < maxLength && payloadOffset < _buffer.length) {
+        NSUInteger length = MIN(_buffer.length - payloadOffset, maxLength - copied);
+        memcpy(buffer + copied, (const uint8_t *)_buffer.bytes + payloadOffset, length);
+        copied += length;
+    }
+
+    return copied;
+}
+
 - (NSString *)description
 {
     return [NSString stringWithFormat:
             @"<SPDYSocketWriteOp: timeout %lu, tag %ld, size %lu, bytesWritten %lu>",
-            (unsigned long)_timeout, _tag, (unsigned long)_buffer.length, (unsigned long)_bytesWritten];
+            (unsigned long)_timeout, _tag, (unsigned long)[self length], (unsigned long)_bytesWritten];
 }
 
 @end
@@ -30,7 +30,7 @@
 @property (nonatomic) SPDYMetadata *metadata;
 @property (nonatomic) NSData *data;
 @property (nonatomic) NSInputStream *dataStream;
-@property (nonatomic, weak) NSURLRequest *request;
+@property (nonatomic) NSURLRequest *request;
 @property (nonatomic, weak) SPDYProtocol *protocol;
 @property (nonatomic) SPDYStreamId streamId;
 @property (nonatomic) uint8_t priority;
@@ -41,10 +41,12 @@
 @property (nonatomic) bool receivedReply;
 @property (nonatomic, readonly) bool hasDataAvailable;
 @property (nonatomic, readonly) bool hasDataPending;
+@property (nonatomic, readonly) bool idempotent;
 @property (nonatomic) uint32_t sendWindowSize;
 @property (nonatomic) uint32_t receiveWindowSize;
 @property (nonatomic) uint32_t sendWindowSizeLowerBound;
 @property (nonatomic) uint32_t receiveWindowSizeLowerBound;
+@property (nonatomic) uint32_t pendingReceiveWindowDelta;
 
 - (id)initWithProtocol:(SPDYProtocol *)protocol;
 - (void)startWithStreamId:(SPDYStreamId)id sendWindowSize:(uint32_t)sendWindowSize receiveWindowSize:(uint32_t)receiveWindowSize;
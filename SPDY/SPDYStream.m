@@ -18,10 +18,12 @@
 #import "NSURLRequest+SPDYURLRequest.h"
 #import "SPDYCommonLogger.h"
 #import "SPDYDefinitions.h"
+#import "SPDYHeaderBlock.h"
 #import "SPDYMetadata+Utils.h"
 #import "SPDYProtocol+Project.h"
 #import "SPDYStopwatch.h"
 #import "SPDYStream.h"
+#import "SPDYZLibAllocator.h"
 
 #define DECOMPRESSED_CHUNK_LENGTH 8192
 #define MIN_WRITE_CHUNK_LENGTH 4096
@@ -58,6 +60,7 @@
     NSUInteger _dispatchAttempts;
     z_stream _zlibStream;
     bool _compressedResponse;
+    bool _zlibStreamEnded;
     bool _writeStreamOpened;
     int _zlibStreamStatus;
     SPDYStopwatch *_blockedStopwatch;
@@ -95,6 +98,7 @@
     _receiveWindowSize = receiveWindowSize;
     _sendWindowSizeLowerBound = 0;
     _receiveWindowSizeLowerBound = 0;
+    _pendingReceiveWindowDelta = 0;
     _writeDataIndex = 0;
     _writeStreamChunkLength = MIN_WRITE_CHUNK_LENGTH;
     _blocked = NO;
@@ -142,7 +146,7 @@
 
 - (void)dealloc
 {
-    if (_compressedResponse) {
+    if (_compressedResponse && !_zlibStreamEnded) {
         inflateEnd(&_zlibStream);
     }
 
@@ -258,6 +262,19 @@
         (writeStreamPending);
 }
 
+- (bool)idempotent
+{
+    // Per RFC 7231, provided the body can be sent again
+    static NSSet *idempotentMethods;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        idempotentMethods = [[NSSet alloc] initWithObjects:@"GET", @"HEAD", @"OPTIONS", @"TRACE", @"PUT", @"DELETE", nil];
+    });
+
+    return [idempotentMethods containsObject:_request.HTTPMethod.uppercaseString] &&
+        !_request.HTTPBodyStream && !_request.SPDYBodyStream;
+}
+
 - (NSData *)readData:(NSUInteger)length error:(NSError **)pError
 {
     if (_dataStream) {
@@ -323,19 +340,25 @@
         return;
     }
 
-    NSMutableDictionary *allHTTPHeaders = [[NSMutableDictionary alloc] init];
-    for (NSString *key in headers) {
-        if (![key hasPrefix:@":"]) {
-            id headerValue = headers[key];
-            if ([headerValue isKindOfClass:NSClassFromString(@"NSArray")]) {
-                allHTTPHeaders[key] = [headers[key] componentsJoinedByString:@", "];
-            } else {
-                allHTTPHeaders[key] = headers[key];
+    NSMutableDictionary *allHTTPHeaders;
+    if ([headers isKindOfClass:[SPDYHeaderBlock class]]) {
+        // Avoid materializing pseudo-headers and intermediate value arrays
+        allHTTPHeaders = [(SPDYHeaderBlock *)headers mutableHTTPHeaderFields];
+    } else {
+        allHTTPHeaders = [[NSMutableDictionary alloc] init];
+        for (NSString *key in headers) {
+            if (![key hasPrefix:@":"]) {
+                id headerValue = headers[key];
+                if ([headerValue isKindOfClass:NSClassFromString(@"NSArray")]) {
+                    allHTTPHeaders[key] = [headers[key] componentsJoinedByString:@", "];
+                } else {
+                    allHTTPHeaders[key] = headers[key];
+                }
             }
         }
     }
 
-    NSURL *requestURL = _protocol.request.URL;
+    NSURL *requestURL = _request.URL;
     BOOL cookiesOn = NO;
     NSHTTPCookieStorage *cookieStore = nil;
 
@@ -381,6 +404,7 @@
     _compressedResponse = [encoding hasPrefix:@"deflate"] || [encoding hasPrefix:@"gzip"];
     if (_compressedResponse) {
         bzero(&_zlibStream, sizeof(_zlibStream));
+        SPDYZLibAllocatorPrepareStream(&_zlibStream);
         _zlibStreamStatus = inflateInit2(&_zlibStream, MAX_WBITS + 32);
     }
 
@@ -480,6 +504,13 @@
             }
         }
 
+        // Return the inflate state and window to the pool as soon as the body is complete,
+        // rather than when the stream is eventually released.
+        if (_zlibStreamStatus == Z_STREAM_END && !_zlibStreamEnded) {
+            inflateEnd(&_zlibStream);
+            _zlibStreamEnded = YES;
+        }
+
         if (_zlibStreamStatus != Z_OK && _zlibStreamStatus != Z_STREAM_END) {
             SPDY_WARNING(@"error decompressing response data: bad z_stream state");
             NSError *error = [[NSError alloc] initWithDomain:NSURLErrorDomain
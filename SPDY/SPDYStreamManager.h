@@ -27,6 +27,18 @@
 - (id)objectAtIndexedSubscript:(NSUInteger)idx;
 - (id)objectForKeyedSubscript:(id)key;
 - (SPDYStream *)nextPriorityStream;
+
+/**
+  Returns the streams at the given priority level, in their current
+  round-robin order.
+*/
+- (NSArray *)streamsWithPriority:(uint8_t)priority;
+
+/**
+  Moves a stream behind every other stream at its priority level, so that it
+  is visited last in the next round.
+*/
+- (void)rotateStream:(SPDYStream *)stream;
 - (void)setObject:(id)obj atIndexedSubscript:(NSUInteger)idx;
 - (void)removeStreamWithStreamId:(SPDYStreamId)streamId;
 - (void)removeStreamForProtocol:(SPDYProtocol *)protocol;
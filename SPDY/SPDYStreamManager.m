@@ -14,46 +14,157 @@
 #import "SPDYProtocol.h"
 #import "SPDYStream.h"
 
+#define INITIAL_NODE_CAPACITY  16
+#define INITIAL_TABLE_CAPACITY 32  // Power of 2, kept at most half full
+
+/**
+  Nodes live in a single growable array and are addressed by index, so they
+  survive reallocation and are recycled through a free list. Index 0 is
+  reserved as the null node.
+*/
+typedef struct {
+    CFTypeRef stream;       // Retained SPDYStream
+    CFTypeRef protocol;     // Retained SPDYProtocol, or NULL
+    SPDYStreamId streamId;
+    uint32_t next;          // Next node at this priority, or next free node
+    uint32_t prev;
+    uint8_t priority;
+    bool local;
+} SPDYStreamNode;
+
+/**
+  Open-addressing hash table with linear probing, mapping a nonzero key to a
+  node index. Keys are stored inline so a probe never touches the nodes.
+*/
+typedef struct {
+    uintptr_t key;
+    uint32_t node;
+} SPDYStreamSlot;
+
+typedef struct {
+    SPDYStreamSlot *slots;
+    NSUInteger mask;
+    NSUInteger count;
+} SPDYStreamTable;
+
+static inline NSUInteger SPDYStreamTableHash(uintptr_t key)
+{
+    // Fibonacci hashing spreads both sequential stream ids and aligned pointers
+    return (NSUInteger)(((uint64_t)key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
 
-@interface SPDYStreamNode : NSObject
-@end
+static void SPDYStreamTableInit(SPDYStreamTable *table, NSUInteger capacity)
+{
+    table->slots = calloc(capacity, sizeof(SPDYStreamSlot));
+    table->mask = capacity - 1;
+    table->count = 0;
+}
 
-@implementation SPDYStreamNode
+static uint32_t SPDYStreamTableGet(const SPDYStreamTable *table, uintptr_t key)
 {
-  @public
-    __strong SPDYStreamNode *next;
-    __strong SPDYStreamNode *prev;
-    __strong SPDYStream *stream;
-    __unsafe_unretained SPDYProtocol *protocol;
-    SPDYStreamId streamId;
+    if (key == 0) return 0;
+
+    NSUInteger index = SPDYStreamTableHash(key) & table->mask;
+    while (table->slots[index].key != 0) {
+        if (table->slots[index].key == key) {
+            return table->slots[index].node;
+        }
+        index = (index + 1) & table->mask;
+    }
+    return 0;
 }
-@end
 
-@interface SPDYStreamManager ()
-- (void)_removeListNode:(SPDYStreamNode *)node;
-@end
+static void SPDYStreamTableSet(SPDYStreamTable *table, uintptr_t key, uint32_t node);
 
-@implementation SPDYStreamManager
+static void SPDYStreamTableGrow(SPDYStreamTable *table)
 {
-    SPDYStreamNode *_priorityHead[8];
-    SPDYStreamNode *_priorityLast[8];
-    CFMutableDictionaryRef _nodesByStreamId;
-    CFMutableDictionaryRef _nodesByProtocol;
-    NSUInteger _localCount;
-    NSUInteger _remoteCount;
-    unsigned long _mutations;
+    SPDYStreamSlot *oldSlots = table->slots;
+    NSUInteger oldCapacity = table->mask + 1;
+
+    SPDYStreamTableInit(table, oldCapacity * 2);
+    for (NSUInteger i = 0; i < oldCapacity; i++) {
+        if (oldSlots[i].key != 0) {
+            SPDYStreamTableSet(table, oldSlots[i].key, oldSlots[i].node);
+        }
+    }
+    free(oldSlots);
 }
 
-Boolean SPDYStreamIdEqual(const void *key1, const void *key2) {
-    return (SPDYStreamId)key1 == (SPDYStreamId)key2;
+static void SPDYStreamTableSet(SPDYStreamTable *table, uintptr_t key, uint32_t node)
+{
+    if ((table->count + 1) * 2 > table->mask + 1) {
+        SPDYStreamTableGrow(table);
+    }
+
+    NSUInteger index = SPDYStreamTableHash(key) & table->mask;
+    while (table->slots[index].key != 0 && table->slots[index].key != key) {
+        index = (index + 1) & table->mask;
+    }
+
+    if (table->slots[index].key == 0) {
+        table->count += 1;
+    }
+    table->slots[index].key = key;
+    table->slots[index].node = node;
 }
 
-CFHashCode SPDYStreamIdHash(const void *key) {
-    return (CFHashCode)((SPDYStreamId)key);
+static void SPDYStreamTableRemove(SPDYStreamTable *table, uintptr_t key)
+{
+    NSUInteger index = SPDYStreamTableHash(key) & table->mask;
+    while (table->slots[index].key != key) {
+        if (table->slots[index].key == 0) return;
+        index = (index + 1) & table->mask;
+    }
+
+    // Shift later entries of the probe run back into the hole, rather than leaving a
+    // tombstone, so lookups never have to probe past removed streams.
+    NSUInteger hole = index;
+    NSUInteger next = index;
+    while (true) {
+        next = (next + 1) & table->mask;
+        uintptr_t nextKey = table->slots[next].key;
+        if (nextKey == 0) break;
+
+        // The entry can move unless its home slot lies cyclically within (hole, next]
+        NSUInteger home = SPDYStreamTableHash(nextKey) & table->mask;
+        bool movable = (hole <= next) ? (home <= hole || home > next) : (home <= hole && home > next);
+        if (movable) {
+            table->slots[hole] = table->slots[next];
+            hole = next;
+        }
+    }
+
+    table->slots[hole].key = 0;
+    table->slots[hole].node = 0;
+    table->count -= 1;
 }
 
-CFStringRef SPDYStreamIdCopyDescription(const void *key) {
-    return CFStringCreateWithFormat(kCFAllocatorDefault, NULL, CFSTR("%d"), (SPDYStreamId)key);
+static void SPDYStreamTableRemoveAll(SPDYStreamTable *table)
+{
+    memset(table->slots, 0, (table->mask + 1) * sizeof(SPDYStreamSlot));
+    table->count = 0;
+}
+
+@interface SPDYStreamManager ()
+- (uint32_t)_allocNode;
+- (void)_addNode:(uint32_t)index;
+- (void)_removeNode:(uint32_t)index;
+@end
+
+@implementation SPDYStreamManager
+{
+    SPDYStreamNode *_nodes;
+    uint32_t _nodeCapacity;
+    uint32_t _nodeCount;
+    uint32_t _freeNode;
+    SPDYStreamTable _nodesByStreamId;
+    SPDYStreamTable _nodesByProtocol;
+    uint32_t _priorityHead[8];
+    uint32_t _priorityLast[8];
+    uint8_t _priorityMask;      // Bit set for each priority with at least one stream
+    NSUInteger _localCount;
+    NSUInteger _remoteCount;
+    unsigned long _mutations;
 }
 
 - (id)init
@@ -63,22 +174,13 @@ CFStringRef SPDYStreamIdCopyDescription(const void *key) {
 
     self = [super init];
     if (self) {
-        CFDictionaryKeyCallBacks SPDYStreamIdKeyCallbacks = {
-            0, NULL, NULL,
-            SPDYStreamIdCopyDescription,
-            SPDYStreamIdEqual,
-            SPDYStreamIdHash
-        };
-        _nodesByStreamId = CFDictionaryCreateMutable(
-            kCFAllocatorDefault, 100,
-            &SPDYStreamIdKeyCallbacks,
-            &kCFTypeDictionaryValueCallBacks
-        );
-        _nodesByProtocol = CFDictionaryCreateMutable(
-            kCFAllocatorDefault, 100,
-            &kCFTypeDictionaryKeyCallBacks,
-            &kCFTypeDictionaryValueCallBacks
-        );
+        _nodeCapacity = INITIAL_NODE_CAPACITY;
+        _nodes = calloc(_nodeCapacity, sizeof(SPDYStreamNode));
+        _nodeCount = 1;
+        _freeNode = 0;
+        SPDYStreamTableInit(&_nodesByStreamId, INITIAL_TABLE_CAPACITY);
+        SPDYStreamTableInit(&_nodesByProtocol, INITIAL_TABLE_CAPACITY);
+        _priorityMask = 0;
         _localCount = 0;
         _remoteCount = 0;
         _mutations = 0;
@@ -88,8 +190,13 @@ CFStringRef SPDYStreamIdCopyDescription(const void *key) {
 
 - (void)dealloc
 {
-    CFRelease(_nodesByStreamId);
-    CFRelease(_nodesByProtocol);
+    for (uint32_t i = 1; i < _nodeCount; i++) {
+        if (_nodes[i].stream) CFRelease(_nodes[i].stream);
+        if (_nodes[i].protocol) CFRelease(_nodes[i].protocol);
+    }
+    free(_nodes);
+    free(_nodesByStreamId.slots);
+    free(_nodesByProtocol.slots);
 }
 
 - (NSUInteger)count
@@ -99,79 +206,138 @@ CFStringRef SPDYStreamIdCopyDescription(const void *key) {
 
 - (id)objectAtIndexedSubscript:(NSUInteger)idx
 {
-    SPDYStreamNode *node = (id)CFDictionaryGetValue(_nodesByStreamId, (void *)idx);
-    return node ? node->stream : nil;
+    uint32_t index = SPDYStreamTableGet(&_nodesByStreamId, (uintptr_t)(SPDYStreamId)idx);
+    return index ? (__bridge SPDYStream *)_nodes[index].stream : nil;
 }
 
 - (id)objectForKeyedSubscript:(id)key
 {
-    SPDYStreamNode *node = (id)CFDictionaryGetValue(_nodesByProtocol, (__bridge CFTypeRef)key);
-    return node ? node->stream : nil;
+    uint32_t index = SPDYStreamTableGet(&_nodesByProtocol, (uintptr_t)(__bridge void *)key);
+    return index ? (__bridge SPDYStream *)_nodes[index].stream : nil;
 }
 
 - (SPDYStream *)nextPriorityStream
 {
-    SPDYStreamNode *currentNode;
-    for (int priority = 0; priority < 8 && currentNode == NULL; priority++) {
-        currentNode = _priorityHead[priority];
+    if (_priorityMask == 0) {
+        return nil;
     }
 
-    if (currentNode) {
-        return currentNode->stream;
+    // Lowest set bit is the highest priority with a stream
+    int priority = __builtin_ctz(_priorityMask);
+    return (__bridge SPDYStream *)_nodes[_priorityHead[priority]].stream;
+}
+
+- (NSArray *)streamsWithPriority:(uint8_t)priority
+{
+    NSMutableArray *streams = [[NSMutableArray alloc] init];
+    for (uint32_t index = _priorityHead[priority]; index != 0; index = _nodes[index].next) {
+        [streams addObject:(__bridge SPDYStream *)_nodes[index].stream];
     }
+    return streams;
+}
 
-    return nil;
+- (void)rotateStream:(SPDYStream *)stream
+{
+    uint32_t index = SPDYStreamTableGet(&_nodesByStreamId, (uintptr_t)stream.streamId);
+    if (index == 0) {
+        return;
+    }
+
+    SPDYStreamNode *node = &_nodes[index];
+    uint8_t priority = node->priority;
+    if (_priorityLast[priority] == index) {
+        return;
+    }
+
+    // Unlink; node is not the last, so it has a successor
+    _nodes[node->next].prev = node->prev;
+    if (node->prev != 0) _nodes[node->prev].next = node->next;
+    if (_priorityHead[priority] == index) _priorityHead[priority] = node->next;
+
+    // Append
+    node->prev = _priorityLast[priority];
+    node->next = 0;
+    _nodes[_priorityLast[priority]].next = index;
+    _priorityLast[priority] = index;
+
+    _mutations += 1;
 }
 
 - (void)addStream:(SPDYStream *)stream
 {
-    SPDYStreamNode *node = [[SPDYStreamNode alloc] init];
-    node->stream = stream;
-    node->protocol = stream.protocol;
+    uint32_t index = [self _allocNode];
+    SPDYStreamNode *node = &_nodes[index];
+    node->stream = CFBridgingRetain(stream);
+    node->protocol = stream.protocol ? CFBridgingRetain(stream.protocol) : NULL;
     node->streamId = stream.streamId;
-    [self _addListNode:node];
+    [self _addNode:index];
 }
 
 - (void)setObject:(id)obj atIndexedSubscript:(NSUInteger)idx
 {
     if (obj) {
-        SPDYStreamNode *node = [[SPDYStreamNode alloc] init];
         SPDYStream *stream = obj;
-        node->stream = stream;
-        node->protocol = stream.protocol;
+        uint32_t index = [self _allocNode];
+        SPDYStreamNode *node = &_nodes[index];
+        node->stream = CFBridgingRetain(stream);
+        node->protocol = stream.protocol ? CFBridgingRetain(stream.protocol) : NULL;
         node->streamId = (SPDYStreamId)idx;
-
-        [self _addListNode:node];
+        [self _addNode:index];
     } else {
         [self removeStreamWithStreamId:(SPDYStreamId)idx];
     }
 }
 
-- (void)_addListNode:(SPDYStreamNode *)node
+- (uint32_t)_allocNode
+{
+    uint32_t index;
+    if (_freeNode != 0) {
+        index = _freeNode;
+        _freeNode = _nodes[index].next;
+    } else {
+        if (_nodeCount == _nodeCapacity) {
+            _nodeCapacity *= 2;
+            _nodes = realloc(_nodes, _nodeCapacity * sizeof(SPDYStreamNode));
+        }
+        index = _nodeCount++;
+    }
+
+    memset(&_nodes[index], 0, sizeof(SPDYStreamNode));
+    return index;
+}
+
+- (void)_addNode:(uint32_t)index
 {
+    SPDYStreamNode *node = &_nodes[index];
+    SPDYStream *stream = (__bridge SPDYStream *)node->stream;
+    node->priority = stream.priority;
+    node->local = stream.local;
+    NSAssert(node->priority < 8, @"invalid stream priority %u", node->priority);
+
     // Update linked list
-    uint8_t priority = node->stream.priority;
-    if (_priorityHead[priority] == NULL) {
-        _priorityHead[priority] = node;
-        _priorityLast[priority] = node;
+    uint8_t priority = node->priority;
+    if (_priorityHead[priority] == 0) {
+        _priorityHead[priority] = index;
+        _priorityLast[priority] = index;
+        _priorityMask |= (uint8_t)(1 << priority);
     } else {
-        _priorityLast[priority]->next = node;
+        _nodes[_priorityLast[priority]].next = index;
         node->prev = _priorityLast[priority];
-        _priorityLast[priority] = node;
+        _priorityLast[priority] = index;
     }
 
-    // Update hash maps
-    NSAssert(node->streamId != 0 || node->protocol != nil, @"cannot insert unaddressable stream");
-    NSAssert(CFDictionaryGetValue(_nodesByStreamId, (void *)(uintptr_t)node->streamId) == NULL, @"cannot insert stream with duplicate streamId");
+    // Update hash tables
+    NSAssert(node->streamId != 0 || node->protocol != NULL, @"cannot insert unaddressable stream");
+    NSAssert(SPDYStreamTableGet(&_nodesByStreamId, (uintptr_t)node->streamId) == 0, @"cannot insert stream with duplicate streamId");
     if (node->streamId) {
-        CFDictionarySetValue(_nodesByStreamId, (void *)(uintptr_t)node->streamId, (__bridge CFTypeRef)node);
+        SPDYStreamTableSet(&_nodesByStreamId, (uintptr_t)node->streamId, index);
     }
     if (node->protocol) {
-        CFDictionarySetValue(_nodesByProtocol, (__bridge CFTypeRef)node->protocol, (__bridge CFTypeRef)node);
+        SPDYStreamTableSet(&_nodesByProtocol, (uintptr_t)node->protocol, index);
     }
 
     // Update counts
-    if (node->stream.local) {
+    if (node->local) {
         _localCount += 1;
     } else {
         _remoteCount += 1;
@@ -182,63 +348,77 @@ CFStringRef SPDYStreamIdCopyDescription(const void *key) {
 
 - (void)removeStreamWithStreamId:(SPDYStreamId)streamId
 {
-    SPDYStreamNode *node = (id)CFDictionaryGetValue(_nodesByStreamId, (void *)(uintptr_t)streamId);
-    if (node) [self _removeListNode:node];
+    uint32_t index = SPDYStreamTableGet(&_nodesByStreamId, (uintptr_t)streamId);
+    if (index) [self _removeNode:index];
 }
 
 - (void)removeStreamForProtocol:(SPDYProtocol *)protocol
 {
-    SPDYStreamNode *node = (id)CFDictionaryGetValue(_nodesByProtocol, (__bridge CFTypeRef)protocol);
-    if (node) [self _removeListNode:node];
+    uint32_t index = SPDYStreamTableGet(&_nodesByProtocol, (uintptr_t)(__bridge void *)protocol);
+    if (index) [self _removeNode:index];
 }
 
-- (void)_removeListNode:(SPDYStreamNode *)node
+- (void)_removeNode:(uint32_t)index
 {
-    // Update linked list
-    uint8_t priority = node->stream.priority;
-    if (node->next != NULL) node->next->prev = node->prev;
-    if (node->prev != NULL) node->prev->next = node->next;
-    if (_priorityHead[priority] == node) _priorityHead[priority] = node->next;
-    if (_priorityLast[priority] == node) _priorityLast[priority] = node->prev;
+    SPDYStreamNode *node = &_nodes[index];
 
-    // Update hash maps
+    // Update linked list
+    uint8_t priority = node->priority;
+    if (node->next != 0) _nodes[node->next].prev = node->prev;
+    if (node->prev != 0) _nodes[node->prev].next = node->next;
+    if (_priorityHead[priority] == index) _priorityHead[priority] = node->next;
+    if (_priorityLast[priority] == index) _priorityLast[priority] = node->prev;
+    if (_priorityHead[priority] == 0) _priorityMask &= (uint8_t)~(1 << priority);
+
+    // Update hash tables
     if (node->streamId) {
-        CFDictionaryRemoveValue(_nodesByStreamId, (void *)(uintptr_t)node->streamId);
+        SPDYStreamTableRemove(&_nodesByStreamId, (uintptr_t)node->streamId);
     }
     if (node->protocol) {
-        CFDictionaryRemoveValue(_nodesByProtocol, (__bridge CFTypeRef)node->protocol);
+        SPDYStreamTableRemove(&_nodesByProtocol, (uintptr_t)node->protocol);
     }
 
     // Update counts
-    if (node->stream.local) {
+    if (node->local) {
         _localCount -= 1;
     } else {
         _remoteCount -= 1;
     }
 
     _mutations += 1;
+
+    // Recycle the node before releasing, in case the stream's dealloc reenters
+    CFTypeRef stream = node->stream;
+    CFTypeRef protocol = node->protocol;
+    node->stream = NULL;
+    node->protocol = NULL;
+    node->next = _freeNode;
+    _freeNode = index;
+
+    CFRelease(stream);
+    if (protocol) CFRelease(protocol);
 }
 
 - (NSUInteger)countByEnumeratingWithState:(NSFastEnumerationState *)state objects:(id __unsafe_unretained [])buffer count:(NSUInteger)len
 {
-    SPDYStreamNode *currentNode = (__bridge SPDYStreamNode *)((void *)state->extra[0]);
+    uint32_t currentNode = (uint32_t)state->extra[0];
     unsigned long *priority = &(state->state);
 
-    for (; *priority < 8 && currentNode == NULL; *priority += 1) {
+    for (; *priority < 8 && currentNode == 0; *priority += 1) {
         currentNode = _priorityHead[*priority];
     }
 
-    if (currentNode == NULL) {
+    if (currentNode == 0) {
         return 0;
     }
 
     NSUInteger i;
-    for (i = 0; i < len && currentNode != NULL; i++) {
-        buffer[i] = currentNode->stream;
-        currentNode = currentNode->next;
+    for (i = 0; i < len && currentNode != 0; i++) {
+        buffer[i] = (__bridge SPDYStream *)_nodes[currentNode].stream;
+        currentNode = _nodes[currentNode].next;
     }
 
-    state->extra[0] = (unsigned long)currentNode;
+    state->extra[0] = currentNode;
     state->itemsPtr = buffer;
     state->mutationsPtr = &_mutations;
     return i;
@@ -248,19 +428,38 @@ CFStringRef SPDYStreamIdCopyDescription(const void *key) {
 {
     // Update linked list
     for (int i = 0; i < 8; i++) {
-        _priorityHead[i] = NULL;
-        _priorityLast[i] = NULL;
+        _priorityHead[i] = 0;
+        _priorityLast[i] = 0;
     }
+    _priorityMask = 0;
 
-    // Update hash maps
-    CFDictionaryRemoveAllValues(_nodesByStreamId);
-    CFDictionaryRemoveAllValues(_nodesByProtocol);
+    // Update hash tables
+    SPDYStreamTableRemoveAll(&_nodesByStreamId);
+    SPDYStreamTableRemoveAll(&_nodesByProtocol);
 
     // Update counts
     _localCount = 0;
     _remoteCount = 0;
 
     _mutations += 1;
+
+    // Recycle every node before releasing, in case a stream's dealloc reenters; the node
+    // array itself is kept for reuse
+    NSUInteger releaseCount = 0;
+    CFTypeRef *released = malloc(2 * _nodeCount * sizeof(CFTypeRef));
+    for (uint32_t i = 1; i < _nodeCount; i++) {
+        if (_nodes[i].stream) released[releaseCount++] = _nodes[i].stream;
+        if (_nodes[i].protocol) released[releaseCount++] = _nodes[i].protocol;
+        _nodes[i].stream = NULL;
+        _nodes[i].protocol = NULL;
+    }
+    _nodeCount = 1;
+    _freeNode = 0;
+
+    for (NSUInteger i = 0; i < releaseCount; i++) {
+        CFRelease(released[i]);
+    }
+    free(released);
 }
 
 @end
@@ -0,0 +1,44 @@
+//
+//  SPDYZLibAllocator.h
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#import <Foundation/Foundation.h>
+#import <zlib.h>
+
+/**
+  Bounded, thread-local pool for zlib state and window buffers.
+
+  zlib requests the same few buffer sizes for every header codec and every
+  compressed response, so freed buffers are cached per size on the freeing
+  thread and handed back out to the next stream, instead of going back to
+  malloc. Each thread caches at most SPDY_ZLIB_POOL_MAX_CACHED_BYTES.
+*/
+
+#define SPDY_ZLIB_POOL_MAX_CACHED_BYTES (512 * 1024)
+
+typedef struct {
+    int64_t bytesInUse;           // outstanding bytes allocated on this thread, less bytes freed on it
+    NSUInteger bytesCached;       // bytes held for reuse
+    NSUInteger highWaterBytes;    // peak of bytesInUse + bytesCached
+    NSUInteger systemAllocations; // requests satisfied by malloc
+    NSUInteger pooledAllocations; // requests satisfied from the pool
+} SPDYZLibAllocatorStatistics;
+
+voidpf SPDYZLibAlloc(voidpf opaque, uInt items, uInt size);
+void SPDYZLibFree(voidpf opaque, voidpf address);
+
+// Points a z_stream at the pool; call before deflateInit*/inflateInit*.
+void SPDYZLibAllocatorPrepareStream(z_stream *zlibStream);
+
+// Statistics for the calling thread's pool.
+SPDYZLibAllocatorStatistics SPDYZLibAllocatorGetStatistics(void);
+
+// Releases every buffer cached by the calling thread's pool.
+void SPDYZLibAllocatorDrain(void);
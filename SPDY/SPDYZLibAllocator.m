@@ -0,0 +1,207 @@
+//
+//  SPDYZLibAllocator.m
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#if !defined(__has_feature) || !__has_feature(objc_arc)
+#error "This file requires ARC support."
+#endif
+
+#import <pthread.h>
+#import "SPDYZLibAllocator.h"
+
+// zlib asks for a handful of distinct sizes (state, window, hash and pending buffers)
+#define POOL_SIZE_CLASSES 16
+
+// Each buffer is prefixed with its size so it can be returned to the right class on free. The
+// union pads the header to 16 bytes, preserving malloc's alignment for the caller.
+typedef union SPDYZLibBlock {
+    struct {
+        union SPDYZLibBlock *next;
+        size_t size;
+    } header;
+    uint8_t padding[16];
+} SPDYZLibBlock;
+
+typedef struct {
+    size_t size;
+    SPDYZLibBlock *head;
+} SPDYZLibSizeClass;
+
+typedef struct {
+    SPDYZLibSizeClass classes[POOL_SIZE_CLASSES];
+    NSUInteger classCount;
+    SPDYZLibAllocatorStatistics statistics;
+} SPDYZLibPool;
+
+static pthread_key_t poolKey;
+static pthread_once_t poolKeyOnce = PTHREAD_ONCE_INIT;
+
+static void drainPool(SPDYZLibPool *pool)
+{
+    for (NSUInteger i = 0; i < pool->classCount; i++) {
+        SPDYZLibBlock *block = pool->classes[i].head;
+        while (block) {
+            SPDYZLibBlock *next = block->header.next;
+            free(block);
+            block = next;
+        }
+        pool->classes[i].head = NULL;
+    }
+    pool->statistics.bytesCached = 0;
+}
+
+static void destroyPool(void *value)
+{
+    drainPool((SPDYZLibPool *)value);
+    free(value);
+}
+
+static void createPoolKey(void)
+{
+    pthread_key_create(&poolKey, destroyPool);
+}
+
+static SPDYZLibPool *currentPool(void)
+{
+    pthread_once(&poolKeyOnce, createPoolKey);
+    SPDYZLibPool *pool = pthread_getspecific(poolKey);
+    if (pool == NULL) {
+        pool = calloc(1, sizeof(SPDYZLibPool));
+        if (pool) {
+            pthread_setspecific(poolKey, pool);
+        }
+    }
+    return pool;
+}
+
+static SPDYZLibSizeClass *sizeClassForSize(SPDYZLibPool *pool, size_t size, bool create)
+{
+    for (NSUInteger i = 0; i < pool->classCount; i++) {
+        if (pool->classes[i].size == size) {
+            return &pool->classes[i];
+        }
+    }
+
+    if (create && pool->classCount < POOL_SIZE_CLASSES) {
+        SPDYZLibSizeClass *sizeClass = &pool->classes[pool->classCount++];
+        sizeClass->size = size;
+        sizeClass->head = NULL;
+        return sizeClass;
+    }
+
+    return NULL;
+}
+
+static void updateHighWater(SPDYZLibPool *pool)
+{
+    int64_t total = pool->statistics.bytesInUse + (int64_t)pool->statistics.bytesCached;
+    if (total > (int64_t)pool->statistics.highWaterBytes) {
+        pool->statistics.highWaterBytes = (NSUInteger)total;
+    }
+}
+
+voidpf SPDYZLibAlloc(voidpf opaque, uInt items, uInt size)
+{
+    if (size != 0 && items > SIZE_MAX / size) {
+        return Z_NULL;
+    }
+
+    size_t length = (size_t)items * size;
+    SPDYZLibPool *pool = currentPool();
+    SPDYZLibBlock *block = NULL;
+
+    if (pool) {
+        SPDYZLibSizeClass *sizeClass = sizeClassForSize(pool, length, NO);
+        if (sizeClass && sizeClass->head) {
+            block = sizeClass->head;
+            sizeClass->head = block->header.next;
+            pool->statistics.bytesCached -= length;
+            pool->statistics.pooledAllocations++;
+        }
+    }
+
+    if (block == NULL) {
+        if (length > SIZE_MAX - sizeof(SPDYZLibBlock)) {
+            return Z_NULL;
+        }
+        block = malloc(sizeof(SPDYZLibBlock) + length);
+        if (block == NULL) {
+            return Z_NULL;
+        }
+        block->header.size = length;
+        if (pool) {
+            pool->statistics.systemAllocations++;
+        }
+    }
+
+    block->header.next = NULL;
+    if (pool) {
+        pool->statistics.bytesInUse += length;
+        updateHighWater(pool);
+    }
+
+    return (voidpf)(block + 1);
+}
+
+void SPDYZLibFree(voidpf opaque, voidpf address)
+{
+    if (address == Z_NULL) {
+        return;
+    }
+
+    SPDYZLibBlock *block = ((SPDYZLibBlock *)address) - 1;
+    size_t length = block->header.size;
+    SPDYZLibPool *pool = currentPool();
+
+    if (pool) {
+        pool->statistics.bytesInUse -= length;
+
+        if (pool->statistics.bytesCached + length <= SPDY_ZLIB_POOL_MAX_CACHED_BYTES) {
+            SPDYZLibSizeClass *sizeClass = sizeClassForSize(pool, length, YES);
+            if (sizeClass) {
+                block->header.next = sizeClass->head;
+                sizeClass->head = block;
+                pool->statistics.bytesCached += length;
+                return;
+            }
+        }
+    }
+
+    free(block);
+}
+
+void SPDYZLibAllocatorPrepareStream(z_stream *zlibStream)
+{
+    // The pool is resolved per call rather than through opaque, since a stream may be torn
+    // down on a different thread than the one that created it.
+    zlibStream->zalloc = SPDYZLibAlloc;
+    zlibStream->zfree = SPDYZLibFree;
+    zlibStream->opaque = Z_NULL;
+}
+
+SPDYZLibAllocatorStatistics SPDYZLibAllocatorGetStatistics(void)
+{
+    SPDYZLibPool *pool = currentPool();
+    if (pool) {
+        return pool->statistics;
+    }
+
+    SPDYZLibAllocatorStatistics empty;
+    bzero(&empty, sizeof(empty));
+    return empty;
+}
+
+void SPDYZLibAllocatorDrain(void)
+{
+    SPDYZLibPool *pool = currentPool();
+    if (pool) {
+        drainPool(pool);
+    }
+}
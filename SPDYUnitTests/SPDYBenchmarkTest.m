@@ -0,0 +1,1006 @@
+//
+//  SPDYBenchmarkTest.m
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+// Microbenchmarks for hot paths. Results are logged rather than asserted on, since timing
+// varies widely across devices and CI hosts; each benchmark still checks that the compared
+// paths produce equivalent output.
+
+#import <SenTestingKit/SenTestingKit.h>
+#import <Foundation/Foundation.h>
+#import <objc/runtime.h>
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <arpa/inet.h>
+#import <unistd.h>
+#import "SPDYDefinitions.h"
+#import "SPDYFrame.h"
+#import "SPDYFrameDecoder.h"
+#import "SPDYFrameEncoder.h"
+#import "SPDYHeaderBlockCompressor.h"
+#import "SPDYMockURLProtocolClient.h"
+#import "SPDYOrigin.h"
+#import "SPDYProtocol.h"
+#import "SPDYReceiveWindowTuner.h"
+#import "SPDYSession.h"
+#import "SPDYSessionManager.h"
+#import "SPDYSessionPool.h"
+#import "SPDYSocket.h"
+#import "SPDYSocketOps.h"
+#import "SPDYStopwatch.h"
+#import "SPDYStream.h"
+#import "SPDYStreamManager.h"
+
+#define BENCHMARK_LOG(name, baseline, candidate) \
+    NSLog(@"SPDYBenchmark: %@: baseline %.3fms, candidate %.3fms (%.2fx)", \
+        name, (baseline) * 1000.0, (candidate) * 1000.0, (candidate) > 0 ? (baseline) / (candidate) : 0.0)
+
+@interface SPDYBenchmarkTest : SenTestCase
+@end
+
+// Stands in for SPDYSocket's write queue: every frame becomes a (recycled) write op.
+@interface SPDYBenchmarkWriteQueue : NSObject <SPDYFrameEncoderDelegate>
+@property (nonatomic) NSUInteger opCount;
+@property (nonatomic) NSUInteger byteCount;
+@property (nonatomic, strong) SPDYSocketWriteOp *lastOp;
+@end
+
+@implementation SPDYBenchmarkWriteQueue
+
+- (void)didEncodeFrameHeader:(const uint8_t *)header
+                      length:(NSUInteger)headerLength
+                     payload:(NSData *)payload
+                         tag:(uint32_t)tag
+                frameEncoder:(SPDYFrameEncoder *)encoder
+{
+    if (_lastOp) {
+        [_lastOp setHeader:header length:headerLength payload:payload timeout:-1 tag:tag];
+    } else {
+        _lastOp = [[SPDYSocketWriteOp alloc] initWithHeader:header length:headerLength payload:payload timeout:-1 tag:tag];
+    }
+    _opCount++;
+    _byteCount += headerLength + payload.length;
+}
+
+@end
+
+@interface SPDYSocket ()
+- (void)_dequeueWrite;
+@end
+
+@interface SPDYBenchmarkSocketDelegate : NSObject <SPDYSocketDelegate>
+@property (nonatomic) NSUInteger completedWrites;
+@end
+
+@implementation SPDYBenchmarkSocketDelegate
+
+- (void)socket:(SPDYSocket *)socket didWriteDataWithTag:(long)tag
+{
+    _completedWrites++;
+}
+
+@end
+
+// Sends SPDYSocket's write passes to a file descriptor, counting each write(2)
+@interface SPDYBenchmarkSocket : SPDYSocket
+@property (nonatomic) int fd;
+@property (nonatomic) NSUInteger writeCalls;
+@end
+
+@implementation SPDYBenchmarkSocket
+
+- (id)initWithFileDescriptor:(int)fd delegate:(id<SPDYSocketDelegate>)delegate
+{
+    self = [super initWithDelegate:delegate];
+    if (self) {
+        _fd = fd;
+
+        // _write requires a write stream; it is never written to since _writeBytes is overridden
+        Ivar ivar = class_getInstanceVariable([SPDYSocket class], "_writeStream");
+        *(CFWriteStreamRef *)((uint8_t *)(__bridge void *)self + ivar_getOffset(ivar)) =
+            CFWriteStreamCreateWithAllocatedBuffers(kCFAllocatorDefault, kCFAllocatorDefault);
+    }
+    return self;
+}
+
+- (bool)_writeStreamReady
+{
+    return YES;
+}
+
+- (CFIndex)_writeBytes:(const uint8_t *)bytes length:(NSUInteger)length
+{
+    _writeCalls++;
+    return write(_fd, bytes, length);
+}
+
+- (void)_scheduleWrite
+{
+}
+
+- (void)_unscheduleWriteStream
+{
+}
+
+@end
+
+// The previous SPDYStreamManager, indexed by stream id only: an object per node, a CFDictionary
+// with callback-based hashing, and a scan over the eight priority list heads.
+@interface SPDYBenchmarkLegacyStreamNode : NSObject
+@end
+
+@implementation SPDYBenchmarkLegacyStreamNode
+{
+  @public
+    __strong SPDYBenchmarkLegacyStreamNode *next;
+    __strong SPDYBenchmarkLegacyStreamNode *prev;
+    __strong SPDYStream *stream;
+    SPDYStreamId streamId;
+}
+@end
+
+@interface SPDYBenchmarkLegacyStreamManager : NSObject
+- (void)addStream:(SPDYStream *)stream;
+- (id)objectAtIndexedSubscript:(NSUInteger)idx;
+- (SPDYStream *)nextPriorityStream;
+- (void)removeStreamWithStreamId:(SPDYStreamId)streamId;
+@end
+
+static Boolean legacyStreamIdEqual(const void *key1, const void *key2)
+{
+    return (SPDYStreamId)key1 == (SPDYStreamId)key2;
+}
+
+static CFHashCode legacyStreamIdHash(const void *key)
+{
+    return (CFHashCode)((SPDYStreamId)key);
+}
+
+@implementation SPDYBenchmarkLegacyStreamManager
+{
+    SPDYBenchmarkLegacyStreamNode *_priorityHead[8];
+    SPDYBenchmarkLegacyStreamNode *_priorityLast[8];
+    CFMutableDictionaryRef _nodesByStreamId;
+}
+
+- (id)init
+{
+    self = [super init];
+    if (self) {
+        CFDictionaryKeyCallBacks keyCallbacks = { 0, NULL, NULL, NULL, legacyStreamIdEqual, legacyStreamIdHash };
+        _nodesByStreamId = CFDictionaryCreateMutable(kCFAllocatorDefault, 100, &keyCallbacks, &kCFTypeDictionaryValueCallBacks);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    CFRelease(_nodesByStreamId);
+}
+
+- (void)addStream:(SPDYStream *)stream
+{
+    SPDYBenchmarkLegacyStreamNode *node = [[SPDYBenchmarkLegacyStreamNode alloc] init];
+    node->stream = stream;
+    node->streamId = stream.streamId;
+
+    uint8_t priority = stream.priority;
+    if (_priorityHead[priority] == nil) {
+        _priorityHead[priority] = node;
+    } else {
+        _priorityLast[priority]->next = node;
+        node->prev = _priorityLast[priority];
+    }
+    _priorityLast[priority] = node;
+
+    CFDictionarySetValue(_nodesByStreamId, (void *)(uintptr_t)node->streamId, (__bridge CFTypeRef)node);
+}
+
+- (id)objectAtIndexedSubscript:(NSUInteger)idx
+{
+    SPDYBenchmarkLegacyStreamNode *node = (id)CFDictionaryGetValue(_nodesByStreamId, (void *)idx);
+    return node ? node->stream : nil;
+}
+
+- (SPDYStream *)nextPriorityStream
+{
+    SPDYBenchmarkLegacyStreamNode *node = nil;
+    for (int priority = 0; priority < 8 && node == nil; priority++) {
+        node = _priorityHead[priority];
+    }
+    return node ? node->stream : nil;
+}
+
+- (void)removeStreamWithStreamId:(SPDYStreamId)streamId
+{
+    SPDYBenchmarkLegacyStreamNode *node = (id)CFDictionaryGetValue(_nodesByStreamId, (void *)(uintptr_t)streamId);
+    if (node == nil) return;
+
+    uint8_t priority = node->stream.priority;
+    if (node->next != nil) node->next->prev = node->prev;
+    if (node->prev != nil) node->prev->next = node->next;
+    if (_priorityHead[priority] == node) _priorityHead[priority] = node->next;
+    if (_priorityLast[priority] == node) _priorityLast[priority] = node->prev;
+
+    CFDictionaryRemoveValue(_nodesByStreamId, (void *)(uintptr_t)streamId);
+}
+
+@end
+
+// A session the pool can choose between without a socket behind it. Each stream it's given
+// completes one round trip later, slowed further by the other streams it's carrying.
+@interface SPDYBenchmarkSimulatedSession : SPDYSession
+@property (nonatomic) SPDYTimeInterval roundTripTime;
+- (SPDYTimeInterval)openStreamAtTime:(SPDYTimeInterval)now;
+- (void)finishStreamsBeforeTime:(SPDYTimeInterval)now;
+@end
+
+@implementation SPDYBenchmarkSimulatedSession
+{
+    NSMutableArray *_completionTimes;
+}
+
+- (id)init
+{
+    self = [super init];
+    if (self) {
+        _completionTimes = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (SPDYTimeInterval)openStreamAtTime:(SPDYTimeInterval)now
+{
+    SPDYTimeInterval latency = _roundTripTime * (1.0 + _completionTimes.count / 16.0);
+    [_completionTimes addObject:@(now + latency)];
+    return latency;
+}
+
+- (void)finishStreamsBeforeTime:(SPDYTimeInterval)now
+{
+    NSIndexSet *finished = [_completionTimes indexesOfObjectsPassingTest:^BOOL(NSNumber *time, NSUInteger idx, BOOL *stop) {
+        return time.doubleValue <= now;
+    }];
+    [_completionTimes removeObjectsAtIndexes:finished];
+}
+
+- (bool)isOpen
+{
+    return YES;
+}
+
+- (NSUInteger)capacity
+{
+    return 100 - _completionTimes.count;
+}
+
+- (NSUInteger)load
+{
+    return _completionTimes.count;
+}
+
+- (SPDYTimeInterval)smoothedRoundTripTime
+{
+    return _roundTripTime;
+}
+
+- (uint32_t)sendWindowSize
+{
+    return 65536;
+}
+
+@end
+
+// One client connection to SPDYBenchmarkLoopbackServer. Answers PINGs, and answers every
+// SYN_STREAM with a SYN_REPLY and a single byte of DATA.
+@interface SPDYBenchmarkLoopbackConnection : NSObject <SPDYFrameDecoderDelegate, SPDYFrameEncoderDelegate>
+- (id)initWithFileDescriptor:(int)fd;
+- (void)run;
+@end
+
+@implementation SPDYBenchmarkLoopbackConnection
+{
+    int _fd;
+    SPDYFrameDecoder *_decoder;
+    SPDYFrameEncoder *_encoder;
+}
+
+- (id)initWithFileDescriptor:(int)fd
+{
+    self = [super init];
+    if (self) {
+        _fd = fd;
+        _decoder = [[SPDYFrameDecoder alloc] initWithDelegate:self];
+        _encoder = [[SPDYFrameEncoder alloc] initWithDelegate:self headerCompressionLevel:9];
+    }
+    return self;
+}
+
+- (void)run
+{
+    NSMutableData *input = [[NSMutableData alloc] initWithLength:65536];
+    NSUInteger length = 0;
+    ssize_t bytesRead;
+
+    while ((bytesRead = read(_fd, (uint8_t *)input.mutableBytes + length, input.length - length)) > 0) {
+        length += bytesRead;
+        NSError *error = nil;
+        NSUInteger consumed = [_decoder decode:input.mutableBytes length:length error:&error];
+        if (error) break;
+
+        length -= consumed;
+        memmove(input.mutableBytes, (uint8_t *)input.mutableBytes + consumed, length);
+    }
+    close(_fd);
+}
+
+- (void)didEncodeFrameHeader:(const uint8_t *)header length:(NSUInteger)headerLength payload:(NSData *)payload tag:(uint32_t)tag frameEncoder:(SPDYFrameEncoder *)encoder
+{
+    write(_fd, header, headerLength);
+    if (payload.length > 0) {
+        write(_fd, payload.bytes, payload.length);
+    }
+}
+
+- (void)didReadPingFrame:(SPDYPingFrame *)pingFrame frameDecoder:(SPDYFrameDecoder *)frameDecoder
+{
+    [_encoder encodePingFrame:pingFrame];
+}
+
+- (void)didReadSynStreamFrame:(SPDYSynStreamFrame *)synStreamFrame frameDecoder:(SPDYFrameDecoder *)frameDecoder
+{
+    SPDYSynReplyFrame *synReplyFrame = [[SPDYSynReplyFrame alloc] init];
+    synReplyFrame.streamId = synStreamFrame.streamId;
+    synReplyFrame.headers = @{ @":status" : @"200", @":version" : @"HTTP/1.1" };
+    synReplyFrame.last = NO;
+    [_encoder encodeSynReplyFrame:synReplyFrame error:nil];
+
+    SPDYDataFrame *dataFrame = [[SPDYDataFrame alloc] init];
+    dataFrame.streamId = synStreamFrame.streamId;
+    dataFrame.data = [NSMutableData dataWithLength:1];
+    dataFrame.last = YES;
+    [_encoder encodeDataFrame:dataFrame];
+}
+
+- (void)didReadDataFrame:(SPDYDataFrame *)dataFrame frameDecoder:(SPDYFrameDecoder *)frameDecoder {}
+- (void)didReadSynReplyFrame:(SPDYSynReplyFrame *)synReplyFrame frameDecoder:(SPDYFrameDecoder *)frameDecoder {}
+- (void)didReadRstStreamFrame:(SPDYRstStreamFrame *)rstStreamFrame frameDecoder:(SPDYFrameDecoder *)frameDecoder {}
+- (void)didReadSettingsFrame:(SPDYSettingsFrame *)settingsFrame frameDecoder:(SPDYFrameDecoder *)frameDecoder {}
+- (void)didReadGoAwayFrame:(SPDYGoAwayFrame *)goAwayFrame frameDecoder:(SPDYFrameDecoder *)frameDecoder {}
+- (void)didReadHeadersFrame:(SPDYHeadersFrame *)headersFrame frameDecoder:(SPDYFrameDecoder *)frameDecoder {}
+- (void)didReadWindowUpdateFrame:(SPDYWindowUpdateFrame *)windowUpdateFrame frameDecoder:(SPDYFrameDecoder *)frameDecoder {}
+
+@end
+
+// Plain-TCP SPDY server on an ephemeral loopback port, serving each connection on its own queue.
+@interface SPDYBenchmarkLoopbackServer : NSObject
+@property (nonatomic, readonly) in_port_t port;
+- (void)stop;
+@end
+
+@implementation SPDYBenchmarkLoopbackServer
+{
+    int _listenFd;
+    NSMutableArray *_connectionFds;
+}
+
+- (id)init
+{
+    self = [super init];
+    if (self) {
+        _connectionFds = [[NSMutableArray alloc] init];
+        _listenFd = socket(AF_INET, SOCK_STREAM, 0);
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_len = sizeof(addr);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        bind(_listenFd, (struct sockaddr *)&addr, sizeof(addr));
+        listen(_listenFd, 8);
+
+        socklen_t addrLength = sizeof(addr);
+        getsockname(_listenFd, (struct sockaddr *)&addr, &addrLength);
+        _port = ntohs(addr.sin_port);
+
+        int listenFd = _listenFd;
+        NSMutableArray *connectionFds = _connectionFds;
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            int fd;
+            while ((fd = accept(listenFd, NULL, NULL)) >= 0) {
+                @synchronized (connectionFds) {
+                    [connectionFds addObject:@(fd)];
+                }
+                SPDYBenchmarkLoopbackConnection *connection = [[SPDYBenchmarkLoopbackConnection alloc] initWithFileDescriptor:fd];
+                dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+                    [connection run];
+                });
+            }
+        });
+    }
+    return self;
+}
+
+- (void)stop
+{
+    shutdown(_listenFd, SHUT_RDWR);
+    close(_listenFd);
+    @synchronized (_connectionFds) {
+        for (NSNumber *fd in _connectionFds) {
+            shutdown(fd.intValue, SHUT_RDWR);
+        }
+    }
+}
+
+@end
+
+// Writes a fixed amount of data to a socket, never exceeding the flow control credit granted by
+// the reader. Grants are delivered after a full round trip, standing in for the DATA's trip to the
+// reader plus the WINDOW_UPDATE's trip back.
+@interface SPDYBenchmarkFlowControlledSender : NSObject
+- (id)initWithFileDescriptor:(int)fd length:(NSUInteger)length window:(uint32_t)window;
+- (void)start;
+- (void)grant:(NSUInteger)delta afterDelay:(NSTimeInterval)delay;
+@end
+
+@implementation SPDYBenchmarkFlowControlledSender
+{
+    int _fd;
+    NSUInteger _length;
+    NSUInteger _credit;
+    NSCondition *_condition;
+}
+
+- (id)initWithFileDescriptor:(int)fd length:(NSUInteger)length window:(uint32_t)window
+{
+    self = [super init];
+    if (self) {
+        _fd = fd;
+        _length = length;
+        _credit = window;
+        _condition = [[NSCondition alloc] init];
+    }
+    return self;
+}
+
+- (void)start
+{
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        uint8_t chunk[16384];
+        bzero(chunk, sizeof(chunk));
+        NSUInteger sent = 0;
+        while (sent < _length) {
+            [_condition lock];
+            while (_credit == 0) {
+                [_condition wait];
+            }
+            NSUInteger length = MIN(MIN(_credit, sizeof(chunk)), _length - sent);
+            _credit -= length;
+            [_condition unlock];
+
+            NSUInteger offset = 0;
+            while (offset < length) {
+                ssize_t written = write(_fd, chunk + offset, length - offset);
+                if (written <= 0) return;
+                offset += (NSUInteger)written;
+            }
+            sent += length;
+        }
+    });
+}
+
+- (void)grant:(NSUInteger)delta afterDelay:(NSTimeInterval)delay
+{
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        [_condition lock];
+        _credit += delta;
+        [_condition signal];
+        [_condition unlock];
+    });
+}
+
+@end
+
+// Reads until the expected length arrives, refilling the sender's window the way SPDYSession
+// does. With a tuner, each sample lasts one simulated round trip, like a PING would.
+static NSUInteger receiveFlowControlled(int fd, SPDYBenchmarkFlowControlledSender *sender, NSUInteger length,
+                                        uint32_t window, SPDYReceiveWindowTuner *tuner, NSTimeInterval roundTripTime)
+{
+    uint8_t buffer[65536];
+    NSUInteger received = 0;
+    NSUInteger unacknowledged = 0;
+    SPDYTimeInterval sampleStart = 0;
+
+    [sender start];
+    while (received < length) {
+        ssize_t bytesRead = read(fd, buffer, sizeof(buffer));
+        if (bytesRead <= 0) break;
+        received += (NSUInteger)bytesRead;
+        unacknowledged += (NSUInteger)bytesRead;
+
+        if (tuner) {
+            SPDYTimeInterval now = [SPDYStopwatch currentSystemTime];
+            if (!tuner.sampling) {
+                [tuner startSample];
+                sampleStart = now;
+            } else {
+                [tuner didReceiveBytes:(NSUInteger)bytesRead];
+                if (now - sampleStart >= roundTripTime) {
+                    uint32_t previousWindow = tuner.windowSize;
+                    if ([tuner finishSampleWithRoundTripTime:now - sampleStart] && tuner.windowSize > previousWindow) {
+                        [sender grant:tuner.windowSize - previousWindow afterDelay:roundTripTime];
+                    }
+                    window = tuner.windowSize;
+                }
+            }
+        }
+
+        if (unacknowledged >= window / 2) {
+            [sender grant:unacknowledged afterDelay:roundTripTime];
+            unacknowledged = 0;
+        }
+    }
+
+    return received;
+}
+
+@implementation SPDYBenchmarkTest
+
+static uint8_t *createEncodedHeaderBlock(NSUInteger *pLength)
+{
+    // A representative request header block in SPDY/3 name/value format
+    NSArray *pairs = @[
+        @":method", @"GET", @":path", @"/1.1/statuses/home_timeline.json?count=20",
+        @":version", @"HTTP/1.1", @":host", @"api.twitter.com", @":scheme", @"https",
+        @"accept-encoding", @"gzip, deflate", @"user-agent", @"SPDYBenchmark/1.0"
+    ];
+
+    NSMutableData *block = [[NSMutableData alloc] init];
+    uint32_t count = htonl((uint32_t)pairs.count / 2);
+    [block appendBytes:&count length:4];
+    for (NSString *string in pairs) {
+        NSData *bytes = [string dataUsingEncoding:NSUTF8StringEncoding];
+        uint32_t length = htonl((uint32_t)bytes.length);
+        [block appendBytes:&length length:4];
+        [block appendData:bytes];
+    }
+
+    uint8_t *buffer = malloc(block.length);
+    memcpy(buffer, block.bytes, block.length);
+    *pLength = block.length;
+    return buffer;
+}
+
+#pragma mark Header compression
+
+- (void)testBenchmarkCompressorSetupWithPrimedState
+{
+    const NSUInteger iterations = 2000;
+    NSUInteger inputLength;
+    uint8_t *input = createEncodedHeaderBlock(&inputLength);
+    uint8_t baselineOutput[1024], candidateOutput[1024];
+    NSUInteger baselineLength = 0, candidateLength = 0;
+
+    // Warm the process-wide primed state so its one-time cost isn't attributed to the run
+    (void)[[SPDYHeaderBlockCompressor alloc] initWithCompressionLevel:9];
+
+    SPDYTimeInterval start = [SPDYStopwatch currentSystemTime];
+    for (NSUInteger i = 0; i < iterations; i++) {
+        SPDYHeaderBlockCompressor *compressor = [[SPDYHeaderBlockCompressor alloc] initWithCompressionLevel:9 usePrimedState:NO];
+        baselineLength = [compressor deflate:input availIn:inputLength outputBuffer:baselineOutput availOut:sizeof(baselineOutput) error:nil];
+    }
+    SPDYTimeInterval baseline = [SPDYStopwatch currentSystemTime] - start;
+
+    start = [SPDYStopwatch currentSystemTime];
+    for (NSUInteger i = 0; i < iterations; i++) {
+        SPDYHeaderBlockCompressor *compressor = [[SPDYHeaderBlockCompressor alloc] initWithCompressionLevel:9 usePrimedState:YES];
+        candidateLength = [compressor deflate:input availIn:inputLength outputBuffer:candidateOutput availOut:sizeof(candidateOutput) error:nil];
+    }
+    SPDYTimeInterval candidate = [SPDYStopwatch currentSystemTime] - start;
+
+    BENCHMARK_LOG(@"compressor setup + first header block x2000", baseline, candidate);
+
+    // A cloned state must produce exactly the same stream as a freshly primed one
+    STAssertTrue(baselineLength > 0, nil);
+    STAssertEquals(baselineLength, candidateLength, nil);
+    STAssertTrue(memcmp(baselineOutput, candidateOutput, baselineLength) == 0, nil);
+
+    free(input);
+}
+
+#pragma mark Frame encoding
+
+// The previous encoding strategy: a fresh NSMutableData per frame built with appendBytes, and
+// a separate write op for the DATA frame header and its payload.
+static void legacyEncodeWindowUpdate(NSMutableArray *queue, SPDYStreamId streamId, uint32_t delta)
+{
+    NSMutableData *encodedData = [[NSMutableData alloc] initWithCapacity:16];
+    uint8_t control = 0x80;
+    uint8_t version = 3;
+    uint16_t type = htons(SPDY_WINDOW_UPDATE_FRAME);
+    uint32_t flags_length = htonl(8);
+    uint32_t streamIdBytes = htonl(streamId);
+    uint32_t deltaBytes = htonl(delta);
+    [encodedData appendBytes:&control length:1];
+    [encodedData appendBytes:&version length:1];
+    [encodedData appendBytes:&type length:2];
+    [encodedData appendBytes:&flags_length length:4];
+    [encodedData appendBytes:&streamIdBytes length:4];
+    [encodedData appendBytes:&deltaBytes length:4];
+    [queue addObject:[[SPDYSocketWriteOp alloc] initWithData:encodedData timeout:-1 tag:0]];
+}
+
+static void legacyEncodeData(NSMutableArray *queue, SPDYStreamId streamId, NSData *data)
+{
+    NSMutableData *encodedData = [[NSMutableData alloc] initWithCapacity:8];
+    uint32_t streamIdBytes = htonl(streamId);
+    uint32_t flags_length = htonl((uint32_t)data.length);
+    [encodedData appendBytes:&streamIdBytes length:4];
+    [encodedData appendBytes:&flags_length length:4];
+    [queue addObject:[[SPDYSocketWriteOp alloc] initWithData:encodedData timeout:-1 tag:0]];
+    [queue addObject:[[SPDYSocketWriteOp alloc] initWithData:data timeout:-1 tag:0]];
+}
+
+- (void)testBenchmarkSmallFrameEncoding
+{
+    const NSUInteger iterations = 20000;
+    NSData *payload = [[NSMutableData alloc] initWithLength:256];
+
+    SPDYWindowUpdateFrame *windowUpdateFrame = [[SPDYWindowUpdateFrame alloc] init];
+    windowUpdateFrame.streamId = 1;
+    windowUpdateFrame.deltaWindowSize = 65536;
+
+    SPDYDataFrame *dataFrame = [[SPDYDataFrame alloc] init];
+    dataFrame.streamId = 1;
+    dataFrame.data = payload;
+
+    NSMutableArray *legacyQueue = [[NSMutableArray alloc] init];
+    SPDYTimeInterval start = [SPDYStopwatch currentSystemTime];
+    for (NSUInteger i = 0; i < iterations; i++) {
+        @autoreleasepool {
+            legacyEncodeWindowUpdate(legacyQueue, 1, 65536);
+            legacyEncodeData(legacyQueue, 1, payload);
+            [legacyQueue removeAllObjects];
+        }
+    }
+    SPDYTimeInterval baseline = [SPDYStopwatch currentSystemTime] - start;
+
+    SPDYBenchmarkWriteQueue *writeQueue = [[SPDYBenchmarkWriteQueue alloc] init];
+    SPDYFrameEncoder *encoder = [[SPDYFrameEncoder alloc] initWithDelegate:writeQueue headerCompressionLevel:9];
+    start = [SPDYStopwatch currentSystemTime];
+    for (NSUInteger i = 0; i < iterations; i++) {
+        @autoreleasepool {
+            [encoder encodeWindowUpdateFrame:windowUpdateFrame];
+            [encoder encodeDataFrame:dataFrame];
+        }
+    }
+    SPDYTimeInterval candidate = [SPDYStopwatch currentSystemTime] - start;
+
+    BENCHMARK_LOG(@"WINDOW_UPDATE + 256B DATA encode x20000", baseline, candidate);
+
+    // One write op per frame, with the DATA payload passed through untouched
+    STAssertEquals(writeQueue.opCount, iterations * 2, nil);
+    STAssertEquals(writeQueue.byteCount, iterations * (16 + 8 + payload.length), nil);
+    STAssertTrue(writeQueue.lastOp->_buffer == payload, nil);
+
+    // Both strategies must produce the same bytes on the wire
+    legacyEncodeWindowUpdate(legacyQueue, 1, 65536);
+    SPDYSocketWriteOp *legacyOp = legacyQueue[0];
+    [encoder encodeWindowUpdateFrame:windowUpdateFrame];
+    STAssertEquals(writeQueue.lastOp->_headerLength, legacyOp->_buffer.length, nil);
+    STAssertTrue(memcmp(writeQueue.lastOp->_header, legacyOp->_buffer.bytes, legacyOp->_buffer.length) == 0, nil);
+}
+
+#pragma mark Socket writes
+
+// The previous write strategy: one op at a time, header and payload as separate ops, each
+// written in slices of at most 2852 bytes.
+static NSUInteger legacyWrite(int fd, const uint8_t *bytes, NSUInteger length)
+{
+    NSUInteger calls = 0;
+    NSUInteger offset = 0;
+    while (offset < length) {
+        ssize_t written = write(fd, bytes + offset, MIN(length - offset, (NSUInteger)2852));
+        if (written <= 0) break;
+        offset += (NSUInteger)written;
+        calls++;
+    }
+    return calls;
+}
+
+// Drains the read end of the pair on another thread, until the expected byte count arrives
+static dispatch_semaphore_t drainSocket(int fd, NSUInteger expectedLength)
+{
+    dispatch_semaphore_t done = dispatch_semaphore_create(0);
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        uint8_t buffer[65536];
+        NSUInteger received = 0;
+        while (received < expectedLength) {
+            ssize_t bytesRead = read(fd, buffer, sizeof(buffer));
+            if (bytesRead <= 0) break;
+            received += (NSUInteger)bytesRead;
+        }
+        dispatch_semaphore_signal(done);
+    });
+    return done;
+}
+
+- (void)testBenchmarkGatherWriteOverLoopback
+{
+    const NSUInteger bytesPerRun = 8 * 1024 * 1024;
+    const NSUInteger frameSizes[] = { 1024, 16 * 1024, 64 * 1024, 1024 * 1024 };
+
+    for (NSUInteger i = 0; i < sizeof(frameSizes) / sizeof(frameSizes[0]); i++) {
+        NSUInteger frameSize = frameSizes[i];
+        NSUInteger frameCount = bytesPerRun / frameSize;
+        NSUInteger runLength = frameCount * (8 + frameSize);
+        NSData *payload = [[NSMutableData alloc] initWithLength:frameSize];
+        uint8_t header[8] = { 0, 0, 0, 1, 0, 0, 0, 0 };
+
+        int fds[2];
+        STAssertEquals(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0, nil);
+
+        // Baseline
+        dispatch_semaphore_t done = drainSocket(fds[1], runLength);
+        NSUInteger baselineCalls = 0;
+        SPDYTimeInterval start = [SPDYStopwatch currentSystemTime];
+        for (NSUInteger frame = 0; frame < frameCount; frame++) {
+            baselineCalls += legacyWrite(fds[0], header, sizeof(header));
+            baselineCalls += legacyWrite(fds[0], payload.bytes, payload.length);
+        }
+        dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+        SPDYTimeInterval baseline = [SPDYStopwatch currentSystemTime] - start;
+
+        // Candidate: the whole burst is queued, then flushed in a single writable event
+        done = drainSocket(fds[1], runLength);
+        SPDYBenchmarkSocketDelegate *delegate = [[SPDYBenchmarkSocketDelegate alloc] init];
+        SPDYBenchmarkSocket *socket = [[SPDYBenchmarkSocket alloc] initWithFileDescriptor:fds[0] delegate:delegate];
+        start = [SPDYStopwatch currentSystemTime];
+        for (NSUInteger frame = 0; frame < frameCount; frame++) {
+            [socket writeHeader:header length:sizeof(header) payload:payload streamId:1 withTimeout:(NSTimeInterval)-1 priority:SPDYSocketWritePriorityNormal tag:(long)frame];
+        }
+        [socket _dequeueWrite];
+        dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+        SPDYTimeInterval candidate = [SPDYStopwatch currentSystemTime] - start;
+
+        NSString *name = [NSString stringWithFormat:@"%luKB frames, %lu/%lu write calls, %.1f/%.1f MB/s",
+                          (unsigned long)(frameSize / 1024),
+                          (unsigned long)baselineCalls, (unsigned long)socket.writeCalls,
+                          runLength / baseline / 1e6, runLength / candidate / 1e6];
+        BENCHMARK_LOG(name, baseline, candidate);
+
+        // Every op must still be reported complete, individually
+        STAssertEquals(delegate.completedWrites, frameCount, nil);
+        STAssertTrue(socket.writeCalls <= baselineCalls, nil);
+
+        close(fds[0]);
+        close(fds[1]);
+    }
+}
+
+#pragma mark Preconnect
+
+static bool runLoopUntil(bool (^condition)(void), NSTimeInterval timeout)
+{
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:timeout];
+    while (!condition()) {
+        if ([deadline timeIntervalSinceNow] <= 0) return NO;
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.001]];
+    }
+    return YES;
+}
+
+// Time from queueing a GET on a fresh origin until its first byte of body arrives
+- (SPDYTimeInterval)timeToFirstByteWithPreconnect:(bool)preconnect
+{
+    SPDYBenchmarkLoopbackServer *server = [[SPDYBenchmarkLoopbackServer alloc] init];
+    NSString *url = [NSString stringWithFormat:@"http://127.0.0.1:%u", server.port];
+    SPDYOrigin *origin = [[SPDYOrigin alloc] initWithString:url error:nil];
+
+    if (preconnect) {
+        __block NSUInteger readySessions = 0;
+        __block bool completed = NO;
+        [SPDYProtocol preconnectToOrigin:url sessions:1 completion:^(NSUInteger ready, NSError *error) {
+            readySessions = ready;
+            completed = YES;
+        }];
+        STAssertTrue(runLoopUntil(^bool { return completed; }, 5.0), nil);
+        STAssertEquals(readySessions, (NSUInteger)1, nil);
+    }
+
+    SPDYMockURLProtocolClient *client = [[SPDYMockURLProtocolClient alloc] init];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:[url stringByAppendingString:@"/"]]];
+    SPDYProtocol *protocol = [[SPDYProtocol alloc] initWithRequest:request cachedResponse:nil client:client];
+    SPDYStream *stream = [[SPDYStream alloc] initWithProtocol:protocol];
+
+    SPDYTimeInterval start = [SPDYStopwatch currentSystemTime];
+    [[SPDYSessionManager localManagerForOrigin:origin] queueStream:stream];
+    STAssertTrue(runLoopUntil(^bool { return client.calledDidLoadData > 0; }, 5.0), nil);
+    SPDYTimeInterval timeToFirstByte = [SPDYStopwatch currentSystemTime] - start;
+
+    // Let the session see the disconnect and leave its pool
+    [server stop];
+    runLoopUntil(^bool { return NO; }, 0.01);
+    return timeToFirstByte;
+}
+
+- (void)testBenchmarkPreconnectTimeToFirstByte
+{
+    SPDYConfiguration *configuration = [SPDYConfiguration defaultConfiguration];
+    configuration.enableProxy = NO;
+    configuration.enableTCPNoDelay = YES;
+    [SPDYProtocol setConfiguration:configuration];
+
+    const int rounds = 20;
+    SPDYTimeInterval cold = 0;
+    SPDYTimeInterval warm = 0;
+    for (int i = 0; i < rounds; i++) {
+        cold += [self timeToFirstByteWithPreconnect:NO];
+        warm += [self timeToFirstByteWithPreconnect:YES];
+    }
+
+    // Loopback timings vary too much from run to run to compare; each round has already
+    // checked that the preconnect made a session ready and that the response arrived
+    [SPDYProtocol setConfiguration:[SPDYConfiguration defaultConfiguration]];
+    BENCHMARK_LOG(@"loopback time to first byte, cold vs. preconnected (mean)", cold / rounds, warm / rounds);
+}
+
+#pragma mark Session selection
+
+// Feeds a steady stream of requests to a pool of four sessions, one of them eight times slower
+// than the rest, and returns the 99th percentile stream latency.
+static SPDYTimeInterval simulatedTailLatency(SPDYSessionSelectionPolicy policy)
+{
+    const NSUInteger streamCount = 20000;
+    const SPDYTimeInterval arrivalInterval = 0.01;
+
+    SPDYSessionPool *pool = [[SPDYSessionPool alloc] init];
+    NSMutableArray *sessions = [[NSMutableArray alloc] init];
+    for (int i = 0; i < 4; i++) {
+        SPDYBenchmarkSimulatedSession *session = [[SPDYBenchmarkSimulatedSession alloc] init];
+        session.roundTripTime = (i == 0) ? 0.4 : 0.05;
+        [pool add:session];
+        [sessions addObject:session];
+    }
+
+    SPDYTimeInterval *latencies = malloc(streamCount * sizeof(SPDYTimeInterval));
+    for (NSUInteger i = 0; i < streamCount; i++) {
+        SPDYTimeInterval now = i * arrivalInterval;
+        for (SPDYBenchmarkSimulatedSession *session in sessions) {
+            [session finishStreamsBeforeTime:now];
+        }
+        SPDYBenchmarkSimulatedSession *session = (SPDYBenchmarkSimulatedSession *)[pool nextSessionWithPolicy:policy];
+        latencies[i] = [session openStreamAtTime:now];
+    }
+
+    qsort_b(latencies, streamCount, sizeof(SPDYTimeInterval), ^int(const void *a, const void *b) {
+        SPDYTimeInterval diff = *(const SPDYTimeInterval *)a - *(const SPDYTimeInterval *)b;
+        return (diff > 0) - (diff < 0);
+    });
+    SPDYTimeInterval p99 = latencies[streamCount * 99 / 100];
+    free(latencies);
+    return p99;
+}
+
+- (void)testBenchmarkSessionSelectionTailLatency
+{
+    // Times here are simulated stream latencies, not run times
+    SPDYTimeInterval roundRobin = simulatedTailLatency(SPDYSessionSelectionRoundRobin);
+    SPDYTimeInterval leastLoaded = simulatedTailLatency(SPDYSessionSelectionLeastLoaded);
+    SPDYTimeInterval lowestLatency = simulatedTailLatency(SPDYSessionSelectionLowestLatency);
+
+    BENCHMARK_LOG(@"p99 stream latency, 1 slow session of 4, least loaded", roundRobin, leastLoaded);
+    BENCHMARK_LOG(@"p99 stream latency, 1 slow session of 4, lowest latency", roundRobin, lowestLatency);
+    STAssertTrue(leastLoaded < roundRobin, nil);
+    STAssertTrue(lowestLatency < roundRobin, nil);
+}
+
+#pragma mark Stream table
+
+// Adds every stream, performs the per-frame lookups and scheduling picks a busy session would,
+// then removes the streams one at a time. Returns a checksum of what the lookups found.
+static NSUInteger exerciseStreamManager(id manager, NSArray *streams, NSUInteger lookups)
+{
+    NSUInteger checksum = 0;
+    NSUInteger count = streams.count;
+
+    for (SPDYStream *stream in streams) {
+        [manager addStream:stream];
+    }
+
+    for (NSUInteger i = 0; i < lookups; i++) {
+        SPDYStream *stream = [manager objectAtIndexedSubscript:(2 * ((i * 7919) % count) + 1)];
+        checksum += stream.streamId;
+        if (i % 4 == 0) {
+            checksum += [manager nextPriorityStream].streamId;
+        }
+    }
+
+    for (SPDYStream *stream in streams) {
+        [manager removeStreamWithStreamId:stream.streamId];
+    }
+    return checksum;
+}
+
+- (void)testBenchmarkStreamTableLookups
+{
+    const NSUInteger lookups = 1000000;
+    const NSUInteger streamCounts[] = { 1, 100, 10000 };
+
+    for (NSUInteger i = 0; i < sizeof(streamCounts) / sizeof(streamCounts[0]); i++) {
+        NSUInteger streamCount = streamCounts[i];
+        NSMutableArray *streams = [[NSMutableArray alloc] initWithCapacity:streamCount];
+        for (NSUInteger j = 0; j < streamCount; j++) {
+            SPDYStream *stream = [[SPDYStream alloc] init];
+            stream.streamId = (SPDYStreamId)(2 * j + 1);
+            stream.priority = (uint8_t)(7 - j % 8);
+            stream.local = YES;
+            [streams addObject:stream];
+        }
+
+        SPDYBenchmarkLegacyStreamManager *legacyManager = [[SPDYBenchmarkLegacyStreamManager alloc] init];
+        SPDYTimeInterval start = [SPDYStopwatch currentSystemTime];
+        NSUInteger baselineChecksum = exerciseStreamManager(legacyManager, streams, lookups);
+        SPDYTimeInterval baseline = [SPDYStopwatch currentSystemTime] - start;
+
+        SPDYStreamManager *manager = [[SPDYStreamManager alloc] init];
+        start = [SPDYStopwatch currentSystemTime];
+        NSUInteger candidateChecksum = exerciseStreamManager(manager, streams, lookups);
+        SPDYTimeInterval candidate = [SPDYStopwatch currentSystemTime] - start;
+
+        NSString *name = [NSString stringWithFormat:@"stream table, %lu streams", (unsigned long)streamCount];
+        BENCHMARK_LOG(name, baseline, candidate);
+        STAssertEquals(candidateChecksum, baselineChecksum, nil);
+        STAssertEquals(manager.count, (NSUInteger)0, nil);
+    }
+}
+
+#pragma mark Receive window tuning
+
+- (void)testBenchmarkReceiveWindowAutoTuningWithSimulatedDelay
+{
+    const NSUInteger length = 4 * 1024 * 1024;
+    const uint32_t initialWindow = 65536;
+    const NSTimeInterval roundTripTimes[] = { 0.01, 0.04 };
+
+    for (NSUInteger i = 0; i < sizeof(roundTripTimes) / sizeof(roundTripTimes[0]); i++) {
+        NSTimeInterval roundTripTime = roundTripTimes[i];
+        int fds[2];
+
+        // Baseline: a fixed window
+        STAssertEquals(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0, nil);
+        SPDYBenchmarkFlowControlledSender *sender = [[SPDYBenchmarkFlowControlledSender alloc] initWithFileDescriptor:fds[0] length:length window:initialWindow];
+        SPDYTimeInterval start = [SPDYStopwatch currentSystemTime];
+        STAssertEquals(receiveFlowControlled(fds[1], sender, length, initialWindow, nil, roundTripTime), length, nil);
+        SPDYTimeInterval baseline = [SPDYStopwatch currentSystemTime] - start;
+        close(fds[0]);
+        close(fds[1]);
+
+        // Candidate: the same starting window, auto-tuned up to 10MB
+        STAssertEquals(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0, nil);
+        sender = [[SPDYBenchmarkFlowControlledSender alloc] initWithFileDescriptor:fds[0] length:length window:initialWindow];
+        SPDYReceiveWindowTuner *tuner = [[SPDYReceiveWindowTuner alloc] initWithWindowSize:initialWindow
+                                                                             minWindowSize:initialWindow
+                                                                             maxWindowSize:10485760];
+        start = [SPDYStopwatch currentSystemTime];
+        STAssertEquals(receiveFlowControlled(fds[1], sender, length, initialWindow, tuner, roundTripTime), length, nil);
+        SPDYTimeInterval candidate = [SPDYStopwatch currentSystemTime] - start;
+        close(fds[0]);
+        close(fds[1]);
+
+        NSString *name = [NSString stringWithFormat:@"%.0fms RTT, %.1f/%.1f MB/s, final window %u",
+                          roundTripTime * 1000, length / baseline / 1e6, length / candidate / 1e6, tuner.windowSize];
+        BENCHMARK_LOG(name, baseline, candidate);
+        STAssertTrue(tuner.windowSize > initialWindow, nil);
+    }
+}
+
+@end
@@ -0,0 +1,168 @@
+//
+//  SPDYConnectionBudgetTest.m
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import "SPDYConnectionBudget.h"
+#import "SPDYOrigin.h"
+#import "SPDYProtocol.h"
+
+@interface SPDYMockBudgetClient : NSObject <SPDYConnectionBudgetClient>
+@property (nonatomic) SPDYOrigin *origin;
+@property (nonatomic) NSArray *runLoopModes;
+@property (nonatomic) int calledConnectionBudgetAvailable;
+- (id)initWithOrigin:(NSString *)originString;
+@end
+
+@implementation SPDYMockBudgetClient
+
+- (id)initWithOrigin:(NSString *)originString
+{
+    self = [super init];
+    if (self) {
+        _origin = [[SPDYOrigin alloc] initWithString:originString error:nil];
+        _runLoopModes = @[NSDefaultRunLoopMode];
+        _calledConnectionBudgetAvailable = 0;
+    }
+    return self;
+}
+
+- (void)connectionBudgetAvailable
+{
+    _calledConnectionBudgetAvailable += 1;
+}
+
+@end
+
+@interface SPDYConnectionBudgetTest : SenTestCase
+@end
+
+@implementation SPDYConnectionBudgetTest
+
+- (void)runRunLoop
+{
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+}
+
+- (SPDYConnectionBudget *)budgetWithMaxSessions:(NSUInteger)maxSessions
+                                     maxStreams:(NSUInteger)maxStreams
+                                        weights:(NSDictionary *)weights
+{
+    SPDYConfiguration *configuration = [SPDYConfiguration defaultConfiguration];
+    configuration.maxSessions = maxSessions;
+    configuration.maxConcurrentStreams = maxStreams;
+    configuration.originWeights = weights;
+
+    SPDYConnectionBudget *budget = [[SPDYConnectionBudget alloc] init];
+    [budget setConfiguration:configuration];
+    return budget;
+}
+
+#pragma mark Tests
+
+- (void)testUnlimitedBudgetCountsGrants
+{
+    SPDYConnectionBudget *budget = [self budgetWithMaxSessions:0 maxStreams:0 weights:@{}];
+    SPDYMockBudgetClient *client = [[SPDYMockBudgetClient alloc] initWithOrigin:@"https://mocked"];
+
+    for (int i = 0; i < 10; i++) {
+        STAssertTrue([budget acquireSessionForClient:client waitIfUnavailable:YES], nil);
+        STAssertTrue([budget acquireStreamForClient:client waitIfUnavailable:YES], nil);
+    }
+    STAssertEquals(budget.sessionCount, (NSUInteger)10, nil);
+    STAssertEquals(budget.streamCount, (NSUInteger)10, nil);
+
+    [budget releaseSessions:10];
+    [budget releaseStreams:4];
+    STAssertEquals(budget.sessionCount, (NSUInteger)0, nil);
+    STAssertEquals(budget.streamCount, (NSUInteger)6, nil);
+}
+
+- (void)testSpentBudgetWakesWaitingClientOnRelease
+{
+    SPDYConnectionBudget *budget = [self budgetWithMaxSessions:1 maxStreams:0 weights:@{}];
+    SPDYMockBudgetClient *first = [[SPDYMockBudgetClient alloc] initWithOrigin:@"https://mocked1"];
+    SPDYMockBudgetClient *second = [[SPDYMockBudgetClient alloc] initWithOrigin:@"https://mocked2"];
+    SPDYMockBudgetClient *third = [[SPDYMockBudgetClient alloc] initWithOrigin:@"https://mocked3"];
+
+    STAssertTrue([budget acquireSessionForClient:first waitIfUnavailable:YES], nil);
+    STAssertFalse([budget acquireSessionForClient:second waitIfUnavailable:YES], nil);
+    STAssertFalse([budget acquireSessionForClient:third waitIfUnavailable:NO], nil);
+
+    [self runRunLoop];
+    STAssertEquals(second.calledConnectionBudgetAvailable, 0, nil);
+
+    [budget releaseSessions:1];
+    [self runRunLoop];
+    STAssertEquals(second.calledConnectionBudgetAvailable, 1, nil);
+    STAssertEquals(third.calledConnectionBudgetAvailable, 0, @"only waiting clients are told");
+    STAssertTrue([budget acquireSessionForClient:second waitIfUnavailable:YES], nil);
+    STAssertEquals(budget.sessionCount, (NSUInteger)1, nil);
+}
+
+- (void)testWaitingOriginsShareStreamsInProportionToWeight
+{
+    SPDYConnectionBudget *budget = [self budgetWithMaxSessions:0 maxStreams:1 weights:@{ @"https://heavy" : @3 }];
+    SPDYMockBudgetClient *heavy = [[SPDYMockBudgetClient alloc] initWithOrigin:@"https://heavy"];
+    SPDYMockBudgetClient *light = [[SPDYMockBudgetClient alloc] initWithOrigin:@"https://light"];
+
+    // Both origins always want another stream, and one is let through each time one closes
+    int heavyGrants = 0;
+    int lightGrants = 0;
+    for (int i = 0; i < 40; i++) {
+        if ([budget acquireStreamForClient:heavy waitIfUnavailable:YES]) heavyGrants += 1;
+        if ([budget acquireStreamForClient:light waitIfUnavailable:YES]) lightGrants += 1;
+        STAssertEquals(budget.streamCount, (NSUInteger)1, nil);
+        [budget releaseStreams:1];
+    }
+
+    STAssertEquals(heavyGrants + lightGrants, 40, nil);
+    STAssertTrue(heavyGrants >= 29 && heavyGrants <= 31, @"heavy origin got %d of 40 streams", heavyGrants);
+}
+
+- (void)testFreeBudgetGoesToOriginFurthestBehind
+{
+    SPDYConnectionBudget *budget = [self budgetWithMaxSessions:0 maxStreams:2 weights:@{}];
+    SPDYMockBudgetClient *busy = [[SPDYMockBudgetClient alloc] initWithOrigin:@"https://mocked1"];
+    SPDYMockBudgetClient *idle = [[SPDYMockBudgetClient alloc] initWithOrigin:@"https://mocked2"];
+
+    STAssertTrue([budget acquireStreamForClient:busy waitIfUnavailable:YES], nil);
+    STAssertTrue([budget acquireStreamForClient:busy waitIfUnavailable:YES], nil);
+    STAssertFalse([budget acquireStreamForClient:busy waitIfUnavailable:YES], nil);
+    STAssertFalse([budget acquireStreamForClient:idle waitIfUnavailable:YES], nil);
+
+    // The busy origin can't take back the stream it gave up while the idle one waits
+    [budget releaseStreams:1];
+    STAssertFalse([budget acquireStreamForClient:busy waitIfUnavailable:YES], nil);
+    STAssertTrue([budget acquireStreamForClient:idle waitIfUnavailable:YES], nil);
+}
+
+- (void)testWithdrawnClientDoesNotHoldUpOthers
+{
+    SPDYConnectionBudget *budget = [self budgetWithMaxSessions:0 maxStreams:2 weights:@{}];
+    SPDYMockBudgetClient *first = [[SPDYMockBudgetClient alloc] initWithOrigin:@"https://mocked1"];
+    SPDYMockBudgetClient *second = [[SPDYMockBudgetClient alloc] initWithOrigin:@"https://mocked2"];
+    SPDYMockBudgetClient *third = [[SPDYMockBudgetClient alloc] initWithOrigin:@"https://mocked3"];
+
+    STAssertTrue([budget acquireStreamForClient:first waitIfUnavailable:YES], nil);
+    STAssertTrue([budget acquireStreamForClient:third waitIfUnavailable:YES], nil);
+    STAssertFalse([budget acquireStreamForClient:second waitIfUnavailable:YES], nil);
+    STAssertFalse([budget acquireStreamForClient:third waitIfUnavailable:YES], nil);
+
+    // The second origin is furthest behind, until it stops waiting
+    [budget releaseStreams:1];
+    STAssertFalse([budget acquireStreamForClient:third waitIfUnavailable:YES], nil);
+    [budget withdrawClient:second];
+    [self runRunLoop];
+    STAssertTrue(third.calledConnectionBudgetAvailable > 0, nil);
+    STAssertTrue([budget acquireStreamForClient:third waitIfUnavailable:YES], nil);
+}
+
+@end
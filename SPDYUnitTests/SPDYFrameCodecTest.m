@@ -13,24 +13,27 @@
 #import "SPDYError.h"
 #import "SPDYFrameEncoder.h"
 #import "SPDYFrameDecoder.h"
+#import "SPDYHeaderBlock.h"
 #import "SPDYMockFrameDecoderDelegate.h"
 
 @interface SPDYFrameCodecTest : SenTestCase
 @end
 
 @interface SPDYFrameDecoder (CodecTest) <SPDYFrameEncoderDelegate>
-- (void)didEncodeData:(NSData *)data frameEncoder:(SPDYFrameEncoder *)encoder;
 @end
 
 @implementation SPDYFrameDecoder (CodecTest)
-- (void)didEncodeData:(NSData *)data frameEncoder:(SPDYFrameEncoder *)encoder
+- (void)didEncodeFrameHeader:(const uint8_t *)header
+                      length:(NSUInteger)headerLength
+                     payload:(NSData *)payload
+                         tag:(uint32_t)tag
+                frameEncoder:(SPDYFrameEncoder *)encoder
 {
-    NSError *error;
-    [self decode:(uint8_t *)data.bytes length:data.length error:&error];
-}
+    NSMutableData *data = [[NSMutableData alloc] initWithBytes:header length:headerLength];
+    if (payload) {
+        [data appendData:payload];
+    }
 
-- (void)didEncodeData:(NSData *)data withTag:(uint32_t)tag frameEncoder:(SPDYFrameEncoder *)encoder
-{
     NSError *error;
     [self decode:(uint8_t *)data.bytes length:data.length error:&error];
 }
@@ -427,6 +430,169 @@ NSDictionary *testHeaders()
     STAssertEquals(inFrame.deltaWindowSize, outFrame.deltaWindowSize, nil);
 }
 
+- (void)testDecodedHeadersAreIndexedHeaderBlock
+{
+    SPDYSynReplyFrame *inFrame = [[SPDYSynReplyFrame alloc] init];
+    inFrame.streamId = 1;
+    inFrame.headers = @{
+        @":status"     : @"200",
+        @":version"    : @"HTTP/1.1",
+        @"set-cookie"  : @[@"a=1", @"b=2"],
+        @"content-type": @"text/plain"
+    };
+
+    NSInteger bytesEncoded = [_encoder encodeSynReplyFrame:inFrame error:nil];
+    STAssertTrue(bytesEncoded > 12, nil);
+    AssertLastFrameClass(@"SPDYSynReplyFrame");
+
+    SPDYSynReplyFrame *outFrame = _mock.lastFrame;
+    STAssertTrue([outFrame.headers isKindOfClass:[SPDYHeaderBlock class]], nil);
+
+    SPDYHeaderBlock *headerBlock = (SPDYHeaderBlock *)outFrame.headers;
+    STAssertEquals(headerBlock.count, (NSUInteger)4, nil);
+    STAssertTrue([headerBlock containsHeader:":status" length:7], nil);
+    STAssertFalse([headerBlock containsHeader:"location" length:8], nil);
+    STAssertEqualObjects(headerBlock[@":status"], @"200", nil);
+    STAssertNil(headerBlock[@"location"], nil);
+    STAssertEqualObjects(headerBlock, inFrame.headers, nil);
+
+    NSDictionary *httpHeaders = [headerBlock mutableHTTPHeaderFields];
+    STAssertEquals(httpHeaders.count, (NSUInteger)2, nil);
+    STAssertEqualObjects(httpHeaders[@"set-cookie"], @"a=1, b=2", nil);
+    STAssertEqualObjects(httpHeaders[@"content-type"], @"text/plain", nil);
+}
+
+- (void)testHeaderBlockRejectsMalformedInput
+{
+    // Count of 1 with a name length running past the end of the block
+    uint8_t truncated[] = { 0, 0, 0, 1, 0, 0, 0, 9, 'a', 'b', 0, 0 };
+    STAssertNil([[SPDYHeaderBlock alloc] initWithBytes:truncated length:sizeof(truncated)], nil);
+
+    // Count exceeding what the block could possibly hold
+    uint8_t overcounted[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0, 0, 0, 0, 0, 0 };
+    STAssertNil([[SPDYHeaderBlock alloc] initWithBytes:overcounted length:sizeof(overcounted)], nil);
+
+    // Trailing garbage after the advertised headers
+    uint8_t trailing[] = { 0, 0, 0, 1, 0, 0, 0, 1, 'a', 0, 0, 0, 1, 'b', 'c' };
+    STAssertNil([[SPDYHeaderBlock alloc] initWithBytes:trailing length:sizeof(trailing)], nil);
+
+    uint8_t valid[] = { 0, 0, 0, 1, 0, 0, 0, 1, 'a', 0, 0, 0, 1, 'b' };
+    SPDYHeaderBlock *headerBlock = [[SPDYHeaderBlock alloc] initWithBytes:valid length:sizeof(valid)];
+    STAssertNotNil(headerBlock, nil);
+    STAssertEqualObjects(headerBlock[@"a"], @"b", nil);
+}
+
+- (void)testHeaderBlockIndexesManyNamesAndRepeats
+{
+    // Thousands of distinct short names, then a repeat of the first that replaces its value
+    NSUInteger nameCount = 4000;
+    NSMutableData *block = [[NSMutableData alloc] init];
+    uint32_t count = htonl((uint32_t)(nameCount + 1));
+    [block appendBytes:&count length:4];
+    for (NSUInteger i = 0; i <= nameCount; i++) {
+        NSData *name = [[NSString stringWithFormat:@"h%lu", (unsigned long)(i % nameCount)] dataUsingEncoding:NSUTF8StringEncoding];
+        NSData *value = [[NSString stringWithFormat:@"%lu", (unsigned long)i] dataUsingEncoding:NSUTF8StringEncoding];
+        uint32_t length = htonl((uint32_t)name.length);
+        [block appendBytes:&length length:4];
+        [block appendData:name];
+        length = htonl((uint32_t)value.length);
+        [block appendBytes:&length length:4];
+        [block appendData:value];
+    }
+
+    SPDYHeaderBlock *headerBlock = [[SPDYHeaderBlock alloc] initWithBytes:block.bytes length:block.length];
+    STAssertNotNil(headerBlock, nil);
+    STAssertEquals(headerBlock.count, nameCount, nil);
+    STAssertEqualObjects(headerBlock[@"h0"], ([NSString stringWithFormat:@"%lu", (unsigned long)nameCount]), nil);
+    STAssertEqualObjects(headerBlock[@"h3999"], @"3999", nil);
+    STAssertNil(headerBlock[@"h4000"], nil);
+    STAssertTrue([headerBlock containsHeader:"h1234" length:5], nil);
+
+    // Strings are materialized lazily, and the same ones handed to every reader
+    __block bool matched = YES;
+    dispatch_apply(8, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t iteration) {
+        for (NSUInteger i = 1; i < nameCount; i += 7) {
+            NSString *name = [NSString stringWithFormat:@"h%lu", (unsigned long)i];
+            if (![headerBlock[name] isEqualToString:[NSString stringWithFormat:@"%lu", (unsigned long)i]]) {
+                matched = NO;
+            }
+        }
+        if (headerBlock.allKeys.count != nameCount) {
+            matched = NO;
+        }
+    });
+    STAssertTrue(matched, nil);
+    STAssertEquals(headerBlock[@"h8"], headerBlock[@"h8"], nil);
+}
+
+- (void)testSynReplyFrameWithHeadersLargerThanInitialBuffer
+{
+    // Well past the decoder's initial buffer, forcing several geometric grows
+    NSString *bigValue = [@"" stringByPaddingToLength:12000 withString:@"1234567890" startingAtIndex:0];
+
+    SPDYSynReplyFrame *inFrame = [[SPDYSynReplyFrame alloc] init];
+    inFrame.streamId = 1;
+    inFrame.headers = @{ @":status" : @"200", @"bigheader" : bigValue };
+
+    NSInteger bytesEncoded = [_encoder encodeSynReplyFrame:inFrame error:nil];
+    STAssertTrue(bytesEncoded > 12, nil);
+    AssertLastFrameClass(@"SPDYSynReplyFrame");
+
+    SPDYSynReplyFrame *outFrame = _mock.lastFrame;
+    STAssertEqualObjects(outFrame.headers[@"bigheader"], bigValue, nil);
+
+    // A second, small block must still decode after the buffer was handed off
+    [_mock clear];
+    inFrame.headers = @{ @":status" : @"204" };
+    STAssertTrue([_encoder encodeSynReplyFrame:inFrame error:nil] > 12, nil);
+    AssertLastFrameClass(@"SPDYSynReplyFrame");
+    STAssertEqualObjects(((SPDYSynReplyFrame *)_mock.lastFrame).headers[@":status"], @"204", nil);
+}
+
+- (void)testSynReplyFrameWithHeadersLargerThanMaxHeaderBlockLength
+{
+    _decoder.maxHeaderBlockLength = 4096;
+
+    SPDYSynReplyFrame *inFrame = [[SPDYSynReplyFrame alloc] init];
+    inFrame.streamId = 1;
+    inFrame.headers = @{
+        @"bigheader" : [@"" stringByPaddingToLength:8192 withString:@"1234567890" startingAtIndex:0]
+    };
+
+    STAssertTrue([_encoder encodeSynReplyFrame:inFrame error:nil] > 12, nil);
+    AssertFramesReceivedCount(0);
+
+    NSError *error = nil;
+    uint8_t byte = 0;
+    [_decoder decode:&byte length:0 error:&error];
+    STAssertNotNil(error, nil);
+}
+
+- (void)testSynReplyFrameWithHeadersExactlyMaxHeaderBlockLength
+{
+    _decoder.maxHeaderBlockLength = 4096;
+
+    // Count, name length, name and value length take 21 bytes of the decompressed block
+    SPDYSynReplyFrame *inFrame = [[SPDYSynReplyFrame alloc] init];
+    inFrame.streamId = 1;
+    inFrame.headers = @{
+        @"bigheader" : [@"" stringByPaddingToLength:(4096 - 21) withString:@"1234567890" startingAtIndex:0]
+    };
+
+    STAssertTrue([_encoder encodeSynReplyFrame:inFrame error:nil] > 12, nil);
+    AssertLastFrameClass(@"SPDYSynReplyFrame");
+    STAssertEquals([((SPDYSynReplyFrame *)_mock.lastFrame).headers[@"bigheader"] length], (NSUInteger)(4096 - 21), nil);
+
+    // One byte more is too many
+    [_mock clear];
+    inFrame.headers = @{
+        @"bigheader" : [@"" stringByPaddingToLength:(4096 - 20) withString:@"1234567890" startingAtIndex:0]
+    };
+
+    STAssertTrue([_encoder encodeSynReplyFrame:inFrame error:nil] > 12, nil);
+    AssertFramesReceivedCount(0);
+}
+
 - (void)tearDown
 {
     [super tearDown];
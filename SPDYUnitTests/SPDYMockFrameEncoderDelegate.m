@@ -24,14 +24,16 @@
     return self;
 }
 
-- (void)didEncodeData:(NSData *)data frameEncoder:(SPDYFrameEncoder *)encoder
+- (void)didEncodeFrameHeader:(const uint8_t *)header
+                      length:(NSUInteger)headerLength
+                     payload:(NSData *)payload
+                         tag:(uint32_t)tag
+                frameEncoder:(SPDYFrameEncoder *)encoder
 {
-    [self.lastEncodedData appendData:data];
-}
-
-- (void)didEncodeData:(NSData *)data withTag:(uint32_t)tag frameEncoder:(SPDYFrameEncoder *)encoder;
-{
-    [self.lastEncodedData appendData:data];
+    [self.lastEncodedData appendBytes:header length:headerLength];
+    if (payload) {
+        [self.lastEncodedData appendData:payload];
+    }
 }
 
 - (void)clear
@@ -27,9 +27,12 @@
 @property(nonatomic, strong) NSURLResponse *lastRedirectResponse;
 @property(nonatomic, strong) NSCachedURLResponse *lastCachedResponse;
 @property(nonatomic, strong) NSURLResponse *lastResponse;
+@property(nonatomic, strong) NSThread *lastResponseThread;
 @property(nonatomic) NSURLCacheStoragePolicy lastCacheStoragePolicy;
 @property(nonatomic, strong) NSData *lastData;
+@property(nonatomic) NSUInteger totalDataLength;
 @property(nonatomic, strong) NSError *lastError;
+@property(nonatomic, strong) NSThread *lastErrorThread;
 @property(nonatomic, strong) NSURLAuthenticationChallenge *lastReceivedAuthenticationChallenge;
 @property(nonatomic, strong) NSURLAuthenticationChallenge *lastCanceledAuthenticationChallenge;
 @end
@@ -30,6 +30,7 @@
 {
     _calledDidReceiveResponse++;
     _lastResponse = response;
+    _lastResponseThread = [NSThread currentThread];
     _lastCacheStoragePolicy = policy;
 }
 
@@ -37,6 +38,7 @@
 {
     _calledDidLoadData++;
     _lastData = data;
+    _totalDataLength += data.length;
 }
 
 - (void)URLProtocolDidFinishLoading:(NSURLProtocol *)urlProtocol
@@ -48,6 +50,7 @@
 {
     _calledDidFailWithError++;
     _lastError = error;
+    _lastErrorThread = [NSThread currentThread];
 }
 
 - (void)URLProtocol:(NSURLProtocol *)urlProtocol didReceiveAuthenticationChallenge:(NSURLAuthenticationChallenge *)challenge
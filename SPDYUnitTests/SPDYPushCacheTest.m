@@ -0,0 +1,191 @@
+//
+//  SPDYPushCacheTest.m
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import "SPDYMetadata+Utils.h"
+#import "SPDYMockURLProtocolClient.h"
+#import "SPDYProtocol.h"
+#import "SPDYPushCache.h"
+#import "SPDYStream.h"
+
+@interface SPDYPushCacheTest : SenTestCase <SPDYPushCacheDelegate>
+@end
+
+@implementation SPDYPushCacheTest
+{
+    NSMutableArray *_protocolList;
+    NSMutableArray *_failedStreams;
+    SPDYMockURLProtocolClient *_mockURLProtocolClient;
+}
+
+- (void)setUp
+{
+    [super setUp];
+    _protocolList = [[NSMutableArray alloc] init];
+    _failedStreams = [[NSMutableArray alloc] init];
+    _mockURLProtocolClient = [[SPDYMockURLProtocolClient alloc] init];
+}
+
+- (void)pushCache:(SPDYPushCache *)pushCache failedToServeStream:(SPDYStream *)stream
+{
+    [_failedStreams addObject:stream];
+}
+
+- (SPDYStream *)pushedStreamWithURL:(NSString *)urlString streamId:(SPDYStreamId)streamId
+{
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:urlString]];
+    SPDYStream *stream = [[SPDYStream alloc] initWithProtocol:nil];
+    stream.local = NO;
+    stream.request = [SPDYProtocol canonicalRequestForRequest:request];
+    [stream startWithStreamId:streamId sendWindowSize:65536 receiveWindowSize:65536];
+    stream.localSideClosed = YES;
+    return stream;
+}
+
+- (SPDYStream *)localStreamWithURL:(NSString *)urlString method:(NSString *)method
+{
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:urlString]];
+    request.HTTPMethod = method;
+    SPDYProtocol *protocol = [[SPDYProtocol alloc] initWithRequest:request cachedResponse:nil client:_mockURLProtocolClient];
+    [_protocolList addObject:protocol];
+    return [[SPDYStream alloc] initWithProtocol:protocol];
+}
+
+- (void)respondOnStream:(SPDYStream *)stream length:(NSUInteger)length last:(bool)last
+{
+    [stream didReceiveResponse:@{ @":status" : @"200", @":version" : @"HTTP/1.1" }];
+    [stream didLoadData:[NSMutableData dataWithLength:length]];
+    if (last) {
+        stream.remoteSideClosed = YES;
+    }
+}
+
+#pragma mark Tests
+
+- (void)testCompletedPushIsServedOnce
+{
+    SPDYPushCache *cache = [[SPDYPushCache alloc] initWithMaxBytes:4096 maxAge:60.0];
+    SPDYStream *pushedStream = [self pushedStreamWithURL:@"https://mocked/pushed" streamId:2];
+    STAssertTrue([cache addPushedStream:pushedStream], nil);
+    STAssertFalse([cache addPushedStream:[self pushedStreamWithURL:@"https://mocked/pushed" streamId:4]], @"duplicate push should be declined");
+
+    [self respondOnStream:pushedStream length:100 last:YES];
+    STAssertEquals(cache.count, (NSUInteger)1, nil);
+    STAssertEquals(cache.bytesCached, (NSUInteger)100, nil);
+
+    SPDYStream *stream = [self localStreamWithURL:@"https://mocked/pushed" method:@"GET"];
+    STAssertTrue([cache serveStream:stream], nil);
+    STAssertEquals(_mockURLProtocolClient.calledDidReceiveResponse, 1, nil);
+    STAssertEquals(_mockURLProtocolClient.calledDidLoadData, 1, nil);
+    STAssertEquals(_mockURLProtocolClient.calledDidFinishLoading, 1, nil);
+    STAssertEquals(_mockURLProtocolClient.lastData.length, (NSUInteger)100, nil);
+    STAssertEquals([(NSHTTPURLResponse *)_mockURLProtocolClient.lastResponse statusCode], (NSInteger)200, nil);
+    STAssertTrue(stream.metadata.pushed, nil);
+    STAssertEquals(stream.metadata.streamId, (NSUInteger)2, nil);
+
+    // The response carries the serving request's metadata, not the pushed stream's
+    NSDictionary *headers = [(NSHTTPURLResponse *)_mockURLProtocolClient.lastResponse allHeaderFields];
+    SPDYMetadata *responseMetadata = [SPDYMetadata metadataForAssociatedDictionary:headers];
+    STAssertTrue(responseMetadata == stream.metadata, nil);
+    STAssertTrue(responseMetadata != pushedStream.metadata, nil);
+
+    STAssertEquals(cache.count, (NSUInteger)0, nil);
+    STAssertEquals(cache.bytesCached, (NSUInteger)0, nil);
+    STAssertFalse([cache serveStream:[self localStreamWithURL:@"https://mocked/pushed" method:@"GET"]], nil);
+}
+
+- (void)testStreamWaitsForPushInProgress
+{
+    SPDYPushCache *cache = [[SPDYPushCache alloc] initWithMaxBytes:4096 maxAge:60.0];
+    SPDYStream *pushedStream = [self pushedStreamWithURL:@"https://mocked/pushed" streamId:2];
+    STAssertTrue([cache addPushedStream:pushedStream], nil);
+    [self respondOnStream:pushedStream length:100 last:NO];
+
+    SPDYStream *stream = [self localStreamWithURL:@"https://mocked/pushed" method:@"GET"];
+    STAssertTrue([cache serveStream:stream], nil);
+    STAssertEquals(_mockURLProtocolClient.calledDidReceiveResponse, 0, nil);
+
+    [pushedStream didLoadData:[NSMutableData dataWithLength:50]];
+    pushedStream.remoteSideClosed = YES;
+
+    STAssertEquals(_mockURLProtocolClient.calledDidReceiveResponse, 1, nil);
+    STAssertEquals(_mockURLProtocolClient.calledDidFinishLoading, 1, nil);
+    STAssertEquals(_mockURLProtocolClient.lastData.length, (NSUInteger)150, nil);
+    STAssertNil(stream.delegate, nil);
+    STAssertEquals(cache.count, (NSUInteger)0, nil);
+}
+
+- (void)testFailedPushSendsWaitingStreamsToDelegate
+{
+    SPDYPushCache *cache = [[SPDYPushCache alloc] initWithMaxBytes:4096 maxAge:60.0];
+    cache.delegate = self;
+    SPDYStream *pushedStream = [self pushedStreamWithURL:@"https://mocked/pushed" streamId:2];
+    STAssertTrue([cache addPushedStream:pushedStream], nil);
+
+    SPDYStream *stream = [self localStreamWithURL:@"https://mocked/pushed" method:@"GET"];
+    STAssertTrue([cache serveStream:stream], nil);
+
+    [pushedStream closeWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:nil]];
+
+    STAssertEquals(_failedStreams.count, (NSUInteger)1, nil);
+    STAssertEquals(_failedStreams[0], stream, nil);
+    STAssertEquals(_mockURLProtocolClient.calledDidFailWithError, 0, nil);
+    STAssertEquals(cache.count, (NSUInteger)0, nil);
+}
+
+- (void)testOldestPushIsEvictedToStayWithinLimit
+{
+    SPDYPushCache *cache = [[SPDYPushCache alloc] initWithMaxBytes:1000 maxAge:60.0];
+    SPDYStream *first = [self pushedStreamWithURL:@"https://mocked/first" streamId:2];
+    SPDYStream *second = [self pushedStreamWithURL:@"https://mocked/second" streamId:4];
+    STAssertTrue([cache addPushedStream:first], nil);
+    STAssertTrue([cache addPushedStream:second], nil);
+
+    [self respondOnStream:first length:600 last:YES];
+    [self respondOnStream:second length:600 last:YES];
+
+    STAssertEquals(cache.count, (NSUInteger)1, nil);
+    STAssertEquals(cache.bytesCached, (NSUInteger)600, nil);
+    STAssertFalse([cache serveStream:[self localStreamWithURL:@"https://mocked/first" method:@"GET"]], nil);
+    STAssertTrue([cache serveStream:[self localStreamWithURL:@"https://mocked/second" method:@"GET"]], nil);
+
+    // A single response over the limit is never cached
+    SPDYStream *oversized = [self pushedStreamWithURL:@"https://mocked/oversized" streamId:6];
+    STAssertTrue([cache addPushedStream:oversized], nil);
+    [self respondOnStream:oversized length:1001 last:YES];
+    STAssertEquals(cache.count, (NSUInteger)0, nil);
+    STAssertEquals(cache.bytesCached, (NSUInteger)0, nil);
+}
+
+- (void)testExpiredPushIsNotServed
+{
+    SPDYPushCache *cache = [[SPDYPushCache alloc] initWithMaxBytes:4096 maxAge:0];
+    SPDYStream *pushedStream = [self pushedStreamWithURL:@"https://mocked/pushed" streamId:2];
+    STAssertTrue([cache addPushedStream:pushedStream], nil);
+    [self respondOnStream:pushedStream length:100 last:YES];
+
+    STAssertFalse([cache serveStream:[self localStreamWithURL:@"https://mocked/pushed" method:@"GET"]], nil);
+    STAssertEquals(cache.count, (NSUInteger)0, nil);
+}
+
+- (void)testOnlyGetRequestsAreServed
+{
+    SPDYPushCache *cache = [[SPDYPushCache alloc] initWithMaxBytes:4096 maxAge:60.0];
+    SPDYStream *pushedStream = [self pushedStreamWithURL:@"https://mocked/pushed" streamId:2];
+    STAssertTrue([cache addPushedStream:pushedStream], nil);
+    [self respondOnStream:pushedStream length:100 last:YES];
+
+    STAssertFalse([cache serveStream:[self localStreamWithURL:@"https://mocked/pushed" method:@"POST"]], nil);
+    STAssertFalse([cache serveStream:[self localStreamWithURL:@"https://mocked/other" method:@"GET"]], nil);
+    STAssertEquals(cache.count, (NSUInteger)1, nil);
+}
+
+@end
@@ -0,0 +1,94 @@
+//
+//  SPDYReceiveWindowTunerTest.m
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import "SPDYReceiveWindowTuner.h"
+
+@interface SPDYReceiveWindowTunerTest : SenTestCase
+@end
+
+@implementation SPDYReceiveWindowTunerTest
+
+- (bool)sample:(SPDYReceiveWindowTuner *)tuner bytes:(NSUInteger)bytes
+{
+    [tuner startSample];
+    [tuner didReceiveBytes:bytes];
+    return [tuner finishSampleWithRoundTripTime:0.1];
+}
+
+- (void)testWindowGrowsWhenSampleFillsWindow
+{
+    SPDYReceiveWindowTuner *tuner = [[SPDYReceiveWindowTuner alloc] initWithWindowSize:65536
+                                                                         minWindowSize:65536
+                                                                         maxWindowSize:1048576];
+    STAssertEquals(tuner.windowSize, (uint32_t)65536, nil);
+
+    // Less than two thirds of the window in a round trip: the window isn't limiting
+    STAssertFalse([self sample:tuner bytes:40000], nil);
+    STAssertEquals(tuner.windowSize, (uint32_t)65536, nil);
+    STAssertEqualsWithAccuracy(tuner.bandwidth, 400000.0, 1.0, nil);
+
+    STAssertTrue([self sample:tuner bytes:60000], nil);
+    STAssertEquals(tuner.windowSize, (uint32_t)120000, nil);
+
+    STAssertTrue([self sample:tuner bytes:120000], nil);
+    STAssertEquals(tuner.windowSize, (uint32_t)240000, nil);
+
+    // Capped at the ceiling
+    STAssertTrue([self sample:tuner bytes:1000000], nil);
+    STAssertEquals(tuner.windowSize, (uint32_t)1048576, nil);
+    STAssertFalse([self sample:tuner bytes:1048576], nil);
+}
+
+- (void)testWindowShrinksAfterSustainedUnderfilledSamples
+{
+    SPDYReceiveWindowTuner *tuner = [[SPDYReceiveWindowTuner alloc] initWithWindowSize:1048576
+                                                                         minWindowSize:65536
+                                                                         maxWindowSize:1048576];
+
+    STAssertFalse([self sample:tuner bytes:1000], nil);
+    STAssertFalse([self sample:tuner bytes:1000], nil);
+    STAssertTrue([self sample:tuner bytes:1000], nil);
+    STAssertEquals(tuner.windowSize, (uint32_t)524288, nil);
+
+    // A sample in between resets the count
+    STAssertFalse([self sample:tuner bytes:1000], nil);
+    STAssertFalse([self sample:tuner bytes:200000], nil);
+    STAssertFalse([self sample:tuner bytes:1000], nil);
+    STAssertFalse([self sample:tuner bytes:1000], nil);
+    STAssertTrue([self sample:tuner bytes:1000], nil);
+    STAssertEquals(tuner.windowSize, (uint32_t)262144, nil);
+
+    // Never below the floor
+    for (int i = 0; i < 30; i++) {
+        [self sample:tuner bytes:0];
+    }
+    STAssertEquals(tuner.windowSize, (uint32_t)65536, nil);
+}
+
+- (void)testBytesOutsideSampleAreIgnored
+{
+    SPDYReceiveWindowTuner *tuner = [[SPDYReceiveWindowTuner alloc] initWithWindowSize:65536
+                                                                         minWindowSize:65536
+                                                                         maxWindowSize:1048576];
+
+    [tuner didReceiveBytes:1000000];
+    STAssertFalse(tuner.sampling, nil);
+    STAssertFalse([tuner finishSampleWithRoundTripTime:0.1], nil);
+
+    [tuner startSample];
+    STAssertTrue(tuner.sampling, nil);
+    STAssertFalse([tuner finishSampleWithRoundTripTime:0.1], nil);
+    STAssertFalse(tuner.sampling, nil);
+    STAssertEquals(tuner.windowSize, (uint32_t)65536, nil);
+}
+
+@end
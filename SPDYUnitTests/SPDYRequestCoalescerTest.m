@@ -0,0 +1,205 @@
+//
+//  SPDYRequestCoalescerTest.m
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import "SPDYMetadata+Utils.h"
+#import "SPDYMockURLProtocolClient.h"
+#import "SPDYProtocol.h"
+#import "SPDYRequestCoalescer.h"
+#import "SPDYStream.h"
+
+@interface SPDYRequestCoalescerTest : SenTestCase <SPDYStreamDelegate>
+@end
+
+@implementation SPDYRequestCoalescerTest
+{
+    NSMutableArray *_protocolList;
+    NSMutableArray *_canceledStreams;
+    SPDYMockURLProtocolClient *_mockURLProtocolClient;
+}
+
+- (void)setUp
+{
+    [super setUp];
+    _protocolList = [[NSMutableArray alloc] init];
+    _canceledStreams = [[NSMutableArray alloc] init];
+    _mockURLProtocolClient = [[SPDYMockURLProtocolClient alloc] init];
+}
+
+- (void)streamCanceled:(SPDYStream *)stream
+{
+    [_canceledStreams addObject:stream];
+}
+
+- (SPDYStream *)localStreamWithURL:(NSString *)urlString method:(NSString *)method headers:(NSDictionary *)headers
+{
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:urlString]];
+    request.HTTPMethod = method;
+    request.allHTTPHeaderFields = headers;
+    SPDYProtocol *protocol = [[SPDYProtocol alloc] initWithRequest:request cachedResponse:nil client:_mockURLProtocolClient];
+    [_protocolList addObject:protocol];
+    return [[SPDYStream alloc] initWithProtocol:protocol];
+}
+
+- (SPDYStream *)localStreamWithURL:(NSString *)urlString
+{
+    return [self localStreamWithURL:urlString method:@"GET" headers:nil];
+}
+
+- (void)startSharedStream:(SPDYStream *)stream
+{
+    stream.delegate = self;
+    [stream startWithStreamId:1 sendWindowSize:65536 receiveWindowSize:65536];
+    stream.localSideClosed = YES;
+}
+
+- (void)respondOnStream:(SPDYStream *)stream length:(NSUInteger)length last:(bool)last
+{
+    [stream didReceiveResponse:@{ @":status" : @"200", @":version" : @"HTTP/1.1" }];
+    [stream didLoadData:[NSMutableData dataWithLength:length]];
+    if (last) {
+        stream.remoteSideClosed = YES;
+    }
+}
+
+#pragma mark Tests
+
+- (void)testIdenticalRequestsShareOneStream
+{
+    SPDYRequestCoalescer *coalescer = [[SPDYRequestCoalescer alloc] init];
+    SPDYStream *first = [self localStreamWithURL:@"https://mocked/avatar"];
+    SPDYStream *second = [self localStreamWithURL:@"https://mocked/avatar"];
+
+    SPDYStream *sharedStream = [coalescer coalesceStream:first];
+    STAssertNotNil(sharedStream, nil);
+    STAssertTrue(sharedStream != first, nil);
+    STAssertNil([coalescer coalesceStream:second], nil);
+    STAssertEquals(coalescer.count, (NSUInteger)1, nil);
+
+    [self startSharedStream:sharedStream];
+    [self respondOnStream:sharedStream length:100 last:YES];
+
+    STAssertEquals(_mockURLProtocolClient.calledDidReceiveResponse, 2, nil);
+    STAssertEquals(_mockURLProtocolClient.calledDidLoadData, 2, nil);
+    STAssertEquals(_mockURLProtocolClient.calledDidFinishLoading, 2, nil);
+    STAssertEquals(_mockURLProtocolClient.totalDataLength, (NSUInteger)200, nil);
+    STAssertTrue(first.closed, nil);
+    STAssertTrue(second.closed, nil);
+    STAssertNil(first.delegate, nil);
+    STAssertNil(second.delegate, nil);
+
+    STAssertFalse(first.metadata.coalesced, nil);
+    STAssertTrue(second.metadata.coalesced, nil);
+    STAssertEquals(second.metadata.streamId, (NSUInteger)1, nil);
+    SPDYMetadata *responseMetadata = [SPDYProtocol metadataForResponse:_mockURLProtocolClient.lastResponse];
+    STAssertEquals(responseMetadata, second.metadata, @"each request should get its own metadata");
+
+    STAssertEquals(coalescer.requestCount, (NSUInteger)2, nil);
+    STAssertEquals(coalescer.coalescedCount, (NSUInteger)1, nil);
+    STAssertEquals(coalescer.count, (NSUInteger)0, nil);
+}
+
+- (void)testRequestAfterResponseStartedIsNotCoalesced
+{
+    SPDYRequestCoalescer *coalescer = [[SPDYRequestCoalescer alloc] init];
+    SPDYStream *sharedStream = [coalescer coalesceStream:[self localStreamWithURL:@"https://mocked/config"]];
+    [self startSharedStream:sharedStream];
+    [self respondOnStream:sharedStream length:100 last:NO];
+
+    SPDYStream *late = [self localStreamWithURL:@"https://mocked/config"];
+    SPDYStream *lateSharedStream = [coalescer coalesceStream:late];
+    STAssertNotNil(lateSharedStream, nil);
+    STAssertTrue(lateSharedStream != sharedStream, nil);
+    STAssertFalse(late.metadata.coalesced, nil);
+    STAssertEquals(coalescer.count, (NSUInteger)2, nil);
+
+    sharedStream.remoteSideClosed = YES;
+    STAssertEquals(_mockURLProtocolClient.calledDidFinishLoading, 1, nil);
+    STAssertEquals(coalescer.count, (NSUInteger)1, nil);
+}
+
+- (void)testDifferentHeadersOrMethodsAreNotCoalesced
+{
+    SPDYRequestCoalescer *coalescer = [[SPDYRequestCoalescer alloc] init];
+    SPDYStream *stream = [self localStreamWithURL:@"https://mocked/avatar" method:@"GET" headers:@{ @"Accept" : @"image/webp" }];
+    SPDYStream *otherHeaders = [self localStreamWithURL:@"https://mocked/avatar" method:@"GET" headers:@{ @"Accept" : @"image/png" }];
+    SPDYStream *post = [self localStreamWithURL:@"https://mocked/avatar" method:@"POST" headers:nil];
+
+    STAssertNotNil([coalescer coalesceStream:stream], nil);
+    STAssertNotNil([coalescer coalesceStream:otherHeaders], nil);
+    STAssertEquals([coalescer coalesceStream:post], post, @"ineligible streams should be returned as is");
+    STAssertEquals(coalescer.count, (NSUInteger)2, nil);
+    STAssertEquals(coalescer.requestCount, (NSUInteger)2, nil);
+    STAssertEquals(coalescer.coalescedCount, (NSUInteger)0, nil);
+}
+
+- (void)testCancelingOneRequestLeavesOthersLoading
+{
+    SPDYRequestCoalescer *coalescer = [[SPDYRequestCoalescer alloc] init];
+    SPDYStream *first = [self localStreamWithURL:@"https://mocked/avatar"];
+    SPDYStream *second = [self localStreamWithURL:@"https://mocked/avatar"];
+    SPDYStream *sharedStream = [coalescer coalesceStream:first];
+    [coalescer coalesceStream:second];
+    [self startSharedStream:sharedStream];
+
+    [first cancel];
+    STAssertNil(first.delegate, nil);
+    STAssertEquals(_canceledStreams.count, (NSUInteger)0, nil);
+
+    [self respondOnStream:sharedStream length:100 last:YES];
+    STAssertEquals(_mockURLProtocolClient.calledDidReceiveResponse, 1, nil);
+    STAssertEquals(_mockURLProtocolClient.calledDidFinishLoading, 1, nil);
+    STAssertFalse(first.closed, nil);
+    STAssertTrue(second.closed, nil);
+}
+
+- (void)testCancelingEveryRequestCancelsSharedStream
+{
+    SPDYRequestCoalescer *coalescer = [[SPDYRequestCoalescer alloc] init];
+    SPDYStream *first = [self localStreamWithURL:@"https://mocked/avatar"];
+    SPDYStream *second = [self localStreamWithURL:@"https://mocked/avatar"];
+    SPDYStream *sharedStream = [coalescer coalesceStream:first];
+    [coalescer coalesceStream:second];
+    [self startSharedStream:sharedStream];
+
+    [second cancel];
+    [first cancel];
+    STAssertEquals(_canceledStreams.count, (NSUInteger)1, nil);
+    STAssertEquals(_canceledStreams[0], sharedStream, nil);
+    STAssertEquals(coalescer.count, (NSUInteger)0, nil);
+
+    // The next request for the resource starts over on a stream of its own
+    SPDYStream *third = [self localStreamWithURL:@"https://mocked/avatar"];
+    SPDYStream *nextSharedStream = [coalescer coalesceStream:third];
+    STAssertNotNil(nextSharedStream, nil);
+    STAssertTrue(nextSharedStream != sharedStream, nil);
+}
+
+- (void)testFailureIsDeliveredToEveryRequest
+{
+    SPDYRequestCoalescer *coalescer = [[SPDYRequestCoalescer alloc] init];
+    SPDYStream *first = [self localStreamWithURL:@"https://mocked/avatar"];
+    SPDYStream *second = [self localStreamWithURL:@"https://mocked/avatar"];
+    SPDYStream *sharedStream = [coalescer coalesceStream:first];
+    [coalescer coalesceStream:second];
+    [self startSharedStream:sharedStream];
+
+    [sharedStream closeWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:nil]];
+
+    STAssertEquals(_mockURLProtocolClient.calledDidFailWithError, 2, nil);
+    STAssertEquals(_mockURLProtocolClient.lastError.code, (NSInteger)NSURLErrorNetworkConnectionLost, nil);
+    STAssertEquals([SPDYProtocol metadataForError:_mockURLProtocolClient.lastError], second.metadata, nil);
+    STAssertTrue(first.closed, nil);
+    STAssertTrue(second.closed, nil);
+    STAssertEquals(coalescer.count, (NSUInteger)0, nil);
+}
+
+@end
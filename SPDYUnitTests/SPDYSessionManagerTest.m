@@ -13,6 +13,7 @@
 #import <Foundation/Foundation.h>
 #import <SystemConfiguration/SystemConfiguration.h>
 #import "NSURLRequest+SPDYURLRequest.h"
+#import "SPDYConnectionBudget.h"
 #import "SPDYSession.h"
 #import "SPDYSessionManager.h"
 #import "SPDYSessionPool.h"
@@ -20,8 +21,12 @@
 #import "SPDYStream.h"
 #import "SPDYProtocol.h"
 #import "SPDYOrigin.h"
+#import "SPDYRequestHedger.h"
 #import "SPDYStreamManager.h"
 #import "SPDYMockFrameDecoderDelegate.h"
+#import "SPDYMockURLProtocolClient.h"
+#import "SPDYNetworkThread.h"
+#import "SPDYTLSTrustEvaluator.h"
 
 @interface SPDYSessionManager ()
 @property (nonatomic, readonly) SPDYStreamManager *pendingStreams;
@@ -50,13 +55,30 @@
 @end
 
 
-@interface SPDYSessionManagerTest : SenTestCase
+// Self-signed certificate for origin.example.com and localhost, standing in for a server's
+// certificate. It's valid for 825 days from its creation on 2026-10-16.
+static NSString *const kStandInCertificate =
+    @"MIIBvjCCAWSgAwIBAgIUTfabk1S4GPtMfg/4HpQmJ44hFnIwCgYIKoZIzj0EAwIwHTEbMBkGA1UE"
+    @"AwwSb3JpZ2luLmV4YW1wbGUuY29tMB4XDTI2MTAxNjEzNDIzMVoXDTI5MDExODEzNDIzMVowHTEb"
+    @"MBkGA1UEAwwSb3JpZ2luLmV4YW1wbGUuY29tMFkwEwYHKoZIzj0CAQYIKoZIzj0DAQcDQgAEdRM2"
+    @"zfW0b9bq5qqqXONZ521OJc6XZGxcB/RAdMoQXdxEyDz+v2YbdGziMCGy35SZnwsyAk+cdrWlBc7L"
+    @"lI53LaOBgTB/MA8GA1UdEwEB/wQFMAMBAf8wDgYDVR0PAQH/BAQDAgKEMBMGA1UdJQQMMAoGCCsG"
+    @"AQUFBwMBMCgGA1UdEQQhMB+CEm9yaWdpbi5leGFtcGxlLmNvbYIJbG9jYWxob3N0MB0GA1UdDgQW"
+    @"BBRDTC4YiQO+d1cNyCTj+E2wul0kNjAKBggqhkjOPQQDAgNIADBFAiBU/cEmlvhwJ4xua5fUoNIo"
+    @"kS1cZTdXGTBvDRtt2RTwtAIhAKjks5GJ+gF3h6XBBbUvRnXS8k50nWF8PVoJMlvxGbCe";
+
+// Evaluated as of the day after the certificate was created, so the test doesn't expire with it
+static const NSTimeInterval kStandInCertificateVerifyTime = 1792195200;  // 2026-10-17 00:00 UTC
+
+@interface SPDYSessionManagerTest : SenTestCase <SPDYTLSTrustEvaluator>
 
 @end
 
 @implementation SPDYSessionManagerTest
 {
     SPDYMockFrameDecoderDelegate *_mockDecoderDelegate;
+    id _standInCertificate;
+    NSMutableArray *_evaluatedHosts;
 }
 
 - (void)setUp
@@ -75,6 +97,7 @@
 - (void)tearDown
 {
     socketMock_frameDecoder = nil;
+    socketMock_connectError = nil;
     [SPDYSocket performSwizzling:NO];
     [super tearDown];
 }
@@ -438,4 +461,838 @@
     [self _commonSocketReachabilityChangesAfterQueueingStreamThenGlobalReachabilityChangesDoesUpdateSessionPool:NO];
 }
 
+- (void)testDispatchSpreadsStreamsToLeastLoadedSessions
+{
+    SPDYConfiguration *configuration = [SPDYConfiguration defaultConfiguration];
+    configuration.sessionPoolSize = 3;
+    configuration.enableTCPNoDelay = NO;
+    configuration.sessionSelectionPolicy = SPDYSessionSelectionLeastLoaded;
+    [SPDYProtocol setConfiguration:configuration];
+
+    NSString *url = [self nextOriginUrl];
+    SPDYOrigin *origin = [[SPDYOrigin alloc] initWithString:url error:nil];
+    NSMutableURLRequest *urlRequest = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:url]];
+    urlRequest.SPDYDeferrableInterval = 0;
+    SPDYSessionManager *sessionManager = [SPDYSessionManager localManagerForOrigin:origin];
+    [sessionManager _updateReachability:kSCNetworkReachabilityFlagsReachable];
+
+    NSMutableArray *protocols = [[NSMutableArray alloc] init];
+    NSMutableArray *streams = [[NSMutableArray alloc] init];
+    for (int i = 0; i < 7; i++) {
+        SPDYProtocol *protocol = [[SPDYProtocol alloc] init];
+        SPDYStream *stream = [[SPDYStream alloc] initWithProtocol:protocol];
+        stream.request = urlRequest;
+        [protocols addObject:protocol];
+        [streams addObject:stream];
+    }
+
+    // Fill the pool and connect every session
+    [sessionManager queueStream:streams[0]];
+    STAssertEquals([[sessionManager basePool] count], (NSUInteger)3, nil);
+    NSMutableArray *sessions = [[NSMutableArray alloc] init];
+    for (int i = 0; i < 3; i++) {
+        SPDYSession *session = [[sessionManager basePool] nextSession];
+        [sessions addObject:session];
+        [(id <SPDYSocketDelegate>)session socket:nil didConnectToHost:@"mocked.com" port:55555];
+    }
+    STAssertEquals([sessionManager.pendingStreams count], (NSUInteger)0, nil);
+
+    for (int i = 1; i < 6; i++) {
+        [sessionManager queueStream:streams[i]];
+    }
+    for (SPDYSession *session in sessions) {
+        STAssertEquals(session.load, (NSUInteger)2, nil);
+    }
+
+    // Freeing a stream on one session steers the next stream to it
+    SPDYStream *canceledStream = streams[2];
+    SPDYSession *lightestSession = nil;
+    for (SPDYSession *session in sessions) {
+        if (session.activeStreams[canceledStream.streamId] == canceledStream) lightestSession = session;
+    }
+    STAssertNotNil(lightestSession, nil);
+    [canceledStream cancel];
+    STAssertEquals(lightestSession.load, (NSUInteger)1, nil);
+
+    [sessionManager queueStream:streams[6]];
+    STAssertEquals(lightestSession.load, (NSUInteger)2, nil);
+    STAssertEquals([sessionManager.pendingStreams count], (NSUInteger)0, nil);
+
+    for (SPDYSession *session in sessions) {
+        [(id <SPDYSocketDelegate>)session socket:nil willDisconnectWithError:nil];
+        [(id <SPDYSocketDelegate>)session socketDidDisconnect:nil];
+    }
+    STAssertEquals([[sessionManager basePool] count], (NSUInteger)0, nil);
+}
+
+- (void)testPreconnectReportsReadySessionsAndExpiresUnusedOnes
+{
+    SPDYConfiguration *configuration = [SPDYConfiguration defaultConfiguration];
+    configuration.sessionPoolSize = 2;
+    configuration.enableTCPNoDelay = NO;
+    configuration.preconnectIdleTimeout = 0;
+    [SPDYProtocol setConfiguration:configuration];
+
+    NSString *url = [self nextOriginUrl];
+    SPDYOrigin *origin = [[SPDYOrigin alloc] initWithString:url error:nil];
+    SPDYSessionManager *sessionManager = [SPDYSessionManager localManagerForOrigin:origin];
+    [sessionManager _updateReachability:kSCNetworkReachabilityFlagsReachable];
+
+    __block NSUInteger completionCount = 0;
+    __block NSUInteger readySessions = 0;
+    __block NSError *preconnectError = nil;
+    [sessionManager preconnectSessions:2 completion:^(NSUInteger ready, NSError *error) {
+        completionCount += 1;
+        readySessions = ready;
+        preconnectError = error;
+    }];
+
+    STAssertEquals([[sessionManager basePool] count], (NSUInteger)2, nil);
+    STAssertEquals(completionCount, (NSUInteger)0, nil);
+
+    // Each session sends its initial PING, and is ready once it's answered
+    NSMutableArray *sessions = [[NSMutableArray alloc] init];
+    for (int i = 0; i < 2; i++) {
+        SPDYSession *session = [[sessionManager basePool] nextSession];
+        [sessions addObject:session];
+        [(id <SPDYSocketDelegate>)session socket:nil didConnectToHost:@"mocked.com" port:55555];
+    }
+
+    NSUInteger pingCount = 0;
+    for (id frame in _mockDecoderDelegate.framesReceived) {
+        if ([frame isKindOfClass:[SPDYPingFrame class]] && ((SPDYPingFrame *)frame).pingId == 1) pingCount++;
+    }
+    STAssertEquals(pingCount, (NSUInteger)2, nil);
+
+    SPDYPingFrame *pingFrame = [[SPDYPingFrame alloc] init];
+    pingFrame.pingId = 1;
+    [(id <SPDYFrameDecoderDelegate>)sessions[0] didReadPingFrame:pingFrame frameDecoder:nil];
+    STAssertEquals(completionCount, (NSUInteger)0, nil);
+    [(id <SPDYFrameDecoderDelegate>)sessions[1] didReadPingFrame:pingFrame frameDecoder:nil];
+    STAssertEquals(completionCount, (NSUInteger)1, nil);
+    STAssertEquals(readySessions, (NSUInteger)2, nil);
+    STAssertNil(preconnectError, nil);
+
+    // Neither session is given a request, so both are closed once the idle timeout passes
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    for (SPDYSession *session in sessions) {
+        STAssertFalse(session.isOpen, nil);
+        [(id <SPDYSocketDelegate>)session socketDidDisconnect:nil];
+    }
+    STAssertEquals([[sessionManager basePool] count], (NSUInteger)0, nil);
+}
+
+- (void)testOptimisticDispatchOpensStreamWhileConnectingAndRetriesAfterConnectFailure
+{
+    SPDYConfiguration *configuration = [SPDYConfiguration defaultConfiguration];
+    configuration.sessionPoolSize = 1;
+    configuration.enableTCPNoDelay = NO;
+    configuration.enableOptimisticDispatch = YES;
+    [SPDYProtocol setConfiguration:configuration];
+
+    NSString *url = [self nextOriginUrl];
+    SPDYOrigin *origin = [[SPDYOrigin alloc] initWithString:url error:nil];
+    NSMutableURLRequest *urlRequest = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:url]];
+    urlRequest.SPDYDeferrableInterval = 0;
+    SPDYSessionManager *sessionManager = [SPDYSessionManager localManagerForOrigin:origin];
+    [sessionManager _updateReachability:kSCNetworkReachabilityFlagsReachable];
+
+    SPDYProtocol *protocol = [[SPDYProtocol alloc] init];
+    SPDYStream *stream = [[SPDYStream alloc] initWithProtocol:protocol];
+    stream.request = urlRequest;
+
+    // The SYN_STREAM is queued on the new session without waiting for it to connect
+    [sessionManager queueStream:stream];
+    STAssertEquals([sessionManager.pendingStreams count], (NSUInteger)0, nil);
+    STAssertEquals([[sessionManager basePool] count], (NSUInteger)1, nil);
+    SPDYSession *session = [[sessionManager basePool] nextSession];
+    STAssertFalse(session.isConnected, nil);
+    STAssertEquals(session.activeStreams.count, (NSUInteger)1, nil);
+    STAssertTrue([_mockDecoderDelegate.lastFrame isKindOfClass:[SPDYSynStreamFrame class]], nil);
+
+    // The connection fails, and the stream moves to a new session rather than failing
+    [(id <SPDYSocketDelegate>)session socket:nil willDisconnectWithError:nil];
+    [(id <SPDYSocketDelegate>)session socketDidDisconnect:nil];
+    STAssertFalse(stream.closed, nil);
+    STAssertEquals([sessionManager.pendingStreams count], (NSUInteger)0, nil);
+    STAssertEquals([[sessionManager basePool] count], (NSUInteger)1, nil);
+
+    SPDYSession *retrySession = [[sessionManager basePool] nextSession];
+    STAssertTrue(retrySession != session, nil);
+    STAssertEquals(retrySession.activeStreams.count, (NSUInteger)1, nil);
+    STAssertEquals(retrySession.activeStreams[stream.streamId], stream, nil);
+
+    // Connection details are filled in once they're known
+    [(id <SPDYSocketDelegate>)retrySession socket:nil didConnectToHost:@"mocked.com" port:55555];
+    STAssertTrue(stream.metadata.timeSessionConnected > 0, nil);
+
+    [(id <SPDYSocketDelegate>)retrySession socket:nil willDisconnectWithError:nil];
+    [(id <SPDYSocketDelegate>)retrySession socketDidDisconnect:nil];
+    STAssertTrue(stream.closed, @"streams that may have reached the peer are not retried");
+    STAssertEquals([[sessionManager basePool] count], (NSUInteger)0, nil);
+}
+
+- (void)testReachabilityChangeMigratesToNewSessionAndRetriesStalledStreams
+{
+    SPDYConfiguration *configuration = [SPDYConfiguration defaultConfiguration];
+    configuration.sessionPoolSize = 1;
+    configuration.enableTCPNoDelay = NO;
+    configuration.enableSessionMigration = YES;
+    configuration.sessionMigrationStallTimeout = 0;
+    [SPDYProtocol setConfiguration:configuration];
+
+    NSString *url = [self nextOriginUrl];
+    SPDYOrigin *origin = [[SPDYOrigin alloc] initWithString:url error:nil];
+    NSMutableURLRequest *urlRequest = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:url]];
+    urlRequest.SPDYDeferrableInterval = 0;
+    SPDYSessionManager *sessionManager = [SPDYSessionManager localManagerForOrigin:origin];
+    SPDYSocket *socket = [[SPDYSocket alloc] initWithDelegate:nil];
+
+    NSMutableArray *protocols = [[NSMutableArray alloc] init];
+    NSMutableArray *streams = [[NSMutableArray alloc] init];
+    for (int i = 0; i < 3; i++) {
+        SPDYProtocol *protocol = [[SPDYProtocol alloc] init];
+        SPDYStream *stream = [[SPDYStream alloc] initWithProtocol:protocol];
+        stream.request = urlRequest;
+        [protocols addObject:protocol];
+        [streams addObject:stream];
+    }
+    SPDYStream *repliedStream = streams[0];
+    SPDYStream *stalledStream = streams[1];
+    SPDYStream *newStream = streams[2];
+
+    // Two streams in flight on a WIFI session, one of which has its reply
+    [sessionManager _updateReachability:kSCNetworkReachabilityFlagsReachable];
+    [sessionManager queueStream:repliedStream];
+    [sessionManager queueStream:stalledStream];
+    SPDYSession *oldSession = [[sessionManager basePool] nextSession];
+    [(id <SPDYSocketDelegate>)oldSession socket:socket didConnectToHost:@"mocked.com" port:55555];
+    STAssertEquals(oldSession.activeStreams.count, (NSUInteger)2, nil);
+
+    SPDYSynReplyFrame *synReplyFrame = [[SPDYSynReplyFrame alloc] init];
+    synReplyFrame.streamId = repliedStream.streamId;
+    synReplyFrame.headers = @{ @":status" : @"200", @":version" : @"HTTP/1.1" };
+    [(id <SPDYFrameDecoderDelegate>)oldSession didReadSynReplyFrame:synReplyFrame frameDecoder:nil];
+
+    // Moving to WWAN opens a session there right away, and drains the WIFI session
+    [sessionManager _updateReachability:(kSCNetworkReachabilityFlagsReachable | kSCNetworkReachabilityFlagsIsWWAN)];
+    STAssertEquals([[sessionManager basePool] count], (NSUInteger)0, nil);
+    STAssertEquals([[sessionManager wwanPool] count], (NSUInteger)1, nil);
+    STAssertFalse(oldSession.isOpen, nil);
+    STAssertEquals(oldSession.activeStreams.count, (NSUInteger)2, nil);
+
+    NSUInteger goAwayCount = 0;
+    for (id frame in _mockDecoderDelegate.framesReceived) {
+        if ([frame isKindOfClass:[SPDYGoAwayFrame class]]) goAwayCount++;
+    }
+    STAssertEquals(goAwayCount, (NSUInteger)1, nil);
+
+    [socket setCellular:YES];
+    SPDYSession *newSession = [[sessionManager wwanPool] nextSession];
+    [(id <SPDYSocketDelegate>)newSession socket:socket didConnectToHost:@"mocked.com" port:55555];
+
+    // New requests only go to the new session
+    [sessionManager queueStream:newStream];
+    STAssertEquals(newSession.activeStreams.count, (NSUInteger)1, nil);
+    STAssertEquals(newSession.activeStreams[newStream.streamId], newStream, nil);
+
+    // Once the stall timeout passes, the stream still waiting on the old network moves over
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    STAssertEquals(oldSession.activeStreams.count, (NSUInteger)1, nil);
+    STAssertEquals(oldSession.activeStreams[repliedStream.streamId], repliedStream, nil);
+    STAssertEquals(newSession.activeStreams.count, (NSUInteger)2, nil);
+    STAssertEquals(newSession.activeStreams[stalledStream.streamId], stalledStream, nil);
+    STAssertFalse(stalledStream.closed, nil);
+
+    // The old session closes when its last stream finishes
+    SPDYDataFrame *dataFrame = [[SPDYDataFrame alloc] init];
+    dataFrame.streamId = repliedStream.streamId;
+    dataFrame.data = [NSData data];
+    dataFrame.last = YES;
+    [(id <SPDYFrameDecoderDelegate>)oldSession didReadDataFrame:dataFrame frameDecoder:nil];
+    STAssertTrue(repliedStream.closed, nil);
+    STAssertEquals(oldSession.activeStreams.count, (NSUInteger)0, nil);
+
+    [(id <SPDYSocketDelegate>)oldSession socketDidDisconnect:nil];
+    [(id <SPDYSocketDelegate>)newSession socket:socket willDisconnectWithError:nil];
+    [(id <SPDYSocketDelegate>)newSession socketDidDisconnect:nil];
+    STAssertEquals([[sessionManager wwanPool] count], (NSUInteger)0, nil);
+}
+
+- (void)testHedgedRequestTakesFirstReplyAndResetsSlowerStream
+{
+    SPDYConfiguration *configuration = [SPDYConfiguration defaultConfiguration];
+    configuration.sessionPoolSize = 2;
+    configuration.enableTCPNoDelay = NO;
+    [SPDYProtocol setConfiguration:configuration];
+
+    NSString *url = [self nextOriginUrl];
+    SPDYOrigin *origin = [[SPDYOrigin alloc] initWithString:url error:nil];
+    NSMutableURLRequest *urlRequest = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:url]];
+    urlRequest.SPDYDeferrableInterval = 0;
+    urlRequest.SPDYHedgeAfter = 0.01;
+    SPDYSessionManager *sessionManager = [SPDYSessionManager localManagerForOrigin:origin];
+    [sessionManager _updateReachability:kSCNetworkReachabilityFlagsReachable];
+
+    SPDYMockURLProtocolClient *mockURLProtocolClient = [[SPDYMockURLProtocolClient alloc] init];
+    SPDYProtocol *protocol = [[SPDYProtocol alloc] init];
+    SPDYStream *stream = [[SPDYStream alloc] initWithProtocol:protocol];
+    stream.request = urlRequest;
+    stream.client = mockURLProtocolClient;
+
+    [sessionManager queueStream:stream];
+    STAssertEquals([[sessionManager basePool] count], (NSUInteger)2, nil);
+    NSMutableArray *sessions = [[NSMutableArray alloc] init];
+    for (int i = 0; i < 2; i++) {
+        SPDYSession *session = [[sessionManager basePool] nextSession];
+        [sessions addObject:session];
+        [(id <SPDYSocketDelegate>)session socket:nil didConnectToHost:@"mocked.com" port:55555];
+    }
+
+    // The request goes out on one session, but not on the request's own stream
+    SPDYSession *originalSession = ((SPDYSession *)sessions[0]).load > 0 ? sessions[0] : sessions[1];
+    SPDYSession *hedgeSession = (originalSession == sessions[0]) ? sessions[1] : sessions[0];
+    STAssertEquals(originalSession.activeStreams.count, (NSUInteger)1, nil);
+    STAssertEquals(hedgeSession.activeStreams.count, (NSUInteger)0, nil);
+    STAssertEquals(stream.streamId, (SPDYStreamId)0, nil);
+    STAssertFalse(stream.metadata.hedged, nil);
+
+    // With no reply in time, a copy is sent on the other session
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    STAssertEquals(hedgeSession.activeStreams.count, (NSUInteger)1, nil);
+    STAssertTrue(stream.metadata.hedged, nil);
+
+    SPDYStream *originalStream = nil;
+    for (SPDYStream *activeStream in originalSession.activeStreams) originalStream = activeStream;
+    SPDYStream *hedgeStream = nil;
+    for (SPDYStream *activeStream in hedgeSession.activeStreams) hedgeStream = activeStream;
+    STAssertTrue(hedgeStream != originalStream, nil);
+
+    // The copy is answered first, so the original is reset
+    SPDYSynReplyFrame *synReplyFrame = [[SPDYSynReplyFrame alloc] init];
+    synReplyFrame.streamId = hedgeStream.streamId;
+    synReplyFrame.headers = @{ @":status" : @"200", @":version" : @"HTTP/1.1" };
+    [(id <SPDYFrameDecoderDelegate>)hedgeSession didReadSynReplyFrame:synReplyFrame frameDecoder:nil];
+    STAssertEquals(mockURLProtocolClient.calledDidReceiveResponse, 1, nil);
+    STAssertEquals(originalSession.activeStreams.count, (NSUInteger)0, nil);
+
+    SPDYRstStreamFrame *rstStreamFrame = nil;
+    for (id frame in _mockDecoderDelegate.framesReceived) {
+        if ([frame isKindOfClass:[SPDYRstStreamFrame class]]) rstStreamFrame = frame;
+    }
+    STAssertNotNil(rstStreamFrame, nil);
+    STAssertEquals(rstStreamFrame.streamId, originalStream.streamId, nil);
+    STAssertEquals(rstStreamFrame.statusCode, SPDY_STREAM_CANCEL, nil);
+
+    SPDYDataFrame *dataFrame = [[SPDYDataFrame alloc] init];
+    dataFrame.streamId = hedgeStream.streamId;
+    dataFrame.data = [NSMutableData dataWithLength:10];
+    dataFrame.last = YES;
+    [(id <SPDYFrameDecoderDelegate>)hedgeSession didReadDataFrame:dataFrame frameDecoder:nil];
+    STAssertEquals(mockURLProtocolClient.calledDidLoadData, 1, nil);
+    STAssertEquals(mockURLProtocolClient.calledDidFinishLoading, 1, nil);
+    STAssertEquals(mockURLProtocolClient.calledDidFailWithError, 0, nil);
+    STAssertTrue(stream.closed, nil);
+    STAssertTrue(stream.metadata.hedgeWon, nil);
+    STAssertEquals(stream.metadata.streamId, (NSUInteger)hedgeStream.streamId, nil);
+    STAssertEquals([SPDYProtocol metadataForResponse:mockURLProtocolClient.lastResponse], stream.metadata, nil);
+
+    for (SPDYSession *session in sessions) {
+        [(id <SPDYSocketDelegate>)session socket:nil willDisconnectWithError:nil];
+        [(id <SPDYSocketDelegate>)session socketDidDisconnect:nil];
+    }
+    STAssertEquals([[sessionManager basePool] count], (NSUInteger)0, nil);
+}
+
+- (void)testSessionBudgetQueuesOtherOriginUntilSessionCloses
+{
+    // Sessions left open by other tests count against the budget too
+    SPDYConfiguration *configuration = [SPDYConfiguration defaultConfiguration];
+    configuration.sessionPoolSize = 1;
+    configuration.enableTCPNoDelay = NO;
+    configuration.maxSessions = [SPDYConnectionBudget sharedBudget].sessionCount + 1;
+    [SPDYProtocol setConfiguration:configuration];
+
+    NSString *url = [self nextOriginUrl];
+    SPDYOrigin *origin = [[SPDYOrigin alloc] initWithString:url error:nil];
+    SPDYSessionManager *sessionManager = [SPDYSessionManager localManagerForOrigin:origin];
+    [sessionManager _updateReachability:kSCNetworkReachabilityFlagsReachable];
+
+    SPDYProtocol *protocol = [[SPDYProtocol alloc] init];
+    SPDYStream *stream = [[SPDYStream alloc] initWithProtocol:protocol];
+    stream.request = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:url]];
+    [sessionManager queueStream:stream];
+    SPDYSession *session = [[sessionManager basePool] nextSession];
+    [(id <SPDYSocketDelegate>)session socket:nil didConnectToHost:@"127.0.0.1" port:443];
+    STAssertEquals(session.load, (NSUInteger)1, nil);
+
+    // A second origin gets no session while the budget is spent
+    NSString *otherUrl = [self nextOriginUrl];
+    SPDYOrigin *otherOrigin = [[SPDYOrigin alloc] initWithString:otherUrl error:nil];
+    SPDYSessionManager *otherManager = [SPDYSessionManager localManagerForOrigin:otherOrigin];
+    [otherManager _updateReachability:kSCNetworkReachabilityFlagsReachable];
+
+    SPDYProtocol *otherProtocol = [[SPDYProtocol alloc] init];
+    SPDYStream *otherStream = [[SPDYStream alloc] initWithProtocol:otherProtocol];
+    otherStream.request = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:otherUrl]];
+    [otherManager queueStream:otherStream];
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    STAssertEquals([[otherManager basePool] count], (NSUInteger)0, nil);
+    STAssertEquals([otherManager.pendingStreams count], (NSUInteger)1, nil);
+
+    // Once the first origin's session closes, the second origin is told and connects
+    [(id <SPDYSocketDelegate>)session socket:nil willDisconnectWithError:nil];
+    [(id <SPDYSocketDelegate>)session socketDidDisconnect:nil];
+
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while ([[otherManager basePool] count] == 0 && [deadline timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    STAssertEquals([[otherManager basePool] count], (NSUInteger)1, nil);
+    STAssertTrue(otherStream.metadata.queuedMs >= 50, @"queued for %lu ms", (unsigned long)otherStream.metadata.queuedMs);
+    STAssertEquals(stream.metadata.queuedMs, (NSUInteger)0, nil);
+
+    SPDYSession *otherSession = [[otherManager basePool] nextSession];
+    [(id <SPDYSocketDelegate>)otherSession socket:nil didConnectToHost:@"127.0.0.1" port:443];
+    STAssertEquals(otherSession.load, (NSUInteger)1, nil);
+    STAssertEquals([otherManager.pendingStreams count], (NSUInteger)0, nil);
+
+    [(id <SPDYSocketDelegate>)otherSession socket:nil willDisconnectWithError:nil];
+    [(id <SPDYSocketDelegate>)otherSession socketDidDisconnect:nil];
+    STAssertEquals([[otherManager basePool] count], (NSUInteger)0, nil);
+}
+
+- (void)testPreconnectWaitsForSessionBudget
+{
+    SPDYConfiguration *configuration = [SPDYConfiguration defaultConfiguration];
+    configuration.sessionPoolSize = 1;
+    configuration.enableTCPNoDelay = NO;
+    configuration.maxSessions = [SPDYConnectionBudget sharedBudget].sessionCount + 1;
+    [SPDYProtocol setConfiguration:configuration];
+
+    NSString *url = [self nextOriginUrl];
+    SPDYOrigin *origin = [[SPDYOrigin alloc] initWithString:url error:nil];
+    SPDYSessionManager *sessionManager = [SPDYSessionManager localManagerForOrigin:origin];
+    [sessionManager _updateReachability:kSCNetworkReachabilityFlagsReachable];
+
+    SPDYProtocol *protocol = [[SPDYProtocol alloc] init];
+    SPDYStream *stream = [[SPDYStream alloc] initWithProtocol:protocol];
+    stream.request = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:url]];
+    [sessionManager queueStream:stream];
+    SPDYSession *session = [[sessionManager basePool] nextSession];
+    [(id <SPDYSocketDelegate>)session socket:nil didConnectToHost:@"127.0.0.1" port:443];
+
+    // A preconnect to another origin neither connects nor completes while the budget is spent
+    NSString *otherUrl = [self nextOriginUrl];
+    SPDYOrigin *otherOrigin = [[SPDYOrigin alloc] initWithString:otherUrl error:nil];
+    SPDYSessionManager *otherManager = [SPDYSessionManager localManagerForOrigin:otherOrigin];
+    [otherManager _updateReachability:kSCNetworkReachabilityFlagsReachable];
+
+    __block NSUInteger completionCount = 0;
+    __block NSUInteger readySessions = 0;
+    [otherManager preconnectSessions:1 completion:^(NSUInteger ready, NSError *error) {
+        completionCount += 1;
+        readySessions = ready;
+    }];
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    STAssertEquals([[otherManager basePool] count], (NSUInteger)0, nil);
+    STAssertEquals(completionCount, (NSUInteger)0, nil);
+
+    // Once the first origin's session closes, the preconnect goes ahead
+    [(id <SPDYSocketDelegate>)session socket:nil willDisconnectWithError:nil];
+    [(id <SPDYSocketDelegate>)session socketDidDisconnect:nil];
+
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while ([[otherManager basePool] count] == 0 && [deadline timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    STAssertEquals([[otherManager basePool] count], (NSUInteger)1, nil);
+    STAssertEquals(completionCount, (NSUInteger)0, nil);
+
+    SPDYSession *otherSession = [[otherManager basePool] nextSession];
+    [(id <SPDYSocketDelegate>)otherSession socket:nil didConnectToHost:@"127.0.0.1" port:443];
+    SPDYPingFrame *pingFrame = [[SPDYPingFrame alloc] init];
+    pingFrame.pingId = 1;
+    [(id <SPDYFrameDecoderDelegate>)otherSession didReadPingFrame:pingFrame frameDecoder:nil];
+    STAssertEquals(completionCount, (NSUInteger)1, nil);
+    STAssertEquals(readySessions, (NSUInteger)1, nil);
+
+    [(id <SPDYSocketDelegate>)otherSession socket:nil willDisconnectWithError:nil];
+    [(id <SPDYSocketDelegate>)otherSession socketDidDisconnect:nil];
+}
+
+- (void)testStreamBudgetReleasedWhenStreamClosesOnDrainingSession
+{
+    SPDYConnectionBudget *budget = [SPDYConnectionBudget sharedBudget];
+    NSUInteger streamCount = budget.streamCount;
+
+    NSString *url = [self nextOriginUrl];
+    SPDYOrigin *origin = [[SPDYOrigin alloc] initWithString:url error:nil];
+    SPDYSessionManager *sessionManager = [SPDYSessionManager localManagerForOrigin:origin];
+    [sessionManager _updateReachability:kSCNetworkReachabilityFlagsReachable];
+
+    SPDYProtocol *protocol = [[SPDYProtocol alloc] init];
+    SPDYStream *stream = [[SPDYStream alloc] initWithProtocol:protocol];
+    stream.request = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:url]];
+    [sessionManager queueStream:stream];
+    SPDYSession *session = [[sessionManager basePool] nextSession];
+    [(id <SPDYSocketDelegate>)session socket:nil didConnectToHost:@"127.0.0.1" port:443];
+    STAssertEquals(budget.streamCount, streamCount + 1, nil);
+
+    // A draining session reports no capacity, but its streams still give back their budget
+    [session drain];
+    STAssertFalse(session.isOpen, nil);
+    [stream cancel];
+    STAssertEquals(budget.streamCount, streamCount, nil);
+
+    [(id <SPDYSocketDelegate>)session socket:nil willDisconnectWithError:nil];
+    [(id <SPDYSocketDelegate>)session socketDidDisconnect:nil];
+}
+
+#pragma mark SPDYTLSTrustEvaluator
+
+- (BOOL)evaluateServerTrust:(SecTrustRef)trust forHost:(NSString *)host
+{
+    // Only the certificate decides: it's trusted as its own root, and the host is checked by the
+    // SSL policy the trust was created with
+    [_evaluatedHosts addObject:host];
+    SecTrustSetAnchorCertificates(trust, (__bridge CFArrayRef)@[ _standInCertificate ]);
+    SecTrustSetVerifyDate(trust, (__bridge CFDateRef)[NSDate dateWithTimeIntervalSince1970:kStandInCertificateVerifyTime]);
+
+    SecTrustResultType result;
+    OSStatus status = SecTrustEvaluate(trust, &result);
+    return status == errSecSuccess && (result == kSecTrustResultProceed || result == kSecTrustResultUnspecified);
+}
+
+- (SecTrustRef)_createStandInTrustForHost:(NSString *)host
+{
+    SecPolicyRef policy = SecPolicyCreateSSL(true, (__bridge CFStringRef)host);
+    SecTrustRef trust = NULL;
+    SecTrustCreateWithCertificates((__bridge CFArrayRef)@[ _standInCertificate ], policy, &trust);
+    CFRelease(policy);
+    return trust;
+}
+
+- (void)testSessionCoalescingSharesSessionWithOriginOnSameAddressAndCertificate
+{
+    SPDYConfiguration *configuration = [SPDYConfiguration defaultConfiguration];
+    configuration.sessionPoolSize = 1;
+    configuration.enableTCPNoDelay = NO;
+    configuration.enableSessionCoalescing = YES;
+    [SPDYProtocol setConfiguration:configuration];
+    [SPDYProtocol setTLSTrustEvaluator:self];
+
+    NSData *certificateData = [[NSData alloc] initWithBase64EncodedString:kStandInCertificate options:0];
+    _standInCertificate = CFBridgingRelease(SecCertificateCreateWithData(NULL, (__bridge CFDataRef)certificateData));
+    STAssertNotNil(_standInCertificate, nil);
+    _evaluatedHosts = [[NSMutableArray alloc] init];
+
+    // The evaluator goes by the certificate alone
+    SecTrustRef coveredTrust = [self _createStandInTrustForHost:@"localhost"];
+    SecTrustRef uncoveredTrust = [self _createStandInTrustForHost:@"127.0.0.1"];
+    STAssertTrue([self evaluateServerTrust:coveredTrust forHost:@"127.0.0.1"], nil);
+    STAssertFalse([self evaluateServerTrust:uncoveredTrust forHost:@"localhost"], nil);
+    CFRelease(coveredTrust);
+    CFRelease(uncoveredTrust);
+    [_evaluatedHosts removeAllObjects];
+
+    NSMutableArray *protocols = [[NSMutableArray alloc] init];
+    SPDYStream *(^makeStream)(NSString *) = ^(NSString *url) {
+        SPDYProtocol *protocol = [[SPDYProtocol alloc] init];
+        SPDYStream *stream = [[SPDYStream alloc] initWithProtocol:protocol];
+        stream.request = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:url]];
+        [protocols addObject:protocol];
+        return stream;
+    };
+
+    // A session to the stand-in server on the loopback address
+    NSString *url = @"https://origin.example.com";
+    SPDYOrigin *origin = [[SPDYOrigin alloc] initWithString:url error:nil];
+    SPDYSessionManager *sessionManager = [SPDYSessionManager localManagerForOrigin:origin];
+    [sessionManager _updateReachability:kSCNetworkReachabilityFlagsReachable];
+    [sessionManager queueStream:makeStream(url)];
+    SPDYSession *session = [[sessionManager basePool] nextSession];
+    SecTrustRef trust = [self _createStandInTrustForHost:origin.host];
+    STAssertTrue([(id <SPDYSocketDelegate>)session socket:nil securedWithTrust:trust], nil);
+    CFRelease(trust);
+    [(id <SPDYSocketDelegate>)session socket:nil didConnectToHost:@"127.0.0.1" port:443];
+    STAssertEquals(session.load, (NSUInteger)1, nil);
+
+    // localhost resolves to the same address and is covered by the certificate, so it
+    // shares the session instead of connecting
+    SPDYOrigin *coalescedOrigin = [[SPDYOrigin alloc] initWithString:@"https://localhost" error:nil];
+    SPDYSessionManager *coalescedManager = [SPDYSessionManager localManagerForOrigin:coalescedOrigin];
+    [coalescedManager _updateReachability:kSCNetworkReachabilityFlagsReachable];
+    SPDYStream *coalescedStream = makeStream(@"https://localhost/resource");
+    [coalescedManager queueStream:coalescedStream];
+
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while (session.load < 2 && [deadline timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    STAssertEquals(session.load, (NSUInteger)2, nil);
+    STAssertEquals(session.activeStreams[coalescedStream.streamId], coalescedStream, nil);
+    STAssertEquals([[coalescedManager basePool] count], (NSUInteger)0, nil);
+    STAssertEquals([coalescedManager.pendingStreams count], (NSUInteger)0, nil);
+    STAssertTrue([_evaluatedHosts containsObject:@"localhost"], nil);
+    NSHashTable *coalescedManagers = [sessionManager valueForKey:@"_coalescedManagers"];
+    STAssertTrue([coalescedManagers containsObject:coalescedManager], nil);
+
+    // The address matches, but the certificate has no entry for the bare IP
+    SPDYOrigin *uncoveredOrigin = [[SPDYOrigin alloc] initWithString:@"https://127.0.0.1" error:nil];
+    SPDYSessionManager *uncoveredManager = [SPDYSessionManager localManagerForOrigin:uncoveredOrigin];
+    [uncoveredManager _updateReachability:kSCNetworkReachabilityFlagsReachable];
+    [uncoveredManager queueStream:makeStream(@"https://127.0.0.1/resource")];
+    STAssertTrue([_evaluatedHosts containsObject:@"127.0.0.1"], @"the certificate should have been checked");
+    STAssertFalse([session canCoalesceOrigin:uncoveredOrigin], nil);
+    STAssertEquals([[uncoveredManager basePool] count], (NSUInteger)1, nil);
+    STAssertEquals(session.load, (NSUInteger)2, nil);
+
+    // Once the shared session is gone, the coalesced origin connects on its own
+    [(id <SPDYSocketDelegate>)session socket:nil willDisconnectWithError:nil];
+    [(id <SPDYSocketDelegate>)session socketDidDisconnect:nil];
+    STAssertTrue(coalescedStream.closed, nil);
+    STAssertEquals(coalescedManagers.count, (NSUInteger)0, @"a manager that stopped coalescing shouldn't be dispatched");
+    [coalescedManager queueStream:makeStream(@"https://localhost/other")];
+    STAssertEquals([[coalescedManager basePool] count], (NSUInteger)1, nil);
+
+    for (SPDYSessionManager *manager in @[ coalescedManager, uncoveredManager ]) {
+        SPDYSession *ownSession = [[manager basePool] nextSession];
+        [(id <SPDYSocketDelegate>)ownSession socket:nil willDisconnectWithError:nil];
+        [(id <SPDYSocketDelegate>)ownSession socketDidDisconnect:nil];
+        STAssertEquals([[manager basePool] count], (NSUInteger)0, nil);
+    }
+
+    [SPDYProtocol setTLSTrustEvaluator:nil];
+}
+
+- (void)_performOnNetworkThread:(dispatch_block_t)block
+{
+    dispatch_semaphore_t done = dispatch_semaphore_create(0);
+    [[SPDYNetworkThread sharedThread] performBlock:^{
+        block();
+        dispatch_semaphore_signal(done);
+    }];
+    dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+}
+
+// Starts a request on the calling thread, then runs this thread's run loop until the response
+// has been delivered to it
+- (void)_loadRequestOnCurrentThread:(NSDictionary *)args
+{
+    @autoreleasepool {
+        SPDYMockURLProtocolClient *client = args[@"client"];
+        NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:args[@"url"]]];
+        SPDYProtocol *protocol = [[SPDYProtocol alloc] initWithRequest:request cachedResponse:nil client:client];
+        [protocol startLoading];
+
+        NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:5.0];
+        while (client.calledDidFinishLoading == 0 && [deadline timeIntervalSinceNow] > 0) {
+            [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+        }
+        dispatch_semaphore_signal(args[@"done"]);
+    }
+}
+
+- (void)testSharedNetworkThreadServesRequestsFromManyThreadsOnOneSession
+{
+    SPDYConfiguration *configuration = [SPDYConfiguration defaultConfiguration];
+    configuration.sessionPoolSize = 1;
+    configuration.enableTCPNoDelay = NO;
+    configuration.enableSharedNetworkThread = YES;
+    [SPDYProtocol setConfiguration:configuration];
+
+    NSString *url = [self nextOriginUrl];
+    SPDYOrigin *origin = [[SPDYOrigin alloc] initWithString:url error:nil];
+    const NSUInteger threadCount = 4;
+
+    __block SPDYSessionManager *sessionManager = nil;
+    [self _performOnNetworkThread:^{
+        sessionManager = [SPDYSessionManager localManagerForOrigin:origin];
+        [sessionManager _updateReachability:kSCNetworkReachabilityFlagsReachable];
+    }];
+
+    dispatch_semaphore_t done = dispatch_semaphore_create(0);
+    NSMutableArray *clients = [[NSMutableArray alloc] init];
+    NSMutableArray *threads = [[NSMutableArray alloc] init];
+    for (NSUInteger i = 0; i < threadCount; i++) {
+        SPDYMockURLProtocolClient *client = [[SPDYMockURLProtocolClient alloc] init];
+        NSDictionary *args = @{ @"client" : client, @"url" : [url stringByAppendingFormat:@"/%lu", (unsigned long)i], @"done" : done };
+        NSThread *thread = [[NSThread alloc] initWithTarget:self selector:@selector(_loadRequestOnCurrentThread:) object:args];
+        [clients addObject:client];
+        [threads addObject:thread];
+        [thread start];
+    }
+
+    // Every request lands in the same session manager, waiting on the one session
+    __block NSUInteger pendingCount = 0;
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:5.0];
+    while (pendingCount < threadCount && [deadline timeIntervalSinceNow] > 0) {
+        [self _performOnNetworkThread:^{
+            pendingCount = sessionManager.pendingStreams.count;
+        }];
+    }
+    STAssertEquals(pendingCount, threadCount, nil);
+
+    __block SPDYSession *session = nil;
+    __block NSUInteger sessionCount = 0;
+    __block NSUInteger activeCount = 0;
+    [self _performOnNetworkThread:^{
+        sessionCount = sessionManager.basePool.count;
+        session = [sessionManager.basePool nextSession];
+        [(id <SPDYSocketDelegate>)session socket:nil didConnectToHost:@"mocked.com" port:55555];
+        activeCount = session.activeStreams.count;
+
+        NSMutableArray *streamIds = [[NSMutableArray alloc] init];
+        for (SPDYStream *stream in session.activeStreams) {
+            [streamIds addObject:@(stream.streamId)];
+        }
+        for (NSNumber *streamId in streamIds) {
+            SPDYSynReplyFrame *synReplyFrame = [[SPDYSynReplyFrame alloc] init];
+            synReplyFrame.streamId = streamId.unsignedIntValue;
+            synReplyFrame.headers = @{ @":status" : @"200", @":version" : @"HTTP/1.1" };
+            synReplyFrame.last = YES;
+            [(id <SPDYFrameDecoderDelegate>)session didReadSynReplyFrame:synReplyFrame frameDecoder:nil];
+        }
+    }];
+    STAssertEquals(sessionCount, (NSUInteger)1, nil);
+    STAssertEquals(activeCount, threadCount, nil);
+
+    // Each response is delivered on the thread that started its request
+    for (NSUInteger i = 0; i < threadCount; i++) {
+        dispatch_semaphore_wait(done, dispatch_time(DISPATCH_TIME_NOW, 5 * NSEC_PER_SEC));
+    }
+    for (NSUInteger i = 0; i < threadCount; i++) {
+        SPDYMockURLProtocolClient *client = clients[i];
+        STAssertEquals(client.calledDidReceiveResponse, 1, nil);
+        STAssertEquals(client.calledDidFinishLoading, 1, nil);
+        STAssertEquals(client.lastResponseThread, threads[i], nil);
+    }
+
+    [self _performOnNetworkThread:^{
+        [(id <SPDYSocketDelegate>)session socket:nil willDisconnectWithError:nil];
+        [(id <SPDYSocketDelegate>)session socketDidDisconnect:nil];
+    }];
+}
+
+- (void)testSharedNetworkThreadReportsSessionFailureOnClientThreadUnlessStopped
+{
+    SPDYConfiguration *configuration = [SPDYConfiguration defaultConfiguration];
+    configuration.sessionPoolSize = 1;
+    configuration.enableTCPNoDelay = NO;
+    configuration.enableSharedNetworkThread = YES;
+    [SPDYProtocol setConfiguration:configuration];
+
+    NSString *url = [self nextOriginUrl];
+    SPDYOrigin *origin = [[SPDYOrigin alloc] initWithString:url error:nil];
+    [self _performOnNetworkThread:^{
+        SPDYSessionManager *sessionManager = [SPDYSessionManager localManagerForOrigin:origin];
+        [sessionManager _updateReachability:kSCNetworkReachabilityFlagsReachable];
+    }];
+    socketMock_connectError = SPDY_SOCKET_ERROR(SPDYSocketConnectCanceled, @"mocked connect failure");
+
+    SPDYMockURLProtocolClient *client = [[SPDYMockURLProtocolClient alloc] init];
+    NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:url]];
+    SPDYProtocol *protocol = [[SPDYProtocol alloc] initWithRequest:request cachedResponse:nil client:client];
+    [protocol startLoading];
+
+    // A request stopped before the failure reaches its thread hears nothing more
+    SPDYMockURLProtocolClient *stoppedClient = [[SPDYMockURLProtocolClient alloc] init];
+    NSURLRequest *stoppedRequest = [NSURLRequest requestWithURL:[NSURL URLWithString:[url stringByAppendingString:@"/stopped"]]];
+    SPDYProtocol *stoppedProtocol = [[SPDYProtocol alloc] initWithRequest:stoppedRequest cachedResponse:nil client:stoppedClient];
+    [stoppedProtocol startLoading];
+    [self _performOnNetworkThread:^{}];
+    [stoppedProtocol stopLoading];
+
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while (client.calledDidFailWithError == 0 && [deadline timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+
+    STAssertEquals(client.calledDidFailWithError, 1, nil);
+    STAssertEquals(client.lastErrorThread, [NSThread currentThread], nil);
+    STAssertEquals(client.lastError.code, (NSInteger)SPDYSocketConnectCanceled, nil);
+    STAssertEquals(stoppedClient.calledDidFailWithError, 0, nil);
+}
+
+- (void)testSessionFailureReachesEveryCoalescedRequest
+{
+    SPDYConfiguration *configuration = [SPDYConfiguration defaultConfiguration];
+    configuration.sessionPoolSize = 1;
+    configuration.enableTCPNoDelay = NO;
+    configuration.enableRequestCoalescing = YES;
+    [SPDYProtocol setConfiguration:configuration];
+
+    NSString *url = [self nextOriginUrl];
+    SPDYOrigin *origin = [[SPDYOrigin alloc] initWithString:url error:nil];
+    SPDYSessionManager *sessionManager = [SPDYSessionManager localManagerForOrigin:origin];
+    [sessionManager _updateReachability:kSCNetworkReachabilityFlagsReachable];
+    socketMock_connectError = SPDY_SOCKET_ERROR(SPDYSocketConnectCanceled, @"mocked connect failure");
+
+    // Both requests are queued before the deferred dispatch tries to connect
+    NSMutableURLRequest *urlRequest = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:[url stringByAppendingString:@"/avatar"]]];
+    urlRequest.SPDYDeferrableInterval = 0.01;
+    NSMutableArray *protocols = [[NSMutableArray alloc] init];
+    NSMutableArray *clients = [[NSMutableArray alloc] init];
+    NSMutableArray *streams = [[NSMutableArray alloc] init];
+    for (int i = 0; i < 2; i++) {
+        SPDYMockURLProtocolClient *client = [[SPDYMockURLProtocolClient alloc] init];
+        SPDYProtocol *protocol = [[SPDYProtocol alloc] initWithRequest:urlRequest cachedResponse:nil client:client];
+        SPDYStream *stream = [[SPDYStream alloc] initWithProtocol:protocol];
+        [protocols addObject:protocol];
+        [clients addObject:client];
+        [streams addObject:stream];
+        [sessionManager queueStream:stream];
+    }
+    STAssertEquals([sessionManager.pendingStreams count], (NSUInteger)1, @"identical requests should share one stream");
+
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while ([sessionManager.pendingStreams count] > 0 && [deadline timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    STAssertEquals([sessionManager.pendingStreams count], (NSUInteger)0, nil);
+    STAssertEquals([[sessionManager basePool] count], (NSUInteger)0, nil);
+
+    for (int i = 0; i < 2; i++) {
+        SPDYMockURLProtocolClient *client = clients[i];
+        STAssertEquals(client.calledDidFailWithError, 1, nil);
+        STAssertEquals(client.lastError.code, (NSInteger)SPDYSocketConnectCanceled, nil);
+        STAssertTrue(((SPDYStream *)streams[i]).closed, nil);
+    }
+}
+
+- (void)testSessionFailureFinishesHedgedRequest
+{
+    NSString *url = [self nextOriginUrl];
+    SPDYOrigin *origin = [[SPDYOrigin alloc] initWithString:url error:nil];
+    SPDYSessionManager *sessionManager = [SPDYSessionManager localManagerForOrigin:origin];
+    [sessionManager _updateReachability:kSCNetworkReachabilityFlagsReachable];
+    socketMock_connectError = SPDY_SOCKET_ERROR(SPDYSocketConnectCanceled, @"mocked connect failure");
+
+    NSMutableURLRequest *urlRequest = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:url]];
+    urlRequest.SPDYDeferrableInterval = 0;
+    urlRequest.SPDYHedgeAfter = 0.01;
+    SPDYMockURLProtocolClient *mockURLProtocolClient = [[SPDYMockURLProtocolClient alloc] init];
+    SPDYProtocol *protocol = [[SPDYProtocol alloc] initWithRequest:urlRequest cachedResponse:nil client:mockURLProtocolClient];
+    SPDYStream *stream = [[SPDYStream alloc] initWithProtocol:protocol];
+
+    // The queued stream is the hedger's original attempt, which reports to the hedger
+    [sessionManager queueStream:stream];
+    SPDYRequestHedger *hedger = [sessionManager valueForKey:@"_hedger"];
+    STAssertEquals(hedger.requestCount, (NSUInteger)1, nil);
+
+    STAssertEquals([sessionManager.pendingStreams count], (NSUInteger)0, nil);
+    STAssertEquals(mockURLProtocolClient.calledDidFailWithError, 1, nil);
+    STAssertEquals(mockURLProtocolClient.lastError.code, (NSInteger)SPDYSocketConnectCanceled, nil);
+    STAssertTrue(stream.closed, nil);
+    STAssertNil(stream.delegate, nil);
+    STAssertEquals(hedger.count, (NSUInteger)0, nil);
+
+    // Nothing is hedged, or reported, after the request has failed
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    STAssertEquals(hedger.hedgedCount, (NSUInteger)0, nil);
+    STAssertEquals(mockURLProtocolClient.calledDidFailWithError, 1, nil);
+}
+
 @end
@@ -19,6 +19,7 @@
 #import "SPDYMockURLProtocolClient.h"
 #import "SPDYOrigin.h"
 #import "SPDYProtocol.h"
+#import "SPDYPushCache.h"
 #import "SPDYSession.h"
 #import "SPDYSocket+SPDYSocketMock.h"
 #import "SPDYStopwatch.h"
@@ -27,6 +28,10 @@
 @interface SPDYSessionTest : SenTestCase
 @end
 
+@interface SPDYSession ()
+- (void)_keepaliveTimerFired;
+@end
+
 @implementation SPDYSessionTest
 {
     // Most of these objects need to be retained for the life of the test. Hence the macro. I don't
@@ -146,6 +151,64 @@
     [_testEncoderDelegate clear];
 }
 
+- (void)mockServerWindowUpdateWithId:(SPDYStreamId)streamId delta:(uint32_t)delta
+{
+    SPDYWindowUpdateFrame *frame = [[SPDYWindowUpdateFrame alloc] init];
+    frame.streamId = streamId;
+    frame.deltaWindowSize = delta;
+
+    STAssertTrue([_testEncoder encodeWindowUpdateFrame:frame] > 0, nil);
+    [self makeSessionReadData:_testEncoderDelegate.lastEncodedData];
+    [_testEncoderDelegate clear];
+}
+
+- (void)mockServerPingWithId:(SPDYPingId)pingId
+{
+    SPDYPingFrame *frame = [[SPDYPingFrame alloc] init];
+    frame.pingId = pingId;
+
+    STAssertTrue([_testEncoder encodePingFrame:frame] > 0, nil);
+    [self makeSessionReadData:_testEncoderDelegate.lastEncodedData];
+    [_testEncoderDelegate clear];
+}
+
+- (SPDYStream *)openUploadStreamWithLength:(NSUInteger)length priority:(NSUInteger)priority
+{
+    NSMutableURLRequest *urlRequest = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:@"http://mocked/upload"]];
+    urlRequest.HTTPMethod = @"POST";
+    urlRequest.HTTPBody = [NSMutableData dataWithLength:length];
+    urlRequest.SPDYPriority = priority;
+
+    SPDYProtocol *protocolRequest = [[SPDYProtocol alloc] initWithRequest:urlRequest cachedResponse:nil client:_mockURLProtocolClient];
+    [_protocolList addObject:protocolRequest];
+
+    SPDYStream *stream = [[SPDYStream alloc] initWithProtocol:protocolRequest];
+    [_session openStream:stream];
+    return stream;
+}
+
+- (NSArray *)sentDataFrames
+{
+    NSMutableArray *dataFrames = [[NSMutableArray alloc] init];
+    for (id frame in _mockDecoderDelegate.framesReceived) {
+        if ([frame isKindOfClass:[SPDYDataFrame class]]) {
+            [dataFrames addObject:frame];
+        }
+    }
+    return dataFrames;
+}
+
+- (NSUInteger)sentDataLengthForStreamId:(SPDYStreamId)streamId
+{
+    NSUInteger length = 0;
+    for (SPDYDataFrame *frame in [self sentDataFrames]) {
+        if (frame.streamId == streamId) {
+            length += frame.data.length;
+        }
+    }
+    return length;
+}
+
 #pragma mark Tests
 
 - (void)testCloseSessionWithMultipleStreams
@@ -360,6 +423,70 @@
     STAssertNil(weakData, nil);
 }
 
+- (void)testUploadExhaustsSessionWindowInQuanta
+{
+    // The initial session and stream windows are 64KB
+    [self openUploadStreamWithLength:1024 * 1024 priority:3];
+
+    NSArray *dataFrames = [self sentDataFrames];
+    STAssertEquals([self sentDataLengthForStreamId:1], (NSUInteger)65536, nil);
+    STAssertEquals(dataFrames.count, (NSUInteger)4, nil);
+    for (SPDYDataFrame *frame in dataFrames) {
+        STAssertEquals(frame.data.length, (NSUInteger)16384, nil);
+        STAssertFalse(frame.last, nil);
+    }
+}
+
+- (void)testSmallUploadIsInterleavedWithBulkUploadOfSamePriority
+{
+    [self openUploadStreamWithLength:1024 * 1024 priority:3];  // stream 1
+    [self openUploadStreamWithLength:2048 priority:3];         // stream 3
+    STAssertEquals([self sentDataLengthForStreamId:3], (NSUInteger)0, @"session window should be exhausted");
+    [_mockDecoderDelegate clear];
+
+    // Open up the bulk stream's window; the session window is still closed
+    [self mockServerWindowUpdateWithId:1 delta:1024 * 1024];
+    STAssertEquals([self sentDataFrames].count, (NSUInteger)0, nil);
+
+    [self mockServerWindowUpdateWithId:kSPDYSessionStreamId delta:65536];
+
+    // The small upload completes in the first round instead of waiting out the bulk upload
+    NSArray *dataFrames = [self sentDataFrames];
+    STAssertTrue(dataFrames.count >= 2, nil);
+    STAssertEquals(((SPDYDataFrame *)dataFrames[0]).streamId, (SPDYStreamId)1, nil);
+    STAssertEquals(((SPDYDataFrame *)dataFrames[0]).data.length, (NSUInteger)16384, nil);
+    STAssertEquals(((SPDYDataFrame *)dataFrames[1]).streamId, (SPDYStreamId)3, nil);
+    STAssertEquals(((SPDYDataFrame *)dataFrames[1]).data.length, (NSUInteger)2048, nil);
+    STAssertTrue(((SPDYDataFrame *)dataFrames[1]).last, nil);
+
+    // The bulk upload gets the rest of the session window
+    STAssertEquals([self sentDataLengthForStreamId:1], (NSUInteger)(65536 - 2048), nil);
+}
+
+- (void)testHighPriorityUploadIsSentAheadOfBulkUpload
+{
+    [self openUploadStreamWithLength:4 * 1024 * 1024 priority:7];  // stream 1
+    [self mockServerWindowUpdateWithId:1 delta:4 * 1024 * 1024];
+
+    // Several small, high priority POSTs arrive while the bulk upload is in flight
+    [self openUploadStreamWithLength:1024 priority:0];  // stream 3
+    [self openUploadStreamWithLength:1024 priority:0];  // stream 5
+    [self openUploadStreamWithLength:1024 priority:1];  // stream 7
+    [_mockDecoderDelegate clear];
+
+    [self mockServerWindowUpdateWithId:kSPDYSessionStreamId delta:65536];
+
+    NSArray *dataFrames = [self sentDataFrames];
+    STAssertTrue(dataFrames.count > 3, nil);
+    STAssertEquals(((SPDYDataFrame *)dataFrames[0]).streamId, (SPDYStreamId)3, nil);
+    STAssertEquals(((SPDYDataFrame *)dataFrames[1]).streamId, (SPDYStreamId)5, nil);
+    STAssertEquals(((SPDYDataFrame *)dataFrames[2]).streamId, (SPDYStreamId)7, nil);
+    for (NSUInteger i = 0; i < 3; i++) {
+        STAssertTrue(((SPDYDataFrame *)dataFrames[i]).last, nil);
+    }
+    STAssertEquals([self sentDataLengthForStreamId:1], (NSUInteger)(65536 - 3 * 1024), nil);
+}
+
 - (void)testCancelStreamDoesSendResetAndCloseStream
 {
     SPDYStream * __weak weakStream = nil;
@@ -378,6 +505,28 @@
     STAssertNil(weakStream, nil);
 }
 
+- (void)testCancelStreamBeforeSynStreamIsWrittenDoesNotJumpAheadOfIt
+{
+    // The mock socket never reports the SYN_STREAM written
+    SPDYStream *stream = [[SPDYStream alloc] initWithProtocol:[self createProtocol]];
+    [_session openStream:stream];
+    STAssertTrue([_mockDecoderDelegate.lastFrame isKindOfClass:[SPDYSynStreamFrame class]], nil);
+    STAssertTrue(socketMock_lastWriteOp->_tag < 0, nil);
+    [stream cancel];
+
+    STAssertTrue([_mockDecoderDelegate.lastFrame isKindOfClass:[SPDYRstStreamFrame class]], nil);
+    STAssertEquals(socketMock_lastWritePriority, SPDYSocketWritePriorityNormal, nil);
+
+    // Once the SYN_STREAM has left, resets go out ahead of queued frames again
+    stream = [[SPDYStream alloc] initWithProtocol:[self createProtocol]];
+    [_session openStream:stream];
+    [_session.socket performDelegateCall_socketDidWriteDataWithTag:socketMock_lastWriteOp->_tag];
+    [stream cancel];
+
+    STAssertTrue([_mockDecoderDelegate.lastFrame isKindOfClass:[SPDYRstStreamFrame class]], nil);
+    STAssertEquals(socketMock_lastWritePriority, SPDYSocketWritePriorityUrgent, nil);
+}
+
 - (void)testReceiveDATABeforeSYNREPLYDoesResetAndCloseStream
 {
     NSMutableData *data = [NSMutableData dataWithLength:1];
@@ -520,5 +669,301 @@
     STAssertTrue(metadata.cellular, nil);
 }
 
-@end
+- (void)mockServerPushWithId:(SPDYStreamId)streamId associatedToStreamId:(SPDYStreamId)associatedStreamId headers:(NSDictionary *)headers
+{
+    SPDYSynStreamFrame *frame = [[SPDYSynStreamFrame alloc] init];
+    frame.streamId = streamId;
+    frame.associatedToStreamId = associatedStreamId;
+    frame.unidirectional = YES;
+    frame.headers = headers;
+
+    STAssertTrue([_testEncoder encodeSynStreamFrame:frame error:nil] > 0, nil);
+    [self makeSessionReadData:_testEncoderDelegate.lastEncodedData];
+    [_testEncoderDelegate clear];
+}
+
+- (void)testServerPushIsCachedAndServed
+{
+    SPDYConfiguration *configuration = [SPDYConfiguration defaultConfiguration];
+    configuration.enableServerPush = YES;
+    _session = [[SPDYSession alloc] initWithOrigin:_origin
+                                          delegate:nil
+                                     configuration:configuration
+                                          cellular:NO
+                                             error:nil];
+    SPDYPushCache *pushCache = [[SPDYPushCache alloc] initWithMaxBytes:4096 maxAge:60.0];
+    _session.pushCache = pushCache;
+
+    SPDYStream *stream = [self mockSynStreamAndReplyWithId:1 last:NO];
+    [self mockServerPushWithId:2 associatedToStreamId:1 headers:@{
+        @":scheme":@"http", @":host":@"mocked", @":path":@"/pushed",
+        @":status":@"200", @":version":@"HTTP/1.1"
+    }];
+    STAssertNil(_mockDecoderDelegate.lastFrame, nil);
+    STAssertEquals(pushCache.count, (NSUInteger)1, nil);
+
+    [self mockServerDataWithId:2 data:[NSMutableData dataWithLength:100] last:YES];
+    STAssertNil(_mockDecoderDelegate.lastFrame, nil);
+    STAssertFalse(stream.closed, @"pushed stream must not affect its associated stream");
 
+    // Pushes missing the resource headers are a protocol error
+    [self mockServerPushWithId:4 associatedToStreamId:1 headers:@{ @":scheme":@"http", @":host":@"mocked" }];
+    STAssertTrue([_mockDecoderDelegate.lastFrame isKindOfClass:[SPDYRstStreamFrame class]], nil);
+    STAssertEquals(((SPDYRstStreamFrame *)_mockDecoderDelegate.lastFrame).statusCode, SPDY_STREAM_PROTOCOL_ERROR, nil);
+    [_mockDecoderDelegate clear];
+
+    // Pushes not associated with an open local stream are refused
+    [self mockServerPushWithId:6 associatedToStreamId:3 headers:@{
+        @":scheme":@"http", @":host":@"mocked", @":path":@"/other",
+        @":status":@"200", @":version":@"HTTP/1.1"
+    }];
+    STAssertEquals(((SPDYRstStreamFrame *)_mockDecoderDelegate.lastFrame).statusCode, SPDY_STREAM_REFUSED_STREAM, nil);
+    [_mockDecoderDelegate clear];
+
+    // Pushes must be for the origin of their associated stream, which needn't be the session's
+    [self mockServerPushWithId:8 associatedToStreamId:1 headers:@{
+        @":scheme":@"http", @":host":@"coalesced", @":path":@"/pushed",
+        @":status":@"200", @":version":@"HTTP/1.1"
+    }];
+    STAssertEquals(((SPDYRstStreamFrame *)_mockDecoderDelegate.lastFrame).statusCode, SPDY_STREAM_REFUSED_STREAM, nil);
+    [_mockDecoderDelegate clear];
+
+    _URLRequest = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:@"http://coalesced/init"]];
+    [self mockSynStreamAndReplyWithId:3 last:NO];
+    [self mockServerPushWithId:10 associatedToStreamId:3 headers:@{
+        @":scheme":@"http", @":host":@"coalesced", @":path":@"/pushed",
+        @":status":@"200", @":version":@"HTTP/1.1"
+    }];
+    STAssertNil(_mockDecoderDelegate.lastFrame, nil);
+    STAssertEquals(pushCache.count, (NSUInteger)2, nil);
+
+    _mockURLProtocolClient = [[SPDYMockURLProtocolClient alloc] init];
+    _URLRequest = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:@"http://mocked/pushed"]];
+    SPDYStream *pushedRequestStream = [[SPDYStream alloc] initWithProtocol:[self createProtocol]];
+    STAssertTrue([pushCache serveStream:pushedRequestStream], nil);
+    STAssertEquals(_mockURLProtocolClient.calledDidFinishLoading, 1, nil);
+    STAssertEquals(_mockURLProtocolClient.lastData.length, (NSUInteger)100, nil);
+    STAssertTrue(pushedRequestStream.metadata.pushed, nil);
+}
+
+- (void)testReceiveWindowAutoTuningGrowsWindowsWhenWindowLimitsThroughput
+{
+    SPDYConfiguration *configuration = [SPDYConfiguration defaultConfiguration];
+    configuration.enableReceiveWindowAutoTuning = YES;
+    _session = [[SPDYSession alloc] initWithOrigin:_origin
+                                          delegate:nil
+                                     configuration:configuration
+                                          cellular:NO
+                                             error:nil];
+
+    SPDYStream *stream = [self mockSynStreamAndReplyWithId:1 last:NO];
+    STAssertEquals(stream.receiveWindowSize, (uint32_t)65536, nil);
+
+    // The first DATA starts a sample, timed by a PING
+    [self mockServerDataWithId:1 data:[NSMutableData dataWithLength:1000] last:NO];
+    STAssertTrue([_mockDecoderDelegate.lastFrame isKindOfClass:[SPDYPingFrame class]], nil);
+    SPDYPingId pingId = ((SPDYPingFrame *)_mockDecoderDelegate.lastFrame).pingId;
+    [_mockDecoderDelegate clear];
+
+    // Most of the window arrives within the round trip
+    [self mockServerDataWithId:1 data:[NSMutableData dataWithLength:50000] last:NO];
+    STAssertEquals(stream.receiveWindowSize, (uint32_t)65536, @"stream window should have been refilled");
+    [_mockDecoderDelegate clear];
+
+    [self mockServerPingWithId:pingId];
+
+    // Both windows grow to twice the sample: the session through WINDOW_UPDATE, streams through SETTINGS
+    SPDYWindowUpdateFrame *windowUpdateFrame = nil;
+    SPDYSettingsFrame *settingsFrame = nil;
+    for (id frame in _mockDecoderDelegate.framesReceived) {
+        if ([frame isKindOfClass:[SPDYWindowUpdateFrame class]]) {
+            windowUpdateFrame = frame;
+        } else if ([frame isKindOfClass:[SPDYSettingsFrame class]]) {
+            settingsFrame = frame;
+        }
+    }
+    STAssertNotNil(windowUpdateFrame, nil);
+    STAssertEquals(windowUpdateFrame.streamId, (SPDYStreamId)0, nil);
+    STAssertEquals(windowUpdateFrame.deltaWindowSize, (uint32_t)(100000 - 65536), nil);
+    STAssertNotNil(settingsFrame, nil);
+    STAssertEquals(settingsFrame.settings[SPDY_SETTINGS_INITIAL_WINDOW_SIZE].value, (int32_t)100000, nil);
+    STAssertEquals(stream.receiveWindowSize, (uint32_t)100000, nil);
+    STAssertFalse(stream.closed, nil);
+}
+
+- (void)testWindowUpdatesAreCoalescedPerReadBatch
+{
+    SPDYConfiguration *configuration = [SPDYConfiguration defaultConfiguration];
+    configuration.sessionReceiveWindow = 262144;
+    configuration.streamReceiveWindow = 65536;
+    _session = [[SPDYSession alloc] initWithOrigin:_origin
+                                          delegate:nil
+                                     configuration:configuration
+                                          cellular:NO
+                                             error:nil];
+
+    NSArray *streams = @[
+        [self mockSynStreamAndReplyWithId:1 last:NO],
+        [self mockSynStreamAndReplyWithId:3 last:NO],
+        [self mockSynStreamAndReplyWithId:5 last:NO]
+    ];
+    [_mockDecoderDelegate clear];
+    NSUInteger windowUpdatesSent = _session.windowUpdatesSent;
+
+    // A single read carrying a full window of small, interleaved DATA frames for each stream
+    for (int i = 0; i < 4; i++) {
+        for (SPDYStream *stream in streams) {
+            SPDYDataFrame *frame = [[SPDYDataFrame alloc] init];
+            frame.data = [NSMutableData dataWithLength:16384];
+            frame.streamId = stream.streamId;
+            STAssertTrue([_testEncoder encodeDataFrame:frame] > 0, nil);
+        }
+    }
+    [self makeSessionReadData:_testEncoderDelegate.lastEncodedData];
+    [_testEncoderDelegate clear];
+
+    // Each stream crossed its half-window twice and the session once, but only one
+    // WINDOW_UPDATE per stream and one for the session should have been written
+    NSMutableDictionary *deltas = [[NSMutableDictionary alloc] init];
+    for (id frame in _mockDecoderDelegate.framesReceived) {
+        if ([frame isKindOfClass:[SPDYWindowUpdateFrame class]]) {
+            SPDYWindowUpdateFrame *windowUpdateFrame = frame;
+            STAssertNil(deltas[@(windowUpdateFrame.streamId)], nil);
+            deltas[@(windowUpdateFrame.streamId)] = @(windowUpdateFrame.deltaWindowSize);
+        }
+    }
+
+    STAssertEquals(deltas.count, (NSUInteger)4, nil);
+    STAssertEqualObjects(deltas[@(kSPDYSessionStreamId)], @(131072), nil);
+    for (SPDYStream *stream in streams) {
+        STAssertEqualObjects(deltas[@(stream.streamId)], @(65536), nil);
+        STAssertEquals(stream.receiveWindowSize, (uint32_t)65536, nil);
+    }
+    STAssertEquals(_session.windowUpdatesSent - windowUpdatesSent, (NSUInteger)4, nil);
+    STAssertEquals(_session.windowUpdatesCoalesced, (NSUInteger)3, nil);
+}
+
+- (void)testKeepalivePingsTrackRoundTripTimeAndDetectDeadSession
+{
+    SPDYConfiguration *configuration = [SPDYConfiguration defaultConfiguration];
+    configuration.keepalivePingInterval = 60.0;
+    configuration.keepaliveMaxMissedPings = 2;
+    _session = [[SPDYSession alloc] initWithOrigin:_origin
+                                          delegate:nil
+                                     configuration:configuration
+                                          cellular:NO
+                                             error:nil];
+    [_session.socket performDelegateCall_socketDidConnectToHost:_origin.host port:_origin.port];
+    STAssertEquals(_session.smoothedRoundTripTime, (SPDYTimeInterval)-1, nil);
+    [_mockDecoderDelegate clear];
+
+    // Answered PINGs feed the round-trip estimate
+    [_session _keepaliveTimerFired];
+    STAssertTrue([_mockDecoderDelegate.lastFrame isKindOfClass:[SPDYPingFrame class]], nil);
+    SPDYPingId pingId = ((SPDYPingFrame *)_mockDecoderDelegate.lastFrame).pingId;
+    STAssertTrue(pingId & 1, @"client PINGs must use odd ids");
+    [SPDYStopwatch sleep:0.01];
+    [self mockServerPingWithId:pingId];
+
+    SPDYTimeInterval roundTripTime = _session.smoothedRoundTripTime;
+    STAssertTrue(roundTripTime >= 0.01, nil);
+    STAssertEqualsWithAccuracy(_session.roundTripTimeVariance, roundTripTime / 2, 0.0001, nil);
+    STAssertTrue(_session.isHealthy, nil);
+
+    // An established session that stops answering becomes unhealthy and, once idle, closes
+    [_session _keepaliveTimerFired];
+    [_session _keepaliveTimerFired];
+    STAssertTrue(_session.isHealthy, @"one missed PING is tolerated");
+    STAssertTrue(_session.isOpen, nil);
+
+    [_session _keepaliveTimerFired];
+    STAssertFalse(_session.isHealthy, nil);
+    STAssertEquals(_session.capacity, (NSUInteger)0, nil);
+    STAssertFalse(_session.isOpen, nil);
+}
+
+- (void)testKeepaliveTimerDoesNotKeepSessionAlive
+{
+    SPDYConfiguration *configuration = [SPDYConfiguration defaultConfiguration];
+    configuration.keepalivePingInterval = 60.0;
+    __weak SPDYSession *weakSession;
+    @autoreleasepool {
+        SPDYSession *session = [[SPDYSession alloc] initWithOrigin:_origin
+                                                          delegate:nil
+                                                     configuration:configuration
+                                                          cellular:NO
+                                                             error:nil];
+        [session.socket performDelegateCall_socketDidConnectToHost:_origin.host port:_origin.port];
+        weakSession = session;
+        STAssertNotNil(weakSession, nil);
+    }
+    STAssertNil(weakSession, nil);
+}
+
+- (void)testLongDownloadKeepsInputBufferBounded
+{
+    // Stream 256MB of DATA through the session the way SPDYSocket would: each read lands
+    // where the session asked and never exceeds the space it offered. Read sizes don't
+    // line up with frame boundaries, so partial frame headers are regularly left behind.
+    SPDYStream *stream = [self mockSynStreamAndReplyWithId:1 last:NO];
+    SPDYSocket *socket = [_session socket];
+    NSMutableData *inputBuffer = [_session inputBuffer];
+    NSUInteger bufferLength = inputBuffer.length;
+    STAssertTrue(bufferLength > 0, nil);
+
+    NSData *payload = [NSMutableData dataWithLength:4093];
+    NSUInteger totalLength = 256 * 1024 * 1024;
+    NSUInteger encodedLength = 0;
+    NSMutableData *wire = [[NSMutableData alloc] init];
+    NSUInteger wireOffset = 0;
+    NSUInteger readSizes[] = { 1, 7, 4099, 8191, 65536 };
+    NSUInteger readCount = 0;
+    NSUInteger maxBufferLength = 0;
+    bool readWithoutSpace = NO;
+
+    while (encodedLength < totalLength || wireOffset < wire.length) {
+        // Keep a few frames queued up on the simulated wire
+        while (encodedLength < totalLength && wire.length - wireOffset < 65536) {
+            NSUInteger length = MIN(payload.length, totalLength - encodedLength);
+            SPDYDataFrame *frame = [[SPDYDataFrame alloc] init];
+            frame.data = [NSData dataWithBytesNoCopy:(void *)payload.bytes length:length freeWhenDone:NO];
+            frame.streamId = 1;
+            frame.last = (encodedLength + length == totalLength);
+            [_testEncoder encodeDataFrame:frame];
+            [wire appendData:_testEncoderDelegate.lastEncodedData];
+            [_testEncoderDelegate clear];
+            encodedLength += length;
+        }
+
+        if (wireOffset > 1048576) {
+            [wire replaceBytesInRange:NSMakeRange(0, wireOffset) withBytes:NULL length:0];
+            wireOffset = 0;
+        }
+
+        NSUInteger offset = socketMock_lastReadOffset;
+        NSUInteger space = socketMock_lastReadMaxLength;
+        if (space == 0 || offset + space > inputBuffer.length) {
+            readWithoutSpace = YES;
+            break;
+        }
+
+        NSUInteger readLength = MIN(MIN(readSizes[readCount % 5], space), wire.length - wireOffset);
+        [inputBuffer replaceBytesInRange:NSMakeRange(offset, readLength) withBytes:(uint8_t *)wire.bytes + wireOffset];
+        wireOffset += readLength;
+        readCount++;
+
+        NSData *data = [NSData dataWithBytesNoCopy:(uint8_t *)inputBuffer.mutableBytes + offset length:readLength freeWhenDone:NO];
+        [socket.delegate socket:socket didReadData:data withTag:(long)readCount];
+        maxBufferLength = MAX(maxBufferLength, inputBuffer.length);
+    }
+
+    STAssertFalse(readWithoutSpace, nil);
+    STAssertEquals(maxBufferLength, bufferLength, nil);
+    STAssertEquals(_mockURLProtocolClient.totalDataLength, totalLength, nil);
+    STAssertEquals(_mockURLProtocolClient.calledDidFinishLoading, 1, nil);
+    STAssertEquals(_mockURLProtocolClient.calledDidFailWithError, 0, nil);
+    STAssertTrue(stream.closed, nil);
+    STAssertTrue(_session.isOpen, nil);
+}
+
+@end
@@ -33,8 +33,12 @@
 // I could do without a proper mocking library. Since these are only used by the unit
 // tests, it's a (barely) acceptable solution.
 extern NSError *socketMock_lastError;
+extern NSError *socketMock_connectError;  // when set, connecting fails with this error
 extern SPDYSocketWriteOp *socketMock_lastWriteOp;
+extern SPDYSocketWritePriority socketMock_lastWritePriority;
 extern SPDYFrameDecoder *socketMock_frameDecoder;
+extern NSUInteger socketMock_lastReadOffset;
+extern NSUInteger socketMock_lastReadMaxLength;
 
 // Swizzles functions that connection/read/write data and allows the tests to call the delegate
 // functions inside SPDYSocket which end up calling into SPDYSession.
@@ -17,8 +17,12 @@
 NSString * const kSPDYTSTResponseStubs = @"kSPDYTSTResponseStubs";
 
 NSError *socketMock_lastError = nil;
+NSError *socketMock_connectError = nil;
 SPDYSocketWriteOp *socketMock_lastWriteOp = nil;
+SPDYSocketWritePriority socketMock_lastWritePriority = SPDYSocketWritePriorityNormal;
 SPDYFrameDecoder *socketMock_frameDecoder = nil;
+NSUInteger socketMock_lastReadOffset = 0;
+NSUInteger socketMock_lastReadMaxLength = 0;
 
 @implementation SPDYSession (Test)
 
@@ -81,6 +85,14 @@ SPDYFrameDecoder *socketMock_frameDecoder = nil;
     } else {
         method_exchangeImplementations(swizzle, original);
     }
+
+    original = class_getInstanceMethod(self, @selector(writeHeader:length:payload:streamId:withTimeout:priority:tag:));
+    swizzle = class_getInstanceMethod(self, @selector(swizzled_writeHeader:length:payload:streamId:withTimeout:priority:tag:));
+    if (performSwizzling) {
+        method_exchangeImplementations(original, swizzle);
+    } else {
+        method_exchangeImplementations(swizzle, original);
+    }
 }
 
 - (void)setCellular:(bool)cellular
@@ -93,6 +105,11 @@ SPDYFrameDecoder *socketMock_frameDecoder = nil;
                            error:(NSError **)pError
 {
     NSLog(@"SPDYMock: Swizzled connectToOrigin:%@ withTimeout:%f error", origin, timeout);
+    if (socketMock_connectError) {
+        if (pError) *pError = socketMock_connectError;
+        return NO;
+    }
+
     [self setValue:@(1) forKey:@"_flags"];  // kDidStartDelegate
     return YES;
 }
@@ -104,6 +121,10 @@ SPDYFrameDecoder *socketMock_frameDecoder = nil;
                                  tag:(long)tag
 {
     NSLog(@"SPDYSocketMock::readDataWithTimeout");
+
+    // Remember where the next read was asked to land, so tests can simulate it.
+    socketMock_lastReadOffset = offset;
+    socketMock_lastReadMaxLength = length;
 }
 
 - (void)swizzled_writeData:(NSData *)data withTimeout:(NSTimeInterval)timeout tag:(long)tag
@@ -120,6 +141,32 @@ SPDYFrameDecoder *socketMock_frameDecoder = nil;
     }
 }
 
+- (void)swizzled_writeHeader:(const uint8_t *)header
+                      length:(NSUInteger)headerLength
+                     payload:(NSData *)payload
+                    streamId:(uint32_t)streamId
+                 withTimeout:(NSTimeInterval)timeout
+                    priority:(SPDYSocketWritePriority)priority
+                         tag:(long)tag
+{
+    NSLog(@"SPDYSocketMock::writeHeader length %lu payload %@", (unsigned long)headerLength, payload);
+
+    // Simulate buffering the write op; its _buffer is the payload, which is retained uncopied.
+    socketMock_lastWriteOp = [[SPDYSocketWriteOp alloc] initWithData:payload timeout:timeout tag:tag];
+    socketMock_lastWritePriority = priority;
+
+    if (socketMock_frameDecoder) {
+        NSMutableData *data = [[NSMutableData alloc] initWithBytes:header length:headerLength];
+        if (payload) {
+            [data appendData:payload];
+        }
+
+        NSError *error = nil;
+        [socketMock_frameDecoder decode:(uint8_t *)data.bytes length:data.length error:&error];
+        socketMock_lastError = error;
+    }
+}
+
 #pragma mark - Response stubbing
 
 //- (NSArray *)responseStubs
@@ -31,6 +31,53 @@
     STAssertTrue([httpConnect hasPrefix:@"CONNECT twitter.com:443 HTTP/1.1\r\nHost: twitter.com:443\r\n"], @"actual: %@", httpConnect);
 }
 
+- (void)testWriteOpWithHeaderAndPayload
+{
+    uint8_t header[8] = { 0, 0, 0, 1, 0x01, 0, 0, 4 };
+    NSData *payload = [@"data" dataUsingEncoding:NSUTF8StringEncoding];
+    SPDYSocketWriteOp *op = [[SPDYSocketWriteOp alloc] initWithHeader:header
+                                                               length:sizeof(header)
+                                                              payload:payload
+                                                              timeout:(NSTimeInterval)-1
+                                                                  tag:3];
+
+    NSLog(@"%@", op);  // ensure no crash in description
+    STAssertEquals([op length], (NSUInteger)12, nil);
+    STAssertTrue(op->_buffer == payload, @"payload should be retained, not copied");
+    STAssertTrue(memcmp(op->_header, header, sizeof(header)) == 0, nil);
+
+    // Recycling resets progress and drops the old payload
+    op->_bytesWritten = 12;
+    [op setHeader:header length:4 payload:nil timeout:(NSTimeInterval)-1 tag:4];
+    STAssertEquals([op length], (NSUInteger)4, nil);
+    STAssertEquals(op->_bytesWritten, (NSUInteger)0, nil);
+    STAssertEquals(op->_tag, (long)4, nil);
+    STAssertNil(op->_buffer, nil);
+}
+
+- (void)testWriteOpCopyBytesSpansHeaderAndPayload
+{
+    uint8_t header[4] = { 'a', 'b', 'c', 'd' };
+    NSData *payload = [@"efgh" dataUsingEncoding:NSUTF8StringEncoding];
+    SPDYSocketWriteOp *op = [[SPDYSocketWriteOp alloc] initWithHeader:header
+                                                               length:sizeof(header)
+                                                              payload:payload
+                                                              timeout:(NSTimeInterval)-1
+                                                                  tag:0];
+    uint8_t buffer[16];
+
+    STAssertEquals([op copyBytesFromOffset:0 toBuffer:buffer maxLength:sizeof(buffer)], (NSUInteger)8, nil);
+    STAssertTrue(memcmp(buffer, "abcdefgh", 8) == 0, nil);
+
+    STAssertEquals([op copyBytesFromOffset:2 toBuffer:buffer maxLength:4], (NSUInteger)4, nil);
+    STAssertTrue(memcmp(buffer, "cdef", 4) == 0, nil);
+
+    STAssertEquals([op copyBytesFromOffset:6 toBuffer:buffer maxLength:sizeof(buffer)], (NSUInteger)2, nil);
+    STAssertTrue(memcmp(buffer, "gh", 2) == 0, nil);
+
+    STAssertEquals([op copyBytesFromOffset:8 toBuffer:buffer maxLength:sizeof(buffer)], (NSUInteger)0, nil);
+}
+
 - (void)testProxyReadOpInit
 {
     SPDYSocketProxyReadOp *op = [[SPDYSocketProxyReadOp alloc] initWithTimeout:(NSTimeInterval)-1];
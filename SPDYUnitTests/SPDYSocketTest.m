@@ -10,6 +10,7 @@
 //
 
 #import <SenTestingKit/SenTestingKit.h>
+#import <objc/runtime.h>
 #import "SPDYMockOriginEndpointManager.h"
 #import "SPDYSocket.h"
 #import "SPDYSocketOps.h"
@@ -17,6 +18,8 @@
 @interface SPDYSocket ()
 - (void)_onProxyResponse;
 - (void)_timeoutConnect:(NSTimer *)timer;
+- (void)_dequeueWrite;
+- (void)_write;
 @end
 
 @interface SPDYMockSocket : SPDYSocket
@@ -109,6 +112,56 @@
 
 @end
 
+// Captures write passes in memory instead of writing to a stream. Each pass accepts at most
+// maxBytesPerWrite bytes, and the stream only reports itself ready for writeLimit passes.
+@interface SPDYGatherSocket : SPDYSocket
+@property (nonatomic, readonly) NSMutableData *written;
+@property (nonatomic, readonly) NSUInteger writeCalls;
+@property (nonatomic) NSUInteger maxBytesPerWrite;
+@property (nonatomic) NSUInteger writeLimit;
+@end
+
+@implementation SPDYGatherSocket
+
+- (id)initWithDelegate:(id<SPDYSocketDelegate>)delegate
+{
+    self = [super initWithDelegate:delegate];
+    if (self) {
+        _written = [[NSMutableData alloc] init];
+        _maxBytesPerWrite = NSUIntegerMax;
+        _writeLimit = NSUIntegerMax;
+
+        // _write requires a write stream; it is never written to since _writeBytes is overridden
+        Ivar ivar = class_getInstanceVariable([SPDYSocket class], "_writeStream");
+        *(CFWriteStreamRef *)((uint8_t *)(__bridge void *)self + ivar_getOffset(ivar)) =
+            CFWriteStreamCreateWithAllocatedBuffers(kCFAllocatorDefault, kCFAllocatorDefault);
+    }
+    return self;
+}
+
+- (bool)_writeStreamReady
+{
+    return _writeCalls < _writeLimit;
+}
+
+- (CFIndex)_writeBytes:(const uint8_t *)bytes length:(NSUInteger)length
+{
+    _writeCalls++;
+    NSUInteger accepted = MIN(length, _maxBytesPerWrite);
+    [_written appendBytes:bytes length:accepted];
+    return (CFIndex)accepted;
+}
+
+- (void)_scheduleWrite
+{
+}
+
+- (void)_unscheduleWriteStream
+{
+}
+
+@end
+
 @interface SPDYMockSocketDelegate : NSObject <SPDYSocketDelegate>
 @property (nonatomic, readonly) BOOL didCallWillDisconnectWithError;
 @property (nonatomic, readonly) BOOL didCallDidDisconnect;
@@ -116,6 +169,8 @@
 @property (nonatomic, readonly) BOOL didCallDidConnectToEndpoint;
 @property (nonatomic, readonly) NSError *lastError;
 @property (nonatomic, readonly) SPDYOriginEndpoint *lastEndpoint;
+@property (nonatomic, readonly) NSMutableArray *writtenTags;
+@property (nonatomic, readonly) NSUInteger partialWriteLength;
 
 @property (nonatomic) BOOL shouldFailWillConnect;
 @property (nonatomic) BOOL shouldStopRunLoop;
@@ -133,10 +188,31 @@
     _didCallWillConnect = NO;
     _didCallDidConnectToEndpoint = NO;
     _lastError = nil;
+    _writtenTags = [[NSMutableArray alloc] init];
+    _partialWriteLength = 0;
     _shouldFailWillConnect = NO;
     _shouldStopRunLoop = NO;
 }
 
+- (id)init
+{
+    self = [super init];
+    if (self) {
+        [self reset];
+    }
+    return self;
+}
+
+- (void)socket:(SPDYSocket *)socket didWriteDataWithTag:(long)tag
+{
+    [_writtenTags addObject:@(tag)];
+}
+
+- (void)socket:(SPDYSocket *)socket didWritePartialDataOfLength:(NSUInteger)partialLength tag:(long)tag
+{
+    _partialWriteLength += partialLength;
+}
+
 - (void)socket:(SPDYSocket *)socket willDisconnectWithError:(NSError *)error
 {
     _didCallWillDisconnectWithError = YES;
@@ -433,4 +509,135 @@
     [self _assertDirectConnectWasInitiatedForSocket:socket];
 }
 
+#pragma mark Gather writes
+
+- (NSData *)_queueFramesOnSocket:(SPDYSocket *)socket
+{
+    uint8_t control[16] = { 0x80, 3, 0, 9, 0, 0, 0, 8, 0, 0, 0, 1, 0, 1, 0, 0 };
+    uint8_t dataHeader[8] = { 0, 0, 0, 1, 0, 0, 0x03, 0xe8 };
+    NSMutableData *payload = [[NSMutableData alloc] initWithLength:1000];
+    memset(payload.mutableBytes, 'x', payload.length);
+    NSData *raw = [@"raw" dataUsingEncoding:NSUTF8StringEncoding];
+
+    [socket writeHeader:control length:sizeof(control) payload:nil streamId:0 withTimeout:(NSTimeInterval)-1 priority:SPDYSocketWritePriorityNormal tag:1];
+    [socket writeHeader:dataHeader length:sizeof(dataHeader) payload:payload streamId:1 withTimeout:(NSTimeInterval)-1 priority:SPDYSocketWritePriorityNormal tag:2];
+    [socket writeData:raw withTimeout:(NSTimeInterval)-1 tag:3];
+
+    NSMutableData *expected = [[NSMutableData alloc] init];
+    [expected appendBytes:control length:sizeof(control)];
+    [expected appendBytes:dataHeader length:sizeof(dataHeader)];
+    [expected appendData:payload];
+    [expected appendData:raw];
+    return expected;
+}
+
+- (void)testGatherWriteFlushesQueueInOneWrite
+{
+    SPDYMockSocketDelegate *delegate = [[SPDYMockSocketDelegate alloc] init];
+    SPDYGatherSocket *socket = [[SPDYGatherSocket alloc] initWithDelegate:delegate];
+    NSData *expected = [self _queueFramesOnSocket:socket];
+
+    [socket _dequeueWrite];
+
+    STAssertEquals(socket.writeCalls, (NSUInteger)1, nil);
+    STAssertEqualObjects(socket.written, expected, nil);
+    STAssertEqualObjects(delegate.writtenTags, (@[@1, @2, @3]), nil);
+    STAssertEquals(delegate.partialWriteLength, (NSUInteger)0, nil);
+}
+
+- (void)testGatherWriteCompletesTagsAcrossShortWrites
+{
+    SPDYMockSocketDelegate *delegate = [[SPDYMockSocketDelegate alloc] init];
+    SPDYGatherSocket *socket = [[SPDYGatherSocket alloc] initWithDelegate:delegate];
+    NSData *expected = [self _queueFramesOnSocket:socket];
+
+    // 20 bytes go out: the 16 byte control frame completes, and 4 bytes of the DATA frame
+    socket.maxBytesPerWrite = 10;
+    socket.writeLimit = 2;
+    [socket _dequeueWrite];
+
+    STAssertEqualObjects(delegate.writtenTags, (@[@1]), nil);
+    STAssertEquals(delegate.partialWriteLength, (NSUInteger)4, nil);
+
+    // Stream becomes writable again
+    socket.maxBytesPerWrite = NSUIntegerMax;
+    socket.writeLimit = NSUIntegerMax;
+    [socket _write];
+
+    STAssertEqualObjects(socket.written, expected, nil);
+    STAssertEqualObjects(delegate.writtenTags, (@[@1, @2, @3]), nil);
+}
+
+- (void)testUrgentWriteIsQueuedAheadOfUnstartedWrites
+{
+    SPDYMockSocketDelegate *delegate = [[SPDYMockSocketDelegate alloc] init];
+    SPDYGatherSocket *socket = [[SPDYGatherSocket alloc] initWithDelegate:delegate];
+
+    // Saturated upload: 100 queued 1000 byte DATA frames
+    uint8_t dataHeader[8] = { 0, 0, 0, 1, 0, 0, 0x03, 0xe0 };
+    NSMutableData *payload = [[NSMutableData alloc] initWithLength:992];
+    memset(payload.mutableBytes, 'x', payload.length);
+    for (long tag = 1; tag <= 100; tag++) {
+        [socket writeHeader:dataHeader length:sizeof(dataHeader) payload:payload streamId:1 withTimeout:(NSTimeInterval)-1 priority:SPDYSocketWritePriorityNormal tag:tag];
+    }
+
+    // 1500 bytes go out: the first frame completes and the second is on the wire
+    socket.maxBytesPerWrite = 1500;
+    socket.writeLimit = 1;
+    [socket _dequeueWrite];
+    STAssertEqualObjects(delegate.writtenTags, (@[@1]), nil);
+
+    uint8_t windowUpdate[16] = { 0x80, 3, 0, 9, 0, 0, 0, 8, 0, 0, 0, 1, 0, 1, 0, 0 };
+    uint8_t ping[12] = { 0x80, 3, 0, 6, 0, 0, 0, 4, 0, 0, 0, 1 };
+    [socket writeHeader:windowUpdate length:sizeof(windowUpdate) payload:nil streamId:0 withTimeout:(NSTimeInterval)-1 priority:SPDYSocketWritePriorityUrgent tag:1000];
+    [socket writeHeader:ping length:sizeof(ping) payload:nil streamId:0 withTimeout:(NSTimeInterval)-1 priority:SPDYSocketWritePriorityUrgent tag:1001];
+
+    socket.maxBytesPerWrite = NSUIntegerMax;
+    socket.writeLimit = NSUIntegerMax;
+    [socket _write];
+
+    // The urgent frames follow the partially written frame rather than the whole queue
+    STAssertEquals(socket.written.length, (NSUInteger)(100 * 1000 + sizeof(windowUpdate) + sizeof(ping)), nil);
+    STAssertTrue(memcmp((const uint8_t *)socket.written.bytes + 2000, windowUpdate, sizeof(windowUpdate)) == 0, nil);
+    STAssertTrue(memcmp((const uint8_t *)socket.written.bytes + 2000 + sizeof(windowUpdate), ping, sizeof(ping)) == 0, nil);
+    STAssertEquals(delegate.writtenTags.count, (NSUInteger)102, nil);
+    STAssertEqualObjects([delegate.writtenTags subarrayWithRange:NSMakeRange(0, 5)], (@[@1, @2, @1000, @1001, @3]), nil);
+    STAssertEqualObjects(delegate.writtenTags.lastObject, @100, nil);
+}
+
+- (void)testRemoveUnsentWritesForStreamIdLeavesStartedWrites
+{
+    SPDYMockSocketDelegate *delegate = [[SPDYMockSocketDelegate alloc] init];
+    SPDYGatherSocket *socket = [[SPDYGatherSocket alloc] initWithDelegate:delegate];
+
+    uint8_t dataHeader1[8] = { 0, 0, 0, 1, 0, 0, 0x03, 0xe0 };
+    uint8_t dataHeader3[8] = { 0, 0, 0, 3, 0, 0, 0x03, 0xe0 };
+    uint8_t rstStream[16] = { 0x80, 3, 0, 3, 0, 0, 0, 8, 0, 0, 0, 1, 0, 0, 0, 5 };
+    NSMutableData *payload = [[NSMutableData alloc] initWithLength:992];
+    [socket writeHeader:dataHeader1 length:sizeof(dataHeader1) payload:payload streamId:1 withTimeout:(NSTimeInterval)-1 priority:SPDYSocketWritePriorityNormal tag:1];
+    [socket writeHeader:dataHeader1 length:sizeof(dataHeader1) payload:payload streamId:1 withTimeout:(NSTimeInterval)-1 priority:SPDYSocketWritePriorityNormal tag:2];
+    [socket writeHeader:dataHeader3 length:sizeof(dataHeader3) payload:payload streamId:3 withTimeout:(NSTimeInterval)-1 priority:SPDYSocketWritePriorityNormal tag:3];
+    [socket writeHeader:dataHeader1 length:sizeof(dataHeader1) payload:payload streamId:1 withTimeout:(NSTimeInterval)-1 priority:SPDYSocketWritePriorityNormal tag:4];
+
+    // The first frame completes and the second is on the wire
+    socket.maxBytesPerWrite = 1500;
+    socket.writeLimit = 1;
+    [socket _dequeueWrite];
+
+    NSUInteger payloadLength = 0;
+    NSUInteger bytesRemoved = [socket removeUnsentWritesForStreamId:1 payloadLength:&payloadLength];
+    STAssertEquals(bytesRemoved, (NSUInteger)1000, nil);
+    STAssertEquals(payloadLength, (NSUInteger)992, nil);
+    STAssertEquals([socket removeUnsentWritesForStreamId:1 payloadLength:NULL], (NSUInteger)0, nil);
+
+    [socket writeHeader:rstStream length:sizeof(rstStream) payload:nil streamId:0 withTimeout:(NSTimeInterval)-1 priority:SPDYSocketWritePriorityUrgent tag:5];
+
+    socket.maxBytesPerWrite = NSUIntegerMax;
+    socket.writeLimit = NSUIntegerMax;
+    [socket _write];
+
+    STAssertEquals(socket.written.length, (NSUInteger)(3 * 1000 + sizeof(rstStream)), nil);
+    STAssertEqualObjects(delegate.writtenTags, (@[@1, @2, @5, @3]), nil);
+}
+
 @end
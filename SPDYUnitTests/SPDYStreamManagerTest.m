@@ -65,6 +65,12 @@ static SPDYStreamId _nextStreamId;
 
 @end
 
+// Home slot of a stream id in a table of the given capacity, as SPDYStreamTableHash places it
+static NSUInteger homeSlotForStreamId(SPDYStreamId streamId, NSUInteger capacity)
+{
+    return (NSUInteger)(((uint64_t)streamId * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+}
+
 @implementation SPDYStreamManagerTest
 {
     SPDYStreamManager *_manager;
@@ -150,4 +156,198 @@ static SPDYStreamId _nextStreamId;
     STAssertEquals(streamCount, _numStreams - 2, nil);
 }
 
+- (void)testNextPriorityStreamIsFromHighestPriority
+{
+    SPDYStream *next = [_manager nextPriorityStream];
+    STAssertNotNil(next, nil);
+    for (SPDYStream *stream in _manager) {
+        STAssertTrue(next.priority <= stream.priority, nil);
+    }
+}
+
+- (void)testRotateStreamMovesItBehindItsPeers
+{
+    SPDYStreamManager *manager = [[SPDYStreamManager alloc] init];
+    SPDYStream *a = [[SPDYStubbedStream alloc] initWithPriority:2];
+    SPDYStream *b = [[SPDYStubbedStream alloc] initWithPriority:2];
+    SPDYStream *c = [[SPDYStubbedStream alloc] initWithPriority:2];
+    SPDYStream *other = [[SPDYStubbedStream alloc] initWithPriority:5];
+    manager[a.streamId] = a;
+    manager[b.streamId] = b;
+    manager[c.streamId] = c;
+    manager[other.streamId] = other;
+
+    STAssertEqualObjects([manager streamsWithPriority:2], (@[a, b, c]), nil);
+
+    [manager rotateStream:a];
+    STAssertEqualObjects([manager streamsWithPriority:2], (@[b, c, a]), nil);
+
+    [manager rotateStream:c];
+    STAssertEqualObjects([manager streamsWithPriority:2], (@[b, a, c]), nil);
+
+    // Rotating the last stream is a no-op
+    [manager rotateStream:c];
+    STAssertEqualObjects([manager streamsWithPriority:2], (@[b, a, c]), nil);
+
+    // Other levels, lookups and removal are unaffected
+    STAssertEqualObjects([manager streamsWithPriority:5], (@[other]), nil);
+    STAssertEquals(manager[a.streamId], a, nil);
+    [manager removeStreamWithStreamId:c.streamId];
+    STAssertEqualObjects([manager streamsWithPriority:2], (@[b, a]), nil);
+    STAssertEquals(manager.count, (NSUInteger)3, nil);
+}
+
+- (void)testRemoveAndReinsertAcrossWrappedProbeRun
+{
+    // Three ids whose home is the last slot of the initial 32-slot table fill it and wrap
+    // around to slots 0 and 1, pushing an id whose home is slot 0 along to slot 2
+    NSMutableArray *wrappingIds = [[NSMutableArray alloc] init];
+    SPDYStreamId displacedId = 0;
+    for (SPDYStreamId streamId = 1; wrappingIds.count < 3 || displacedId == 0; streamId++) {
+        NSUInteger home = homeSlotForStreamId(streamId, 32);
+        if (home == 31 && wrappingIds.count < 3) {
+            [wrappingIds addObject:@(streamId)];
+        } else if (home == 0 && displacedId == 0) {
+            displacedId = streamId;
+        }
+    }
+    [wrappingIds addObject:@(displacedId)];
+    NSArray *streamIds = [wrappingIds copy];
+
+    SPDYStreamManager *manager = [[SPDYStreamManager alloc] init];
+    NSMutableDictionary *streams = [[NSMutableDictionary alloc] init];
+    for (NSNumber *streamId in streamIds) {
+        SPDYStream *stream = [[SPDYStubbedStream alloc] initWithPriority:0];
+        streams[streamId] = stream;
+        manager[streamId.unsignedIntValue] = stream;
+    }
+
+    // Removing each id in turn must shift the rest of the run back across the wrap
+    for (NSNumber *removedId in streamIds) {
+        [manager removeStreamWithStreamId:removedId.unsignedIntValue];
+        STAssertNil(manager[removedId.unsignedIntValue], nil);
+        STAssertEquals(manager.count, streamIds.count - 1, nil);
+        for (NSNumber *streamId in streamIds) {
+            if ([streamId isEqual:removedId]) continue;
+            STAssertEquals(manager[streamId.unsignedIntValue], streams[streamId], @"lost stream %@ after removing %@", streamId, removedId);
+        }
+
+        manager[removedId.unsignedIntValue] = streams[removedId];
+        STAssertEquals(manager[removedId.unsignedIntValue], streams[removedId], nil);
+        STAssertEquals(manager.count, streamIds.count, nil);
+    }
+}
+
+- (void)testTableGrowsAndKeepsEveryStream
+{
+    SPDYStreamManager *manager = [[SPDYStreamManager alloc] init];
+    NSMutableArray *streams = [[NSMutableArray alloc] init];
+
+    // Far past the initial node array and tables, which grow several times over
+    [SPDYStubbedStream resetTestStreamIds];
+    for (NSUInteger i = 0; i < 2000; i++) {
+        SPDYStream *stream = [[SPDYStubbedStream alloc] initWithPriority:(uint8_t)(i % 8)];
+        [streams addObject:stream];
+        manager[stream.streamId] = stream;
+    }
+    STAssertEquals(manager.count, (NSUInteger)2000, nil);
+    STAssertEquals(manager.localCount, (NSUInteger)1000, nil);
+
+    for (SPDYStream *stream in streams) {
+        STAssertEquals(manager[stream.streamId], stream, nil);
+        if (stream.protocol) {
+            STAssertEquals(manager[stream.protocol], stream, nil);
+        }
+    }
+
+    // Nodes freed by removal are reused without disturbing the streams left
+    for (NSUInteger i = 0; i < streams.count; i += 2) {
+        [manager removeStreamWithStreamId:((SPDYStream *)streams[i]).streamId];
+    }
+    for (NSUInteger i = 0; i < 500; i++) {
+        SPDYStream *stream = [[SPDYStubbedStream alloc] initWithPriority:3];
+        [streams addObject:stream];
+        manager[stream.streamId] = stream;
+    }
+    STAssertEquals(manager.count, (NSUInteger)1500, nil);
+    for (NSUInteger i = 0; i < streams.count; i++) {
+        SPDYStream *stream = streams[i];
+        SPDYStream *expected = (i < 2000 && i % 2 == 0) ? nil : stream;
+        STAssertEquals(manager[stream.streamId], expected, nil);
+    }
+}
+
+- (void)testIterationKeepsPriorityAndArrivalOrderAfterRemovals
+{
+    SPDYStreamManager *manager = [[SPDYStreamManager alloc] init];
+    NSMutableArray *expected = [[NSMutableArray alloc] init];
+    NSMutableArray *removed = [[NSMutableArray alloc] init];
+
+    // Four streams at each of three priorities, added interleaved
+    [SPDYStubbedStream resetTestStreamIds];
+    NSMutableArray *levels[3] = { [NSMutableArray array], [NSMutableArray array], [NSMutableArray array] };
+    uint8_t priorities[3] = { 6, 1, 4 };
+    for (int i = 0; i < 4; i++) {
+        for (int level = 0; level < 3; level++) {
+            SPDYStream *stream = [[SPDYStubbedStream alloc] initWithPriority:priorities[level]];
+            [levels[level] addObject:stream];
+            manager[stream.streamId] = stream;
+        }
+    }
+
+    // Take out the head of one level, the tail of another and the middle of the third
+    [removed addObject:levels[1][0]];
+    [removed addObject:levels[2][3]];
+    [removed addObject:levels[0][1]];
+    for (SPDYStream *stream in removed) {
+        [manager removeStreamWithStreamId:stream.streamId];
+    }
+
+    int levelOrder[3] = { 1, 2, 0 };
+    for (int i = 0; i < 3; i++) {
+        for (SPDYStream *stream in levels[levelOrder[i]]) {
+            if (![removed containsObject:stream]) [expected addObject:stream];
+        }
+    }
+
+    NSMutableArray *iterated = [[NSMutableArray alloc] init];
+    for (SPDYStream *stream in manager) {
+        [iterated addObject:stream];
+    }
+    STAssertEqualObjects(iterated, expected, nil);
+    STAssertEquals([manager nextPriorityStream], levels[1][1], nil);
+
+    // Emptying the highest priority hands over to the next
+    for (SPDYStream *stream in levels[1]) {
+        [manager removeStreamWithStreamId:stream.streamId];
+    }
+    STAssertEquals([manager nextPriorityStream], levels[2][0], nil);
+}
+
+- (void)removeStreamsWhileEnumerating
+{
+    for (SPDYStream *stream in _manager) {
+        [_manager removeStreamWithStreamId:stream.streamId];
+    }
+}
+
+- (void)testRemovalDuringEnumerationIsDetected
+{
+    STAssertThrows([self removeStreamsWhileEnumerating], nil);
+
+    // Streams are removed after enumeration instead, as the session does
+    NSMutableArray *streams = [[NSMutableArray alloc] init];
+    for (SPDYStream *stream in _manager) {
+        if (stream.local) [streams addObject:stream];
+    }
+    for (SPDYStream *stream in streams) {
+        [_manager removeStreamWithStreamId:stream.streamId];
+    }
+    STAssertEquals(_manager.localCount, (NSUInteger)0, nil);
+    STAssertEquals(_manager.count, _manager.remoteCount, nil);
+    for (SPDYStream *stream in _manager) {
+        STAssertFalse(stream.local, nil);
+    }
+}
+
 @end
@@ -290,6 +290,7 @@
 
     request.SPDYPriority = 1;
     request.SPDYDeferrableInterval = 3.95;
+    request.SPDYHedgeAfter = 0.25;
     request.SPDYBypass = YES;
     request.SPDYBodyStream = stream;
     request.SPDYBodyFile = @"Bodyfile.json";
@@ -297,6 +298,7 @@
 
     STAssertEquals(request.SPDYPriority, (NSUInteger)1, nil);
     STAssertEquals(request.SPDYDeferrableInterval, (double)3.95, nil);
+    STAssertEquals(request.SPDYHedgeAfter, (double)0.25, nil);
     STAssertEquals(request.SPDYBypass, (BOOL)YES, nil);
     STAssertEquals(request.SPDYBodyStream, stream, nil);
     STAssertEquals(request.SPDYBodyFile, @"Bodyfile.json", nil);
@@ -306,6 +308,7 @@
 
     STAssertEquals(mutableCopy.SPDYPriority, (NSUInteger)1, nil);
     STAssertEquals(mutableCopy.SPDYDeferrableInterval, (double)3.95, nil);
+    STAssertEquals(mutableCopy.SPDYHedgeAfter, (double)0.25, nil);
     STAssertEquals(mutableCopy.SPDYBypass, (BOOL)YES, nil);
     STAssertEquals(mutableCopy.SPDYBodyStream, stream, nil);
     STAssertEquals(mutableCopy.SPDYBodyFile, @"Bodyfile.json", nil);
@@ -315,6 +318,7 @@
 
     STAssertEquals(immutableCopy.SPDYPriority, (NSUInteger)1, nil);
     STAssertEquals(immutableCopy.SPDYDeferrableInterval, (double)3.95, nil);
+    STAssertEquals(immutableCopy.SPDYHedgeAfter, (double)0.25, nil);
     STAssertEquals(immutableCopy.SPDYBypass, (BOOL)TRUE, nil);
     STAssertEquals(immutableCopy.SPDYBodyStream, stream, nil);
     STAssertEquals(immutableCopy.SPDYBodyFile, @"Bodyfile.json", nil);
@@ -0,0 +1,147 @@
+//
+//  SPDYZLibAllocatorTest.m
+//  SPDY
+//
+//  Copyright (c) 2014 Twitter, Inc. All rights reserved.
+//  Licensed under the Apache License v2.0
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Created by Michael Schore and Jeffrey Pinner.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import "SPDYHeaderBlockCompressor.h"
+#import "SPDYHeaderBlockDecompressor.h"
+#import "SPDYMockURLProtocolClient.h"
+#import "SPDYProtocol.h"
+#import "SPDYStream.h"
+#import "SPDYZLibAllocator.h"
+
+@interface SPDYZLibAllocatorTest : SenTestCase
+@end
+
+@implementation SPDYZLibAllocatorTest
+{
+    NSData *_gzipBody;
+    NSData *_plainBody;
+}
+
+- (void)setUp
+{
+    [super setUp];
+
+    NSMutableData *plain = [[NSMutableData alloc] init];
+    for (int i = 0; i < 2048; i++) {
+        [plain appendBytes:"{\"id\":12345,\"text\":\"hello\"}," length:28];
+    }
+    _plainBody = plain;
+
+    z_stream zlibStream;
+    bzero(&zlibStream, sizeof(zlibStream));
+    deflateInit2(&zlibStream, 9, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);  // gzip
+    NSMutableData *gzip = [[NSMutableData alloc] initWithLength:deflateBound(&zlibStream, (uLong)plain.length)];
+    zlibStream.next_in = (uint8_t *)plain.bytes;
+    zlibStream.avail_in = (uInt)plain.length;
+    zlibStream.next_out = gzip.mutableBytes;
+    zlibStream.avail_out = (uInt)gzip.length;
+    STAssertEquals(deflate(&zlibStream, Z_FINISH), Z_STREAM_END, nil);
+    gzip.length = zlibStream.total_out;
+    deflateEnd(&zlibStream);
+    _gzipBody = gzip;
+}
+
+- (void)loadCompressedResponse
+{
+    @autoreleasepool {
+        SPDYMockURLProtocolClient *client = [[SPDYMockURLProtocolClient alloc] init];
+        NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"https://mocked/gzip"]];
+        SPDYProtocol *protocol = [[SPDYProtocol alloc] initWithRequest:request cachedResponse:nil client:client];
+        SPDYStream *stream = [[SPDYStream alloc] initWithProtocol:protocol];
+        [stream startWithStreamId:1 sendWindowSize:65536 receiveWindowSize:65536];
+
+        [stream didReceiveResponse:@{
+            @":status" : @"200",
+            @":version" : @"HTTP/1.1",
+            @"content-encoding" : @"gzip"
+        }];
+
+        // Deliver in DATA-frame sized pieces
+        NSUInteger offset = 0;
+        while (offset < _gzipBody.length) {
+            NSUInteger length = MIN((NSUInteger)1024, _gzipBody.length - offset);
+            [stream didLoadData:[_gzipBody subdataWithRange:NSMakeRange(offset, length)]];
+            offset += length;
+        }
+
+        STAssertTrue(client.calledDidLoadData > 0, nil);
+        STAssertNil(client.lastError, nil);
+    }
+}
+
+#pragma mark Tests
+
+- (void)testSteadyStateCompressedResponsesAllocateNothing
+{
+    // Warm up the pool with the buffer sizes a gzip response needs
+    [self loadCompressedResponse];
+    [self loadCompressedResponse];
+
+    SPDYZLibAllocatorStatistics before = SPDYZLibAllocatorGetStatistics();
+
+    for (int i = 0; i < 20; i++) {
+        [self loadCompressedResponse];
+    }
+
+    SPDYZLibAllocatorStatistics after = SPDYZLibAllocatorGetStatistics();
+    STAssertEquals(after.systemAllocations, before.systemAllocations, @"steady state should not hit malloc");
+    STAssertTrue(after.pooledAllocations > before.pooledAllocations, nil);
+    STAssertEquals(after.bytesInUse, before.bytesInUse, @"all zlib state should have been returned");
+    STAssertEquals(after.highWaterBytes, before.highWaterBytes, nil);
+}
+
+- (void)testSteadyStateHeaderCodecsAllocateNothing
+{
+    @autoreleasepool {
+        (void)[[SPDYHeaderBlockCompressor alloc] initWithCompressionLevel:9];
+        (void)[[SPDYHeaderBlockDecompressor alloc] init];
+    }
+
+    SPDYZLibAllocatorStatistics before = SPDYZLibAllocatorGetStatistics();
+
+    for (int i = 0; i < 20; i++) {
+        @autoreleasepool {
+            (void)[[SPDYHeaderBlockCompressor alloc] initWithCompressionLevel:9];
+            (void)[[SPDYHeaderBlockDecompressor alloc] init];
+        }
+    }
+
+    SPDYZLibAllocatorStatistics after = SPDYZLibAllocatorGetStatistics();
+    STAssertEquals(after.systemAllocations, before.systemAllocations, nil);
+    STAssertEquals(after.bytesInUse, before.bytesInUse, nil);
+}
+
+- (void)testPoolIsBounded
+{
+    SPDYZLibAllocatorDrain();
+
+    const int count = 64;
+    voidpf buffers[count];
+    for (int i = 0; i < count; i++) {
+        buffers[i] = SPDYZLibAlloc(Z_NULL, 32768, 1);
+        STAssertTrue(buffers[i] != Z_NULL, nil);
+        STAssertTrue(((uintptr_t)buffers[i] & 0xF) == 0, @"buffers must keep malloc alignment");
+    }
+    for (int i = 0; i < count; i++) {
+        SPDYZLibFree(Z_NULL, buffers[i]);
+    }
+
+    SPDYZLibAllocatorStatistics statistics = SPDYZLibAllocatorGetStatistics();
+    STAssertTrue(statistics.bytesCached <= SPDY_ZLIB_POOL_MAX_CACHED_BYTES, nil);
+    STAssertTrue(statistics.bytesCached > 0, nil);
+    STAssertTrue(statistics.highWaterBytes >= (NSUInteger)count * 32768, nil);
+
+    SPDYZLibAllocatorDrain();
+    STAssertEquals(SPDYZLibAllocatorGetStatistics().bytesCached, (NSUInteger)0, nil);
+}
+
+@end